@@ -49,6 +49,12 @@ SOFTWARE.
 #define DX_AVNET_IOT_CONNECT_SW_VER_MAX_LEN (32 + 1)
 #define DX_AVNET_IOT_CONNECT_TG_LEN 32
 
+// C2D messages are parsed into one block of this size and released at once, a message that does not fit is
+// parsed on the heap instead. tests/parse_arena_benchmark.c prints the arena a message needs.
+#ifndef DX_AVNET_IOT_CONNECT_PARSE_ARENA_BYTES
+#define DX_AVNET_IOT_CONNECT_PARSE_ARENA_BYTES 4096
+#endif
+
 // The gateway field length is long to acomidate long ids from child devices
 #define DX_AVNET_IOT_CONNECT_GW_FIELD_LEN 128+64
 
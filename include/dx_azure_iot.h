@@ -9,6 +9,8 @@
 #include "azure_prov_client/prov_transport.h"
 #include "azure_prov_client/prov_transport_mqtt_client.h"
 #include "dx_config.h"
+#include "dx_latency_histogram.h"
+#include "dx_retry_policy.h"
 #include "dx_device_twins.h"
 #include "dx_direct_methods.h"
 #include "dx_terminate.h"
@@ -25,6 +27,7 @@
 #include <iothub_client_options.h>
 #include <iothub_device_client_ll.h>
 #include <iothubtransportmqtt.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -38,6 +41,50 @@
 #define IOT_HUB_POLL_TIME_NANOSECONDS 100000000
 #endif
 
+// DoWork backs off from the poll time above to this ceiling while there is no outstanding work
+#ifndef IOT_HUB_POLL_TIME_MAX_MILLISECONDS
+#define IOT_HUB_POLL_TIME_MAX_MILLISECONDS 1000
+#endif
+
+// Hub connect and DPS retry delay ceiling, doubled per failed attempt up to the max
+#ifndef AZURE_CONNECT_RETRY_BASE_MILLISECONDS
+#define AZURE_CONNECT_RETRY_BASE_MILLISECONDS 1000
+#endif
+
+#ifndef AZURE_CONNECT_RETRY_MAX_MILLISECONDS
+#define AZURE_CONNECT_RETRY_MAX_MILLISECONDS 60000
+#endif
+
+// Time to wait for DPS to assign an IoT Hub before provisioning is restarted
+#ifndef DX_DPS_PROVISIONING_TIMEOUT_SECONDS
+#define DX_DPS_PROVISIONING_TIMEOUT_SECONDS 60
+#endif
+
+// Connects to the cached DPS hub that may fail in a row, for any reason other than the hub refusing the
+// device, before the cache is dropped and DPS runs again
+#ifndef DX_DPS_CACHE_MAX_FAILED_CONNECTS
+#define DX_DPS_CACHE_MAX_FAILED_CONNECTS 3
+#endif
+
+// Longest IoT Hub host name the DPS assignment cache will hold
+#ifndef DX_DPS_CACHE_URI_MAX_LENGTH
+#define DX_DPS_CACHE_URI_MAX_LENGTH 128
+#endif
+
+// Connection state transitions kept for dx_azureGetConnectionTrace
+#ifndef DX_CONNECTION_TRACE_SIZE
+#define DX_CONNECTION_TRACE_SIZE 32
+#endif
+
+// Disconnects are counted per IOTHUB_CLIENT_CONNECTION_STATUS_REASON, the last slot counts any newer reason
+#define DX_DISCONNECT_REASON_OTHER (IOTHUB_CLIENT_CONNECTION_NO_PING_RESPONSE + 1)
+#define DX_DISCONNECT_REASON_COUNT (DX_DISCONNECT_REASON_OTHER + 1)
+
+// Messages handed to the IoT Hub client between two DoWork calls that are sampled for publish to wire latency
+#ifndef IOT_HUB_DOWORK_LATENCY_SAMPLES
+#define IOT_HUB_DOWORK_LATENCY_SAMPLES 16
+#endif
+
 typedef struct DX_MESSAGE_PROPERTY {
     const char *key;
     const char *value;
@@ -48,6 +95,62 @@ typedef struct DX_MESSAGE_CONTENT_PROPERTIES {
     const char *contentType;
 } DX_MESSAGE_CONTENT_PROPERTIES;
 
+/// <summary>
+/// Called once IoT Hub has confirmed or failed a message sent with dx_azurePublishWithCallback.
+/// latencyMs is the time from publish to confirmation, including any time spent in the offline queue.
+/// </summary>
+typedef void (*DX_PUBLISH_COMPLETION_CALLBACK)(IOTHUB_CLIENT_CONFIRMATION_RESULT result, uint32_t latencyMs, void *context);
+
+typedef struct {
+    uint32_t confirmed;       // Messages confirmed by IoT Hub with IOTHUB_CLIENT_CONFIRMATION_OK
+    uint32_t failed;          // Messages confirmed with any other result
+    uint32_t wouldBlock;      // Publishes refused because the in-flight caps were reached
+    uint32_t inFlight;        // Messages handed to the IoT Hub client and not yet confirmed
+    uint32_t inFlightBytes;   // Payload bytes of the in-flight messages
+    DX_LATENCY_STATS latency; // Publish to confirmation latency of confirmed messages
+} DX_PUBLISH_STATS;
+
+typedef struct {
+    uint32_t dpsCacheHits;                                    // Connects that reused the cached DPS hub assignment
+    uint32_t dpsCacheMisses;                                  // Connects that had to run DPS, no cached hub or TTL expired
+    uint32_t dpsCacheInvalidations;                           // Cached hub assignments dropped, the hub rejected the device or kept failing
+    uint32_t lastTimeToConnectMs;                             // First connect attempt to IoT Hub authenticated, retries included
+    uint32_t meanTimeToConnectMs;
+    uint32_t maxTimeToConnectMs;
+    uint32_t connects;                                        // Times IoT Hub authenticated the device
+    uint32_t disconnects;                                     // Authenticated connections lost, for any reason
+    uint32_t disconnectsByReason[DX_DISCONNECT_REASON_COUNT]; // Indexed by IOTHUB_CLIENT_CONNECTION_STATUS_REASON
+} DX_CONNECTION_STATS;
+
+typedef struct {
+    int64_t timestampMs; // dx_getNowMilliseconds when the transition happened
+    const char *state;   // State entered, for example "DEVICE_PROVISIONING" or "Authenticated"
+} DX_CONNECTION_TRACE_ENTRY;
+
+#define DX_CONNECTION_PRIORITY_DEFAULT 0
+
+typedef void (*DX_CONNECTION_CHANGED_CALLBACK)(bool connected, void *context);
+
+typedef struct {
+    uint32_t wakeupsPerMinute;      // DoWork timer wakeups over the last full minute
+    uint32_t pollMs;                // Current DoWork poll period
+    DX_LATENCY_STATS publishToWire; // Time from handing a message to the IoT Hub client to the DoWork that sends it
+} DX_DOWORK_STATS;
+
+typedef enum {
+    DX_PUBLISH_OK = 0,            // Handed to the IoT Hub client
+    DX_PUBLISH_QUEUED = 1,        // Stored in the offline telemetry queue or the current telemetry batch
+    DX_PUBLISH_WOULD_BLOCK = 2,   // In-flight message or byte cap reached, retry when notified of capacity
+    DX_PUBLISH_NOT_CONNECTED = 3, // Not connected and the offline telemetry queue is not enabled
+    DX_PUBLISH_FAILED = 4,
+    DX_PUBLISH_TERMINATING = 5 // Termination requested, outstanding messages are being drained
+} DX_PUBLISH_RESULT;
+
+typedef struct {
+    uint32_t flushed;   // Messages confirmed by IoT Hub after termination was requested
+    uint32_t abandoned; // Messages still awaiting confirmation, queued or batched when the drain ended
+} DX_DRAIN_STATS;
+
 /// <summary>
 /// Check if there is a network connection and an authenticated connection to Azure IoT Hub/Central
 /// </summary>
@@ -58,6 +161,10 @@ bool dx_isAzureConnected(void);
 /// <summary>
 /// Send message to Azure IoT Hub/Central with application and content properties.
 /// Application and content properties can be NULL if not required.
+/// If the offline telemetry queue is enabled with dx_telemetryQueueInit then messages published while
+/// not connected are queued and true is returned.
+/// If telemetry batching is enabled with dx_telemetryBatchInit then JSON messages are collected into a JSON array
+/// and published together, see dx_azurePublishFlush.
 /// </summary>
 /// <param name="msg"></param>
 /// <param name="messageProperties"></param>
@@ -67,6 +174,74 @@ bool dx_isAzureConnected(void);
 bool dx_azurePublish(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties, size_t messagePropertyCount,
                      DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties);
 
+/// <summary>
+/// Send message to Azure IoT Hub/Central and call completionCallback with the IoT Hub confirmation result and
+/// end to end latency once the message has been confirmed. Returns false if the message was not accepted, in
+/// which case the callback will not be called.
+/// </summary>
+/// <param name="message"></param>
+/// <param name="messageLength"></param>
+/// <param name="messageProperties"></param>
+/// <param name="messagePropertyCount"></param>
+/// <param name="messageContentProperties"></param>
+/// <param name="completionCallback"></param>
+/// <param name="context"></param>
+/// <returns></returns>
+bool dx_azurePublishWithCallback(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                 size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                 DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context);
+
+/// <summary>
+/// Same as dx_azurePublishWithCallback but returns why a message was not sent. completionCallback can be NULL.
+/// DX_PUBLISH_WOULD_BLOCK is returned when the limits set with dx_azureSetPublishLimits are reached, the producer
+/// should hold off until the publish capacity notification fires.
+/// </summary>
+DX_PUBLISH_RESULT dx_azurePublishNonBlocking(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                             size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                             DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context);
+
+/// <summary>
+/// Publish any telemetry held in the current batch when batching is enabled with dx_telemetryBatchInit.
+/// Returns DX_PUBLISH_OK when there was nothing to publish.
+/// </summary>
+/// <param name=""></param>
+/// <returns></returns>
+DX_PUBLISH_RESULT dx_azurePublishFlush(void);
+
+/// <summary>
+/// Cap the number of messages and payload bytes handed to the IoT Hub client but not yet confirmed.
+/// This bounds the heap used by the IoT SDK outbound queue on a slow link. Zero means no limit, the default.
+/// </summary>
+/// <param name="maxInFlight"></param>
+/// <param name="maxBytesInFlight"></param>
+void dx_azureSetPublishLimits(size_t maxInFlight, size_t maxBytesInFlight);
+
+/// <summary>
+/// Register to be notified, from the IoT Hub confirmation callback, when capacity is available again after a
+/// publish returned DX_PUBLISH_WOULD_BLOCK
+/// </summary>
+/// <param name="publishCapacityCallback"></param>
+/// <param name="context"></param>
+void dx_azureRegisterPublishCapacityNotification(void (*publishCapacityCallback)(void *context), void *context);
+
+/// <summary>
+/// Get confirmed and failed message counts and the publish to confirmation latency percentiles
+/// </summary>
+/// <param name="stats"></param>
+void dx_azureGetPublishStats(DX_PUBLISH_STATS *stats);
+
+/// <summary>
+/// Reset the publish counters and latency histogram
+/// </summary>
+/// <param name=""></param>
+void dx_azureResetPublishStats(void);
+
+/// <summary>
+/// After dx_eventLoopRun returns, how many messages were flushed during the termination drain and how many were lost
+/// </summary>
+/// <param name="stats"></param>
+void dx_azureGetDrainStats(DX_DRAIN_STATS *stats);
+
 /// <summary>
 /// Exposed for Device Twins. Not for general use.
 /// </summary>
@@ -74,6 +249,82 @@ bool dx_azurePublish(const void *message, size_t messageLength, DX_MESSAGE_PROPE
 /// <returns></returns>
 IOTHUB_DEVICE_CLIENT_LL_HANDLE dx_azureClientHandleGet(void);
 
+/// <summary>
+/// Exposed for Device Twins. Not for general use.
+/// Run IoTHubDeviceClient_LL_DoWork on the next event loop pass so newly queued work goes out without waiting for the poll.
+/// </summary>
+/// <param name=""></param>
+void dx_azureRequestDoWork(void);
+
+/// <summary>
+/// Set the ceiling DoWork backs off to while idle. The floor is IOT_HUB_POLL_TIME_SECONDS and IOT_HUB_POLL_TIME_NANOSECONDS.
+/// A longer ceiling saves power at the cost of latency for cloud to device messages, direct methods and twin updates.
+/// </summary>
+/// <param name="maxPollMs"></param>
+void dx_azureSetDoWorkPollCeiling(uint32_t maxPollMs);
+
+/// <summary>
+/// Get DoWork wakeups per minute, the current poll period and publish to wire latency percentiles
+/// </summary>
+/// <param name="stats"></param>
+void dx_azureGetDoWorkStats(DX_DOWORK_STATS *stats);
+
+/// <summary>
+/// Replace the hub connect and DPS retry policy. Delays start at baseDelayMs and double per failed attempt up to maxDelayMs.
+/// delayFunction picks the actual delay, NULL uses dx_retryPolicyFullJitter. The policy resets once IoT Hub authenticates.
+/// </summary>
+/// <param name="baseDelayMs"></param>
+/// <param name="maxDelayMs"></param>
+/// <param name="delayFunction"></param>
+void dx_azureSetConnectRetryPolicy(uint32_t baseDelayMs, uint32_t maxDelayMs, DX_RETRY_DELAY_FUNCTION delayFunction);
+
+/// <summary>
+/// Get a copy of the connect retry policy, attempt is the failed attempts since the last connection and
+/// nextDelayMs the delay before the pending retry
+/// </summary>
+/// <param name="policy"></param>
+void dx_azureGetConnectRetryState(DX_RETRY_POLICY *policy);
+
+/// <summary>
+/// How long to wait for DPS to assign an IoT Hub before provisioning is restarted, default DX_DPS_PROVISIONING_TIMEOUT_SECONDS
+/// </summary>
+/// <param name="timeoutSeconds"></param>
+void dx_azureSetProvisioningTimeout(uint32_t timeoutSeconds);
+
+/// <summary>
+/// Reuse the IoT Hub assigned by DPS when reconnecting instead of provisioning again. DPS runs when the cached
+/// assignment is older than ttlSeconds, zero for no expiry, or the cached hub rejects the device.
+/// With persist the assignment is kept in mutable storage, see dx_storage.h, so it also survives a reboot.
+/// </summary>
+/// <param name="ttlSeconds"></param>
+/// <param name="persist"></param>
+void dx_azureEnableDpsCache(uint32_t ttlSeconds, bool persist);
+
+/// <summary>
+/// Get DPS assignment cache counters, time to connect and disconnect counts by reason
+/// </summary>
+/// <param name="stats"></param>
+void dx_azureGetConnectionStats(DX_CONNECTION_STATS *stats);
+
+/// <summary>
+/// Copy the most recent connection state transitions, oldest first. Covers network and DAA readiness, the
+/// DPS and hub connection states and the IoT Hub authentication state. Returns the number of entries copied.
+/// </summary>
+/// <param name="entries"></param>
+/// <param name="maxEntries"></param>
+/// <returns></returns>
+size_t dx_azureGetConnectionTrace(DX_CONNECTION_TRACE_ENTRY *entries, size_t maxEntries);
+
+// dx_device_twins.h includes this header, so the binding is referred to by its struct tag
+struct _deviceTwinBinding;
+
+/// <summary>
+/// Report the connection stats as a JSON object through a DX_DEVICE_TWIN_JSON_OBJECT device twin binding
+/// </summary>
+/// <param name="deviceTwinBinding"></param>
+/// <returns></returns>
+bool dx_azureReportConnectionMetrics(struct _deviceTwinBinding *deviceTwinBinding);
+
 /// <summary>
 /// Initialise Azure IoT Hub/Connection connection, passing in network interface for connecting testing and IoT Plug and Play model id.
 /// Cloud to device messages is also enabled. For information on Plug and Play see
@@ -97,19 +348,36 @@ void dx_azureToDeviceStop(void);
 void dx_azureRegisterMessageReceivedNotification(IOTHUBMESSAGE_DISPOSITION_RESULT (*messageReceivedCallback)(IOTHUB_MESSAGE_HANDLE message, void *context));
 
 /// <summary>
-/// Register to be notified of change in Azure IoT Connection status
-/// Up to 5 callbacks can be registered
+/// Register to be notified of change in Azure IoT Connection status.
+/// Callbacks run from the event loop, once per change, with DX_CONNECTION_PRIORITY_DEFAULT priority.
 /// </summary>
 /// <param name="connectionStatusCallback"></param>
 /// <returns></returns>
 bool dx_azureRegisterConnectionChangedNotification(void (*connectionStatusCallback)(bool connected));
 
+/// <summary>
+/// Register to be notified of change in Azure IoT Connection status with a context pointer.
+/// Subscribers with a higher priority are called first, equal priorities in registration order.
+/// </summary>
+/// <param name="connectionChangedCallback"></param>
+/// <param name="context"></param>
+/// <param name="priority"></param>
+/// <returns></returns>
+bool dx_azureRegisterConnectionChangedNotificationEx(DX_CONNECTION_CHANGED_CALLBACK connectionChangedCallback, void *context, int priority);
+
 /// <summary>
 /// Unregister a callback to be notified of change in Azure IoT Connection status
 /// </summary>
 /// <param name="connectionStatusCallback"></param>
 void dx_azureUnregisterConnectionChangedNotification(void (*connectionStatusCallback)(bool connected));
 
+/// <summary>
+/// Unregister a callback registered with dx_azureRegisterConnectionChangedNotificationEx and the same context
+/// </summary>
+/// <param name="connectionChangedCallback"></param>
+/// <param name="context"></param>
+void dx_azureUnregisterConnectionChangedNotificationEx(DX_CONNECTION_CHANGED_CALLBACK connectionChangedCallback, void *context);
+
 /// <summary>
 /// Register Device Twin callback to process an Azure IoT device twin message
 /// </summary>
@@ -125,6 +393,15 @@ void dx_azureRegisterDeviceTwinCallback(void (*deviceTwinCallbackHandler)(DEVICE
 void dx_azureRegisterDirectMethodCallback(int (*directMethodCallbackHandler)(const char *method_name, const unsigned char *payload,
                                                                              size_t payloadSize, unsigned char **responsePayload,
                                                                              size_t *responsePayloadSize, void *userContextCallback));
+
+/// <summary>
+/// Register a Direct Method callback that answers each method later with IoTHubDeviceClient_LL_DeviceMethodResponse
+/// and methodId. Takes the place of the callback registered with dx_azureRegisterDirectMethodCallback while set.
+/// </summary>
+/// <param name="directMethodInboundHandler"></param>
+void dx_azureRegisterDirectMethodInboundCallback(int (*directMethodInboundHandler)(const char *method_name, const unsigned char *payload,
+                                                                                   size_t payloadSize, METHOD_HANDLE methodId,
+                                                                                   void *userContextCallback));
 /// <summary>
 /// Returns the outstanding Telemetry message count.  This variable is incrremented 
 /// each time the application sends a telemetry message and decremented each time a 
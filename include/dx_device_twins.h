@@ -7,6 +7,28 @@
 #include "parson.h"
 #include "dx_gpio.h"
 #include <iothub_device_client_ll.h>
+#include <stdint.h>
+
+// Most properties the reported properties batch holds before it is sent as one patch
+#ifndef DX_DEVICE_TWIN_BATCH_MAX_PROPERTIES
+#define DX_DEVICE_TWIN_BATCH_MAX_PROPERTIES 32
+#endif
+
+// Largest device twin cache record, see dx_deviceTwinEnableCache
+#ifndef DX_DEVICE_TWIN_CACHE_MAX_BYTES
+#define DX_DEVICE_TWIN_CACHE_MAX_BYTES 2048
+#endif
+
+// Most segments in a dotted property path such as "sampling.rate"
+#ifndef DX_DEVICE_TWIN_MAX_PATH_DEPTH
+#define DX_DEVICE_TWIN_MAX_PATH_DEPTH 4
+#endif
+
+// Twin documents are parsed into one block of this size and released at once, a document that does not fit
+// is parsed on the heap instead. tests/parse_arena_benchmark.c prints the arena a document needs.
+#ifndef DX_DEVICE_TWIN_PARSE_ARENA_BYTES
+#define DX_DEVICE_TWIN_PARSE_ARENA_BYTES 8192
+#endif
 
 #define DX_DEVICE_TWIN_HANDLER(name, deviceTwinBinding) \
 	void name(DX_DEVICE_TWIN_BINDING *deviceTwinBinding)      \
@@ -18,6 +40,39 @@
 #define DX_DECLARE_DEVICE_TWIN_HANDLER(name) \
 	void name(DX_DEVICE_TWIN_BINDING *deviceTwinBinding);
 
+// Define a scalar device twin binding with typed accessors, for example
+//     DX_DEFINE_DEVICE_TWIN_INT(dt_sample_rate, "SampleRate", dt_sample_rate_handler);
+// defines the static binding dt_sample_rate plus
+//     int dt_sample_rate_get(void);
+//     bool dt_sample_rate_report(int value);
+//     bool dt_sample_rate_ack(int value, DX_DEVICE_TWIN_RESPONSE_CODE statusCode);
+// so a value of the wrong type is a compile time error rather than a pointer cast.
+#define DX_DEFINE_DEVICE_TWIN_SCALAR(variable, name, type, twin_type, member, handler_function)                    \
+	static DX_DEVICE_TWIN_BINDING variable;                                                                       \
+	static inline type variable##_get(void)                                                                       \
+	{                                                                                                             \
+		return variable.storage.member;                                                                           \
+	}                                                                                                             \
+	static inline bool variable##_report(type value)                                                              \
+	{                                                                                                             \
+		return dx_deviceTwinReportValue(&variable, &value);                                                       \
+	}                                                                                                             \
+	static inline bool variable##_ack(type value, DX_DEVICE_TWIN_RESPONSE_CODE statusCode)                        \
+	{                                                                                                             \
+		return dx_deviceTwinAckDesiredValue(&variable, &value, statusCode);                                       \
+	}                                                                                                             \
+	static DX_DEVICE_TWIN_BINDING variable = {                                                                    \
+		.propertyName = name, .twinType = twin_type, .handler = handler_function, .propertyValue = &variable.storage.member}
+
+#define DX_DEFINE_DEVICE_TWIN_INT(variable, name, handler) \
+	DX_DEFINE_DEVICE_TWIN_SCALAR(variable, name, int, DX_DEVICE_TWIN_INT, intValue, handler)
+#define DX_DEFINE_DEVICE_TWIN_FLOAT(variable, name, handler) \
+	DX_DEFINE_DEVICE_TWIN_SCALAR(variable, name, float, DX_DEVICE_TWIN_FLOAT, floatValue, handler)
+#define DX_DEFINE_DEVICE_TWIN_DOUBLE(variable, name, handler) \
+	DX_DEFINE_DEVICE_TWIN_SCALAR(variable, name, double, DX_DEVICE_TWIN_DOUBLE, doubleValue, handler)
+#define DX_DEFINE_DEVICE_TWIN_BOOL(variable, name, handler) \
+	DX_DEFINE_DEVICE_TWIN_SCALAR(variable, name, bool, DX_DEVICE_TWIN_BOOL, boolValue, handler)
+
 typedef enum {
 	DX_TYPE_UNKNOWN = 0,
 	DX_DEVICE_TWIN_BOOL = 1,
@@ -25,9 +80,29 @@ typedef enum {
 	DX_DEVICE_TWIN_DOUBLE = 3,
 	DX_DEVICE_TWIN_INT = 4,
 	DX_DEVICE_TWIN_STRING = 5,
-	DX_DEVICE_TWIN_JSON_OBJECT = 6
+	DX_DEVICE_TWIN_JSON_OBJECT = 6,
+	DX_DEVICE_TWIN_INT_ARRAY = 7,    // JSON array of numbers decoded into the caller's int propertyValue buffer
+	DX_DEVICE_TWIN_FLOAT_ARRAY = 8,  // As DX_DEVICE_TWIN_INT_ARRAY into a float buffer
+	DX_DEVICE_TWIN_DOUBLE_ARRAY = 9  // As DX_DEVICE_TWIN_INT_ARRAY into a double buffer
 } DX_DEVICE_TWIN_TYPE;
 
+typedef enum {
+	DX_DEVICE_TWIN_REPORT_ALWAYS = 0,             // Send every reported value
+	DX_DEVICE_TWIN_REPORT_ON_CHANGE = 1,          // Skip reports equal to the last reported value
+	DX_DEVICE_TWIN_REPORT_ABSOLUTE_DEADBAND = 2,  // Numeric types, skip reports within reportDeadband of the last reported value
+	DX_DEVICE_TWIN_REPORT_RELATIVE_DEADBAND = 3   // Numeric types, skip reports within reportDeadband * |last reported value|
+} DX_DEVICE_TWIN_REPORT_FILTER;
+
+typedef enum
+{
+	DX_DEVICE_TWIN_RESPONSE_COMPLETED = 200,
+	DX_DEVICE_TWIN_RESPONSE_ERROR = 500,
+	DX_DEVICE_TWIN_REPONSE_INVALID = 404
+} DX_DEVICE_TWIN_RESPONSE_CODE;
+
+// propertyName can be a dotted path, "sampling.rate" binds the rate member of the sampling desired property.
+// Array types decode into the propertyValue buffer the application provides, arrayCapacity elements long.
+// arrayLength is the number of elements decoded and the number reported by dx_deviceTwinReportValue.
 typedef struct _deviceTwinBinding {
 	const char* propertyName;
 	void* propertyValue;
@@ -36,19 +111,73 @@ typedef struct _deviceTwinBinding {
 	DX_DEVICE_TWIN_TYPE twinType;
 	void (*handler)(struct _deviceTwinBinding* deviceTwinBinding);
 	void *context;
+	// Backing storage for scalar types, propertyValue points here once subscribed
+	union {
+		int intValue;
+		float floatValue;
+		double doubleValue;
+		bool boolValue;
+	} storage;
+	DX_DEVICE_TWIN_REPORT_FILTER reportFilter;
+	double reportDeadband;
+	uint32_t minReportIntervalMs; // Hold back reports sooner than this after the last, the latest is sent when it expires
+	// Last reported value, maintained by dx_deviceTwinReportValue. Strings, JSON objects and arrays keep a copy
+	// in reportedValue when reportFilter is not DX_DEVICE_TWIN_REPORT_ALWAYS.
+	bool reportedValid;
+	double reportedNumber;
+	void *reportedValue;
+	size_t reportedSize;
+	int64_t reportedMs;
+	// Copy of the latest report held back by minReportIntervalMs
+	bool reportPending;
+	void *pendingValue;
+	size_t pendingSize;
+	// Copy of the last desired value applied, in the form the twin cache stores it, and its hash. The handler
+	// is not called again for the same value, the hash turns away most changed values before the bytes are compared.
+	bool desiredValid;
+	uint64_t desiredHash;
+	void *desiredValue;
+	size_t desiredSize;
+	// Set once the application acknowledges a desired value, an unchanged value with a new $version is then
+	// acknowledged with desiredAckCode on its behalf
+	bool desiredAcked;
+	DX_DEVICE_TWIN_RESPONSE_CODE desiredAckCode;
+	size_t arrayCapacity;
+	size_t arrayLength;
+	// propertyName split at each '.', resolved by dx_deviceTwinSubscribe
+	uint8_t pathDepth;
+	uint16_t pathOffsets[DX_DEVICE_TWIN_MAX_PATH_DEPTH];
+	uint16_t pathLengths[DX_DEVICE_TWIN_MAX_PATH_DEPTH];
 } DX_DEVICE_TWIN_BINDING;
 
-typedef enum
-{
-	DX_DEVICE_TWIN_RESPONSE_COMPLETED = 200,
-	DX_DEVICE_TWIN_RESPONSE_ERROR = 500,
-	DX_DEVICE_TWIN_REPONSE_INVALID = 404
-} DX_DEVICE_TWIN_RESPONSE_CODE;
+typedef struct {
+	size_t maxPatchBytes; // Size of the patch buffer, the patch is sent when the next property will not fit
+	uint32_t maxDelayMs;  // Send the patch this long after the first property was added
+} DX_DEVICE_TWIN_BATCH_CONFIG;
+
+typedef struct {
+	uint32_t patches;          // Reported properties patches handed to the IoT Hub client
+	uint32_t properties;       // Properties carried by those patches
+	uint32_t failed;           // Patches the IoT Hub client did not accept
+	uint32_t suppressedUnchanged;    // Reports skipped by the binding reportFilter
+	uint32_t suppressedRateLimited;  // Reports held back by the binding minReportIntervalMs
+	uint32_t deferredReports;        // Held back reports sent once minReportIntervalMs expired
+	uint32_t cacheRestored;    // Properties restored from the device twin cache
+	uint32_t cacheReconciled;  // Full twins skipped because their $version matched the cache
+	uint32_t cacheWrites;      // Times the device twin cache was written to mutable storage
+	uint32_t cacheWritesSkipped;  // Twin documents that left the cache as it was, so nothing was written
+	uint32_t stalePatches;        // Desired property patches dropped because their $version was not newer
+	uint32_t suppressedHandlers;  // Desired properties that did not change so the handler was not called
+	uint32_t autoAcks;            // Of those, unchanged values with a new $version acknowledged for the application
+	float propertiesPerPatch;  // properties / patches
+} DX_DEVICE_TWIN_STATS;
 
 //typedef struct _deviceTwinBinding DX_DEVICE_TWIN_BINDING;
 
 /// <summary>
 /// IoT Plug and Play acknowledge receipt of a device twin message with new state and status code.
+/// Once a binding has been acknowledged, a desired update with a new $version but the same value does not call
+/// the handler and is acknowledged with the last status code instead.
 /// </summary>
 /// <param name="deviceTwinBinding"></param>
 /// <param name="state"></param>
@@ -58,7 +187,9 @@ bool dx_deviceTwinAckDesiredValue(DX_DEVICE_TWIN_BINDING* deviceTwinBinding, voi
 
 
 /// <summary>
-/// Update device twin state.
+/// Update device twin state. Returns true without sending when the binding reportFilter suppresses the report.
+/// A report within minReportIntervalMs of the last one is held back, and the latest held back value is sent when
+/// the interval expires. IoT Plug and Play acknowledgements and removals are never suppressed.
 /// </summary>
 /// <param name="deviceTwinBinding"></param>
 /// <param name="state"></param>
@@ -66,14 +197,60 @@ bool dx_deviceTwinAckDesiredValue(DX_DEVICE_TWIN_BINDING* deviceTwinBinding, voi
 bool dx_deviceTwinReportValue(DX_DEVICE_TWIN_BINDING* deviceTwinBinding, void* state);
 
 /// <summary>
-/// Close all device twins, deallocate backing storage for each twin, and stop inbound and outbound device twin updates.
+/// Close all device twins, free the memory dx_deviceTwinSubscribe and desired updates allocated, and stop inbound and
+/// outbound device twin updates.
 /// </summary>
 /// <param name=""></param>
 void dx_deviceTwinUnsubscribe(void);
 
 /// <summary>
-/// Open device twins and start processing of device twins.
+/// Open device twins and start processing of device twins. Scalar values are held in the bindings, but subscribing
+/// does allocate: the binding name index is one heap block of at least twice deviceTwinCount slots, and with
+/// dx_deviceTwinEnableCache the cache takes DX_DEVICE_TWIN_CACHE_MAX_BYTES plus two pointer sized entries per
+/// binding. Each binding also keeps a heap copy of the last desired value applied to it.
 /// </summary>
 /// <param name="deviceTwins"></param>
 /// <param name="deviceTwinCount"></param>
 void dx_deviceTwinSubscribe(DX_DEVICE_TWIN_BINDING* deviceTwins[], size_t deviceTwinCount);
+
+/// <summary>
+/// Enable batching of reported properties. dx_deviceTwinReportValue and dx_deviceTwinAckDesiredValue merge each
+/// property into one patch which is sent by dx_deviceTwinReportCommit, when the patch buffer is full, or maxDelayMs
+/// after the first property was added. Each property keeps its own ac and av acknowledgement values.
+/// While batching, the report functions return true once the property is added to the patch.
+/// </summary>
+/// <param name="config"></param>
+/// <returns></returns>
+bool dx_deviceTwinReportBatchInit(const DX_DEVICE_TWIN_BATCH_CONFIG* config);
+
+/// <summary>
+/// Send any pending patch then return to sending one patch per reported property
+/// </summary>
+/// <param name=""></param>
+void dx_deviceTwinReportBatchDeinit(void);
+
+/// <summary>
+/// Send the pending reported properties patch now. Returns true when there was nothing to send.
+/// </summary>
+/// <param name=""></param>
+/// <returns></returns>
+bool dx_deviceTwinReportCommit(void);
+
+void dx_deviceTwinGetStats(DX_DEVICE_TWIN_STATS* stats);
+void dx_deviceTwinResetStats(void);
+
+/// <summary>
+/// Keep desired property values in mutable storage, see dx_storage.h. Call before dx_deviceTwinSubscribe.
+/// The cached values are applied and handlers called during dx_deviceTwinSubscribe, before IoT Hub is connected,
+/// so acknowledgements sent from those handlers fail. The first full twin from IoT Hub is skipped when its
+/// $version matches the cache, otherwise it is applied as normal.
+/// </summary>
+/// <param name=""></param>
+void dx_deviceTwinEnableCache(void);
+
+/// <summary>
+/// Delete the cached desired properties, for example when the meaning of a property changes
+/// </summary>
+/// <param name=""></param>
+/// <returns></returns>
+bool dx_deviceTwinClearCache(void);
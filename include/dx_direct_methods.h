@@ -5,6 +5,25 @@
 
 #include "dx_azure_iot.h"
 #include "dx_gpio.h"
+#include "dx_latency_histogram.h"
+#include "dx_timer.h"
+#include <stdarg.h>
+
+// Most async direct methods waiting for dx_directMethodComplete at one time
+#ifndef DX_DIRECT_METHOD_MAX_IN_FLIGHT
+#define DX_DIRECT_METHOD_MAX_IN_FLIGHT 8
+#endif
+
+// Largest direct method response payload. Responses are built in a buffer of this size, async completions in a
+// second one so they can be sent from inside a responseHandler.
+#ifndef DX_DIRECT_METHOD_RESPONSE_MAX_BYTES
+#define DX_DIRECT_METHOD_RESPONSE_MAX_BYTES 2048
+#endif
+
+// Async method timeout used when the binding timeoutMs is 0
+#ifndef DX_DIRECT_METHOD_DEFAULT_TIMEOUT_MS
+#define DX_DIRECT_METHOD_DEFAULT_TIMEOUT_MS 30000
+#endif
 
 #define DX_DIRECT_METHOD_HANDLER(name, json, directMethodBinding, responseMsg)                                         \
     DX_DIRECT_METHOD_RESPONSE_CODE name(JSON_Value *json, DX_DIRECT_METHOD_BINDING *directMethodBinding, char **responseMsg) \
@@ -16,13 +35,155 @@
 #define DX_DECLARE_DIRECT_METHOD_HANDLER(name) \
     DX_DIRECT_METHOD_RESPONSE_CODE name(JSON_Value *json, DX_DIRECT_METHOD_BINDING *directMethodBinding, char **responseMsg);
 
-typedef enum { DX_METHOD_SUCCEEDED = 200, DX_METHOD_FAILED = 500, DX_METHOD_NOT_FOUND = 404 } DX_DIRECT_METHOD_RESPONSE_CODE;
+#define DX_DIRECT_METHOD_RESPONSE_HANDLER(name, json, directMethodBinding, response)                                                \
+    DX_DIRECT_METHOD_RESPONSE_CODE name(JSON_Value *json, DX_DIRECT_METHOD_BINDING *directMethodBinding, DX_DIRECT_METHOD_RESPONSE *response) \
+    {
+
+#define DX_DIRECT_METHOD_RESPONSE_HANDLER_END \
+    }
+
+#define DX_DECLARE_DIRECT_METHOD_RESPONSE_HANDLER(name) \
+    DX_DIRECT_METHOD_RESPONSE_CODE name(JSON_Value *json, DX_DIRECT_METHOD_BINDING *directMethodBinding, DX_DIRECT_METHOD_RESPONSE *response);
+
+#define DX_ASYNC_DIRECT_METHOD_HANDLER(name, json, directMethodBinding, token)                                \
+    void name(JSON_Value *json, DX_DIRECT_METHOD_BINDING *directMethodBinding, DX_DIRECT_METHOD_TOKEN token) \
+    {
+
+#define DX_ASYNC_DIRECT_METHOD_HANDLER_END \
+    }
+
+#define DX_DECLARE_ASYNC_DIRECT_METHOD_HANDLER(name) \
+    void name(JSON_Value *json, DX_DIRECT_METHOD_BINDING *directMethodBinding, DX_DIRECT_METHOD_TOKEN token);
+
+typedef enum {
+    DX_METHOD_SUCCEEDED = 200,
+    DX_METHOD_FAILED = 500,
+    DX_METHOD_NOT_FOUND = 404,
+    DX_METHOD_TOO_MANY_REQUESTS = 429,
+    DX_METHOD_TIMEOUT = 504
+} DX_DIRECT_METHOD_RESPONSE_CODE;
+
+// Identifies an async direct method until it is completed or times out
+typedef struct {
+    uint32_t slot;
+    uint32_t generation;
+} DX_DIRECT_METHOD_TOKEN;
+
+// The response payload a responseHandler writes, handed to the SDK as is. buffer holds length bytes of JSON
+// and capacity in total. Write with the dx_directMethodResponse functions, or directly into buffer then set
+// length. overflow is set when a write did not fit, the method is then answered with DX_METHOD_FAILED.
+typedef struct {
+    char *buffer;
+    size_t capacity;
+    size_t length;
+    bool overflow;
+} DX_DIRECT_METHOD_RESPONSE;
 
 typedef struct _directMethodBinding {
     const char *methodName;
     DX_DIRECT_METHOD_RESPONSE_CODE (*handler)(JSON_Value *json, struct _directMethodBinding *peripheral, char **responseMsg);
     void *context;
+    // Set instead of handler for a method that responds later with dx_directMethodComplete. The json
+    // payload is freed when asyncHandler returns.
+    void (*asyncHandler)(JSON_Value *json, struct _directMethodBinding *directMethodBinding, DX_DIRECT_METHOD_TOKEN token);
+    uint32_t timeoutMs; // Async methods not completed in time are answered with DX_METHOD_TIMEOUT
+    // Set instead of handler to write any JSON response, see DX_DIRECT_METHOD_RESPONSE
+    DX_DIRECT_METHOD_RESPONSE_CODE (*responseHandler)(JSON_Value *json, struct _directMethodBinding *directMethodBinding,
+                                                      DX_DIRECT_METHOD_RESPONSE *response);
+    // Calls over these limits are answered with DX_METHOD_TOO_MANY_REQUESTS before the payload is parsed, 0 is no limit
+    uint32_t rateLimitPerMinute; // Token bucket refill rate
+    uint32_t rateLimitBurst;     // Token bucket size, calls allowed back to back, 0 is 1
+    uint32_t maxInFlight;        // Async calls of this method waiting at once, all async methods share DX_DIRECT_METHOD_MAX_IN_FLIGHT
+    // Maintained by the library, see dx_directMethodGetBindingStats
+    uint32_t accepted;
+    uint32_t rejected;
+    uint32_t inFlight;
+    double rateTokens;
+    int64_t rateRefillMs;
+    DX_LATENCY_HISTOGRAM executionTime; // Handler call to response, async methods until dx_directMethodComplete
 } DX_DIRECT_METHOD_BINDING;
 
+typedef struct {
+    uint32_t started;       // Async methods handed to their asyncHandler
+    uint32_t completed;     // Async methods answered with dx_directMethodComplete
+    uint32_t timedOut;      // Async methods answered with DX_METHOD_TIMEOUT
+    uint32_t rejected;      // Calls refused because DX_DIRECT_METHOD_MAX_IN_FLIGHT or the binding maxInFlight were waiting
+    uint32_t rateLimited;   // Calls refused by the binding rate limit
+    uint32_t abandoned;     // Async methods dropped because the connection or subscription ended first
+    uint32_t inFlight;      // Async methods waiting now
+    uint32_t inFlightHighWaterMark;
+} DX_DIRECT_METHOD_STATS;
+
+typedef struct {
+    uint32_t accepted;  // Calls within the binding limits
+    uint32_t rejected;  // Calls answered with DX_METHOD_TOO_MANY_REQUESTS
+    uint32_t inFlight;  // Async calls waiting now
+    DX_LATENCY_STATS executionTime;
+} DX_DIRECT_METHOD_BINDING_STATS;
+
 void dx_directMethodUnsubscribe(void);
 void dx_directMethodSubscribe(DX_DIRECT_METHOD_BINDING *directMethods[], size_t directMethodCount);
+
+/// <summary>
+/// Add a direct method after dx_directMethodSubscribe. When more than one binding has the same method name
+/// the one added first handles the method. Returns false if the binding is already subscribed.
+/// </summary>
+/// <param name="directMethod"></param>
+/// <returns></returns>
+bool dx_directMethodAdd(DX_DIRECT_METHOD_BINDING *directMethod);
+
+/// <summary>
+/// Remove a direct method added with dx_directMethodAdd or dx_directMethodSubscribe. Invocations of the
+/// method are then answered with DX_METHOD_NOT_FOUND.
+/// </summary>
+/// <param name="directMethod"></param>
+/// <returns></returns>
+bool dx_directMethodRemove(DX_DIRECT_METHOD_BINDING *directMethod);
+
+/// <summary>
+/// Answer an async direct method. Can be called from any event loop callback, including the asyncHandler
+/// itself or a responseHandler, whose response is left as it was. responseMsg can be NULL for the default message. Returns false when the token has already been
+/// completed, timed out or abandoned.
+/// </summary>
+/// <param name="token"></param>
+/// <param name="responseCode"></param>
+/// <param name="responseMsg"></param>
+/// <returns></returns>
+bool dx_directMethodComplete(DX_DIRECT_METHOD_TOKEN token, DX_DIRECT_METHOD_RESPONSE_CODE responseCode, const char *responseMsg);
+
+/// <summary>
+/// Answer an async direct method with a JSON value, serialized straight into the response buffer
+/// </summary>
+/// <param name="token"></param>
+/// <param name="responseCode"></param>
+/// <param name="value"></param>
+/// <returns></returns>
+bool dx_directMethodCompleteJson(DX_DIRECT_METHOD_TOKEN token, DX_DIRECT_METHOD_RESPONSE_CODE responseCode, const JSON_Value *value);
+
+/// <summary>
+/// Replace the response with value serialized as JSON. Returns false and sets overflow if it does not fit.
+/// </summary>
+/// <param name="response"></param>
+/// <param name="value"></param>
+/// <returns></returns>
+bool dx_directMethodResponseJson(DX_DIRECT_METHOD_RESPONSE *response, const JSON_Value *value);
+
+/// <summary>
+/// Replace the response with string as a JSON string, quoted and escaped
+/// </summary>
+/// <param name="response"></param>
+/// <param name="string"></param>
+/// <returns></returns>
+bool dx_directMethodResponseString(DX_DIRECT_METHOD_RESPONSE *response, const char *string);
+
+/// <summary>
+/// Append printf formatted text to the response. The text is not escaped, the complete response must be valid JSON.
+/// </summary>
+/// <param name="response"></param>
+/// <param name="format"></param>
+/// <param name=""></param>
+/// <returns></returns>
+bool dx_directMethodResponsePrintf(DX_DIRECT_METHOD_RESPONSE *response, const char *format, ...);
+
+void dx_directMethodGetStats(DX_DIRECT_METHOD_STATS *stats);
+void dx_directMethodGetBindingStats(const DX_DIRECT_METHOD_BINDING *directMethod, DX_DIRECT_METHOD_BINDING_STATS *stats);
@@ -0,0 +1,46 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Log-linear buckets: values below 4 ms have their own bucket, then each power of two is split into
+// four buckets, so a reported percentile is within 25% of the true value. 80 buckets reach ~17 minutes.
+#define DX_LATENCY_HISTOGRAM_BUCKETS 80
+
+typedef struct {
+    uint32_t buckets[DX_LATENCY_HISTOGRAM_BUCKETS];
+    uint32_t count;
+    uint32_t minMs;
+    uint32_t maxMs;
+    uint64_t totalMs;
+} DX_LATENCY_HISTOGRAM;
+
+typedef struct {
+    uint32_t count;
+    uint32_t minMs;
+    uint32_t maxMs;
+    uint32_t meanMs;
+    uint32_t p50Ms;
+    uint32_t p95Ms;
+    uint32_t p99Ms;
+} DX_LATENCY_STATS;
+
+/// <summary>
+/// Add a latency sample in milliseconds to the histogram
+/// </summary>
+/// <param name="histogram"></param>
+/// <param name="latencyMs"></param>
+void dx_latencyHistogramRecord(DX_LATENCY_HISTOGRAM *histogram, uint32_t latencyMs);
+
+/// <summary>
+/// Calculate count, min, max, mean and p50/p95/p99 from the histogram
+/// </summary>
+/// <param name="histogram"></param>
+/// <param name="stats"></param>
+void dx_latencyHistogramGetStats(const DX_LATENCY_HISTOGRAM *histogram, DX_LATENCY_STATS *stats);
+
+void dx_latencyHistogramReset(DX_LATENCY_HISTOGRAM *histogram);
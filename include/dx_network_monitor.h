@@ -0,0 +1,92 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "dx_timer.h"
+#include "dx_utilities.h"
+#include <applibs/log.h>
+#include <applibs/networking.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Refresh period while connected
+#ifndef DX_NETWORK_MONITOR_REFRESH_MILLISECONDS
+#define DX_NETWORK_MONITOR_REFRESH_MILLISECONDS 30000
+#endif
+
+// Refresh period while not connected, so recovery is noticed quickly
+#ifndef DX_NETWORK_MONITOR_DEGRADED_REFRESH_MILLISECONDS
+#define DX_NETWORK_MONITOR_DEGRADED_REFRESH_MILLISECONDS 2000
+#endif
+
+typedef struct {
+    const char *networkInterface; // Interface checked for internet connectivity, NULL to only check networking is ready
+    uint32_t refreshMs;           // Zero uses DX_NETWORK_MONITOR_REFRESH_MILLISECONDS
+    uint32_t degradedRefreshMs;   // Zero uses DX_NETWORK_MONITOR_DEGRADED_REFRESH_MILLISECONDS
+} DX_NETWORK_MONITOR_CONFIG;
+
+/// <summary>
+/// The networking calls used by the monitor. Replace them to run the monitor off device, for example on a Linux host.
+/// </summary>
+typedef struct {
+    bool (*isNetworkingReady)(void);
+    bool (*isInterfaceConnected)(const char *networkInterface);
+} DX_NETWORK_MONITOR_PROVIDER;
+
+typedef void (*DX_NETWORK_CHANGED_CALLBACK)(bool connected, void *context);
+
+typedef struct {
+    uint32_t refreshes;   // Calls made to the networking provider
+    uint32_t changes;     // Connected state transitions
+    int64_t lastChangeMs; // dx_getNowMilliseconds of the last transition
+} DX_NETWORK_MONITOR_STATS;
+
+/// <summary>
+/// Start tracking network state. The state is read once now and then on the configured schedule.
+/// Calling again changes the configuration.
+/// </summary>
+/// <param name="config"></param>
+/// <returns></returns>
+bool dx_networkMonitorStart(const DX_NETWORK_MONITOR_CONFIG *config);
+
+/// <summary>
+/// Stop the refresh timer, the last known state is still returned by dx_networkMonitorIsConnected
+/// </summary>
+/// <param name=""></param>
+void dx_networkMonitorStop(void);
+
+bool dx_networkMonitorIsRunning(void);
+
+/// <summary>
+/// The cached network state, no networking calls are made
+/// </summary>
+/// <param name=""></param>
+/// <returns></returns>
+bool dx_networkMonitorIsConnected(void);
+
+/// <summary>
+/// Read the network state now, for example after a connection error suggests the cached state is stale
+/// </summary>
+/// <param name=""></param>
+/// <returns></returns>
+bool dx_networkMonitorRefresh(void);
+
+/// <summary>
+/// Replace the networking provider, NULL restores the Azure Sphere networking API
+/// </summary>
+/// <param name="provider"></param>
+void dx_networkMonitorSetProvider(const DX_NETWORK_MONITOR_PROVIDER *provider);
+
+/// <summary>
+/// Register to be called from the event loop when the network state changes
+/// </summary>
+/// <param name="networkChangedCallback"></param>
+/// <param name="context"></param>
+/// <returns></returns>
+bool dx_networkMonitorRegisterChangedNotification(DX_NETWORK_CHANGED_CALLBACK networkChangedCallback, void *context);
+
+void dx_networkMonitorUnregisterChangedNotification(DX_NETWORK_CHANGED_CALLBACK networkChangedCallback, void *context);
+
+void dx_networkMonitorGetStats(DX_NETWORK_MONITOR_STATS *stats);
@@ -0,0 +1,48 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct DX_RETRY_POLICY DX_RETRY_POLICY;
+
+/// <summary>
+/// Returns the delay in milliseconds before the next retry. attempt has already been incremented.
+/// </summary>
+typedef uint32_t (*DX_RETRY_DELAY_FUNCTION)(const DX_RETRY_POLICY *policy);
+
+struct DX_RETRY_POLICY {
+    uint32_t baseDelayMs;                  // Delay ceiling for the first retry, doubled for each following attempt
+    uint32_t maxDelayMs;                   // Cap on the delay ceiling
+    DX_RETRY_DELAY_FUNCTION delayFunction; // NULL uses dx_retryPolicyFullJitter
+    uint32_t attempt;                      // Failed attempts since the last reset
+    uint32_t nextDelayMs;                  // Delay returned by the last call to dx_retryPolicyNextDelay
+};
+
+/// <summary>
+/// Record a failed attempt and return the milliseconds to wait before retrying, never less than 1 ms
+/// </summary>
+/// <param name="policy"></param>
+/// <returns></returns>
+uint32_t dx_retryPolicyNextDelay(DX_RETRY_POLICY *policy);
+
+/// <summary>
+/// Call on success, the next failure starts again from baseDelayMs
+/// </summary>
+/// <param name="policy"></param>
+void dx_retryPolicyReset(DX_RETRY_POLICY *policy);
+
+/// <summary>
+/// min(maxDelayMs, baseDelayMs * 2^(attempt - 1)), no jitter
+/// </summary>
+uint32_t dx_retryPolicyExponential(const DX_RETRY_POLICY *policy);
+
+/// <summary>
+/// Uniform random delay between 0 and the exponential ceiling. Spreads retries from a fleet that lost its
+/// connection at the same moment so devices do not reconnect in lock step.
+/// </summary>
+uint32_t dx_retryPolicyFullJitter(const DX_RETRY_POLICY *policy);
@@ -0,0 +1,55 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// An Azure Sphere application has one mutable storage file. Once any record is written this module owns
+// the file, applications sharing it should store their data as records with ids from DX_STORAGE_ID_USER.
+// A file longer than the two regions below with no region header is taken to hold other data, it is left
+// alone and every write fails. Anything shorter may be a torn write of our own and is reused.
+#define DX_STORAGE_ID_DPS_CACHE 1
+#define DX_STORAGE_ID_DEVICE_TWIN_CACHE 2
+#define DX_STORAGE_ID_USER 0x100
+
+// The file is split into two regions of this size that take turns holding every record, so the
+// MutableStorage SizeKB in app_manifest.json must be at least twice this
+#ifndef DX_STORAGE_REGION_BYTES
+#define DX_STORAGE_REGION_BYTES 4096
+#endif
+
+/// <summary>
+/// Write or replace the record with this id. All records are written together into the region not holding
+/// the current set, stamped with the next generation and a CRC, so this is for small, infrequently changing
+/// data. A torn write leaves that region invalid and reads carry on from the previous generation.
+/// </summary>
+/// <param name="id"></param>
+/// <param name="data"></param>
+/// <param name="length"></param>
+/// <returns></returns>
+bool dx_storageWrite(uint16_t id, const void *data, size_t length);
+
+/// <summary>
+/// Read the record with this id into buffer. Returns false if there is no valid record or it does not fit.
+/// </summary>
+/// <param name="id"></param>
+/// <param name="buffer"></param>
+/// <param name="bufferSize"></param>
+/// <param name="length">Set to the record length</param>
+/// <returns></returns>
+bool dx_storageRead(uint16_t id, void *buffer, size_t bufferSize, size_t *length);
+
+/// <summary>
+/// Remove the record with this id
+/// </summary>
+/// <param name="id"></param>
+/// <returns></returns>
+bool dx_storageDelete(uint16_t id);
@@ -0,0 +1,78 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "dx_azure_iot.h"
+#include "dx_timer.h"
+#include <applibs/log.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef DX_TELEMETRY_BATCH_MAX_PROPERTIES
+#define DX_TELEMETRY_BATCH_MAX_PROPERTIES 8
+#endif
+
+// Space to hold a copy of the application and content properties shared by every message in a batch
+#ifndef DX_TELEMETRY_BATCH_PROPERTY_BYTES
+#define DX_TELEMETRY_BATCH_PROPERTY_BYTES 256
+#endif
+
+// Estimated per message cost of an IoT Hub publish, MQTT fixed header, topic and message id, used for bytesSaved
+#ifndef DX_TELEMETRY_BATCH_MESSAGE_OVERHEAD
+#define DX_TELEMETRY_BATCH_MESSAGE_OVERHEAD 100
+#endif
+
+typedef struct {
+    size_t maxBatchBytes; // Size of the batch buffer, the batch is published when the next message will not fit
+    uint32_t maxAgeMs;    // Publish the batch this long after the first message was added
+} DX_TELEMETRY_BATCH_CONFIG;
+
+typedef struct {
+    uint32_t messages;        // Messages added to a batch
+    uint32_t publishes;       // Batches handed to the IoT Hub client
+    uint32_t bypassed;        // Messages sent on their own, too large or with properties that do not fit
+    uint32_t dropped;         // Messages in batches that failed to publish
+    uint32_t bytesSaved;      // Estimated bytes not sent because messages shared one publish
+    float messagesPerPublish; // messages / publishes
+} DX_TELEMETRY_BATCH_STATS;
+
+typedef DX_PUBLISH_RESULT (*DX_TELEMETRY_BATCH_SEND)(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                                     size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties);
+
+/// <summary>
+/// Enable telemetry batching. dx_azurePublish appends each JSON payload to a JSON array which is published
+/// as one IoT Hub message when the buffer is full, when maxAgeMs expires or when dx_azurePublishFlush is called.
+/// Messages with different application or content properties are never mixed in one batch.
+/// </summary>
+/// <param name="config"></param>
+/// <returns></returns>
+bool dx_telemetryBatchInit(const DX_TELEMETRY_BATCH_CONFIG *config);
+
+/// <summary>
+/// Publish any pending batch then release the batch buffer
+/// </summary>
+/// <param name=""></param>
+void dx_telemetryBatchDeinit(void);
+
+/// <summary>
+/// Add a message to the current batch, publishing the batch first with send if the properties differ or the
+/// message will not fit. Returns DX_PUBLISH_QUEUED when the message is held in the batch.
+/// Messages that can not be batched are passed straight to send.
+/// </summary>
+DX_PUBLISH_RESULT dx_telemetryBatchAppend(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                          size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                          DX_TELEMETRY_BATCH_SEND send);
+
+/// <summary>
+/// Publish the current batch. A batch turned away with DX_PUBLISH_WOULD_BLOCK is kept and retried after maxAgeMs,
+/// any other failure discards the batch.
+/// </summary>
+DX_PUBLISH_RESULT dx_telemetryBatchFlush(DX_TELEMETRY_BATCH_SEND send);
+
+bool dx_telemetryBatchIsEnabled(void);
+size_t dx_telemetryBatchPendingCount(void);
+void dx_telemetryBatchGetStats(DX_TELEMETRY_BATCH_STATS *stats);
+void dx_telemetryBatchResetStats(void);
@@ -0,0 +1,77 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "dx_azure_iot.h"
+#include <applibs/log.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef DX_TELEMETRY_QUEUE_MAX_PROPERTIES
+#define DX_TELEMETRY_QUEUE_MAX_PROPERTIES 8
+#endif
+
+typedef enum {
+    DX_TELEMETRY_QUEUE_DROP_OLDEST = 0,
+    DX_TELEMETRY_QUEUE_DROP_NEWEST = 1
+} DX_TELEMETRY_QUEUE_POLICY;
+
+typedef struct {
+    size_t byteBudget;                // Total bytes reserved for queued messages, allocated once at init
+    size_t slotSize;                  // Bytes per slot, a slot holds one message plus its properties
+    DX_TELEMETRY_QUEUE_POLICY policy; // What to discard when the queue is full
+    size_t drainPerTick;              // Max messages sent each time the Azure connection handler runs
+} DX_TELEMETRY_QUEUE_CONFIG;
+
+typedef struct {
+    uint32_t enqueued;
+    uint32_t dropped;
+    uint32_t drained;
+    uint32_t failed; // Messages removed because the IoT Hub client would not take them
+    uint32_t highWaterMark;
+    uint32_t count;
+    uint32_t capacity;
+} DX_TELEMETRY_QUEUE_STATS;
+
+typedef DX_PUBLISH_RESULT (*DX_TELEMETRY_QUEUE_SEND)(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                                     size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                                     DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context, int64_t publishTimeMs);
+
+/// <summary>
+/// Enable the offline store and forward telemetry queue. While Azure IoT is not connected dx_azurePublish
+/// copies messages into the queue instead of failing. Queued messages are sent, oldest first, once the
+/// connection is authenticated. All memory is allocated once here.
+/// </summary>
+/// <param name="config"></param>
+/// <returns></returns>
+bool dx_telemetryQueueInit(const DX_TELEMETRY_QUEUE_CONFIG *config);
+
+/// <summary>
+/// Release the queue memory. Any queued messages are discarded and their completion callbacks called
+/// with IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY.
+/// </summary>
+/// <param name=""></param>
+void dx_telemetryQueueDeinit(void);
+
+/// <summary>
+/// Copy a message and its properties into the next free slot, applying the configured drop policy when full.
+/// A message with a completion callback that is later dropped to make room is completed with IOTHUB_CLIENT_CONFIRMATION_ERROR.
+/// </summary>
+bool dx_telemetryQueueEnqueue(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                              size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                              DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context);
+
+/// <summary>
+/// Send up to maxMessages queued messages, oldest first. A message turned away with DX_PUBLISH_WOULD_BLOCK stays at
+/// the head of the queue and ends the drain. Any other failure removes the message and completes it with
+/// IOTHUB_CLIENT_CONFIRMATION_ERROR so one bad message can not hold up the rest.
+/// Pass 0 to use the configured drainPerTick. Returns the number of messages sent.
+/// </summary>
+size_t dx_telemetryQueueDrain(size_t maxMessages, DX_TELEMETRY_QUEUE_SEND send);
+
+bool dx_telemetryQueueIsEnabled(void);
+bool dx_telemetryQueueIsEmpty(void);
+void dx_telemetryQueueGetStats(DX_TELEMETRY_QUEUE_STATS *stats);
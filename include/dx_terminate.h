@@ -8,9 +8,24 @@
 #include <errno.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
 
+// Longest time dx_eventLoopRun keeps running registered drain handlers after termination is requested
+#ifndef DX_TERMINATE_DRAIN_DEADLINE_MILLISECONDS
+#define DX_TERMINATE_DRAIN_DEADLINE_MILLISECONDS 3000
+#endif
+
+#ifndef DX_TERMINATE_MAX_DRAIN_HANDLERS
+#define DX_TERMINATE_MAX_DRAIN_HANDLERS 4
+#endif
+
+/// <summary>
+/// Called repeatedly from the event loop after termination is requested, return true once there is nothing left to flush
+/// </summary>
+typedef bool (*DX_TERMINATION_DRAIN_HANDLER)(void *context);
+
 extern volatile bool asyncEventReady;
 
 bool dx_isTerminationRequired(void);
@@ -18,4 +33,19 @@ int dx_getTerminationExitCode(void);
 void dx_eventLoopRun(void);
 void dx_registerTerminationHandler(void);
 void dx_terminate(int exitCode);
-void dx_terminationHandler(int signalNumber);
\ No newline at end of file
+void dx_terminationHandler(int signalNumber);
+
+/// <summary>
+/// Register work to finish before dx_eventLoopRun returns. Once termination is requested the event loop keeps
+/// running, timers included, until every drain handler returns true or the drain deadline passes.
+/// </summary>
+/// <param name="drainHandler"></param>
+/// <param name="context"></param>
+/// <returns></returns>
+bool dx_registerTerminationDrainHandler(DX_TERMINATION_DRAIN_HANDLER drainHandler, void *context);
+
+/// <summary>
+/// Change the drain deadline from DX_TERMINATE_DRAIN_DEADLINE_MILLISECONDS, zero exits without draining
+/// </summary>
+/// <param name="deadlineMs"></param>
+void dx_setTerminationDrainDeadline(uint32_t deadlineMs);
\ No newline at end of file
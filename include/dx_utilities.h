@@ -13,6 +13,7 @@
 #include <math.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,6 +46,60 @@ bool dx_startThreadDetached(void *(*daemon)(void *), void *arg, char *daemon_nam
 char *dx_getCurrentUtc(char *buffer, size_t bufferSize);
 char *dx_getHttpData(const char *url, long timeout);
 int dx_stringEndsWith(const char *str, const char *suffix);
+
+/// <summary>
+/// 32 bit FNV-1a hash of a NULL terminated string, used to index bindings by name
+/// </summary>
+/// <param name="string"></param>
+/// <returns></returns>
+uint32_t dx_hashString(const char *string);
+
+/// <summary>
+/// dx_hashString of the first length characters of string
+/// </summary>
+/// <param name="string"></param>
+/// <param name="length"></param>
+/// <returns></returns>
+uint32_t dx_hashStringLength(const char *string, size_t length);
+
+// Open addressing hash index of items by name, for binding tables looked up on every message. Each slot holds
+// an item index + 1, 0 marks an empty slot. The index stores no names, the caller compares each candidate.
+typedef struct {
+    size_t *slots; // NULL when the index could not be allocated, every item is then a candidate in turn
+    size_t mask;
+    size_t count;
+} DX_NAME_INDEX;
+
+/// <summary>
+/// Size the index for count items, at most half full so an empty slot ends every probe. Returns false when
+/// the slots can not be allocated, the index then falls back to a linear scan of the items.
+/// </summary>
+/// <param name="index"></param>
+/// <param name="count"></param>
+/// <returns></returns>
+bool dx_nameIndexInit(DX_NAME_INDEX *index, size_t count);
+
+/// <summary>
+/// Add item with the hash of its name. Items are added in order so among items with the same name the first
+/// one added is the first candidate.
+/// </summary>
+/// <param name="index"></param>
+/// <param name="hash"></param>
+/// <param name="item"></param>
+void dx_nameIndexInsert(DX_NAME_INDEX *index, uint32_t hash, size_t item);
+
+/// <summary>
+/// Next item that may have the name with this hash. Start with cursor 0, returns false when there are no more.
+/// </summary>
+/// <param name="index"></param>
+/// <param name="hash"></param>
+/// <param name="cursor"></param>
+/// <param name="item"></param>
+/// <returns></returns>
+bool dx_nameIndexNext(const DX_NAME_INDEX *index, uint32_t hash, size_t *cursor, size_t *item);
+
+void dx_nameIndexFree(DX_NAME_INDEX *index);
+
 int64_t dx_getNowMilliseconds(void);
 void dx_Log_Debug(char *fmt, ...);
 void dx_Log_Debug_Init(const char *buffer, size_t buffer_size);
\ No newline at end of file
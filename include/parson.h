@@ -56,6 +56,16 @@ typedef int JSON_Value_Type;
 enum json_result_t { JSONSuccess = 0, JSONFailure = -1 };
 typedef int JSON_Status;
 
+/* Caller provided buffer the values of a parse are allocated from, see json_arena_init */
+typedef struct json_arena_t {
+    char *buffer;
+    size_t capacity;
+    size_t used;      /* bytes handed out since the last json_arena_reset */
+    size_t last;      /* offset of the newest block, the only one given back when freed */
+    size_t peak;      /* most bytes used at once */
+    size_t overflows; /* parses since the last json_arena_reset that did not fit and were made on the heap */
+} JSON_Arena;
+
 typedef void *(*JSON_Malloc_Function)(size_t);
 typedef void (*JSON_Free_Function)(void *);
 
@@ -63,9 +73,37 @@ typedef void (*JSON_Free_Function)(void *);
    from stdlib will be used for all allocations */
 void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun);
 
+/* Arenas. json_arena_parse_string_with_length allocates the parsed values from the arena buffer so the
+   whole tree is one block, released at once by json_arena_reset. A document that does not fit in what is
+   left of the arena is given back and parsed again with the allocation functions above, so each tree is
+   either all arena or all heap. Allocations made after the parse returns also use the allocation functions.
+   Values parsed into an arena can be read, changed and passed to json_value_free as usual,
+   json_value_free skips the arena blocks.
+   Call json_value_free before json_arena_reset when the tree may hold heap blocks, overflows is non zero
+   or values were added after the parse, otherwise json_arena_reset alone releases the tree.
+   At most PARSON_MAX_BORROWED arenas and in-situ sources can be registered at once, parsing into an
+   arena that is not initialised uses the heap. */
+JSON_Status json_arena_init(JSON_Arena *arena, void *buffer, size_t capacity);
+void json_arena_reset(JSON_Arena *arena);
+void json_arena_deinit(JSON_Arena *arena);
+JSON_Value *json_arena_parse_string_with_length(JSON_Arena *arena, const char *string, size_t length);
+
 /*  Parses first JSON value in a string, returns NULL in case of error */
 JSON_Value *json_parse_string(const char *string);
 
+/*  Parses first JSON value in the first length bytes of string, which does not need to be NUL
+    terminated. Returns NULL in case of error */
+JSON_Value *json_parse_string_with_length(const char *string, size_t length);
+
+/*  Parses first JSON value in the first length bytes of string in place. Escape sequences are decoded
+    within string and string values and object names point into it rather than being copied, so only
+    value nodes, objects and arrays are allocated. string is modified, even when parsing fails, and must
+    stay valid until the value is freed. json_value_free skips the borrowed strings, call
+    json_release_in_situ(string) after it. Returns NULL in case of error or when PARSON_MAX_BORROWED
+    arenas and in-situ sources are already registered */
+JSON_Value *json_parse_string_in_situ(char *string, size_t length);
+void json_release_in_situ(char *string);
+
 /*  Parses first JSON value in a string and ignores comments (/ * * / and //),
     returns NULL in case of error */
 JSON_Value *json_parse_string_with_comments(const char *string);
@@ -103,6 +141,8 @@ JSON_Status json_validate(const JSON_Value *schema, const JSON_Value *value);
  * JSON Object
  */
 JSON_Value *json_object_get_value(const JSON_Object *object, const char *name);
+/* Same as json_object_get_value, name is name_len characters and need not be null terminated */
+JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name, size_t name_len);
 const char *json_object_get_string(const JSON_Object *object, const char *name);
 JSON_Object *json_object_get_object(const JSON_Object *object, const char *name);
 JSON_Array *json_object_get_array(const JSON_Object *object, const char *name);
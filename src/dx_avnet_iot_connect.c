@@ -35,6 +35,10 @@ static DX_MESSAGE_PROPERTY *_telemetryMsgProps[AVT_TELEMETRY_PROP_COUNT];
 static DX_MESSAGE_PROPERTY *_devIdMsgProps[AVT_DEV_ID_PROP_COUNT];
 static DX_MESSAGE_CONTENT_PROPERTIES _ioTCContentProperties = {.contentEncoding = "utf-8", .contentType = "application/json"};
 
+// C2D messages are parsed into _parseArena rather than as many small heap blocks
+static char _parseArenaBuffer[DX_AVNET_IOT_CONNECT_PARSE_ARENA_BYTES];
+static JSON_Arena _parseArena;
+
 // char arrays for custom application message properties
 char _vKey[] = "v";
 char _vValue[DX_AVNET_IOT_CONNECT_MAX_MSG_PROPERTY_LEN] = {'\0'};
@@ -111,6 +115,11 @@ void dx_avnetConnect(DX_USER_CONFIG *userConfig, const char *networkInterface)
     // and C2D messages
     dx_azureRegisterConnectionChangedNotification(AvnetReconnectCallback);
     dx_azureRegisterMessageReceivedNotification(ReceiveMessageCallback);
+
+    json_arena_deinit(&_parseArena);
+    if (json_arena_init(&_parseArena, _parseArenaBuffer, sizeof(_parseArenaBuffer)) != JSONSuccess) {
+        avt_Debug(AVT_DEBUG_LEVEL_ERROR, "C2D parse arena not available, parsing on the heap\n");
+    }
     
     dx_azureConnect(userConfig, networkInterface, NULL);
 }
@@ -153,22 +162,12 @@ static IOTHUBMESSAGE_DISPOSITION_RESULT ReceiveMessageCallback(IOTHUB_MESSAGE_HA
         return IOTHUBMESSAGE_REJECTED;
     }
 
-    // 'buffer' is not null terminated, make a copy and null terminate it.
-    unsigned char *str_msg = (unsigned char *)malloc(msgSize + 1);
-    if (str_msg == NULL) {
-        avt_Debug(AVT_DEBUG_LEVEL_ERROR, "Could not allocate buffer for incoming message\n");
-        abort();
-    }
-
-    // Copy the buffer and null terminate it
-    memcpy(str_msg, buffer, msgSize);
-    str_msg[msgSize] = '\0';
-
-    avt_Debug(AVT_DEBUG_LEVEL_INFO, "Received C2D message '%s'\n", str_msg);
+    // 'buffer' is not null terminated, print and parse it using its length
+    avt_Debug(AVT_DEBUG_LEVEL_INFO, "Received C2D message '%.*s'\n", (int)msgSize, buffer);
 
     // Using the mesage string get a pointer to the rootMessage
     JSON_Value *rootMessage = NULL;
-    rootMessage = json_parse_string(str_msg);
+    rootMessage = json_arena_parse_string_with_length(&_parseArena, (const char *)buffer, msgSize);
     if (rootMessage == NULL) {
         avt_Debug(AVT_DEBUG_LEVEL_ERROR, "Cannot parse the string as JSON content.\n");
         goto cleanup;
@@ -257,9 +256,9 @@ static IOTHUBMESSAGE_DISPOSITION_RESULT ReceiveMessageCallback(IOTHUB_MESSAGE_HA
     }
 
 cleanup:
-    // Release the allocated memory.
+    // Frees a message too large for the arena, then the arena in one step
     json_value_free(rootMessage);
-    free(str_msg);
+    json_arena_reset(&_parseArena);
 
     return IOTHUBMESSAGE_ACCEPTED;
 }
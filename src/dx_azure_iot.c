@@ -1,6 +1,8 @@
 #include "dx_azure_iot.h"
-
-#define MAX_CONNECTION_STATUS_CALLBACKS 5
+#include "dx_network_monitor.h"
+#include "dx_storage.h"
+#include "dx_telemetry_batch.h"
+#include "dx_telemetry_queue.h"
 
 static bool SetupAzureClient(void);
 static bool SetUpAzureIoTHubClientWithDaa(void);
@@ -10,10 +12,35 @@ static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason
 static void AzureConnectionHandler(EventLoopTimer *eventLoopTimer);
 static void HubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS, IOTHUB_CLIENT_CONNECTION_STATUS_REASON, void *);
 static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT, void *);
+static DX_PUBLISH_RESULT DrainQueuedMessage(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                            size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                            DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context, int64_t publishTimeMs);
+static DX_PUBLISH_RESULT PublishMessage(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                        size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                        DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context);
+static DX_PUBLISH_RESULT PublishBatch(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                      size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties);
+static DX_PUBLISH_RESULT RouteMessage(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                      size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                      DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context);
+static DX_PUBLISH_RESULT SendMessageToHub(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                          size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                          DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context, int64_t publishTimeMs);
+static struct timespec NextDoWorkPeriod(void);
+static void RecordDoWorkWakeup(void);
+static void RecordPublishToWire(size_t handoffs);
+static struct timespec RetryDelayPeriod(void);
+static bool LoadCachedHubUri(void);
+static void StoreCachedHubUri(void);
+static void InvalidateCachedHubUri(void);
+static void TraceConnectionEvent(const char *state);
+static void RecordDisconnect(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason);
+static void TraceDeviceReadiness(void);
+static void ProcessConnectionStatusCallbacks(bool connection_state);
+static void NetworkChangedCallback(bool connected, void *context);
+static bool TerminationDrainHandler(void *context);
+static void SetDirectMethodCallback(void);
 
-static bool network_ready_cached = false;
-static DX_DECLARE_TIMER_HANDLER(network_ready_expired_handler);
-static DX_TIMER_BINDING tmr_network_ready_cached = {.name = "tmr_network_ready_cached", .handler = network_ready_expired_handler};
 
 static IOTHUB_DEVICE_CLIENT_LL_HANDLE iothubClientHandle = NULL;
 
@@ -21,8 +48,56 @@ static char *iotHubUri = NULL;
 static const char *_networkInterface = NULL;
 static DX_USER_CONFIG *_userConfig = NULL;
 static int outstandingMessageCount = 0;
+static DX_LATENCY_HISTOGRAM publishLatencyHistogram;
+static DX_PUBLISH_STATS publishStats;
+
+// Admission control for messages handed to the IoT Hub client, zero means no limit
+static size_t maxInFlightMessages = 0;
+static size_t maxInFlightBytes = 0;
+static size_t inFlightBytes = 0;
+static bool publishBlocked = false;
+static void (*_publishCapacityCallback)(void *context) = NULL;
+static void *_publishCapacityContext = NULL;
 static bool connection_initialized = false;
 
+// Adaptive DoWork scheduling, poll at the floor while there is work in progress and back off geometrically when idle
+#define DOWORK_POLL_FLOOR_MS (IOT_HUB_POLL_TIME_SECONDS * 1000 + IOT_HUB_POLL_TIME_NANOSECONDS / 1000000)
+static uint32_t doWorkPollCeilingMs = IOT_HUB_POLL_TIME_MAX_MILLISECONDS;
+static uint32_t doWorkPollMs = DOWORK_POLL_FLOOR_MS;
+static bool doWorkRequested = false;
+static bool hubActivity = false;
+static uint32_t doWorkWakeups = 0;
+static uint32_t doWorkWakeupsPerMinute = 0;
+static int64_t doWorkWindowStartMs = 0;
+static int64_t pendingHandoffMs[IOT_HUB_DOWORK_LATENCY_SAMPLES];
+static size_t pendingHandoffCount = 0;
+static DX_LATENCY_HISTOGRAM publishToWireHistogram;
+
+// Hub connect and DPS retries back off with full jitter so a fleet that drops together does not reconnect together
+static DX_RETRY_POLICY connectRetryPolicy = {.baseDelayMs = AZURE_CONNECT_RETRY_BASE_MILLISECONDS,
+                                             .maxDelayMs = AZURE_CONNECT_RETRY_MAX_MILLISECONDS};
+static bool reconnectPending = false;
+static uint32_t provisioningTimeoutMs = DX_DPS_PROVISIONING_TIMEOUT_SECONDS * 1000;
+
+// Hub assigned by DPS, reused on reconnect until the TTL expires or the hub rejects the device
+typedef struct {
+    int64_t cachedAt; // Wall clock seconds
+    char hubUri[DX_DPS_CACHE_URI_MAX_LENGTH];
+} DPS_CACHE_RECORD;
+
+static bool dpsCacheEnabled = false;
+static bool dpsCachePersist = false;
+static uint32_t dpsCacheTtlSeconds = 0;
+static int64_t hubUriCachedAt = 0;
+static bool connectedFromCache = false;
+static uint32_t cachedHubFailedConnects = 0;
+static int64_t connectStartMs = 0;
+static DX_CONNECTION_STATS connectionStats;
+
+// Termination drain, confirmations counted from the moment termination was requested
+static bool drainStarted = false;
+static uint32_t drainConfirmedAtStart = 0;
+
 static char *_pnpModelIdJson = NULL;
 static const char *_pnpModelId = NULL;
 static const char *_pnpModelIdJsonTemplate = "{\"modelId\":\"%s\"}";
@@ -33,8 +108,25 @@ static void (*_deviceTwinCallbackHandler)(DEVICE_TWIN_UPDATE_STATE updateState,
 
 static int (*_directMethodCallbackHandler)(const char *method_name, const unsigned char *payload, size_t payloadSize,
                                            unsigned char **responsePayload, size_t *responsePayloadSize, void *userContextCallback);
+static int (*_directMethodInboundHandler)(const char *method_name, const unsigned char *payload, size_t payloadSize, METHOD_HANDLE methodId,
+                                          void *userContextCallback);
 
-static void (*_connectionStatusCallback[MAX_CONNECTION_STATUS_CALLBACKS])(bool connected);
+// Connection changed subscribers, sorted by descending priority, grown on demand
+typedef struct {
+    void (*legacyCallback)(bool connected);
+    DX_CONNECTION_CHANGED_CALLBACK callback;
+    void *context;
+    int priority;
+} CONNECTION_SUBSCRIBER;
+
+static CONNECTION_SUBSCRIBER *connectionSubscribers = NULL;
+static size_t connectionSubscriberCount = 0;
+static size_t connectionSubscriberCapacity = 0;
+static bool dispatchingConnectionChanged = false;
+static bool connectionState = false;
+static bool notifiedConnectionState = false;
+static DX_DECLARE_TIMER_HANDLER(connection_changed_handler);
+static DX_TIMER_BINDING tmr_connection_changed = {.name = "tmr_connection_changed", .handler = connection_changed_handler};
 
 MU_DEFINE_ENUM_STRINGS_WITHOUT_INVALID(PROV_DEVICE_RESULT, PROV_DEVICE_RESULT_VALUE);
 MU_DEFINE_ENUM_STRINGS_WITHOUT_INVALID(IOTHUB_CLIENT_RESULT, IOTHUB_CLIENT_RESULT_VALUE);
@@ -48,6 +140,17 @@ typedef enum {
 } DEVICE_CONNECTION_STATE;
 
 static DEVICE_CONNECTION_STATE deviceConnectionState = DEVICE_NOT_CONNECTED;
+
+static const char *deviceConnectionStateNames[] = {"DEVICE_NOT_CONNECTED", "DEVICE_PROVISIONING_ERROR", "DEVICE_PROVISIONING",
+                                                   "DEVICE_PROVISION_IOT_CLIENT", "DEVICE_CONNECTED"};
+
+// Passed as the SendEventAsync context so the confirmation can be matched to the publish
+typedef struct {
+    DX_PUBLISH_COMPLETION_CALLBACK completionCallback;
+    void *context;
+    int64_t publishTimeMs;
+    size_t messageLength;
+} PUBLISH_TRACKER;
 static PROV_DEVICE_LL_HANDLE prov_handle = NULL;
 
 /// <summary>
@@ -67,6 +170,37 @@ typedef enum {
 // Authentication state with respect to the IoT Hub.
 static IoTHubClientAuthenticationState iotHubClientAuthenticationState = IoTHubClientAuthenticationState_NotAuthenticated;
 
+static const char *authenticationStateNames[] = {"NotAuthenticated", "AuthenticationInitiated", "Authenticated", "Device_Disabled"};
+
+// Ring of the most recent state transitions
+static DX_CONNECTION_TRACE_ENTRY connectionTrace[DX_CONNECTION_TRACE_SIZE];
+static size_t connectionTraceNext = 0;
+static size_t connectionTraceCount = 0;
+static uint64_t totalTimeToConnectMs = 0;
+
+/// <summary>
+///     All changes to the connection state machine go through here so each transition is traced
+/// </summary>
+static void SetDeviceConnectionState(DEVICE_CONNECTION_STATE state)
+{
+    if (state != deviceConnectionState) {
+        deviceConnectionState = state;
+        TraceConnectionEvent(deviceConnectionStateNames[state]);
+    }
+}
+
+static void SetAuthenticationState(IoTHubClientAuthenticationState state)
+{
+    if (state != iotHubClientAuthenticationState) {
+        iotHubClientAuthenticationState = state;
+        TraceConnectionEvent(authenticationStateNames[state]);
+
+        if (state != IoTHubClientAuthenticationState_Authenticated) {
+            ProcessConnectionStatusCallbacks(false);
+        }
+    }
+}
+
 #define dpsUrl "global.azure-devices-provisioning.net"
 
 static PROV_DEVICE_RESULT dpsRegisterStatus = PROV_DEVICE_RESULT_INVALID_STATE;
@@ -89,31 +223,126 @@ void dx_azureRegisterDirectMethodCallback(int (*directMethodCallbackHandler)(con
     _directMethodCallbackHandler = directMethodCallbackHandler;
 }
 
+void dx_azureRegisterDirectMethodInboundCallback(int (*directMethodInboundHandler)(const char *method_name, const unsigned char *payload,
+                                                                                   size_t payloadSize, METHOD_HANDLE methodId,
+                                                                                   void *userContextCallback))
+{
+    _directMethodInboundHandler = directMethodInboundHandler;
+
+    if (iothubClientHandle != NULL) {
+        SetDirectMethodCallback();
+    }
+}
+
 void dx_azureRegisterMessageReceivedNotification(IOTHUBMESSAGE_DISPOSITION_RESULT (*messageReceivedCallback)(IOTHUB_MESSAGE_HANDLE message,
                                                                                                              void *context))
 {
     _messageReceivedCallback = messageReceivedCallback;
 }
 
-bool dx_azureRegisterConnectionChangedNotification(void (*connectionStatusCallback)(bool connected))
+/// <summary>
+/// Stable insertion sort by descending priority, also drops subscribers removed during a dispatch
+/// </summary>
+static void SortConnectionSubscribers(void)
 {
-    bool result = false;
-    for (size_t i = 0; i < MAX_CONNECTION_STATUS_CALLBACKS; i++) {
-        if (_connectionStatusCallback[i] == NULL) {
-            _connectionStatusCallback[i] = connectionStatusCallback;
-            result = true;
-            break;
+    size_t count = 0;
+
+    for (size_t i = 0; i < connectionSubscriberCount; i++) {
+        if (connectionSubscribers[i].legacyCallback == NULL && connectionSubscribers[i].callback == NULL) {
+            continue;
         }
+
+        CONNECTION_SUBSCRIBER subscriber = connectionSubscribers[i];
+        size_t j = count;
+
+        while (j > 0 && connectionSubscribers[j - 1].priority < subscriber.priority) {
+            connectionSubscribers[j] = connectionSubscribers[j - 1];
+            j--;
+        }
+
+        connectionSubscribers[j] = subscriber;
+        count++;
     }
-    return result;
+
+    connectionSubscriberCount = count;
 }
 
-void dx_azureUnregisterConnectionChangedNotification(void (*connectionStatusCallback)(bool connected))
+static bool AddConnectionSubscriber(const CONNECTION_SUBSCRIBER *subscriber)
 {
-    for (size_t i = 0; i < MAX_CONNECTION_STATUS_CALLBACKS; i++) {
-        if (_connectionStatusCallback[i] == connectionStatusCallback) {
-            _connectionStatusCallback[i] = NULL;
+    if (connectionSubscriberCount == connectionSubscriberCapacity) {
+        size_t capacity = connectionSubscriberCapacity == 0 ? 8 : connectionSubscriberCapacity * 2;
+        CONNECTION_SUBSCRIBER *grown = (CONNECTION_SUBSCRIBER *)realloc(connectionSubscribers, capacity * sizeof(CONNECTION_SUBSCRIBER));
+
+        if (grown == NULL) {
+            Log_Debug("ERROR: Connection changed subscriber realloc failed.\n");
+            return false;
         }
+
+        connectionSubscribers = grown;
+        connectionSubscriberCapacity = capacity;
+    }
+
+    connectionSubscribers[connectionSubscriberCount++] = *subscriber;
+
+    // A subscriber added from a callback is put in order once the dispatch finishes
+    if (!dispatchingConnectionChanged) {
+        SortConnectionSubscribers();
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Tombstone matching subscribers so a callback can unregister itself during a dispatch
+/// </summary>
+static void RemoveConnectionSubscribers(void (*legacyCallback)(bool connected), DX_CONNECTION_CHANGED_CALLBACK callback, void *context)
+{
+    for (size_t i = 0; i < connectionSubscriberCount; i++) {
+        CONNECTION_SUBSCRIBER *subscriber = &connectionSubscribers[i];
+
+        if ((legacyCallback != NULL && subscriber->legacyCallback == legacyCallback) ||
+            (callback != NULL && subscriber->callback == callback && subscriber->context == context)) {
+            subscriber->legacyCallback = NULL;
+            subscriber->callback = NULL;
+        }
+    }
+
+    if (!dispatchingConnectionChanged) {
+        SortConnectionSubscribers();
+    }
+}
+
+bool dx_azureRegisterConnectionChangedNotification(void (*connectionStatusCallback)(bool connected))
+{
+    if (connectionStatusCallback == NULL) {
+        return false;
+    }
+
+    return AddConnectionSubscriber(
+        &(CONNECTION_SUBSCRIBER){.legacyCallback = connectionStatusCallback, .priority = DX_CONNECTION_PRIORITY_DEFAULT});
+}
+
+bool dx_azureRegisterConnectionChangedNotificationEx(DX_CONNECTION_CHANGED_CALLBACK connectionChangedCallback, void *context, int priority)
+{
+    if (connectionChangedCallback == NULL) {
+        return false;
+    }
+
+    return AddConnectionSubscriber(
+        &(CONNECTION_SUBSCRIBER){.callback = connectionChangedCallback, .context = context, .priority = priority});
+}
+
+void dx_azureUnregisterConnectionChangedNotification(void (*connectionStatusCallback)(bool connected))
+{
+    if (connectionStatusCallback != NULL) {
+        RemoveConnectionSubscribers(connectionStatusCallback, NULL, NULL);
+    }
+}
+
+void dx_azureUnregisterConnectionChangedNotificationEx(DX_CONNECTION_CHANGED_CALLBACK connectionChangedCallback, void *context)
+{
+    if (connectionChangedCallback != NULL) {
+        RemoveConnectionSubscribers(NULL, connectionChangedCallback, context);
     }
 }
 
@@ -121,7 +350,14 @@ static void dx_azureToDeviceStart(void)
 {
     if (azureConnectionTimer.eventLoopTimer == NULL) {
         dx_timerStart(&azureConnectionTimer);
-        dx_timerStart(&tmr_network_ready_cached);
+        dx_timerStart(&tmr_connection_changed);
+
+        // The application may have started the monitor with its own schedule
+        if (!dx_networkMonitorIsRunning()) {
+            dx_networkMonitorStart(&(DX_NETWORK_MONITOR_CONFIG){.networkInterface = _networkInterface});
+        }
+        dx_networkMonitorRegisterChangedNotification(NetworkChangedCallback, NULL);
+
         dx_timerOneShotSet(&azureConnectionTimer, &(struct timespec){1, 0});
     }
 }
@@ -130,7 +366,8 @@ void dx_azureToDeviceStop(void)
 {
     if (azureConnectionTimer.eventLoopTimer != NULL) {
         dx_timerStop(&azureConnectionTimer);
-        dx_timerStop(&tmr_network_ready_cached);
+        dx_networkMonitorUnregisterChangedNotification(NetworkChangedCallback, NULL);
+        dx_timerStop(&tmr_connection_changed);
         connection_initialized = false;
     }
 }
@@ -198,53 +435,78 @@ void dx_azureConnect(DX_USER_CONFIG *userConfig, const char *networkInterface, c
     // Start the timer that drives the Azure connection process
     dx_azureToDeviceStart();
 
+    static bool drainHandlerRegistered = false;
+    if (!drainHandlerRegistered) {
+        drainHandlerRegistered = dx_registerTerminationDrainHandler(TerminationDrainHandler, NULL);
+    }
+
     connection_initialized = true;
 }
 
 /// <summary>
-/// If network connection has changed then call all network status changed registered callbacks
+/// If the connection has changed then schedule the registered callbacks. They run from the event loop rather than
+/// from the IoT Hub SDK callback so a slow subscriber does not stall the SDK.
 /// </summary>
 /// <param name="connection_state"></param>
 static void ProcessConnectionStatusCallbacks(bool connection_state)
 {
-    static bool previous_connection_state = false;
+    if (connection_state != connectionState) {
+        connectionState = connection_state;
+        dx_timerOneShotSet(&tmr_connection_changed, &(struct timespec){0, 1});
+    }
+}
 
-    if (connection_state != previous_connection_state) {
-        previous_connection_state = connection_state;
+/// <summary>
+/// Call subscribers in priority order. A connect and disconnect in quick succession that nets out to no change is not dispatched.
+/// </summary>
+static DX_TIMER_HANDLER(connection_changed_handler)
+{
+    if (connectionState == notifiedConnectionState) {
+        return;
+    }
 
-        for (size_t i = 0; i < MAX_CONNECTION_STATUS_CALLBACKS; i++) {
-            if (_connectionStatusCallback[i] != NULL) {
-                _connectionStatusCallback[i](connection_state);
-            }
+    notifiedConnectionState = connectionState;
+    dispatchingConnectionChanged = true;
+
+    // Subscribers added during the dispatch are appended and not called until the next change
+    size_t count = connectionSubscriberCount;
+
+    for (size_t i = 0; i < count; i++) {
+        CONNECTION_SUBSCRIBER subscriber = connectionSubscribers[i];
+
+        if (subscriber.legacyCallback != NULL) {
+            subscriber.legacyCallback(notifiedConnectionState);
+        } else if (subscriber.callback != NULL) {
+            subscriber.callback(notifiedConnectionState, subscriber.context);
         }
     }
-}
 
-static DX_TIMER_HANDLER(network_ready_expired_handler)
-{
-    network_ready_cached = false;
+    dispatchingConnectionChanged = false;
+    SortConnectionSubscribers();
 }
 DX_TIMER_HANDLER_END
 
 static bool isNetworkReady(const char *network_interface)
 {
-    static bool connection_state = false;
+    return dx_networkMonitorIsConnected();
+}
 
-    if (network_ready_cached) {
-        return connection_state;
+/// <summary>
+/// Drop an authenticated connection as soon as the network monitor sees the network go
+/// </summary>
+static void NetworkChangedCallback(bool connected, void *context)
+{
+    if (!connected) {
+        dx_isAzureConnected();
     }
-
-    connection_state = dx_isNetworkConnected(_networkInterface);
-    network_ready_cached = true;
-    dx_timerOneShotSet(&tmr_network_ready_cached, &(struct timespec){30, 0});
-    return connection_state;
 }
 
 bool dx_isAzureConnected(void)
 {
     if (!isNetworkReady(_networkInterface) && iotHubClientAuthenticationState == IoTHubClientAuthenticationState_Authenticated) {
-        iotHubClientAuthenticationState = IoTHubClientAuthenticationState_NotAuthenticated;
-        deviceConnectionState = DEVICE_NOT_CONNECTED;
+        RecordDisconnect(IOTHUB_CLIENT_CONNECTION_NO_NETWORK);
+        SetAuthenticationState(IoTHubClientAuthenticationState_NotAuthenticated);
+        SetDeviceConnectionState(DEVICE_NOT_CONNECTED);
         ProcessConnectionStatusCallbacks(false);
         return false;
     } else if (iothubClientHandle != NULL && iotHubClientAuthenticationState == IoTHubClientAuthenticationState_Authenticated &&
@@ -256,6 +518,23 @@ bool dx_isAzureConnected(void)
     return false;
 }
 
+/// <summary>
+///     True if a message of messageLength bytes can be handed to the IoT Hub client without exceeding the in-flight caps.
+///     A message larger than the byte cap is admitted when nothing else is in flight so it cannot block forever.
+/// </summary>
+static bool HasPublishCapacity(size_t messageLength)
+{
+    if (maxInFlightMessages > 0 && (size_t)outstandingMessageCount >= maxInFlightMessages) {
+        return false;
+    }
+
+    if (maxInFlightBytes > 0 && inFlightBytes > 0 && inFlightBytes + messageLength > maxInFlightBytes) {
+        return false;
+    }
+
+    return true;
+}
+
 /// <summary>
 ///     Callback confirming message delivered to IoT Hub.
 /// </summary>
@@ -263,10 +542,173 @@ bool dx_isAzureConnected(void)
 /// <param name="context">User specified context</param>
 static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
 {
+    PUBLISH_TRACKER *tracker = (PUBLISH_TRACKER *)context;
+
     outstandingMessageCount--;
+    hubActivity = true;
 #if DX_LOGGING_ENABLED
     Log_Debug("INFO: Message received by IoT Hub. Result is: %d\n", result);
 #endif
+
+    if (result == IOTHUB_CLIENT_CONFIRMATION_OK) {
+        publishStats.confirmed++;
+    } else {
+        publishStats.failed++;
+    }
+
+    if (tracker == NULL) {
+        return;
+    }
+
+    uint32_t latencyMs = (uint32_t)(dx_getNowMilliseconds() - tracker->publishTimeMs);
+    inFlightBytes -= tracker->messageLength;
+
+    if (result == IOTHUB_CLIENT_CONFIRMATION_OK) {
+        dx_latencyHistogramRecord(&publishLatencyHistogram, latencyMs);
+    }
+
+    if (tracker->completionCallback != NULL) {
+        tracker->completionCallback(result, latencyMs, tracker->context);
+    }
+
+    free(tracker);
+
+    // A producer was turned away, let it know it can publish again
+    if (publishBlocked && HasPublishCapacity(0)) {
+        publishBlocked = false;
+        if (_publishCapacityCallback != NULL) {
+            _publishCapacityCallback(_publishCapacityContext);
+        }
+    }
+}
+
+/// <summary>
+///     Count wakeups of the Azure connection timer in one minute windows
+/// </summary>
+static void RecordDoWorkWakeup(void)
+{
+    int64_t now = dx_getNowMilliseconds();
+
+    doWorkWakeups++;
+
+    if (doWorkWindowStartMs == 0) {
+        doWorkWindowStartMs = now;
+    } else if (now - doWorkWindowStartMs >= 60000) {
+        doWorkWakeupsPerMinute = (uint32_t)((int64_t)doWorkWakeups * 60000 / (now - doWorkWindowStartMs));
+        doWorkWakeups = 0;
+        doWorkWindowStartMs = now;
+    }
+}
+
+/// <summary>
+///     The first handoffs messages handed to the IoT Hub client went out on the DoWork that just ran
+/// </summary>
+static void RecordPublishToWire(size_t handoffs)
+{
+    int64_t now = dx_getNowMilliseconds();
+
+    for (size_t i = 0; i < handoffs; i++) {
+        dx_latencyHistogramRecord(&publishToWireHistogram, (uint32_t)(now - pendingHandoffMs[i]));
+    }
+
+    // Keep anything handed over from a callback during DoWork for the next pass
+    memmove(pendingHandoffMs, pendingHandoffMs + handoffs, (pendingHandoffCount - handoffs) * sizeof(pendingHandoffMs[0]));
+    pendingHandoffCount -= handoffs;
+}
+
+/// <summary>
+///     Poll at the floor while messages await confirmation or the hub was active, otherwise double the period up to the ceiling
+/// </summary>
+static struct timespec NextDoWorkPeriod(void)
+{
+    if (doWorkRequested) {
+        return (struct timespec){0, 1};
+    }
+
+    if (hubActivity || outstandingMessageCount > 0 || !dx_telemetryQueueIsEmpty()) {
+        doWorkPollMs = DOWORK_POLL_FLOOR_MS;
+    } else if (doWorkPollMs < doWorkPollCeilingMs) {
+        doWorkPollMs = doWorkPollMs == 0 ? 1 : doWorkPollMs * 2;
+        if (doWorkPollMs > doWorkPollCeilingMs) {
+            doWorkPollMs = doWorkPollCeilingMs;
+        }
+    }
+
+    return (struct timespec){doWorkPollMs / 1000, (doWorkPollMs % 1000) * 1000000};
+}
+
+void dx_azureRequestDoWork(void)
+{
+    doWorkPollMs = DOWORK_POLL_FLOOR_MS;
+
+    if (!doWorkRequested && iotHubClientAuthenticationState == IoTHubClientAuthenticationState_Authenticated) {
+        doWorkRequested = true;
+        dx_timerOneShotSet(&azureConnectionTimer, &(struct timespec){0, 1});
+    }
+}
+
+void dx_azureSetDoWorkPollCeiling(uint32_t maxPollMs)
+{
+    doWorkPollCeilingMs = maxPollMs < DOWORK_POLL_FLOOR_MS ? DOWORK_POLL_FLOOR_MS : maxPollMs;
+}
+
+void dx_azureGetDoWorkStats(DX_DOWORK_STATS *stats)
+{
+    if (stats != NULL) {
+        stats->wakeupsPerMinute = doWorkWakeupsPerMinute;
+        stats->pollMs = doWorkPollMs;
+        dx_latencyHistogramGetStats(&publishToWireHistogram, &stats->publishToWire);
+    }
+}
+
+/// <summary>
+///     Trace when the network and the DAA certificate become ready, or stop being ready, while connecting
+/// </summary>
+static void TraceDeviceReadiness(void)
+{
+    static bool networkReady = false;
+    static bool daaReady = false;
+
+    if (isNetworkReady(_networkInterface) != networkReady) {
+        networkReady = !networkReady;
+        TraceConnectionEvent(networkReady ? "NetworkReady" : "NetworkNotReady");
+    }
+
+    if (dx_isDeviceAuthReady() != daaReady) {
+        daaReady = !daaReady;
+        TraceConnectionEvent(daaReady ? "DaaReady" : "DaaNotReady");
+    }
+}
+
+/// <summary>
+///     Next hub connect or DPS retry from the retry policy
+/// </summary>
+static struct timespec RetryDelayPeriod(void)
+{
+    uint32_t delayMs = dx_retryPolicyNextDelay(&connectRetryPolicy);
+
+    Log_Debug("INFO: Azure connection retry %u in %u ms\n", connectRetryPolicy.attempt, delayMs);
+
+    return (struct timespec){delayMs / 1000, (delayMs % 1000) * 1000000};
+}
+
+void dx_azureSetConnectRetryPolicy(uint32_t baseDelayMs, uint32_t maxDelayMs, DX_RETRY_DELAY_FUNCTION delayFunction)
+{
+    connectRetryPolicy.baseDelayMs = baseDelayMs;
+    connectRetryPolicy.maxDelayMs = maxDelayMs;
+    connectRetryPolicy.delayFunction = delayFunction;
+}
+
+void dx_azureGetConnectRetryState(DX_RETRY_POLICY *policy)
+{
+    if (policy != NULL) {
+        *policy = connectRetryPolicy;
+    }
+}
+
+void dx_azureSetProvisioningTimeout(uint32_t timeoutSeconds)
+{
+    provisioningTimeoutMs = timeoutSeconds * 1000;
 }
 
 /// <summary>
@@ -281,30 +723,69 @@ static void AzureConnectionHandler(EventLoopTimer *eventLoopTimer)
         return;
     }
 
+    RecordDoWorkWakeup();
+
     // network disconnected but was previously authenticated
     if (!isNetworkReady(_networkInterface) && iotHubClientAuthenticationState == IoTHubClientAuthenticationState_Authenticated) {
-        iotHubClientAuthenticationState = IoTHubClientAuthenticationState_NotAuthenticated;
-        deviceConnectionState = DEVICE_NOT_CONNECTED;
+        RecordDisconnect(IOTHUB_CLIENT_CONNECTION_NO_NETWORK);
+        SetAuthenticationState(IoTHubClientAuthenticationState_NotAuthenticated);
+        SetDeviceConnectionState(DEVICE_NOT_CONNECTED);
+        reconnectPending = true;
     }
 
     // Use the current connection state to determine what to do next
     switch (iotHubClientAuthenticationState) {
         // This is the start state when we first run
     case IoTHubClientAuthenticationState_NotAuthenticated:
-        SetupAzureClient();
-        nextEventPeriod = (struct timespec){1, 0};
+        TraceDeviceReadiness();
+
+        if (!dx_isDeviceAuthReady() || !isNetworkReady(_networkInterface)) {
+            // Nothing goes to the cloud until the device is ready, so there is nothing to back off from
+            nextEventPeriod = (struct timespec){1, 0};
+        } else if (reconnectPending) {
+            // Spread reconnects after a drop before the first attempt
+            reconnectPending = false;
+            nextEventPeriod = RetryDelayPeriod();
+        } else {
+            // Time to connect runs from the first attempt, retries included, to IoT Hub authenticating
+            if (connectStartMs == 0) {
+                connectStartMs = dx_getNowMilliseconds();
+            }
+
+            if (SetupAzureClient() || deviceConnectionState == DEVICE_PROVISIONING ||
+                deviceConnectionState == DEVICE_PROVISION_IOT_CLIENT) {
+                // Connecting or DPS registration in progress, check back in a second
+                nextEventPeriod = (struct timespec){1, 0};
+            } else {
+                nextEventPeriod = RetryDelayPeriod();
+            }
+        }
         break;
     case IoTHubClientAuthenticationState_AuthenticationInitiated:
         IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
         nextEventPeriod = (struct timespec){1, 0};
         break;
     case IoTHubClientAuthenticationState_Authenticated:
+        doWorkRequested = false;
+        hubActivity = false;
+
+        // Forward telemetry stored while offline, a few messages per tick so the drain does not swamp the link.
+        // The DoWork below sends what was handed over, the next batch waits for the floor period rather than
+        // the immediate DoWork each handover requests.
+        if (!dx_telemetryQueueIsEmpty()) {
+            dx_telemetryQueueDrain(0, DrainQueuedMessage);
+            doWorkRequested = false;
+        }
+
+        size_t handoffs = pendingHandoffCount;
         IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
-        nextEventPeriod = (struct timespec){IOT_HUB_POLL_TIME_SECONDS, IOT_HUB_POLL_TIME_NANOSECONDS};
+        RecordPublishToWire(handoffs);
+
+        nextEventPeriod = NextDoWorkPeriod();
         break;
     case IoTHubClientAuthenticationState_Device_Disbled:
-        iotHubClientAuthenticationState = IoTHubClientAuthenticationState_NotAuthenticated;
-        deviceConnectionState = DEVICE_NOT_CONNECTED;
+        SetAuthenticationState(IoTHubClientAuthenticationState_NotAuthenticated);
+        SetDeviceConnectionState(DEVICE_NOT_CONNECTED);
         nextEventPeriod = (struct timespec){1, 0};
         break;
     }
@@ -315,24 +796,150 @@ static void AzureConnectionHandler(EventLoopTimer *eventLoopTimer)
 bool dx_azurePublish(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties, size_t messagePropertyCount,
                      DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties)
 {
-    IOTHUB_CLIENT_RESULT result;
-    IOTHUB_MESSAGE_RESULT messageResult;
-    IOTHUB_MESSAGE_HANDLE messageHandle;
+    DX_PUBLISH_RESULT result =
+        PublishMessage(message, messageLength, messageProperties, messagePropertyCount, messageContentProperties, NULL, NULL);
+
+    return result == DX_PUBLISH_OK || result == DX_PUBLISH_QUEUED;
+}
 
+bool dx_azurePublishWithCallback(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                 size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                 DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context)
+{
+    DX_PUBLISH_RESULT result = PublishMessage(message, messageLength, messageProperties, messagePropertyCount, messageContentProperties,
+                                              completionCallback, context);
+
+    return result == DX_PUBLISH_OK || result == DX_PUBLISH_QUEUED;
+}
+
+DX_PUBLISH_RESULT dx_azurePublishNonBlocking(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                             size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                             DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context)
+{
+    return PublishMessage(message, messageLength, messageProperties, messagePropertyCount, messageContentProperties, completionCallback,
+                          context);
+}
+
+DX_PUBLISH_RESULT dx_azurePublishFlush(void)
+{
+    return dx_telemetryBatchFlush(PublishBatch);
+}
+
+void dx_azureSetPublishLimits(size_t maxInFlight, size_t maxBytesInFlight)
+{
+    maxInFlightMessages = maxInFlight;
+    maxInFlightBytes = maxBytesInFlight;
+}
+
+void dx_azureRegisterPublishCapacityNotification(void (*publishCapacityCallback)(void *context), void *context)
+{
+    _publishCapacityCallback = publishCapacityCallback;
+    _publishCapacityContext = context;
+}
+
+static DX_PUBLISH_RESULT PublishMessage(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                        size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                        DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context)
+{
     if (messageLength == 0) {
-        return true;
+        return DX_PUBLISH_OK;
+    }
+
+    // Only what is already outstanding is flushed once the application is shutting down
+    if (dx_isTerminationRequired()) {
+        return DX_PUBLISH_TERMINATING;
     }
 
+    if (dx_telemetryBatchIsEnabled()) {
+        // A batch has no per message confirmation so messages with a completion callback are sent on their own
+        if (completionCallback == NULL) {
+            return dx_telemetryBatchAppend(message, messageLength, messageProperties, messagePropertyCount, messageContentProperties,
+                                           PublishBatch);
+        }
+
+        if (dx_telemetryBatchFlush(PublishBatch) == DX_PUBLISH_WOULD_BLOCK) {
+            return DX_PUBLISH_WOULD_BLOCK;
+        }
+    }
+
+    return RouteMessage(message, messageLength, messageProperties, messagePropertyCount, messageContentProperties, completionCallback,
+                        context);
+}
+
+/// <summary>
+///     Batch flush wrapper, a batch goes through the same offline queue and admission control as a single message
+/// </summary>
+static DX_PUBLISH_RESULT PublishBatch(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                      size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties)
+{
+    return RouteMessage(message, messageLength, messageProperties, messagePropertyCount, messageContentProperties, NULL, NULL);
+}
+
+/// <summary>
+///     Send now if connected, otherwise hold the message in the offline telemetry queue when enabled
+/// </summary>
+static DX_PUBLISH_RESULT RouteMessage(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                      size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                      DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context)
+{
     if (!dx_isAzureConnected()) {
-        // Log_Debug("FAILED: Not connected to Azure IoT\n");
-        return false;
+        // Store and forward when the offline telemetry queue is enabled
+        if (!dx_telemetryQueueIsEnabled()) {
+            return DX_PUBLISH_NOT_CONNECTED;
+        }
+        return dx_telemetryQueueEnqueue(message, messageLength, messageProperties, messagePropertyCount, messageContentProperties,
+                                        completionCallback, context)
+                   ? DX_PUBLISH_QUEUED
+                   : DX_PUBLISH_FAILED;
+    }
+
+    // Keep message order, anything published while the queue is still draining goes to the back of the queue.
+    // A message the queue turns away is failed rather than sent ahead of the messages still queued.
+    if (!dx_telemetryQueueIsEmpty()) {
+        return dx_telemetryQueueEnqueue(message, messageLength, messageProperties, messagePropertyCount, messageContentProperties,
+                                        completionCallback, context)
+                   ? DX_PUBLISH_QUEUED
+                   : DX_PUBLISH_FAILED;
+    }
+
+    return SendMessageToHub(message, messageLength, messageProperties, messagePropertyCount, messageContentProperties, completionCallback,
+                            context, dx_getNowMilliseconds());
+}
+
+/// <summary>
+///     Queue drain wrapper, a queued message stays queued while the IoT Hub client is out of capacity
+/// </summary>
+static DX_PUBLISH_RESULT DrainQueuedMessage(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                            size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                            DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context, int64_t publishTimeMs)
+{
+    return SendMessageToHub(message, messageLength, messageProperties, messagePropertyCount, messageContentProperties, completionCallback,
+                            context, publishTimeMs);
+}
+
+/// <summary>
+///     Hand a message over to the IoT Hub client. Caller has checked the connection.
+/// </summary>
+static DX_PUBLISH_RESULT SendMessageToHub(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                          size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                          DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context, int64_t publishTimeMs)
+{
+    IOTHUB_CLIENT_RESULT result;
+    IOTHUB_MESSAGE_RESULT messageResult;
+    IOTHUB_MESSAGE_HANDLE messageHandle;
+    PUBLISH_TRACKER *tracker = NULL;
+
+    if (!HasPublishCapacity(messageLength)) {
+        publishBlocked = true;
+        publishStats.wouldBlock++;
+        return DX_PUBLISH_WOULD_BLOCK;
     }
 
     messageHandle = IoTHubMessage_CreateFromByteArray(message, messageLength);
 
     if (messageHandle == NULL) {
         Log_Debug("ERROR: unable to create a new IoTHubMessage\n");
-        return false;
+        return DX_PUBLISH_FAILED;
     }
 
     // add system content properties
@@ -341,7 +948,8 @@ bool dx_azurePublish(const void *message, size_t messageLength, DX_MESSAGE_PROPE
             if ((messageResult = IoTHubMessage_SetContentEncodingSystemProperty(
                      messageHandle, messageContentProperties->contentEncoding)) != IOTHUB_MESSAGE_OK) {
                 Log_Debug("ERROR: ContentEncodingSystemProperty: %s\n", GetMessageResultReasonString(messageResult));
-                return false;
+                IoTHubMessage_Destroy(messageHandle);
+                return DX_PUBLISH_FAILED;
             }
         }
 
@@ -349,7 +957,8 @@ bool dx_azurePublish(const void *message, size_t messageLength, DX_MESSAGE_PROPE
             if ((messageResult = IoTHubMessage_SetContentTypeSystemProperty(messageHandle, messageContentProperties->contentType)) !=
                 IOTHUB_MESSAGE_OK) {
                 Log_Debug("ERROR: ContentTypeSystemProperty: %s\n", GetMessageResultReasonString(messageResult));
-                return false;
+                IoTHubMessage_Destroy(messageHandle);
+                return DX_PUBLISH_FAILED;
             }
         }
     }
@@ -362,24 +971,86 @@ bool dx_azurePublish(const void *message, size_t messageLength, DX_MESSAGE_PROPE
                     IOTHUB_MESSAGE_OK) {
                     Log_Debug("ERROR: Setting key/value properties: %s, %s, %s\n", messageProperties[i]->key, messageProperties[i]->value,
                               GetMessageResultReasonString(messageResult));
-                    return false;
+                    IoTHubMessage_Destroy(messageHandle);
+                    return DX_PUBLISH_FAILED;
                 }
             }
         }
     }
 
-    if ((result = IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendMessageCallback,
-                                                       /*&callback_param*/ 0)) != IOTHUB_CLIENT_OK) {
+    // Every message is tracked for latency and in-flight bytes
+    if ((tracker = (PUBLISH_TRACKER *)malloc(sizeof(PUBLISH_TRACKER))) == NULL) {
+        Log_Debug("ERROR: Publish tracker malloc failed.\n");
+        IoTHubMessage_Destroy(messageHandle);
+        return DX_PUBLISH_FAILED;
+    }
+
+    tracker->completionCallback = completionCallback;
+    tracker->context = context;
+    tracker->publishTimeMs = publishTimeMs;
+    tracker->messageLength = messageLength;
+
+    if ((result = IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendMessageCallback, tracker)) !=
+        IOTHUB_CLIENT_OK) {
         Log_Debug("ERROR: failed to hand over the message to IoTHubClient\n");
+        free(tracker);
     } else {
         outstandingMessageCount++;
+        inFlightBytes += messageLength;
+
+        if (pendingHandoffCount < IOT_HUB_DOWORK_LATENCY_SAMPLES) {
+            pendingHandoffMs[pendingHandoffCount++] = dx_getNowMilliseconds();
+        }
     }
 
     IoTHubMessage_Destroy(messageHandle);
 
-    // IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+    if (result == IOTHUB_CLIENT_OK) {
+        dx_azureRequestDoWork();
+    }
 
-    return result == IOTHUB_CLIENT_OK;
+    return result == IOTHUB_CLIENT_OK ? DX_PUBLISH_OK : DX_PUBLISH_FAILED;
+}
+
+/// <summary>
+///     Flush the current batch then keep DoWork running until every message handed to the IoT Hub client is confirmed.
+///     Nothing can be flushed without a connection so the drain ends straight away when disconnected.
+/// </summary>
+static bool TerminationDrainHandler(void *context)
+{
+    if (!drainStarted) {
+        drainStarted = true;
+        drainConfirmedAtStart = publishStats.confirmed;
+
+        if (dx_isAzureConnected()) {
+            dx_azurePublishFlush();
+        }
+    }
+
+    if (!dx_isAzureConnected()) {
+        return true;
+    }
+
+    if (outstandingMessageCount > 0 || !dx_telemetryQueueIsEmpty()) {
+        dx_azureRequestDoWork();
+        return false;
+    }
+
+    return true;
+}
+
+void dx_azureGetDrainStats(DX_DRAIN_STATS *stats)
+{
+    DX_TELEMETRY_QUEUE_STATS queueStats;
+
+    if (stats == NULL) {
+        return;
+    }
+
+    dx_telemetryQueueGetStats(&queueStats);
+
+    stats->flushed = drainStarted ? publishStats.confirmed - drainConfirmedAtStart : 0;
+    stats->abandoned = (uint32_t)outstandingMessageCount + queueStats.count + dx_telemetryBatchPendingCount();
 }
 
 IOTHUB_DEVICE_CLIENT_LL_HANDLE dx_azureClientHandleGet(void)
@@ -397,8 +1068,26 @@ int dx_azureGetOutstandingMessageCount(void)
     return outstandingMessageCount;
 }
 
+void dx_azureGetPublishStats(DX_PUBLISH_STATS *stats)
+{
+    if (stats != NULL) {
+        *stats = publishStats;
+        stats->inFlight = (uint32_t)outstandingMessageCount;
+        stats->inFlightBytes = (uint32_t)inFlightBytes;
+        dx_latencyHistogramGetStats(&publishLatencyHistogram, &stats->latency);
+    }
+}
+
+void dx_azureResetPublishStats(void)
+{
+    memset(&publishStats, 0x00, sizeof(publishStats));
+    dx_latencyHistogramReset(&publishLatencyHistogram);
+}
+
 static IOTHUBMESSAGE_DISPOSITION_RESULT HubMessageReceivedCallback(IOTHUB_MESSAGE_HANDLE message, void *context)
 {
+    hubActivity = true;
+
     if (_messageReceivedCallback != NULL) {
         return _messageReceivedCallback(message, context);
     }
@@ -410,6 +1099,8 @@ static IOTHUBMESSAGE_DISPOSITION_RESULT HubMessageReceivedCallback(IOTHUB_MESSAG
 static void HubDeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload, size_t payloadSize,
                                   void *userContextCallback)
 {
+    hubActivity = true;
+
     if (_deviceTwinCallbackHandler != NULL) {
         _deviceTwinCallbackHandler(updateState, payload, payloadSize, userContextCallback);
     }
@@ -418,6 +1109,8 @@ static void HubDeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const un
 static int HubDirectMethodCallback(const char *method_name, const unsigned char *payload, size_t payloadSize,
                                    unsigned char **responsePayload, size_t *responsePayloadSize, void *userContextCallback)
 {
+    hubActivity = true;
+
     if (_directMethodCallbackHandler != NULL) {
         return _directMethodCallbackHandler(method_name, payload, payloadSize, responsePayload, responsePayloadSize, userContextCallback);
     } else {
@@ -425,6 +1118,34 @@ static int HubDirectMethodCallback(const char *method_name, const unsigned char
     }
 }
 
+static int HubDirectMethodInboundCallback(const char *method_name, const unsigned char *payload, size_t payloadSize, METHOD_HANDLE methodId,
+                                          void *userContextCallback)
+{
+    hubActivity = true;
+
+    if (_directMethodInboundHandler != NULL) {
+        return _directMethodInboundHandler(method_name, payload, payloadSize, methodId, userContextCallback);
+    } else {
+        return -1;
+    }
+}
+
+/// <summary>
+///     Subscribe to direct methods with the inbound callback when one is registered, the response is then sent
+///     later with IoTHubDeviceClient_LL_DeviceMethodResponse. The SDK does not allow both kinds of method
+///     callback so the other one is removed first.
+/// </summary>
+static void SetDirectMethodCallback(void)
+{
+    if (_directMethodInboundHandler != NULL) {
+        IoTHubDeviceClient_LL_SetDeviceMethodCallback(iothubClientHandle, NULL, NULL);
+        IoTHubClientCore_LL_SetDeviceMethodCallback_Ex(iothubClientHandle, HubDirectMethodInboundCallback, NULL);
+    } else {
+        IoTHubClientCore_LL_SetDeviceMethodCallback_Ex(iothubClientHandle, NULL, NULL);
+        IoTHubDeviceClient_LL_SetDeviceMethodCallback(iothubClientHandle, HubDirectMethodCallback, NULL);
+    }
+}
+
 /// <summary>
 ///     Sets up the Azure IoT Hub connection (creates the iothubClientHandle)
 ///     When the SAS Token for a device expires the connection needs to be recreated
@@ -457,10 +1178,10 @@ static bool SetupAzureClient()
         return false;
     }
 
-    iotHubClientAuthenticationState = IoTHubClientAuthenticationState_AuthenticationInitiated;
+    SetAuthenticationState(IoTHubClientAuthenticationState_AuthenticationInitiated);
 
     IoTHubDeviceClient_LL_SetDeviceTwinCallback(iothubClientHandle, HubDeviceTwinCallback, NULL);
-    IoTHubDeviceClient_LL_SetDeviceMethodCallback(iothubClientHandle, HubDirectMethodCallback, NULL);
+    SetDirectMethodCallback();
     IoTHubDeviceClient_LL_SetConnectionStatusCallback(iothubClientHandle, HubConnectionStatusCallback, NULL);
     IoTHubDeviceClient_LL_SetMessageCallback(iothubClientHandle, HubMessageReceivedCallback, NULL);
 
@@ -528,7 +1249,7 @@ static bool SetUpAzureIoTHubClientWithDaa(void)
 {
     int retError = 0;
 
-    deviceConnectionState = DEVICE_NOT_CONNECTED;
+    SetDeviceConnectionState(DEVICE_NOT_CONNECTED);
 
     // If network/DAA are not ready, fail out (which will trigger a retry)
     if (!dx_isDeviceAuthReady() || !isNetworkReady(_networkInterface)) {
@@ -551,7 +1272,7 @@ static bool SetUpAzureIoTHubClientWithDaa(void)
         goto cleanup;
     }
 
-    deviceConnectionState = DEVICE_CONNECTED;
+    SetDeviceConnectionState(DEVICE_CONNECTED);
 
 cleanup:
     iothub_security_deinit();
@@ -582,7 +1303,170 @@ static void RegisterProvisioningDeviceCallback(PROV_DEVICE_RESULT registerResult
         } else {
             memset(iotHubUri, 0, uriSize);
             strncpy(iotHubUri, callbackHubUri, uriSize);
+            StoreCachedHubUri();
+        }
+    }
+}
+
+void dx_azureEnableDpsCache(uint32_t ttlSeconds, bool persist)
+{
+    dpsCacheEnabled = true;
+    dpsCacheTtlSeconds = ttlSeconds;
+    dpsCachePersist = persist;
+}
+
+void dx_azureGetConnectionStats(DX_CONNECTION_STATS *stats)
+{
+    if (stats != NULL) {
+        *stats = connectionStats;
+        stats->meanTimeToConnectMs = connectionStats.connects > 0 ? (uint32_t)(totalTimeToConnectMs / connectionStats.connects) : 0;
+    }
+}
+
+static void TraceConnectionEvent(const char *state)
+{
+    connectionTrace[connectionTraceNext] = (DX_CONNECTION_TRACE_ENTRY){.timestampMs = dx_getNowMilliseconds(), .state = state};
+    connectionTraceNext = (connectionTraceNext + 1) % DX_CONNECTION_TRACE_SIZE;
+
+    if (connectionTraceCount < DX_CONNECTION_TRACE_SIZE) {
+        connectionTraceCount++;
+    }
+}
+
+size_t dx_azureGetConnectionTrace(DX_CONNECTION_TRACE_ENTRY *entries, size_t maxEntries)
+{
+    size_t count = connectionTraceCount < maxEntries ? connectionTraceCount : maxEntries;
+    size_t oldest = (connectionTraceNext + DX_CONNECTION_TRACE_SIZE - count) % DX_CONNECTION_TRACE_SIZE;
+
+    if (entries == NULL) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        entries[i] = connectionTrace[(oldest + i) % DX_CONNECTION_TRACE_SIZE];
+    }
+
+    return count;
+}
+
+/// <summary>
+///     Count the loss of an authenticated connection
+/// </summary>
+static void RecordDisconnect(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason)
+{
+    connectionStats.disconnects++;
+    connectionStats.disconnectsByReason[(size_t)reason < DX_DISCONNECT_REASON_OTHER ? (size_t)reason : DX_DISCONNECT_REASON_OTHER]++;
+}
+
+bool dx_azureReportConnectionMetrics(struct _deviceTwinBinding *deviceTwinBinding)
+{
+    DX_CONNECTION_STATS stats;
+    char json[512];
+    int len;
+
+    if (deviceTwinBinding == NULL || deviceTwinBinding->twinType != DX_DEVICE_TWIN_JSON_OBJECT) {
+        return false;
+    }
+
+    dx_azureGetConnectionStats(&stats);
+
+    len = snprintf(json, sizeof(json),
+                   "{\"connects\":%u,\"meanTimeToConnectMs\":%u,\"maxTimeToConnectMs\":%u,\"lastTimeToConnectMs\":%u,"
+                   "\"dpsCacheHits\":%u,\"dpsCacheMisses\":%u,\"disconnects\":%u,\"disconnectsByReason\":{",
+                   stats.connects, stats.meanTimeToConnectMs, stats.maxTimeToConnectMs, stats.lastTimeToConnectMs, stats.dpsCacheHits,
+                   stats.dpsCacheMisses, stats.disconnects);
+
+    for (size_t i = 0; i < DX_DISCONNECT_REASON_COUNT && len > 0 && len < sizeof(json); i++) {
+        len += snprintf(json + len, sizeof(json) - (size_t)len, "%s\"%s\":%u", i == 0 ? "" : ",",
+                        i == DX_DISCONNECT_REASON_OTHER ? "OTHER" : GetReasonString((IOTHUB_CLIENT_CONNECTION_STATUS_REASON)i),
+                        stats.disconnectsByReason[i]);
+    }
+
+    if (len < 0 || len + 3 > sizeof(json)) {
+        Log_Debug("ERROR: Connection metrics too large to report.\n");
+        return false;
+    }
+
+    memcpy(json + len, "}}", 3);
+
+    return dx_deviceTwinReportValue(deviceTwinBinding, json);
+}
+
+/// <summary>
+///     Use the hub from the last DPS assignment, loading it from mutable storage after a reboot
+/// </summary>
+static bool LoadCachedHubUri(void)
+{
+    DPS_CACHE_RECORD record;
+    size_t length = 0;
+    int64_t now = (int64_t)time(NULL);
+
+    if (!dpsCacheEnabled) {
+        return false;
+    }
+
+    if (iotHubUri == NULL && dpsCachePersist && dx_storageRead(DX_STORAGE_ID_DPS_CACHE, &record, sizeof(record), &length) &&
+        length > offsetof(DPS_CACHE_RECORD, hubUri) && memchr(record.hubUri, 0, length - offsetof(DPS_CACHE_RECORD, hubUri)) != NULL) {
+        if ((iotHubUri = strdup(record.hubUri)) == NULL) {
+            Log_Debug("ERROR: IoT Hub URI malloc failed.\n");
         }
+        hubUriCachedAt = record.cachedAt;
+    }
+
+    if (iotHubUri == NULL ||
+        (dpsCacheTtlSeconds > 0 && (now < hubUriCachedAt || now - hubUriCachedAt > (int64_t)dpsCacheTtlSeconds))) {
+        connectionStats.dpsCacheMisses++;
+        connectedFromCache = false;
+        return false;
+    }
+
+    connectionStats.dpsCacheHits++;
+    connectedFromCache = true;
+
+    return true;
+}
+
+static void StoreCachedHubUri(void)
+{
+    DPS_CACHE_RECORD record;
+
+    if (!dpsCacheEnabled || iotHubUri == NULL) {
+        return;
+    }
+
+    hubUriCachedAt = (int64_t)time(NULL);
+    cachedHubFailedConnects = 0;
+
+    if (dpsCachePersist) {
+        size_t uriSize = strlen(iotHubUri) + 1;
+
+        if (uriSize > sizeof(record.hubUri)) {
+            Log_Debug("ERROR: IoT Hub URI too long to cache, increase DX_DPS_CACHE_URI_MAX_LENGTH.\n");
+            return;
+        }
+
+        record.cachedAt = hubUriCachedAt;
+        memcpy(record.hubUri, iotHubUri, uriSize);
+        dx_storageWrite(DX_STORAGE_ID_DPS_CACHE, &record, offsetof(DPS_CACHE_RECORD, hubUri) + uriSize);
+    }
+}
+
+/// <summary>
+///     The cached hub rejected the device or kept failing, the next connect goes back to DPS
+/// </summary>
+static void InvalidateCachedHubUri(void)
+{
+    if (iotHubUri != NULL) {
+        free(iotHubUri);
+        iotHubUri = NULL;
+    }
+
+    connectedFromCache = false;
+    cachedHubFailedConnects = 0;
+    connectionStats.dpsCacheInvalidations++;
+
+    if (dpsCachePersist) {
+        dx_storageDelete(DX_STORAGE_ID_DPS_CACHE);
     }
 }
 
@@ -595,23 +1479,29 @@ static bool SetUpAzureIoTHubClientWithDaaDpsPnP(void)
                                            // provisioning client.
     PROV_DEVICE_RESULT prov_result;
     static bool security_init_called = false;
-    static int provisionCompletedMaxRetry = 0;
+    static int64_t provisioningStartMs = 0;
 
     if (!dx_isDeviceAuthReady() || !isNetworkReady(_networkInterface)) {
         return false;
     }
 
+    // Reconnect straight to the hub DPS assigned last time, after a failure DPS runs again
+    if (deviceConnectionState == DEVICE_NOT_CONNECTED && LoadCachedHubUri()) {
+        SetDeviceConnectionState(DEVICE_PROVISION_IOT_CLIENT);
+    }
+
     switch (deviceConnectionState) {
     case DEVICE_NOT_CONNECTED:
     case DEVICE_PROVISIONING_ERROR:
 
+        connectedFromCache = false;
         dpsRegisterStatus = PROV_DEVICE_RESULT_INVALID_STATE;
-        provisionCompletedMaxRetry = 0;
+        provisioningStartMs = dx_getNowMilliseconds();
 
         // Initiate security with X509 Certificate
         if (prov_dev_security_init(SECURE_DEVICE_TYPE_X509) != 0) {
             Log_Debug("ERROR: Failed to initiate X509 Certificate security\n");
-            deviceConnectionState = DEVICE_PROVISIONING_ERROR;
+            SetDeviceConnectionState(DEVICE_PROVISIONING_ERROR);
             goto cleanup;
         }
 
@@ -630,14 +1520,14 @@ static bool SetUpAzureIoTHubClientWithDaaDpsPnP(void)
             // Create Provisioning Client for communication with DPS using MQTT protocol
             if ((prov_handle = Prov_Device_LL_Create(dpsUrl, _userConfig->idScope, Prov_Device_MQTT_Protocol)) == NULL) {
                 Log_Debug("ERROR: Failed to create Provisioning Client\n");
-                deviceConnectionState = DEVICE_PROVISIONING_ERROR;
+                SetDeviceConnectionState(DEVICE_PROVISIONING_ERROR);
                 goto cleanup;
             }
         }
         // Sets Device ID on Provisioning Client
         if ((prov_result = Prov_Device_LL_SetOption(prov_handle, "SetDeviceId", &deviceIdForDaaCertUsage)) != PROV_DEVICE_RESULT_OK) {
             Log_Debug("ERROR: Failed to set Device ID in Provisioning Client, error=%d\n", prov_result);
-            deviceConnectionState = DEVICE_PROVISIONING_ERROR;
+            SetDeviceConnectionState(DEVICE_PROVISIONING_ERROR);
             goto cleanup;
         }
 
@@ -645,7 +1535,7 @@ static bool SetUpAzureIoTHubClientWithDaaDpsPnP(void)
         if (_pnpModelIdJson != NULL) {
             if ((prov_result = Prov_Device_LL_Set_Provisioning_Payload(prov_handle, _pnpModelIdJson)) != PROV_DEVICE_RESULT_OK) {
                 Log_Debug("Error: Failed to set Model ID in Provisioning Client, error=%d\n", prov_result);
-                deviceConnectionState = DEVICE_PROVISIONING_ERROR;
+                SetDeviceConnectionState(DEVICE_PROVISIONING_ERROR);
                 goto cleanup;
             }
         }
@@ -654,11 +1544,11 @@ static bool SetUpAzureIoTHubClientWithDaaDpsPnP(void)
         if ((prov_result = Prov_Device_LL_Register_Device(prov_handle, RegisterProvisioningDeviceCallback, NULL, NULL, NULL)) !=
             PROV_DEVICE_RESULT_OK) {
             Log_Debug("ERROR: Failed to set callback function for device registration, error=%d\n", prov_result);
-            deviceConnectionState = DEVICE_PROVISIONING_ERROR;
+            SetDeviceConnectionState(DEVICE_PROVISIONING_ERROR);
             goto cleanup;
         }
 
-        deviceConnectionState = DEVICE_PROVISIONING;
+        SetDeviceConnectionState(DEVICE_PROVISIONING);
 
         break;
 
@@ -666,13 +1556,12 @@ static bool SetUpAzureIoTHubClientWithDaaDpsPnP(void)
 
         Prov_Device_LL_DoWork(prov_handle);
         if (dpsRegisterStatus == PROV_DEVICE_RESULT_OK) {
-            deviceConnectionState = DEVICE_PROVISION_IOT_CLIENT;
-        }
-
-        // Retry cadence is once a second, wait max 60 seconds for call to
-        // RegisterProvisioningDeviceCallback() to complete else restart provisioning process
-        if (provisionCompletedMaxRetry++ > 60) {
-            deviceConnectionState = DEVICE_PROVISIONING_ERROR;
+            SetDeviceConnectionState(DEVICE_PROVISION_IOT_CLIENT);
+        } else if (dpsRegisterStatus != PROV_DEVICE_RESULT_INVALID_STATE ||
+                   dx_getNowMilliseconds() - provisioningStartMs > provisioningTimeoutMs) {
+            // DPS rejected the registration or RegisterProvisioningDeviceCallback() was not called in time,
+            // restart the provisioning process after the retry policy delay
+            SetDeviceConnectionState(DEVICE_PROVISIONING_ERROR);
             Log_Debug("ERROR: Failed to register device with provisioning service: %s\n", PROV_DEVICE_RESULTStrings(dpsRegisterStatus));
         }
 
@@ -687,11 +1576,11 @@ static bool SetUpAzureIoTHubClientWithDaaDpsPnP(void)
                 iothubClientHandle = NULL;
             }
 
-            deviceConnectionState = DEVICE_PROVISIONING_ERROR;
+            SetDeviceConnectionState(DEVICE_PROVISIONING_ERROR);
             goto cleanup;
         }
 
-        deviceConnectionState = DEVICE_CONNECTED;
+        SetDeviceConnectionState(DEVICE_CONNECTED);
 
         break;
 
@@ -734,21 +1623,55 @@ static void HubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
 
     Log_Debug("IoT Hub Connection Status reason: %s\n", GetReasonString(reason));
 
+    // The cached network state may be stale, check now rather than at the next refresh
+    if (reason == IOTHUB_CLIENT_CONNECTION_NO_NETWORK || reason == IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR) {
+        dx_networkMonitorRefresh();
+    }
+
     if (result != IOTHUB_CLIENT_CONNECTION_AUTHENTICATED) {
+        if (iotHubClientAuthenticationState == IoTHubClientAuthenticationState_Authenticated) {
+            RecordDisconnect(reason);
+        }
+
+        // A hub from the DPS cache that refuses the device is no longer ours. Any other failure to authenticate may
+        // be the network, the cache is only dropped once it has happened DX_DPS_CACHE_MAX_FAILED_CONNECTS times in a row.
+        if (connectedFromCache) {
+            if (reason == IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL || reason == IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED) {
+                InvalidateCachedHubUri();
+            } else if (iotHubClientAuthenticationState == IoTHubClientAuthenticationState_AuthenticationInitiated &&
+                       ++cachedHubFailedConnects >= DX_DPS_CACHE_MAX_FAILED_CONNECTS) {
+                InvalidateCachedHubUri();
+            }
+        }
+
         if (reason == IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED || reason == IOTHUB_CLIENT_CONNECTION_NO_NETWORK) {
 
-            iotHubClientAuthenticationState = IoTHubClientAuthenticationState_Device_Disbled;
+            SetAuthenticationState(IoTHubClientAuthenticationState_Device_Disbled);
             Log_Debug("Hub status callback: IoTHubClientAuthenticationState_Device_Disbled\n");
 
         } else {
-            iotHubClientAuthenticationState = IoTHubClientAuthenticationState_NotAuthenticated;
+            SetAuthenticationState(IoTHubClientAuthenticationState_NotAuthenticated);
             Log_Debug("Hub status callback: IoTHubClientAuthenticationState_NotAuthenticated\n");
         }
 
-        deviceConnectionState = DEVICE_NOT_CONNECTED;
+        SetDeviceConnectionState(DEVICE_NOT_CONNECTED);
+        reconnectPending = true;
 
     } else {
-        iotHubClientAuthenticationState = IoTHubClientAuthenticationState_Authenticated;
+        SetAuthenticationState(IoTHubClientAuthenticationState_Authenticated);
+        dx_retryPolicyReset(&connectRetryPolicy);
+        cachedHubFailedConnects = 0;
+
+        if (connectStartMs != 0) {
+            connectionStats.lastTimeToConnectMs = (uint32_t)(dx_getNowMilliseconds() - connectStartMs);
+            connectStartMs = 0;
+
+            connectionStats.connects++;
+            totalTimeToConnectMs += connectionStats.lastTimeToConnectMs;
+            if (connectionStats.lastTimeToConnectMs > connectionStats.maxTimeToConnectMs) {
+                connectionStats.maxTimeToConnectMs = connectionStats.lastTimeToConnectMs;
+            }
+        }
     }
 
     dx_isAzureConnected();
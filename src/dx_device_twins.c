@@ -2,41 +2,235 @@
    Licensed under the MIT License. */
 
 #include "dx_device_twins.h"
+#include "dx_storage.h"
 
 static bool deviceTwinReportState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, void *state,
                                   bool deviceTwinPnPAcknowledgment,
                                   DX_DEVICE_TWIN_RESPONSE_CODE statusCode);
-static bool deviceTwinUpdateReportedState(char *reportedPropertiesString);
+static bool deviceTwinUpdateReportedState(const char *reportedPropertiesString, size_t propertyCount);
+static bool deviceTwinReportPatch(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, const char *reportedPropertiesString);
+static bool deviceTwinMergePatch(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, const char *reportedPropertiesString);
+static bool patchHasProperty(const char *propertyName);
+static bool reportSuppressed(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, void *state);
+static void recordReport(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, void *state);
+static void scheduleDeferredReports(int64_t notBeforeMs);
+static DX_DECLARE_TIMER_HANDLER(twin_report_batch_handler);
+static DX_DECLARE_TIMER_HANDLER(twin_report_deferred_handler);
 static void deviceTwinClose(DX_DEVICE_TWIN_BINDING *deviceTwinBinding);
 static void deviceTwinOpen(DX_DEVICE_TWIN_BINDING *deviceTwinBinding);
 static void deviceTwinsReportStatusCallback(int result, void *context);
-static void SetDesiredState(JSON_Object *desiredProperties,
-                            DX_DEVICE_TWIN_BINDING *deviceTwinBinding);
+static bool SetDesiredState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, JSON_Value *jsonValue, bool hasVersion, int version);
+static bool desiredValueHash(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, JSON_Value *jsonValue, uint64_t *hash);
+static uint64_t hashJsonValue(const JSON_Value *jsonValue);
 static void DeviceTwinCallbackHandler(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload, size_t payloadSize,
                                       void *userContextCallback);
+static void buildTwinIndex(void);
+static DX_DEVICE_TWIN_BINDING *nextTwinNamed(const char *propertyName, size_t *cursor, size_t *bindingIndex);
+static void dispatchDesiredProperty(const char *propertyName, JSON_Value *jsonValue, bool hasVersion, int version);
+static bool splitTwinPath(DX_DEVICE_TWIN_BINDING *deviceTwinBinding);
+static JSON_Value *resolveTwinPath(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, JSON_Value *jsonValue);
+static char *wrapTwinPath(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, const char *reportedPropertiesString);
+static size_t twinElementSize(DX_DEVICE_TWIN_TYPE twinType);
+static size_t twinValueSize(DX_DEVICE_TWIN_TYPE twinType);
+static void loadTwinCache(void);
+static void writeTwinCache(bool replace, bool hasVersion, int version);
+static void freeTwinCache(void);
 
 static DX_DEVICE_TWIN_BINDING **_deviceTwins = NULL;
 static size_t _deviceTwinCount = 0;
 
+// Desired $version of the last twin document applied, patches that are not newer are replays
+static bool _hasDesiredVersion = false;
+static int _desiredVersion = 0;
+
+// Binding names, so each desired property is matched to its bindings with one hash probe
+static DX_NAME_INDEX _twinIndex;
+
+static DX_TIMER_BINDING tmr_twin_report_batch = {.name = "tmr_twin_report_batch", .handler = twin_report_batch_handler};
+
+// Sends reports held back by minReportIntervalMs, retried this often while the report can not be sent
+#define DEFERRED_REPORT_RETRY_MS 1000
+static DX_TIMER_BINDING tmr_twin_report_deferred = {.name = "tmr_twin_report_deferred", .handler = twin_report_deferred_handler};
+
+// Reported properties waiting to be sent as one patch, the members of each {"name":value} report joined
+// with commas. NULL when batching is not enabled.
+static char *_patch = NULL;
+static size_t _patchLength = 0;
+static DX_DEVICE_TWIN_BINDING *_patchBindings[DX_DEVICE_TWIN_BATCH_MAX_PROPERTIES];
+static size_t _patchPropertyCount = 0;
+static DX_DEVICE_TWIN_BATCH_CONFIG _batchConfig;
+static DX_DEVICE_TWIN_STATS _stats;
+
+// Twin documents are parsed into _parseArena rather than as hundreds of small heap blocks
+static char _parseArenaBuffer[DX_DEVICE_TWIN_PARSE_ARENA_BYTES];
+static JSON_Arena _parseArena;
+
+// Desired property values kept in mutable storage, see dx_deviceTwinEnableCache. The record is an int32 $version,
+// a uint16 entry count, then for each property a uint8 type, uint8 name size, uint16 value size, the NULL terminated
+// name and the value. String and JSON object values are stored NULL terminated.
+#define TWIN_CACHE_HEADER_SIZE 6
+#define TWIN_CACHE_ENTRY_HEADER_SIZE 4
+
+static bool _cacheEnabled = false;
+static bool _cacheRestored = false;
+static uint8_t *_cache = NULL;
+static size_t _cacheLength = 0;
+static int32_t _cacheVersion = 0;
+static size_t *_cacheOffsets = NULL;      // Per binding, offset + 1 of its entry in _cache, 0 when not cached
+static JSON_Value **_desiredValues = NULL; // Per binding, the value applied from the twin document being processed
+
 void dx_deviceTwinSubscribe(DX_DEVICE_TWIN_BINDING *deviceTwins[], size_t deviceTwinCount)
 {
     dx_azureRegisterDeviceTwinCallback(DeviceTwinCallbackHandler);
 
+    json_arena_deinit(&_parseArena);
+    if (json_arena_init(&_parseArena, _parseArenaBuffer, sizeof(_parseArenaBuffer)) != JSONSuccess) {
+        Log_Debug("ERROR: Device twin parse arena not available, parsing on the heap.\n");
+    }
+
     _deviceTwins = deviceTwins;
     _deviceTwinCount = deviceTwinCount;
 
     for (int i = 0; i < _deviceTwinCount; i++) {
         deviceTwinOpen(_deviceTwins[i]);
     }
+
+    buildTwinIndex();
+    dx_timerStart(&tmr_twin_report_deferred);
+
+    if (_cacheEnabled) {
+        loadTwinCache();
+    }
 }
 
 void dx_deviceTwinUnsubscribe(void)
 {
     dx_azureRegisterDeviceTwinCallback(NULL);
 
+    dx_deviceTwinReportCommit();
+    dx_timerStop(&tmr_twin_report_deferred);
+
     for (int i = 0; i < _deviceTwinCount; i++) {
         deviceTwinClose(_deviceTwins[i]);
     }
+
+    dx_nameIndexFree(&_twinIndex);
+    freeTwinCache();
+    json_arena_deinit(&_parseArena);
+
+    _hasDesiredVersion = false;
+}
+
+/// <summary>
+/// Index the bindings on the first segment of their names
+/// </summary>
+static void buildTwinIndex(void)
+{
+    dx_nameIndexInit(&_twinIndex, _deviceTwinCount);
+
+    for (size_t i = 0; i < _deviceTwinCount; i++) {
+        dx_nameIndexInsert(&_twinIndex, dx_hashStringLength(_deviceTwins[i]->propertyName, _deviceTwins[i]->pathLengths[0]), i);
+    }
+}
+
+static bool firstSegmentEquals(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, const char *name, size_t length)
+{
+    return deviceTwinBinding->pathLengths[0] == length && strncmp(deviceTwinBinding->propertyName, name, length) == 0;
+}
+
+/// <summary>
+/// Find the next binding whose first path segment matches the first segment of propertyName, more than one
+/// binding can share a name. Start with cursor 0, returns NULL when there are no more.
+/// </summary>
+static DX_DEVICE_TWIN_BINDING *nextTwinNamed(const char *propertyName, size_t *cursor, size_t *bindingIndex)
+{
+    size_t length = strcspn(propertyName, ".");
+    uint32_t hash = dx_hashStringLength(propertyName, length);
+
+    while (dx_nameIndexNext(&_twinIndex, hash, cursor, bindingIndex)) {
+        if (firstSegmentEquals(_deviceTwins[*bindingIndex], propertyName, length)) {
+            return _deviceTwins[*bindingIndex];
+        }
+    }
+
+    return NULL;
+}
+
+/// <summary>
+/// Pass a desired property to every binding with that name, or to the member a dotted path binding selects
+/// </summary>
+static void dispatchDesiredProperty(const char *propertyName, JSON_Value *jsonValue, bool hasVersion, int version)
+{
+    DX_DEVICE_TWIN_BINDING *deviceTwinBinding;
+    JSON_Value *bindingValue;
+    size_t cursor = 0;
+    size_t bindingIndex;
+
+    while ((deviceTwinBinding = nextTwinNamed(propertyName, &cursor, &bindingIndex)) != NULL) {
+        // A patch only carries the members that changed, skip paths it does not reach
+        if ((bindingValue = resolveTwinPath(deviceTwinBinding, jsonValue)) == NULL) {
+            continue;
+        }
+
+        if (SetDesiredState(deviceTwinBinding, bindingValue, hasVersion, version) && _desiredValues != NULL) {
+            _desiredValues[bindingIndex] = bindingValue;
+        }
+    }
+}
+
+/// <summary>
+/// Split propertyName at each '.' once so desired properties are matched on the first segment and the rest
+/// are looked up without parsing the path again
+/// </summary>
+static bool splitTwinPath(DX_DEVICE_TWIN_BINDING *deviceTwinBinding)
+{
+    const char *propertyName = deviceTwinBinding->propertyName;
+    size_t offset = 0;
+    size_t length;
+
+    deviceTwinBinding->pathDepth = 0;
+
+    do {
+        length = strcspn(propertyName + offset, ".");
+
+        if (length == 0 || deviceTwinBinding->pathDepth == DX_DEVICE_TWIN_MAX_PATH_DEPTH || offset + length > UINT16_MAX) {
+            return false;
+        }
+
+        deviceTwinBinding->pathOffsets[deviceTwinBinding->pathDepth] = (uint16_t)offset;
+        deviceTwinBinding->pathLengths[deviceTwinBinding->pathDepth] = (uint16_t)length;
+        deviceTwinBinding->pathDepth++;
+
+        offset += length;
+    } while (propertyName[offset++] == '.');
+
+    return true;
+}
+
+/// <summary>
+/// Walk the rest of the binding path from the value of its first segment, NULL when a member is missing
+/// </summary>
+static JSON_Value *resolveTwinPath(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, JSON_Value *jsonValue)
+{
+    for (uint8_t i = 1; i < deviceTwinBinding->pathDepth && jsonValue != NULL; i++) {
+        jsonValue = json_object_getn_value(json_value_get_object(jsonValue),
+                                           deviceTwinBinding->propertyName + deviceTwinBinding->pathOffsets[i],
+                                           deviceTwinBinding->pathLengths[i]);
+    }
+
+    return jsonValue;
+}
+
+/// <summary>
+/// Name of the last path segment, the key reported values are written under
+/// </summary>
+static const char *twinLeafName(DX_DEVICE_TWIN_BINDING *deviceTwinBinding)
+{
+    if (deviceTwinBinding->pathDepth == 0) {
+        return deviceTwinBinding->propertyName;
+    }
+
+    return deviceTwinBinding->propertyName + deviceTwinBinding->pathOffsets[deviceTwinBinding->pathDepth - 1];
 }
 
 static void deviceTwinOpen(DX_DEVICE_TWIN_BINDING *deviceTwinBinding)
@@ -50,45 +244,74 @@ static void deviceTwinOpen(DX_DEVICE_TWIN_BINDING *deviceTwinBinding)
         dx_terminate(DX_ExitCode_OpenDeviceTwin);
     }
 
-    // types JSON and String allocated dynamically when called in azure_iot.c
+    if (!splitTwinPath(deviceTwinBinding)) {
+        Log_Debug("Device Twin '%s' is not a valid property path of at most %d segments.\n", deviceTwinBinding->propertyName,
+                  DX_DEVICE_TWIN_MAX_PATH_DEPTH);
+        dx_terminate(DX_ExitCode_OpenDeviceTwin);
+    }
+
+    if (twinElementSize(deviceTwinBinding->twinType) > 0 &&
+        (deviceTwinBinding->propertyValue == NULL || deviceTwinBinding->arrayCapacity == 0)) {
+        Log_Debug("Device Twin '%s' array types need a propertyValue buffer and arrayCapacity.\n", deviceTwinBinding->propertyName);
+        dx_terminate(DX_ExitCode_OpenDeviceTwin);
+    }
+
+    deviceTwinBinding->desiredValid = false;
+    deviceTwinBinding->desiredValue = NULL;
+    deviceTwinBinding->desiredSize = 0;
+    deviceTwinBinding->desiredAcked = false;
+    deviceTwinBinding->arrayLength = 0;
+
+    // Scalar values live in the binding and arrays in the application's buffer. String and JSON object values
+    // point into the twin document while the handler runs.
     switch (deviceTwinBinding->twinType) {
     case DX_DEVICE_TWIN_INT:
-        deviceTwinBinding->propertyValue = malloc(sizeof(int));
-        memset(deviceTwinBinding->propertyValue, 0x00, sizeof(int));
-        *(int *)deviceTwinBinding->propertyValue = 0;
+        deviceTwinBinding->storage.intValue = 0;
+        deviceTwinBinding->propertyValue = &deviceTwinBinding->storage.intValue;
         break;
     case DX_DEVICE_TWIN_FLOAT:
-        deviceTwinBinding->propertyValue = malloc(sizeof(float));
-        memset(deviceTwinBinding->propertyValue, 0x00, sizeof(float));
-        *(float *)deviceTwinBinding->propertyValue = 0.0f;
+        deviceTwinBinding->storage.floatValue = 0.0f;
+        deviceTwinBinding->propertyValue = &deviceTwinBinding->storage.floatValue;
         break;
     case DX_DEVICE_TWIN_DOUBLE:
-        deviceTwinBinding->propertyValue = malloc(sizeof(double));
-        memset(deviceTwinBinding->propertyValue, 0x00, sizeof(double));
-        *(double *)deviceTwinBinding->propertyValue = 0.0;
+        deviceTwinBinding->storage.doubleValue = 0.0;
+        deviceTwinBinding->propertyValue = &deviceTwinBinding->storage.doubleValue;
         break;
     case DX_DEVICE_TWIN_BOOL:
-        deviceTwinBinding->propertyValue = malloc(sizeof(bool));
-        memset(deviceTwinBinding->propertyValue, 0x00, sizeof(bool));
-        *(bool *)deviceTwinBinding->propertyValue = false;
-        break;
-    case DX_DEVICE_TWIN_STRING:
-        // Note no memory is allocated for string twin type as size is unknown
+        deviceTwinBinding->storage.boolValue = false;
+        deviceTwinBinding->propertyValue = &deviceTwinBinding->storage.boolValue;
         break;
-    case DX_DEVICE_TWIN_JSON_OBJECT:
-        // Note no memory is allocated for JSON OBJECT twin type as size is unknown
+    case DX_DEVICE_TWIN_INT_ARRAY:
+    case DX_DEVICE_TWIN_FLOAT_ARRAY:
+    case DX_DEVICE_TWIN_DOUBLE_ARRAY:
         break;
     default:
+        deviceTwinBinding->propertyValue = NULL;
         break;
     }
 }
 
 static void deviceTwinClose(DX_DEVICE_TWIN_BINDING *deviceTwinBinding)
 {
-    if (deviceTwinBinding->propertyValue != NULL) {
-        free(deviceTwinBinding->propertyValue);
+    // Array buffers belong to the application
+    if (twinElementSize(deviceTwinBinding->twinType) == 0) {
         deviceTwinBinding->propertyValue = NULL;
     }
+
+    free(deviceTwinBinding->reportedValue);
+    deviceTwinBinding->reportedValue = NULL;
+    deviceTwinBinding->reportedSize = 0;
+    deviceTwinBinding->reportedValid = false;
+
+    free(deviceTwinBinding->pendingValue);
+    deviceTwinBinding->pendingValue = NULL;
+    deviceTwinBinding->pendingSize = 0;
+    deviceTwinBinding->reportPending = false;
+
+    free(deviceTwinBinding->desiredValue);
+    deviceTwinBinding->desiredValue = NULL;
+    deviceTwinBinding->desiredSize = 0;
+    deviceTwinBinding->desiredValid = false;
 }
 
 /// <summary>
@@ -103,17 +326,8 @@ static void DeviceTwinCallbackHandler(DEVICE_TWIN_UPDATE_STATE updateState,
     JSON_Value *root_value = NULL;
     JSON_Object *root_object = NULL;
 
-    char *payLoadString = (char *)malloc(payloadSize + 1);
-    if (payLoadString == NULL) {
-        goto cleanup;
-    }
-
-    memset(payLoadString, 0x00, payloadSize + 1);
-
-    memcpy(payLoadString, payload, payloadSize);
-    payLoadString[payloadSize] = 0; // null terminate string
-
-    root_value = json_parse_string(payLoadString);
+    // The payload is not NULL terminated, parse it in place using its length
+    root_value = json_arena_parse_string_with_length(&_parseArena, (const char *)payload, payloadSize);
     if (root_value == NULL) {
         goto cleanup;
     }
@@ -128,94 +342,497 @@ static void DeviceTwinCallbackHandler(DEVICE_TWIN_UPDATE_STATE updateState,
         desiredProperties = root_object;
     }
 
-    for (int i = 0; i < _deviceTwinCount; i++) {
-        JSON_Value *jsonValue =
-            json_object_get_value(desiredProperties, _deviceTwins[i]->propertyName);
-        if (jsonValue != NULL) {
-            SetDesiredState(desiredProperties, _deviceTwins[i]);
+    bool hasVersion = json_object_has_value_of_type(desiredProperties, "$version", JSONNumber);
+    int version = hasVersion ? (int)json_object_get_number(desiredProperties, "$version") : 0;
+
+    // Handlers already ran with the cached values, skip the first full twin if nothing changed while offline
+    if (_cacheRestored && updateState == DEVICE_TWIN_UPDATE_COMPLETE) {
+        _cacheRestored = false;
+
+        if (hasVersion && version == _cacheVersion) {
+            _desiredVersion = version;
+            _hasDesiredVersion = true;
+            _stats.cacheReconciled++;
+            goto cleanup;
+        }
+    }
+
+    // A full twin is always applied, a patch only when it is newer than what was last applied
+    if (updateState == DEVICE_TWIN_UPDATE_PARTIAL && hasVersion && _hasDesiredVersion && version <= _desiredVersion) {
+        _stats.stalePatches++;
+        goto cleanup;
+    }
+
+    if (hasVersion) {
+        _desiredVersion = version;
+        _hasDesiredVersion = true;
+    }
+
+    if (_desiredValues != NULL) {
+        memset(_desiredValues, 0x00, _deviceTwinCount * sizeof(JSON_Value *));
+    }
+
+    // Walk the desired properties once, each name is matched to its bindings with one hash probe
+    size_t propertyCount = json_object_get_count(desiredProperties);
+
+    for (size_t i = 0; i < propertyCount; i++) {
+        const char *propertyName = json_object_get_name(desiredProperties, i);
+
+        // Skip $version and $metadata
+        if (propertyName != NULL && propertyName[0] != '$') {
+            dispatchDesiredProperty(propertyName, json_object_get_value_at(desiredProperties, i), hasVersion, version);
         }
     }
 
+    if (_desiredValues != NULL) {
+        writeTwinCache(updateState == DEVICE_TWIN_UPDATE_COMPLETE, hasVersion, version);
+    }
+
 cleanup:
-    // Release the allocated memory.
+    // Frees a document too large for the arena or values added by a JSON object handler, then the arena in one step
     if (root_value != NULL) {
         json_value_free(root_value);
     }
+    json_arena_reset(&_parseArena);
+}
+
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t length)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    // 64 bit FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+#define HASH_SEED 14695981039346656037ull
+
+/// <summary>
+///     Structural hash of a JSON value. Object members are combined without regard to order, so the same
+///     object serialized differently hashes the same.
+/// </summary>
+static uint64_t hashJsonValue(const JSON_Value *jsonValue)
+{
+    JSON_Value_Type valueType = json_value_get_type(jsonValue);
+    uint64_t hash = hashBytes(HASH_SEED, &valueType, sizeof(valueType));
+    uint64_t members = 0;
+    double number;
+    int boolean;
+    const char *string;
+
+    switch (valueType) {
+    case JSONNumber:
+        number = json_value_get_number(jsonValue);
+        return hashBytes(hash, &number, sizeof(number));
+    case JSONBoolean:
+        boolean = json_value_get_boolean(jsonValue);
+        return hashBytes(hash, &boolean, sizeof(boolean));
+    case JSONString:
+        string = json_value_get_string(jsonValue);
+        return hashBytes(hash, string, strlen(string));
+    case JSONArray:
+        for (size_t i = 0; i < json_array_get_count(json_value_get_array(jsonValue)); i++) {
+            uint64_t element = hashJsonValue(json_array_get_value(json_value_get_array(jsonValue), i));
+            hash = hashBytes(hash, &element, sizeof(element));
+        }
+        return hash;
+    case JSONObject:
+        for (size_t i = 0; i < json_object_get_count(json_value_get_object(jsonValue)); i++) {
+            const char *name = json_object_get_name(json_value_get_object(jsonValue), i);
+            uint64_t value = hashJsonValue(json_object_get_value_at(json_value_get_object(jsonValue), i));
+            members += hashBytes(hashBytes(HASH_SEED, name, strlen(name)), &value, sizeof(value));
+        }
+        return hashBytes(hash, &members, sizeof(members));
+    default:
+        return hash;
+    }
+}
+
+static size_t twinElementSize(DX_DEVICE_TWIN_TYPE twinType)
+{
+    switch (twinType) {
+    case DX_DEVICE_TWIN_INT_ARRAY:
+        return sizeof(int);
+    case DX_DEVICE_TWIN_FLOAT_ARRAY:
+        return sizeof(float);
+    case DX_DEVICE_TWIN_DOUBLE_ARRAY:
+        return sizeof(double);
+    default:
+        return 0;
+    }
+}
+
+/// <summary>
+///     Convert a JSON array of numbers to the binding element type, copying the elements to buffer and
+///     adding them to hash when those are not NULL. Returns false when an element is not a number or the
+///     array is longer than the binding arrayCapacity.
+/// </summary>
+static bool decodeArray(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, const JSON_Array *jsonArray, void *buffer, uint64_t *hash)
+{
+    size_t elementSize = twinElementSize(deviceTwinBinding->twinType);
+    union {
+        int intValue;
+        float floatValue;
+        double doubleValue;
+    } element;
+
+    if (jsonArray == NULL || json_array_get_count(jsonArray) > deviceTwinBinding->arrayCapacity) {
+        return false;
+    }
+
+    for (size_t i = 0; i < json_array_get_count(jsonArray); i++) {
+        JSON_Value *jsonValue = json_array_get_value(jsonArray, i);
+
+        if (json_value_get_type(jsonValue) != JSONNumber) {
+            return false;
+        }
+
+        switch (deviceTwinBinding->twinType) {
+        case DX_DEVICE_TWIN_INT_ARRAY:
+            element.intValue = (int)json_value_get_number(jsonValue);
+            break;
+        case DX_DEVICE_TWIN_FLOAT_ARRAY:
+            element.floatValue = (float)json_value_get_number(jsonValue);
+            break;
+        default:
+            element.doubleValue = json_value_get_number(jsonValue);
+            break;
+        }
+
+        if (hash != NULL) {
+            *hash = hashBytes(*hash, &element, elementSize);
+        }
+
+        if (buffer != NULL) {
+            memcpy((uint8_t *)buffer + i * elementSize, &element, elementSize);
+        }
+    }
+
+    return true;
+}
+
+/// <summary>
+///     Hash of the desired value as the binding stores it, so 1.2 and 1.25 are the same to an int binding.
+///     Returns false when the value is the wrong type for the binding.
+/// </summary>
+static bool desiredValueHash(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, JSON_Value *jsonValue, uint64_t *hash)
+{
+    JSON_Value_Type valueType = json_value_get_type(jsonValue);
+    int intValue;
+    float floatValue;
+    double doubleValue;
+    bool boolValue;
+
+    switch (deviceTwinBinding->twinType) {
+    case DX_DEVICE_TWIN_INT:
+        intValue = (int)json_value_get_number(jsonValue);
+        *hash = hashBytes(HASH_SEED, &intValue, sizeof(intValue));
+        return valueType == JSONNumber;
+    case DX_DEVICE_TWIN_FLOAT:
+        floatValue = (float)json_value_get_number(jsonValue);
+        *hash = hashBytes(HASH_SEED, &floatValue, sizeof(floatValue));
+        return valueType == JSONNumber;
+    case DX_DEVICE_TWIN_DOUBLE:
+        doubleValue = json_value_get_number(jsonValue);
+        *hash = hashBytes(HASH_SEED, &doubleValue, sizeof(doubleValue));
+        return valueType == JSONNumber;
+    case DX_DEVICE_TWIN_BOOL:
+        boolValue = json_value_get_boolean(jsonValue) == 1;
+        *hash = hashBytes(HASH_SEED, &boolValue, sizeof(boolValue));
+        return valueType == JSONBoolean;
+    case DX_DEVICE_TWIN_STRING:
+        if (valueType == JSONString) {
+            *hash = hashBytes(HASH_SEED, json_value_get_string(jsonValue), strlen(json_value_get_string(jsonValue)));
+        }
+        return valueType == JSONString;
+    case DX_DEVICE_TWIN_JSON_OBJECT:
+        *hash = hashJsonValue(jsonValue);
+        return valueType == JSONObject;
+    case DX_DEVICE_TWIN_INT_ARRAY:
+    case DX_DEVICE_TWIN_FLOAT_ARRAY:
+    case DX_DEVICE_TWIN_DOUBLE_ARRAY:
+        *hash = HASH_SEED;
+        if (valueType == JSONArray && !decodeArray(deviceTwinBinding, json_value_get_array(jsonValue), NULL, hash)) {
+            Log_Debug("ERROR: Device twin '%s' needs an array of at most %zu numbers.\n", deviceTwinBinding->propertyName,
+                      deviceTwinBinding->arrayCapacity);
+            return false;
+        }
+        return valueType == JSONArray;
+    default:
+        return false;
+    }
+}
+
+/// <summary>
+///     Keep a copy of the desired value being applied, in the form the twin cache stores it. Without the copy
+///     the next value is always treated as changed. A NULL value leaves size bytes for the caller to fill.
+/// </summary>
+static bool keepDesiredValue(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, uint64_t hash, const void *value, size_t size)
+{
+    void *copy = realloc(deviceTwinBinding->desiredValue, size > 0 ? size : 1);
+
+    if (copy == NULL) {
+        Log_Debug("ERROR: Device twin '%s' desired value realloc failed.\n", deviceTwinBinding->propertyName);
+        free(deviceTwinBinding->desiredValue);
+        deviceTwinBinding->desiredValue = NULL;
+        deviceTwinBinding->desiredSize = 0;
+        deviceTwinBinding->desiredValid = false;
+        return false;
+    }
+
+    if (value != NULL) {
+        memcpy(copy, value, size);
+    }
+    deviceTwinBinding->desiredValue = copy;
+    deviceTwinBinding->desiredSize = size;
+    deviceTwinBinding->desiredHash = hash;
+    deviceTwinBinding->desiredValid = true;
+
+    return true;
+}
+
+/// <summary>
+///     Compare the desired value, as the binding would store it, with the copy of the last value applied.
+///     JSON objects are compared member by member, so the same object serialized differently is unchanged.
+/// </summary>
+static bool desiredValueEquals(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, JSON_Value *jsonValue)
+{
+    const void *value = deviceTwinBinding->desiredValue;
+    size_t size = deviceTwinBinding->desiredSize;
+    size_t elementSize = twinElementSize(deviceTwinBinding->twinType);
+    JSON_Value *lastValue = NULL;
+    const char *string;
+    void *elements;
+    bool equal = false;
+    union {
+        int intValue;
+        float floatValue;
+        double doubleValue;
+        bool boolValue;
+    } scalar;
+
+    if (!deviceTwinBinding->desiredValid || value == NULL) {
+        return false;
+    }
+
+    switch (deviceTwinBinding->twinType) {
+    case DX_DEVICE_TWIN_INT:
+        scalar.intValue = (int)json_value_get_number(jsonValue);
+        return size == sizeof(scalar.intValue) && memcmp(value, &scalar.intValue, size) == 0;
+    case DX_DEVICE_TWIN_FLOAT:
+        scalar.floatValue = (float)json_value_get_number(jsonValue);
+        return size == sizeof(scalar.floatValue) && memcmp(value, &scalar.floatValue, size) == 0;
+    case DX_DEVICE_TWIN_DOUBLE:
+        scalar.doubleValue = json_value_get_number(jsonValue);
+        return size == sizeof(scalar.doubleValue) && memcmp(value, &scalar.doubleValue, size) == 0;
+    case DX_DEVICE_TWIN_BOOL:
+        scalar.boolValue = json_value_get_boolean(jsonValue) == 1;
+        return size == sizeof(scalar.boolValue) && memcmp(value, &scalar.boolValue, size) == 0;
+    case DX_DEVICE_TWIN_STRING:
+        string = json_value_get_string(jsonValue);
+        return string != NULL && size == strlen(string) + 1 && memcmp(value, string, size) == 0;
+    case DX_DEVICE_TWIN_JSON_OBJECT:
+        if (size > 0 && (lastValue = json_parse_string_with_length((const char *)value, size - 1)) != NULL) {
+            equal = json_value_equals(lastValue, jsonValue) == 1;
+            json_value_free(lastValue);
+        }
+        return equal;
+    case DX_DEVICE_TWIN_INT_ARRAY:
+    case DX_DEVICE_TWIN_FLOAT_ARRAY:
+    case DX_DEVICE_TWIN_DOUBLE_ARRAY:
+        if (size != json_array_get_count(json_value_get_array(jsonValue)) * elementSize) {
+            return false;
+        }
+        if ((elements = malloc(size > 0 ? size : 1)) == NULL) {
+            return false;
+        }
+        equal = decodeArray(deviceTwinBinding, json_value_get_array(jsonValue), elements, NULL) && memcmp(value, elements, size) == 0;
+        free(elements);
+        return equal;
+    default:
+        return false;
+    }
+}
+
+/// <summary>
+///     Keep the desired value SetDesiredState is about to apply, converted to the binding type the way the handler
+///     will see it. The value has already been checked against the binding type.
+/// </summary>
+static void keepAppliedValue(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, JSON_Value *jsonValue, uint64_t hash)
+{
+    const JSON_Array *jsonArray;
+    const char *string;
+    char *serialized;
+    union {
+        int intValue;
+        float floatValue;
+        double doubleValue;
+        bool boolValue;
+    } scalar;
+
+    switch (deviceTwinBinding->twinType) {
+    case DX_DEVICE_TWIN_INT:
+        scalar.intValue = (int)json_value_get_number(jsonValue);
+        keepDesiredValue(deviceTwinBinding, hash, &scalar.intValue, sizeof(scalar.intValue));
+        break;
+    case DX_DEVICE_TWIN_FLOAT:
+        scalar.floatValue = (float)json_value_get_number(jsonValue);
+        keepDesiredValue(deviceTwinBinding, hash, &scalar.floatValue, sizeof(scalar.floatValue));
+        break;
+    case DX_DEVICE_TWIN_DOUBLE:
+        scalar.doubleValue = json_value_get_number(jsonValue);
+        keepDesiredValue(deviceTwinBinding, hash, &scalar.doubleValue, sizeof(scalar.doubleValue));
+        break;
+    case DX_DEVICE_TWIN_BOOL:
+        scalar.boolValue = json_value_get_boolean(jsonValue) == 1;
+        keepDesiredValue(deviceTwinBinding, hash, &scalar.boolValue, sizeof(scalar.boolValue));
+        break;
+    case DX_DEVICE_TWIN_STRING:
+        string = json_value_get_string(jsonValue);
+        keepDesiredValue(deviceTwinBinding, hash, string, strlen(string) + 1);
+        break;
+    case DX_DEVICE_TWIN_JSON_OBJECT:
+        if ((serialized = json_serialize_to_string(jsonValue)) != NULL) {
+            keepDesiredValue(deviceTwinBinding, hash, serialized, strlen(serialized) + 1);
+            json_free_serialized_string(serialized);
+        } else {
+            deviceTwinBinding->desiredValid = false;
+        }
+        break;
+    case DX_DEVICE_TWIN_INT_ARRAY:
+    case DX_DEVICE_TWIN_FLOAT_ARRAY:
+    case DX_DEVICE_TWIN_DOUBLE_ARRAY:
+        jsonArray = json_value_get_array(jsonValue);
+        if (keepDesiredValue(deviceTwinBinding, hash, NULL, json_array_get_count(jsonArray) * twinElementSize(deviceTwinBinding->twinType))) {
+            decodeArray(deviceTwinBinding, jsonArray, deviceTwinBinding->desiredValue, NULL);
+        }
+        break;
+    default:
+        deviceTwinBinding->desiredValid = false;
+        break;
+    }
+}
+
+/// <summary>
+///     The handler is not called for an unchanged desired value, so acknowledge its new $version the way the
+///     application acknowledged the value. Scalars and arrays are already held by the binding.
+/// </summary>
+static void ackUnchangedDesiredValue(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, JSON_Value *jsonValue)
+{
+    char *serialized = NULL;
+    void *state = deviceTwinBinding->propertyValue;
+
+    if (deviceTwinBinding->twinType == DX_DEVICE_TWIN_STRING) {
+        state = (void *)json_value_get_string(jsonValue);
+    } else if (deviceTwinBinding->twinType == DX_DEVICE_TWIN_JSON_OBJECT) {
+        if ((serialized = json_serialize_to_string(jsonValue)) == NULL) {
+            return;
+        }
+        state = serialized;
+    }
 
-    if (payLoadString != NULL) {
-        free(payLoadString);
-        payLoadString = NULL;
+    if (deviceTwinReportState(deviceTwinBinding, state, true, deviceTwinBinding->desiredAckCode)) {
+        _stats.autoAcks++;
     }
+
+    json_free_serialized_string(serialized);
 }
 
 /// <summary>
-///     Checks to see if the device twin propertyName(name) is found in the json object. If yes,
-///     then act upon the request
+///     Update the device twin binding with the desired property value. Values of the wrong type for the
+///     binding are ignored, returns true when the value was accepted. The handler is only called when the
+///     value differs from the last desired value applied to the binding, an unchanged value with a new
+///     $version is acknowledged here if the application acknowledges the binding.
 /// </summary>
-static void SetDesiredState(JSON_Object *jsonObject, DX_DEVICE_TWIN_BINDING *deviceTwinBinding)
+static bool SetDesiredState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, JSON_Value *jsonValue, bool hasVersion, int version)
 {
-    if (json_object_has_value_of_type(jsonObject, "$version", JSONNumber)) {
-        deviceTwinBinding->propertyVersion = (int)json_object_get_number(jsonObject, "$version");
+    JSON_Value_Type valueType = json_value_get_type(jsonValue);
+    int previousVersion = deviceTwinBinding->propertyVersion;
+    bool applied = false;
+    uint64_t hash;
+
+    if (hasVersion) {
+        deviceTwinBinding->propertyVersion = version;
+    }
+
+    if (!desiredValueHash(deviceTwinBinding, jsonValue, &hash)) {
+        return false;
+    }
+
+    // The hash turns away a changed value cheaply, equal hashes are confirmed against the last value applied
+    if (deviceTwinBinding->desiredValid && deviceTwinBinding->desiredHash == hash && desiredValueEquals(deviceTwinBinding, jsonValue)) {
+        _stats.suppressedHandlers++;
+
+        if (hasVersion && version != previousVersion && deviceTwinBinding->desiredAcked) {
+            ackUnchangedDesiredValue(deviceTwinBinding, jsonValue);
+        }
+        return true;
     }
 
+    keepAppliedValue(deviceTwinBinding, jsonValue, hash);
+
     switch (deviceTwinBinding->twinType) {
     case DX_DEVICE_TWIN_INT:
-        if (json_object_has_value_of_type(jsonObject, deviceTwinBinding->propertyName,
-                                          JSONNumber)) {
-            *(int *)deviceTwinBinding->propertyValue =
-                (int)json_object_get_number(jsonObject, deviceTwinBinding->propertyName);
+        if (valueType == JSONNumber) {
+            *(int *)deviceTwinBinding->propertyValue = (int)json_value_get_number(jsonValue);
 
             deviceTwinBinding->propertyUpdated = true;
 
+            applied = true;
+
             if (deviceTwinBinding->handler != NULL) {
                 deviceTwinBinding->handler(deviceTwinBinding);
             }
         }
         break;
     case DX_DEVICE_TWIN_FLOAT:
-        if (json_object_has_value_of_type(jsonObject, deviceTwinBinding->propertyName,
-                                          JSONNumber)) {
-            *(float *)deviceTwinBinding->propertyValue =
-                (float)json_object_get_number(jsonObject, deviceTwinBinding->propertyName);
+        if (valueType == JSONNumber) {
+            *(float *)deviceTwinBinding->propertyValue = (float)json_value_get_number(jsonValue);
 
             deviceTwinBinding->propertyUpdated = true;
 
+            applied = true;
+
             if (deviceTwinBinding->handler != NULL) {
                 deviceTwinBinding->handler(deviceTwinBinding);
             }
         }
         break;
     case DX_DEVICE_TWIN_DOUBLE:
-        if (json_object_has_value_of_type(jsonObject, deviceTwinBinding->propertyName,
-                                          JSONNumber)) {
-            *(double *)deviceTwinBinding->propertyValue =
-                (double)json_object_get_number(jsonObject, deviceTwinBinding->propertyName);
+        if (valueType == JSONNumber) {
+            *(double *)deviceTwinBinding->propertyValue = (double)json_value_get_number(jsonValue);
 
             deviceTwinBinding->propertyUpdated = true;
 
+            applied = true;
+
             if (deviceTwinBinding->handler != NULL) {
                 deviceTwinBinding->handler(deviceTwinBinding);
             }
         }
         break;
     case DX_DEVICE_TWIN_BOOL:
-        if (json_object_has_value_of_type(jsonObject, deviceTwinBinding->propertyName,
-                                          JSONBoolean)) {
-            *(bool *)deviceTwinBinding->propertyValue =
-                (bool)json_object_get_boolean(jsonObject, deviceTwinBinding->propertyName);
+        if (valueType == JSONBoolean) {
+            *(bool *)deviceTwinBinding->propertyValue = (bool)json_value_get_boolean(jsonValue);
 
             deviceTwinBinding->propertyUpdated = true;
 
+            applied = true;
+
             if (deviceTwinBinding->handler != NULL) {
                 deviceTwinBinding->handler(deviceTwinBinding);
             }
         }
         break;
     case DX_DEVICE_TWIN_STRING:
-        if (json_object_has_value_of_type(jsonObject, deviceTwinBinding->propertyName,
-                                          JSONString)) {
-            deviceTwinBinding->propertyValue =
-                (char *)json_object_get_string(jsonObject, deviceTwinBinding->propertyName);
+        if (valueType == JSONString) {
+            deviceTwinBinding->propertyValue = (char *)json_value_get_string(jsonValue);
+
+            applied = true;
 
             if (deviceTwinBinding->handler != NULL) {
                 deviceTwinBinding->handler(deviceTwinBinding);
@@ -224,10 +841,10 @@ static void SetDesiredState(JSON_Object *jsonObject, DX_DEVICE_TWIN_BINDING *dev
         }
         break;
     case DX_DEVICE_TWIN_JSON_OBJECT:
-        if (json_object_has_value_of_type(jsonObject, deviceTwinBinding->propertyName,
-                                          JSONObject)) {
-            deviceTwinBinding->propertyValue =
-                (JSON_Object *)json_object_get_object(jsonObject, deviceTwinBinding->propertyName);
+        if (valueType == JSONObject) {
+            deviceTwinBinding->propertyValue = (JSON_Object *)json_value_get_object(jsonValue);
+
+            applied = true;
 
             if (deviceTwinBinding->handler != NULL) {
                 deviceTwinBinding->handler(deviceTwinBinding);
@@ -235,9 +852,28 @@ static void SetDesiredState(JSON_Object *jsonObject, DX_DEVICE_TWIN_BINDING *dev
             deviceTwinBinding->propertyValue = NULL;
         }
         break;
+    case DX_DEVICE_TWIN_INT_ARRAY:
+    case DX_DEVICE_TWIN_FLOAT_ARRAY:
+    case DX_DEVICE_TWIN_DOUBLE_ARRAY:
+        if (valueType == JSONArray) {
+            // Validated by desiredValueHash so the buffer is never left half written
+            decodeArray(deviceTwinBinding, json_value_get_array(jsonValue), deviceTwinBinding->propertyValue, NULL);
+            deviceTwinBinding->arrayLength = json_array_get_count(json_value_get_array(jsonValue));
+
+            deviceTwinBinding->propertyUpdated = true;
+
+            applied = true;
+
+            if (deviceTwinBinding->handler != NULL) {
+                deviceTwinBinding->handler(deviceTwinBinding);
+            }
+        }
+        break;
     default:
         break;
     }
+
+    return applied;
 }
 
 /// <summary>
@@ -246,6 +882,11 @@ static void SetDesiredState(JSON_Object *jsonObject, DX_DEVICE_TWIN_BINDING *dev
 bool dx_deviceTwinAckDesiredValue(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, void *state,
                                   DX_DEVICE_TWIN_RESPONSE_CODE statusCode)
 {
+    if (deviceTwinBinding != NULL) {
+        deviceTwinBinding->desiredAcked = true;
+        deviceTwinBinding->desiredAckCode = statusCode;
+    }
+
     return deviceTwinReportState(deviceTwinBinding, state, true, statusCode);
 }
 
@@ -273,10 +914,10 @@ static bool deviceTwinRemoveReportedProperty(DX_DEVICE_TWIN_BINDING *deviceTwinB
     }
 
     int len = snprintf(reportedPropertiesString, reportLen, "{\"%s\":null}",
-                    deviceTwinBinding->propertyName);
+                    twinLeafName(deviceTwinBinding));
 
     if ((len > 0) && (len <= reportLen)) {
-        result = deviceTwinUpdateReportedState(reportedPropertiesString);
+        result = deviceTwinReportPatch(deviceTwinBinding, reportedPropertiesString);
     }
 
     if (reportedPropertiesString != NULL) {
@@ -287,14 +928,268 @@ static bool deviceTwinRemoveReportedProperty(DX_DEVICE_TWIN_BINDING *deviceTwinB
     return result;
 }
 
-/// <summary>
-///   Supports device twin report state and device twin ack desired state request
-/// </summary>
-static bool deviceTwinReportState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, void *state,
-                                  bool deviceTwinPnPAcknowledgment,
-                                  DX_DEVICE_TWIN_RESPONSE_CODE statusCode)
+static bool isNumericTwin(DX_DEVICE_TWIN_TYPE twinType)
 {
-    int len = 0;
+    return twinType == DX_DEVICE_TWIN_INT || twinType == DX_DEVICE_TWIN_FLOAT || twinType == DX_DEVICE_TWIN_DOUBLE ||
+           twinType == DX_DEVICE_TWIN_BOOL;
+}
+
+static double twinNumber(DX_DEVICE_TWIN_TYPE twinType, void *state)
+{
+    switch (twinType) {
+    case DX_DEVICE_TWIN_INT:
+        return *(int *)state;
+    case DX_DEVICE_TWIN_FLOAT:
+        return *(float *)state;
+    case DX_DEVICE_TWIN_DOUBLE:
+        return *(double *)state;
+    case DX_DEVICE_TWIN_BOOL:
+        return *(bool *)state ? 1.0 : 0.0;
+    default:
+        return 0.0;
+    }
+}
+
+/// <summary>
+///   Bytes the value at state occupies, strings and JSON objects include the terminator
+/// </summary>
+static size_t reportValueSize(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, const void *state)
+{
+    size_t elementSize = twinElementSize(deviceTwinBinding->twinType);
+
+    if (elementSize > 0) {
+        return deviceTwinBinding->arrayLength * elementSize;
+    }
+
+    if (isNumericTwin(deviceTwinBinding->twinType)) {
+        return twinValueSize(deviceTwinBinding->twinType);
+    }
+
+    return strlen((const char *)state) + 1;
+}
+
+/// <summary>
+///   Copy size bytes from state into a buffer grown to fit. On failure the buffer is released and left NULL.
+/// </summary>
+static bool copyReportValue(void **buffer, size_t *bufferSize, const void *state, size_t size)
+{
+    void *copy = realloc(*buffer, size > 0 ? size : 1);
+
+    if (copy == NULL) {
+        Log_Debug("ERROR: Device twin report value realloc failed.\n");
+        free(*buffer);
+        *buffer = NULL;
+        *bufferSize = 0;
+        return false;
+    }
+
+    memcpy(copy, state, size);
+    *buffer = copy;
+    *bufferSize = size;
+
+    return true;
+}
+
+/// <summary>
+///   Remember what was reported so the next report can be compared against it. A report that went out
+///   replaces any held back value.
+/// </summary>
+static void recordReport(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, void *state)
+{
+    if (isNumericTwin(deviceTwinBinding->twinType)) {
+        deviceTwinBinding->reportedNumber = twinNumber(deviceTwinBinding->twinType, state);
+    } else if (deviceTwinBinding->reportFilter != DX_DEVICE_TWIN_REPORT_ALWAYS) {
+        copyReportValue(&deviceTwinBinding->reportedValue, &deviceTwinBinding->reportedSize, state,
+                        reportValueSize(deviceTwinBinding, state));
+    }
+
+    deviceTwinBinding->reportedMs = dx_getNowMilliseconds();
+    deviceTwinBinding->reportedValid = true;
+    deviceTwinBinding->reportPending = false;
+}
+
+/// <summary>
+///   Apply the binding reportFilter then minReportIntervalMs. Numeric values that are suppressed still update
+///   the binding propertyValue. A value held back by minReportIntervalMs is copied and sent when the interval
+///   expires unless a newer report replaces it first.
+/// </summary>
+static bool reportSuppressed(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, void *state)
+{
+    bool unchanged = false;
+
+    if (!deviceTwinBinding->reportedValid) {
+        return false;
+    }
+
+    if (isNumericTwin(deviceTwinBinding->twinType)) {
+        double delta = fabs(twinNumber(deviceTwinBinding->twinType, state) - deviceTwinBinding->reportedNumber);
+
+        switch (deviceTwinBinding->reportFilter) {
+        case DX_DEVICE_TWIN_REPORT_ON_CHANGE:
+            unchanged = delta == 0.0;
+            break;
+        case DX_DEVICE_TWIN_REPORT_ABSOLUTE_DEADBAND:
+            unchanged = delta <= deviceTwinBinding->reportDeadband;
+            break;
+        case DX_DEVICE_TWIN_REPORT_RELATIVE_DEADBAND:
+            unchanged = delta <= deviceTwinBinding->reportDeadband * fabs(deviceTwinBinding->reportedNumber);
+            break;
+        default:
+            break;
+        }
+    } else if (deviceTwinBinding->reportFilter != DX_DEVICE_TWIN_REPORT_ALWAYS && deviceTwinBinding->reportedValue != NULL) {
+        // Deadbands do not apply to strings, JSON objects and arrays, treat them as on change
+        size_t size = reportValueSize(deviceTwinBinding, state);
+        unchanged = size == deviceTwinBinding->reportedSize && memcmp(state, deviceTwinBinding->reportedValue, size) == 0;
+    }
+
+    if (unchanged) {
+        // Back to what the hub already has, anything held back is out of date
+        deviceTwinBinding->reportPending = false;
+        _stats.suppressedUnchanged++;
+    } else if (deviceTwinBinding->minReportIntervalMs > 0 &&
+               dx_getNowMilliseconds() - deviceTwinBinding->reportedMs < deviceTwinBinding->minReportIntervalMs) {
+        if (state != deviceTwinBinding->pendingValue &&
+            !copyReportValue(&deviceTwinBinding->pendingValue, &deviceTwinBinding->pendingSize, state,
+                             reportValueSize(deviceTwinBinding, state))) {
+            deviceTwinBinding->reportPending = false;
+            return false;
+        }
+
+        deviceTwinBinding->reportPending = true;
+        _stats.suppressedRateLimited++;
+        scheduleDeferredReports(0);
+    } else {
+        return false;
+    }
+
+    switch (deviceTwinBinding->twinType) {
+    case DX_DEVICE_TWIN_INT:
+        *(int *)deviceTwinBinding->propertyValue = *(int *)state;
+        break;
+    case DX_DEVICE_TWIN_FLOAT:
+        *(float *)deviceTwinBinding->propertyValue = *(float *)state;
+        break;
+    case DX_DEVICE_TWIN_DOUBLE:
+        *(double *)deviceTwinBinding->propertyValue = *(double *)state;
+        break;
+    case DX_DEVICE_TWIN_BOOL:
+        *(bool *)deviceTwinBinding->propertyValue = *(bool *)state;
+        break;
+    default:
+        break;
+    }
+
+    return true;
+}
+
+/// <summary>
+///   Arm the deferred report timer for the first held back report to come due, no sooner than notBeforeMs
+/// </summary>
+static void scheduleDeferredReports(int64_t notBeforeMs)
+{
+    int64_t dueMs = INT64_MAX;
+    int64_t nowMs = dx_getNowMilliseconds();
+
+    for (size_t i = 0; i < _deviceTwinCount; i++) {
+        DX_DEVICE_TWIN_BINDING *deviceTwinBinding = _deviceTwins[i];
+
+        if (deviceTwinBinding->reportPending && deviceTwinBinding->reportedMs + deviceTwinBinding->minReportIntervalMs < dueMs) {
+            dueMs = deviceTwinBinding->reportedMs + deviceTwinBinding->minReportIntervalMs;
+        }
+    }
+
+    if (dueMs == INT64_MAX) {
+        return;
+    }
+
+    if (dueMs < notBeforeMs) {
+        dueMs = notBeforeMs;
+    }
+
+    int64_t delayMs = dueMs > nowMs ? dueMs - nowMs : 0;
+
+    dx_timerOneShotSet(&tmr_twin_report_deferred,
+                       &(struct timespec){delayMs / 1000, delayMs == 0 ? 1 : (delayMs % 1000) * 1000000});
+}
+
+/// <summary>
+///   Send the held back reports whose minReportIntervalMs has expired. A report that can not be sent, while
+///   disconnected for example, stays held back and is tried again.
+/// </summary>
+static DX_TIMER_HANDLER(twin_report_deferred_handler)
+{
+    int64_t nowMs = dx_getNowMilliseconds();
+    bool retry = false;
+
+    for (size_t i = 0; i < _deviceTwinCount; i++) {
+        DX_DEVICE_TWIN_BINDING *deviceTwinBinding = _deviceTwins[i];
+        size_t elementSize = twinElementSize(deviceTwinBinding->twinType);
+
+        if (!deviceTwinBinding->reportPending || nowMs - deviceTwinBinding->reportedMs < deviceTwinBinding->minReportIntervalMs) {
+            continue;
+        }
+
+        deviceTwinBinding->reportPending = false;
+
+        if (elementSize > 0) {
+            deviceTwinBinding->arrayLength = deviceTwinBinding->pendingSize / elementSize;
+        }
+
+        int64_t reportedMs = deviceTwinBinding->reportedMs;
+
+        if (deviceTwinReportState(deviceTwinBinding, deviceTwinBinding->pendingValue, false, 0)) {
+            // Not counted when the held back value turned out to match what was last reported
+            if (deviceTwinBinding->reportedMs != reportedMs) {
+                _stats.deferredReports++;
+            }
+        } else {
+            deviceTwinBinding->reportPending = true;
+            retry = true;
+        }
+    }
+
+    scheduleDeferredReports(retry ? nowMs + DEFERRED_REPORT_RETRY_MS : 0);
+}
+DX_TIMER_HANDLER_END
+
+/// <summary>
+///   Append the arrayLength elements at state as a JSON array at offset len, returns the new length or 0 if
+///   the buffer is too small
+/// </summary>
+static int appendTwinArray(char *buffer, size_t bufferSize, int len, DX_DEVICE_TWIN_BINDING *deviceTwinBinding, const void *state)
+{
+    for (size_t i = 0; i < deviceTwinBinding->arrayLength && len > 0 && (size_t)len < bufferSize; i++) {
+        const char *separator = i == 0 ? "[" : ",";
+
+        switch (deviceTwinBinding->twinType) {
+        case DX_DEVICE_TWIN_INT_ARRAY:
+            len += snprintf(buffer + len, bufferSize - (size_t)len, "%s%d", separator, ((const int *)state)[i]);
+            break;
+        case DX_DEVICE_TWIN_FLOAT_ARRAY:
+            len += snprintf(buffer + len, bufferSize - (size_t)len, "%s%.9g", separator, (double)((const float *)state)[i]);
+            break;
+        default:
+            len += snprintf(buffer + len, bufferSize - (size_t)len, "%s%.17g", separator, ((const double *)state)[i]);
+            break;
+        }
+    }
+
+    if (len > 0 && (size_t)len < bufferSize) {
+        len += snprintf(buffer + len, bufferSize - (size_t)len, deviceTwinBinding->arrayLength == 0 ? "[]" : "]");
+    }
+
+    return len > 0 && (size_t)len < bufferSize ? len : 0;
+}
+
+/// <summary>
+///   Supports device twin report state and device twin ack desired state request
+/// </summary>
+static bool deviceTwinReportState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, void *state,
+                                  bool deviceTwinPnPAcknowledgment,
+                                  DX_DEVICE_TWIN_RESPONSE_CODE statusCode)
+{
+    int len = 0;
     size_t reportLen = 10; // initialize to 10 chars to allow for JSON and NULL termination. This is
                            // generous by a couple of bytes
     bool result = false;
@@ -303,21 +1198,34 @@ static bool deviceTwinReportState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, voi
         return false;
     }
 
+    // Dotted path bindings report under the last segment, deviceTwinReportPatch nests it under the rest
+    const char *propertyName = twinLeafName(deviceTwinBinding);
+
     if (!dx_isAzureConnected()) {
         return false;
     }
 
-    reportLen +=
-        strlen(deviceTwinBinding->propertyName); // allow for twin property name in JSON response
+    reportLen += strlen(propertyName); // allow for twin property name in JSON response
 
     // Check for a null reported value in the state pointer.  If the user passed in null, then assume they want
     // to clear the reported property from the device twin.
     if(state == NULL){
+        deviceTwinBinding->reportedValid = false;
+        deviceTwinBinding->reportPending = false;
         return deviceTwinRemoveReportedProperty(deviceTwinBinding);
     } 
 
+    if (!deviceTwinPnPAcknowledgment && reportSuppressed(deviceTwinBinding, state)) {
+        return true;
+    }
+
     if ((deviceTwinBinding->twinType == DX_DEVICE_TWIN_STRING) || (deviceTwinBinding->twinType == DX_DEVICE_TWIN_JSON_OBJECT)) {
         reportLen += strlen((char *)state);
+    } else if (twinElementSize(deviceTwinBinding->twinType) > 0) {
+        if (deviceTwinBinding->arrayLength > deviceTwinBinding->arrayCapacity) {
+            return false;
+        }
+        reportLen += 2 + deviceTwinBinding->arrayLength * 26; // brackets, and 25 chars plus a separator per element
     } else {
         reportLen += 40; // allow 40 chars for Int, float, double, and boolean serialization
     }
@@ -341,11 +1249,11 @@ static bool deviceTwinReportState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, voi
         if (deviceTwinPnPAcknowledgment) {
             len = snprintf(reportedPropertiesString, reportLen,
                            "{\"%s\":{\"value\":%d, \"ac\":%d, \"av\":%d}}",
-                           deviceTwinBinding->propertyName, (*(int *)deviceTwinBinding->propertyValue),
+                           propertyName, (*(int *)deviceTwinBinding->propertyValue),
                            (int)statusCode, deviceTwinBinding->propertyVersion);
         } else {
             len = snprintf(reportedPropertiesString, reportLen, "{\"%s\":%d}",
-                           deviceTwinBinding->propertyName, (*(int *)deviceTwinBinding->propertyValue));
+                           propertyName, (*(int *)deviceTwinBinding->propertyValue));
         }
         break;
     case DX_DEVICE_TWIN_FLOAT:
@@ -355,12 +1263,12 @@ static bool deviceTwinReportState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, voi
             len =
                 snprintf(reportedPropertiesString, reportLen,
                          "{\"%s\":{\"value\":%f, \"ac\":%d, \"av\":%d}}",
-                         deviceTwinBinding->propertyName, (*(float *)deviceTwinBinding->propertyValue),
+                         propertyName, (*(float *)deviceTwinBinding->propertyValue),
                          (int)statusCode, deviceTwinBinding->propertyVersion);
         } else {
             len =
                 snprintf(reportedPropertiesString, reportLen, "{\"%s\":%f}",
-                         deviceTwinBinding->propertyName, (*(float *)deviceTwinBinding->propertyValue));
+                         propertyName, (*(float *)deviceTwinBinding->propertyValue));
         }
         break;
     case DX_DEVICE_TWIN_DOUBLE:
@@ -370,11 +1278,11 @@ static bool deviceTwinReportState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, voi
             len =
                 snprintf(reportedPropertiesString, reportLen,
                          "{\"%s\":{\"value\":%lf, \"ac\":%d, \"av\":%d}}",
-                         deviceTwinBinding->propertyName, (*(double *)deviceTwinBinding->propertyValue),
+                         propertyName, (*(double *)deviceTwinBinding->propertyValue),
                          (int)statusCode, deviceTwinBinding->propertyVersion);
         } else {
             len = snprintf(reportedPropertiesString, reportLen, "{\"%s\":%lf}",
-                           deviceTwinBinding->propertyName,
+                           propertyName,
                            (*(double *)deviceTwinBinding->propertyValue));
         }
         break;
@@ -384,12 +1292,12 @@ static bool deviceTwinReportState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, voi
         if (deviceTwinPnPAcknowledgment) {
             len = snprintf(reportedPropertiesString, reportLen,
                            "{\"%s\":{\"value\":%s, \"ac\":%d, \"av\":%d}}",
-                           deviceTwinBinding->propertyName,
+                           propertyName,
                            (*(bool *)deviceTwinBinding->propertyValue ? "true" : "false"),
                            (int)statusCode, deviceTwinBinding->propertyVersion);
         } else {
             len = snprintf(reportedPropertiesString, reportLen, "{\"%s\":%s}",
-                           deviceTwinBinding->propertyName,
+                           propertyName,
                            (*(bool *)deviceTwinBinding->propertyValue ? "true" : "false"));
         }
         break;
@@ -399,11 +1307,11 @@ static bool deviceTwinReportState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, voi
         if (deviceTwinPnPAcknowledgment) {
             len = snprintf(reportedPropertiesString, reportLen,
                            "{\"%s\":{\"value\":\"%s\", \"ac\":%d, \"av\":%d}}",
-                           deviceTwinBinding->propertyName, (char *)state, (int)statusCode,
+                           propertyName, (char *)state, (int)statusCode,
                            deviceTwinBinding->propertyVersion);
         } else {
             len = snprintf(reportedPropertiesString, reportLen, "{\"%s\":\"%s\"}",
-                           deviceTwinBinding->propertyName, (char *)state);
+                           propertyName, (char *)state);
         }
 
         break;
@@ -413,14 +1321,32 @@ static bool deviceTwinReportState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, voi
         if (deviceTwinPnPAcknowledgment) {
             len = snprintf(reportedPropertiesString, reportLen,
                            "{\"%s\":{\"value\":%s, \"ac\":%d, \"av\":%d}}",
-                           deviceTwinBinding->propertyName, (char *)state, (int)statusCode,
+                           propertyName, (char *)state, (int)statusCode,
                            deviceTwinBinding->propertyVersion);
         } else {
             len = snprintf(reportedPropertiesString, reportLen, "{\"%s\":%s}",
-                           deviceTwinBinding->propertyName, (char *)state);
+                           propertyName, (char *)state);
         }
 
         break;
+    case DX_DEVICE_TWIN_INT_ARRAY:
+    case DX_DEVICE_TWIN_FLOAT_ARRAY:
+    case DX_DEVICE_TWIN_DOUBLE_ARRAY:
+        len = snprintf(reportedPropertiesString, reportLen, deviceTwinPnPAcknowledgment ? "{\"%s\":{\"value\":" : "{\"%s\":",
+                       propertyName);
+        len = appendTwinArray(reportedPropertiesString, reportLen, len, deviceTwinBinding, state);
+
+        if (len > 0 && deviceTwinPnPAcknowledgment) {
+            len += snprintf(reportedPropertiesString + len, reportLen - (size_t)len, ", \"ac\":%d, \"av\":%d}}", (int)statusCode,
+                            deviceTwinBinding->propertyVersion);
+        } else if (len > 0) {
+            len += snprintf(reportedPropertiesString + len, reportLen - (size_t)len, "}");
+        }
+
+        if (len >= (int)reportLen) {
+            len = 0;
+        }
+        break;
 
     case DX_TYPE_UNKNOWN:
         Log_Debug("Device Twin Type Unknown");
@@ -430,7 +1356,11 @@ static bool deviceTwinReportState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, voi
     }
 
     if (len > 0) {
-        result = deviceTwinUpdateReportedState(reportedPropertiesString);
+        result = deviceTwinReportPatch(deviceTwinBinding, reportedPropertiesString);
+    }
+
+    if (result) {
+        recordReport(deviceTwinBinding, state);
     }
 
     if (reportedPropertiesString != NULL) {
@@ -441,26 +1371,580 @@ static bool deviceTwinReportState(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, voi
     return result;
 }
 
-static bool deviceTwinUpdateReportedState(char *reportedPropertiesString)
+static bool deviceTwinUpdateReportedState(const char *reportedPropertiesString, size_t propertyCount)
 {
     if (IoTHubDeviceClient_LL_SendReportedState(
-            dx_azureClientHandleGet(), (unsigned char *)reportedPropertiesString,
+            dx_azureClientHandleGet(), (const unsigned char *)reportedPropertiesString,
             strlen(reportedPropertiesString), deviceTwinsReportStatusCallback,
             0) != IOTHUB_CLIENT_OK) {
 #if DX_LOGGING_ENABLED
         Log_Debug("ERROR: failed to set reported state for '%s'.\n", reportedPropertiesString);
 #endif
+        _stats.failed++;
 
         return false;
     } else {
 #if DX_LOGGING_ENABLED
         Log_Debug("INFO: Reported state propertyUpdated '%s'.\n", reportedPropertiesString);
 #endif
+        _stats.patches++;
+        _stats.properties += (uint32_t)propertyCount;
+
+        dx_azureRequestDoWork();
+
+        return true;
+    }
+}
+
+bool dx_deviceTwinReportBatchInit(const DX_DEVICE_TWIN_BATCH_CONFIG *config)
+{
+    // Room for the braces, the terminator and at least a one character property
+    if (config == NULL || config->maxPatchBytes < 8 || config->maxDelayMs == 0) {
+        Log_Debug("ERROR: Device twin batching requires maxPatchBytes of at least 8 and a non zero maxDelayMs\n");
+        return false;
+    }
+
+    dx_deviceTwinReportBatchDeinit();
+
+    if ((_patch = (char *)malloc(config->maxPatchBytes)) == NULL) {
+        Log_Debug("ERROR: Device twin patch malloc failed.\n");
+        return false;
+    }
+
+    _batchConfig = *config;
+    _patchLength = 0;
+    _patchPropertyCount = 0;
+
+    if (!dx_timerStart(&tmr_twin_report_batch)) {
+        free(_patch);
+        _patch = NULL;
+        return false;
+    }
+
+    return true;
+}
 
+void dx_deviceTwinReportBatchDeinit(void)
+{
+    if (_patch != NULL) {
+        dx_deviceTwinReportCommit();
+        dx_timerStop(&tmr_twin_report_batch);
+        free(_patch);
+        _patch = NULL;
+    }
+
+    _patchLength = 0;
+    _patchPropertyCount = 0;
+}
+
+bool dx_deviceTwinReportCommit(void)
+{
+    bool result = false;
+
+    if (_patch == NULL || _patchPropertyCount == 0) {
         return true;
     }
 
-    // IoTHubDeviceClient_LL_DoWork(dx_azureClientHandleGet());
+    // Room for the closing brace and terminator was reserved when each property was added
+    _patch[_patchLength] = '}';
+    _patch[_patchLength + 1] = 0x00;
+
+    if (dx_isAzureConnected()) {
+        result = deviceTwinUpdateReportedState(_patch, _patchPropertyCount);
+    } else {
+        _stats.failed++;
+    }
+
+    // The hub never saw these values so do not let them suppress the next report
+    if (!result) {
+        for (size_t i = 0; i < _patchPropertyCount; i++) {
+            _patchBindings[i]->reportedValid = false;
+        }
+    }
+
+    _patchLength = 0;
+    _patchPropertyCount = 0;
+
+    return result;
+}
+
+void dx_deviceTwinGetStats(DX_DEVICE_TWIN_STATS *stats)
+{
+    if (stats != NULL) {
+        *stats = _stats;
+        stats->propertiesPerPatch = _stats.patches > 0 ? (float)_stats.properties / (float)_stats.patches : 0.0f;
+    }
+}
+
+void dx_deviceTwinResetStats(void)
+{
+    memset(&_stats, 0x00, sizeof(_stats));
+}
+
+/// <summary>
+///   True when the patch already has a member named by the first segment of propertyName
+/// </summary>
+static bool patchHasProperty(const char *propertyName)
+{
+    size_t length = strcspn(propertyName, ".");
+
+    for (size_t i = 0; i < _patchPropertyCount; i++) {
+        if (firstSegmentEquals(_patchBindings[i], propertyName, length)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// <summary>
+///   Nest a {"leaf":value} report under the parent segments of the binding path, {"a":{"b":{"leaf":value}}}
+/// </summary>
+static char *wrapTwinPath(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, const char *reportedPropertiesString)
+{
+    size_t length = strlen(reportedPropertiesString);
+    size_t parents = deviceTwinBinding->pathDepth - 1u;
+    size_t prefixLength = 0;
+
+    for (size_t i = 0; i < parents; i++) {
+        prefixLength += deviceTwinBinding->pathLengths[i] + 4u; // {"segment":
+    }
+
+    char *wrapped = (char *)malloc(prefixLength + length + parents + 1);
+    if (wrapped == NULL) {
+        return NULL;
+    }
+
+    char *cursor = wrapped;
+
+    for (size_t i = 0; i < parents; i++) {
+        memcpy(cursor, "{\"", 2);
+        memcpy(cursor + 2, deviceTwinBinding->propertyName + deviceTwinBinding->pathOffsets[i], deviceTwinBinding->pathLengths[i]);
+        memcpy(cursor + 2 + deviceTwinBinding->pathLengths[i], "\":", 2);
+        cursor += deviceTwinBinding->pathLengths[i] + 4u;
+    }
+
+    memcpy(cursor, reportedPropertiesString, length);
+    memset(cursor + length, '}', parents);
+    cursor[length + parents] = 0x00;
+
+    return wrapped;
+}
+
+/// <summary>
+///   Report a {"leaf":value} string for the binding, nested under its path when propertyName is dotted
+/// </summary>
+static bool deviceTwinReportPatch(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, const char *reportedPropertiesString)
+{
+    if (deviceTwinBinding->pathDepth <= 1) {
+        return deviceTwinMergePatch(deviceTwinBinding, reportedPropertiesString);
+    }
+
+    char *wrapped = wrapTwinPath(deviceTwinBinding, reportedPropertiesString);
+    bool result = wrapped != NULL && deviceTwinMergePatch(deviceTwinBinding, wrapped);
+
+    free(wrapped);
+
+    return result;
+}
+
+/// <summary>
+///   Send a {"name":value} report, or merge it into the pending patch when batching is enabled.
+///   A property already in the patch, or one sharing its top level name, sends the patch first so the hub
+///   sees every value in order and the patch never repeats a member name.
+/// </summary>
+static bool deviceTwinMergePatch(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, const char *reportedPropertiesString)
+{
+    size_t length = strlen(reportedPropertiesString);
+
+    if (_patch == NULL) {
+        return deviceTwinUpdateReportedState(reportedPropertiesString, 1);
+    }
+
+    // The patch keeps what is between the outer braces
+    const char *member = reportedPropertiesString + 1;
+    size_t memberLength = length - 2;
+
+    // Opening brace or separator, the member, the closing brace and the terminator
+    if (memberLength + 3 > _batchConfig.maxPatchBytes) {
+        dx_deviceTwinReportCommit();
+        return deviceTwinUpdateReportedState(reportedPropertiesString, 1);
+    }
+
+    if (_patchPropertyCount > 0 &&
+        (_patchPropertyCount == DX_DEVICE_TWIN_BATCH_MAX_PROPERTIES || patchHasProperty(deviceTwinBinding->propertyName) ||
+         _patchLength + 1 + memberLength + 2 > _batchConfig.maxPatchBytes)) {
+        dx_deviceTwinReportCommit();
+    }
+
+    if (_patchPropertyCount == 0) {
+        dx_timerOneShotSet(&tmr_twin_report_batch,
+                           &(struct timespec){_batchConfig.maxDelayMs / 1000, (_batchConfig.maxDelayMs % 1000) * 1000000});
+    }
+
+    _patch[_patchLength++] = _patchPropertyCount == 0 ? '{' : ',';
+    memcpy(_patch + _patchLength, member, memberLength);
+    _patchLength += memberLength;
+    _patchBindings[_patchPropertyCount++] = deviceTwinBinding;
+
+    return true;
+}
+
+/// <summary>
+///   Send the pending patch maxDelayMs after its first property was added
+/// </summary>
+static DX_TIMER_HANDLER(twin_report_batch_handler)
+{
+    dx_deviceTwinReportCommit();
+}
+DX_TIMER_HANDLER_END
+
+void dx_deviceTwinEnableCache(void)
+{
+    _cacheEnabled = true;
+}
+
+bool dx_deviceTwinClearCache(void)
+{
+    _cacheLength = 0;
+
+    if (_cacheOffsets != NULL) {
+        memset(_cacheOffsets, 0x00, _deviceTwinCount * sizeof(size_t));
+    }
+
+    return dx_storageDelete(DX_STORAGE_ID_DEVICE_TWIN_CACHE);
+}
+
+static void freeTwinCache(void)
+{
+    free(_cache);
+    free(_cacheOffsets);
+    free(_desiredValues);
+
+    _cache = NULL;
+    _cacheOffsets = NULL;
+    _desiredValues = NULL;
+    _cacheLength = 0;
+    _cacheRestored = false;
+}
+
+static size_t twinValueSize(DX_DEVICE_TWIN_TYPE twinType)
+{
+    switch (twinType) {
+    case DX_DEVICE_TWIN_INT:
+        return sizeof(int);
+    case DX_DEVICE_TWIN_FLOAT:
+        return sizeof(float);
+    case DX_DEVICE_TWIN_DOUBLE:
+        return sizeof(double);
+    case DX_DEVICE_TWIN_BOOL:
+        return sizeof(bool);
+    default:
+        return 0;
+    }
+}
+
+static uint16_t readUint16(const uint8_t *buffer)
+{
+    uint16_t value;
+    memcpy(&value, buffer, sizeof(value));
+    return value;
+}
+
+/// <summary>
+///   Size of the cache entry at offset, 0 if the entry is malformed
+/// </summary>
+static size_t cacheEntrySize(size_t offset)
+{
+    if (offset + TWIN_CACHE_ENTRY_HEADER_SIZE > _cacheLength) {
+        return 0;
+    }
+
+    size_t nameSize = _cache[offset + 1];
+    size_t valueSize = readUint16(_cache + offset + 2);
+    size_t entrySize = TWIN_CACHE_ENTRY_HEADER_SIZE + nameSize + valueSize;
+
+    if (nameSize == 0 || offset + entrySize > _cacheLength || _cache[offset + TWIN_CACHE_ENTRY_HEADER_SIZE + nameSize - 1] != 0x00) {
+        return 0;
+    }
+
+    return entrySize;
+}
+
+/// <summary>
+///   Apply a cached value to the binding and call its handler, the same as a desired property from IoT Hub
+/// </summary>
+static bool restoreCachedValue(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, size_t offset)
+{
+    DX_DEVICE_TWIN_TYPE twinType = (DX_DEVICE_TWIN_TYPE)_cache[offset];
+    size_t valueSize = readUint16(_cache + offset + 2);
+    const uint8_t *value = _cache + offset + TWIN_CACHE_ENTRY_HEADER_SIZE + _cache[offset + 1];
+    JSON_Value *jsonValue = NULL;
+
+    if (twinType != deviceTwinBinding->twinType) {
+        return false;
+    }
+
+    switch (twinType) {
+    case DX_DEVICE_TWIN_INT:
+    case DX_DEVICE_TWIN_FLOAT:
+    case DX_DEVICE_TWIN_DOUBLE:
+    case DX_DEVICE_TWIN_BOOL:
+        if (deviceTwinBinding->propertyValue == NULL || valueSize != twinValueSize(twinType)) {
+            return false;
+        }
+        memcpy(deviceTwinBinding->propertyValue, value, valueSize);
+        deviceTwinBinding->propertyUpdated = true;
+        break;
+    case DX_DEVICE_TWIN_STRING:
+        if (valueSize == 0 || value[valueSize - 1] != 0x00) {
+            return false;
+        }
+        deviceTwinBinding->propertyValue = (char *)value;
+        break;
+    case DX_DEVICE_TWIN_JSON_OBJECT:
+        if (valueSize == 0 || (jsonValue = json_parse_string_with_length((const char *)value, valueSize - 1)) == NULL ||
+            json_value_get_object(jsonValue) == NULL) {
+            json_value_free(jsonValue);
+            return false;
+        }
+        deviceTwinBinding->propertyValue = json_value_get_object(jsonValue);
+        break;
+    case DX_DEVICE_TWIN_INT_ARRAY:
+    case DX_DEVICE_TWIN_FLOAT_ARRAY:
+    case DX_DEVICE_TWIN_DOUBLE_ARRAY:
+        if (valueSize % twinElementSize(twinType) != 0 || valueSize / twinElementSize(twinType) > deviceTwinBinding->arrayCapacity) {
+            return false;
+        }
+        memcpy(deviceTwinBinding->propertyValue, value, valueSize);
+        deviceTwinBinding->arrayLength = valueSize / twinElementSize(twinType);
+        deviceTwinBinding->propertyUpdated = true;
+        break;
+    default:
+        return false;
+    }
+
+    deviceTwinBinding->propertyVersion = (int)_cacheVersion;
+    keepDesiredValue(deviceTwinBinding,
+                     jsonValue != NULL ? hashJsonValue(jsonValue)
+                                       : hashBytes(HASH_SEED, value, twinType == DX_DEVICE_TWIN_STRING ? valueSize - 1 : valueSize),
+                     value, valueSize);
+
+    if (deviceTwinBinding->handler != NULL) {
+        deviceTwinBinding->handler(deviceTwinBinding);
+    }
+
+    if (twinType == DX_DEVICE_TWIN_STRING || twinType == DX_DEVICE_TWIN_JSON_OBJECT) {
+        deviceTwinBinding->propertyValue = NULL;
+    }
+
+    if (jsonValue != NULL) {
+        json_value_free(jsonValue);
+    }
+
+    return true;
+}
+
+/// <summary>
+///   Read the cached desired properties and hand them to the bindings so the application starts with its last
+///   configuration rather than defaults while it waits for IoT Hub
+/// </summary>
+static void loadTwinCache(void)
+{
+    size_t offset = TWIN_CACHE_HEADER_SIZE;
+    size_t entrySize;
+
+    freeTwinCache();
+
+    _cache = (uint8_t *)malloc(DX_DEVICE_TWIN_CACHE_MAX_BYTES);
+    _cacheOffsets = (size_t *)calloc(_deviceTwinCount > 0 ? _deviceTwinCount : 1, sizeof(size_t));
+    _desiredValues = (JSON_Value **)calloc(_deviceTwinCount > 0 ? _deviceTwinCount : 1, sizeof(JSON_Value *));
+
+    if (_cache == NULL || _cacheOffsets == NULL || _desiredValues == NULL) {
+        Log_Debug("ERROR: Device twin cache malloc failed.\n");
+        freeTwinCache();
+        return;
+    }
+
+    if (!dx_storageRead(DX_STORAGE_ID_DEVICE_TWIN_CACHE, _cache, DX_DEVICE_TWIN_CACHE_MAX_BYTES, &_cacheLength) ||
+        _cacheLength < TWIN_CACHE_HEADER_SIZE) {
+        _cacheLength = 0;
+        return;
+    }
+
+    memcpy(&_cacheVersion, _cache, sizeof(_cacheVersion));
+
+    for (uint16_t entry = 0; entry < readUint16(_cache + 4) && (entrySize = cacheEntrySize(offset)) > 0; entry++) {
+        const char *propertyName = (const char *)(_cache + offset + TWIN_CACHE_ENTRY_HEADER_SIZE);
+        DX_DEVICE_TWIN_BINDING *deviceTwinBinding;
+        size_t cursor = 0;
+        size_t bindingIndex;
+
+        while ((deviceTwinBinding = nextTwinNamed(propertyName, &cursor, &bindingIndex)) != NULL) {
+            if (strcmp(deviceTwinBinding->propertyName, propertyName) == 0) {
+                _cacheOffsets[bindingIndex] = offset + 1;
+            }
+        }
+
+        offset += entrySize;
+    }
+
+    for (size_t i = 0; i < _deviceTwinCount; i++) {
+        if (_cacheOffsets[i] != 0 && restoreCachedValue(_deviceTwins[i], _cacheOffsets[i] - 1)) {
+            _stats.cacheRestored++;
+            _cacheRestored = true;
+        }
+    }
+
+    if (_cacheRestored) {
+        _desiredVersion = (int)_cacheVersion;
+        _hasDesiredVersion = true;
+    }
+}
+
+static bool appendCacheEntry(uint8_t *buffer, size_t *length, DX_DEVICE_TWIN_TYPE twinType, const char *propertyName,
+                             const void *value, size_t valueSize)
+{
+    size_t nameSize = strlen(propertyName) + 1;
+
+    if (nameSize > UINT8_MAX || valueSize > UINT16_MAX ||
+        *length + TWIN_CACHE_ENTRY_HEADER_SIZE + nameSize + valueSize > DX_DEVICE_TWIN_CACHE_MAX_BYTES) {
+        Log_Debug("ERROR: Device twin '%s' does not fit the cache, increase DX_DEVICE_TWIN_CACHE_MAX_BYTES.\n", propertyName);
+        return false;
+    }
+
+    uint16_t size = (uint16_t)valueSize;
+    buffer[*length] = (uint8_t)twinType;
+    buffer[*length + 1] = (uint8_t)nameSize;
+    memcpy(buffer + *length + 2, &size, sizeof(size));
+    memcpy(buffer + *length + TWIN_CACHE_ENTRY_HEADER_SIZE, propertyName, nameSize);
+    memcpy(buffer + *length + TWIN_CACHE_ENTRY_HEADER_SIZE + nameSize, value, valueSize);
+    *length += TWIN_CACHE_ENTRY_HEADER_SIZE + nameSize + valueSize;
+
+    return true;
+}
+
+static bool appendDesiredValue(uint8_t *buffer, size_t *length, DX_DEVICE_TWIN_BINDING *deviceTwinBinding, JSON_Value *jsonValue)
+{
+    int intValue;
+    float floatValue;
+    double doubleValue;
+    bool boolValue;
+    const char *stringValue;
+    bool result = false;
+
+    switch (deviceTwinBinding->twinType) {
+    case DX_DEVICE_TWIN_INT:
+        intValue = (int)json_value_get_number(jsonValue);
+        return appendCacheEntry(buffer, length, deviceTwinBinding->twinType, deviceTwinBinding->propertyName, &intValue, sizeof(intValue));
+    case DX_DEVICE_TWIN_FLOAT:
+        floatValue = (float)json_value_get_number(jsonValue);
+        return appendCacheEntry(buffer, length, deviceTwinBinding->twinType, deviceTwinBinding->propertyName, &floatValue,
+                                sizeof(floatValue));
+    case DX_DEVICE_TWIN_DOUBLE:
+        doubleValue = json_value_get_number(jsonValue);
+        return appendCacheEntry(buffer, length, deviceTwinBinding->twinType, deviceTwinBinding->propertyName, &doubleValue,
+                                sizeof(doubleValue));
+    case DX_DEVICE_TWIN_BOOL:
+        boolValue = json_value_get_boolean(jsonValue) == 1;
+        return appendCacheEntry(buffer, length, deviceTwinBinding->twinType, deviceTwinBinding->propertyName, &boolValue, sizeof(boolValue));
+    case DX_DEVICE_TWIN_STRING:
+        stringValue = json_value_get_string(jsonValue);
+        return appendCacheEntry(buffer, length, deviceTwinBinding->twinType, deviceTwinBinding->propertyName, stringValue,
+                                strlen(stringValue) + 1);
+    case DX_DEVICE_TWIN_JSON_OBJECT:
+        if ((stringValue = json_serialize_to_string(jsonValue)) != NULL) {
+            result = appendCacheEntry(buffer, length, deviceTwinBinding->twinType, deviceTwinBinding->propertyName, stringValue,
+                                      strlen(stringValue) + 1);
+            json_free_serialized_string((char *)stringValue);
+        }
+        return result;
+    case DX_DEVICE_TWIN_INT_ARRAY:
+    case DX_DEVICE_TWIN_FLOAT_ARRAY:
+    case DX_DEVICE_TWIN_DOUBLE_ARRAY:
+        // Already decoded into the binding buffer
+        return appendCacheEntry(buffer, length, deviceTwinBinding->twinType, deviceTwinBinding->propertyName,
+                                deviceTwinBinding->propertyValue, deviceTwinBinding->arrayLength * twinElementSize(deviceTwinBinding->twinType));
+    default:
+        return false;
+    }
+}
+
+/// <summary>
+///   Rewrite the cache with the values just applied. A full twin replaces the cache, a patch keeps the cached
+///   values of properties it did not change. Mutable storage is only written when the $version or a value differs
+///   from what is cached, IoT Hub sends the full twin again on every reconnect.
+/// </summary>
+static void writeTwinCache(bool replace, bool hasVersion, int version)
+{
+    size_t length = TWIN_CACHE_HEADER_SIZE;
+    uint16_t entries = 0;
+    bool changed = replace;
+    size_t bindingIndex;
+
+    for (size_t i = 0; i < _deviceTwinCount && !changed; i++) {
+        changed = _desiredValues[i] != NULL;
+    }
+
+    if (!changed) {
+        return;
+    }
+
+    uint8_t *buffer = (uint8_t *)malloc(DX_DEVICE_TWIN_CACHE_MAX_BYTES);
+    if (buffer == NULL) {
+        Log_Debug("ERROR: Device twin cache malloc failed.\n");
+        return;
+    }
+
+    for (size_t i = 0; i < _deviceTwinCount; i++) {
+        size_t offset = length;
+        size_t cursor = 0;
+
+        // Bindings sharing a name share one entry, the first of them holds it
+        while (nextTwinNamed(_deviceTwins[i]->propertyName, &cursor, &bindingIndex) != NULL &&
+               strcmp(_deviceTwins[bindingIndex]->propertyName, _deviceTwins[i]->propertyName) != 0) {
+        }
+        if (bindingIndex != i) {
+            _cacheOffsets[i] = _cacheOffsets[bindingIndex];
+            continue;
+        }
+
+        if (_desiredValues[i] != NULL) {
+            if (!appendDesiredValue(buffer, &length, _deviceTwins[i], _desiredValues[i])) {
+                offset = 0;
+            }
+        } else if (!replace && _cacheOffsets[i] != 0 && length + cacheEntrySize(_cacheOffsets[i] - 1) <= DX_DEVICE_TWIN_CACHE_MAX_BYTES) {
+            memcpy(buffer + length, _cache + _cacheOffsets[i] - 1, cacheEntrySize(_cacheOffsets[i] - 1));
+            length += cacheEntrySize(_cacheOffsets[i] - 1);
+        } else {
+            offset = 0;
+        }
+
+        if (offset != 0) {
+            entries++;
+        }
+        _cacheOffsets[i] = offset == 0 ? 0 : offset + 1;
+    }
+
+    // Keep the previous version when the document did not carry one
+    _cacheVersion = hasVersion ? (int32_t)version : _cacheVersion;
+    memcpy(buffer, &_cacheVersion, sizeof(_cacheVersion));
+    memcpy(buffer + 4, &entries, sizeof(entries));
+
+    bool unchanged = _cache != NULL && _cacheLength == length && memcmp(_cache, buffer, length) == 0;
+
+    free(_cache);
+    _cache = buffer;
+    _cacheLength = length;
+
+    if (unchanged) {
+        _stats.cacheWritesSkipped++;
+        return;
+    }
+
+    if (dx_storageWrite(DX_STORAGE_ID_DEVICE_TWIN_CACHE, _cache, _cacheLength)) {
+        _stats.cacheWrites++;
+    }
 }
 
 /// <summary>
@@ -3,41 +3,624 @@
 
 #include "dx_direct_methods.h"
 
-static int DirectMethodCallbackHandler(const char *method_name, const unsigned char *payload, size_t payloadSize,
-                                       unsigned char **responsePayload, size_t *responsePayloadSize, void *userContextCallback);
+static int DirectMethodCallbackHandler(const char *method_name, const unsigned char *payload, size_t payloadSize, METHOD_HANDLE methodId,
+                                       void *userContextCallback);
+static bool sendMethodResponse(METHOD_HANDLE methodId, int result, const char *responseMessage);
+static bool sendResponse(METHOD_HANDLE methodId, int result, DX_DIRECT_METHOD_RESPONSE *response);
+static void resetResponse(DX_DIRECT_METHOD_RESPONSE *response);
+static const char *defaultResponseMessage(int result);
+static void startAsyncMethod(DX_DIRECT_METHOD_BINDING *directMethodBinding, JSON_Value *json, METHOD_HANDLE methodId);
+static bool asyncMethodWaiting(DX_DIRECT_METHOD_TOKEN token);
+static const char *admitMethod(DX_DIRECT_METHOD_BINDING *directMethodBinding);
+static void recordExecutionTime(DX_DIRECT_METHOD_BINDING *directMethodBinding, int64_t startMs);
+static bool finishAsyncMethod(uint32_t slot, int result);
+static void abandonAsyncMethods(void);
+static void armTimeoutTimer(void);
+static void AsyncMethodConnectionChanged(bool connected, void *context);
+static DX_DECLARE_TIMER_HANDLER(async_method_timeout_handler);
+static void buildMethodIndex(void);
+static DX_DIRECT_METHOD_BINDING *findMethod(const char *methodName);
+static bool reserveMethods(size_t count);
+static void freeMethods(void);
 
-static DX_DIRECT_METHOD_BINDING **_directMethods;
-static size_t _directMethodCount;
+// The application's binding array until a method is added or removed, then a copy owned here.
+// _directMethodCapacity is 0 while the application's array is in use.
+static DX_DIRECT_METHOD_BINDING **_directMethods = NULL;
+static size_t _directMethodCount = 0;
+static size_t _directMethodCapacity = 0;
+
+// Method names, so each invocation is matched with one hash probe rather than a compare against every name
+static DX_NAME_INDEX _methodIndex;
+
+static const char *methodSucceededMsg = "Method Succeeded";
+static const char *methodNotFoundMsg = "Method not found";
+static const char *methodErrorMsg = "Method Error";
+static const char *methodTimeoutMsg = "Method timed out";
+static const char *methodBusyMsg = "Too many methods in progress";
+static const char *methodRateLimitedMsg = "Too many requests";
+static const char *invalidJsonMsg = "Invalid JSON";
+static const char *responseTooLargeMsg = "Response too large";
+
+// Responses are built here then handed to the SDK, which takes its own copy. Async completions have their own
+// buffer, a responseHandler can complete an async method while its own response is half written.
+static char _responseBuffer[DX_DIRECT_METHOD_RESPONSE_MAX_BYTES];
+static DX_DIRECT_METHOD_RESPONSE _response = {.buffer = _responseBuffer, .capacity = sizeof(_responseBuffer)};
+static char _completionBuffer[DX_DIRECT_METHOD_RESPONSE_MAX_BYTES];
+static DX_DIRECT_METHOD_RESPONSE _completion = {.buffer = _completionBuffer, .capacity = sizeof(_completionBuffer)};
+
+// Async methods waiting for dx_directMethodComplete. The generation changes each time a slot is released so
+// a token for an earlier method can not complete a later one. The method handle belongs to the client that
+// received the method, a response is only sent while that client is still current.
+typedef struct {
+    METHOD_HANDLE methodId;
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE client;
+    DX_DIRECT_METHOD_BINDING *binding;
+    int64_t startMs;
+    int64_t deadlineMs;
+    uint32_t generation;
+    bool active;
+} ASYNC_METHOD;
+
+static ASYNC_METHOD _asyncMethods[DX_DIRECT_METHOD_MAX_IN_FLIGHT];
+static DX_DIRECT_METHOD_STATS _stats;
+static DX_TIMER_BINDING tmr_async_method_timeout = {.name = "tmr_async_method_timeout", .handler = async_method_timeout_handler};
 
 void dx_directMethodSubscribe(DX_DIRECT_METHOD_BINDING *directMethods[], size_t directMethodCount)
 {
-    dx_azureRegisterDirectMethodCallback(DirectMethodCallbackHandler);
+    freeMethods();
 
     _directMethods = directMethods;
     _directMethodCount = directMethodCount;
+
+    buildMethodIndex();
+
+    if (!dx_timerStart(&tmr_async_method_timeout)) {
+        Log_Debug("ERROR: Async direct method timeout timer failed to start.\n");
+    }
+    dx_azureRegisterConnectionChangedNotificationEx(AsyncMethodConnectionChanged, NULL, DX_CONNECTION_PRIORITY_DEFAULT);
+    dx_azureRegisterDirectMethodInboundCallback(DirectMethodCallbackHandler);
 }
 
 void dx_directMethodUnsubscribe(void)
 {
-    dx_azureRegisterDirectMethodCallback(NULL);
+    dx_azureRegisterDirectMethodInboundCallback(NULL);
+    dx_azureUnregisterConnectionChangedNotificationEx(AsyncMethodConnectionChanged, NULL);
+
+    abandonAsyncMethods();
+    dx_timerStop(&tmr_async_method_timeout);
+
+    freeMethods();
+}
+
+void dx_directMethodGetStats(DX_DIRECT_METHOD_STATS *stats)
+{
+    if (stats != NULL) {
+        *stats = _stats;
+    }
+}
+
+void dx_directMethodGetBindingStats(const DX_DIRECT_METHOD_BINDING *directMethod, DX_DIRECT_METHOD_BINDING_STATS *stats)
+{
+    if (directMethod != NULL && stats != NULL) {
+        stats->accepted = directMethod->accepted;
+        stats->rejected = directMethod->rejected;
+        stats->inFlight = directMethod->inFlight;
+        dx_latencyHistogramGetStats(&directMethod->executionTime, &stats->executionTime);
+    }
+}
+
+/// <summary>
+/// Apply the binding concurrency cap then its token bucket. Returns NULL when the call can go ahead,
+/// otherwise the message to reject it with.
+/// </summary>
+static const char *admitMethod(DX_DIRECT_METHOD_BINDING *directMethodBinding)
+{
+    if (directMethodBinding->asyncHandler != NULL) {
+        bool slotFree = false;
+
+        for (size_t slot = 0; slot < DX_DIRECT_METHOD_MAX_IN_FLIGHT && !slotFree; slot++) {
+            slotFree = !_asyncMethods[slot].active;
+        }
+
+        if (!slotFree || (directMethodBinding->maxInFlight > 0 && directMethodBinding->inFlight >= directMethodBinding->maxInFlight)) {
+            directMethodBinding->rejected++;
+            _stats.rejected++;
+            return methodBusyMsg;
+        }
+    }
+
+    if (directMethodBinding->rateLimitPerMinute > 0) {
+        int64_t now = dx_getNowMilliseconds();
+        double burst = directMethodBinding->rateLimitBurst > 0 ? directMethodBinding->rateLimitBurst : 1.0;
+
+        // rateRefillMs is 0 until the first call, the bucket starts full
+        if (directMethodBinding->rateRefillMs == 0) {
+            directMethodBinding->rateTokens = burst;
+        } else {
+            directMethodBinding->rateTokens += (double)(now - directMethodBinding->rateRefillMs) * directMethodBinding->rateLimitPerMinute / 60000.0;
+            directMethodBinding->rateTokens = fmin(directMethodBinding->rateTokens, burst);
+        }
+        directMethodBinding->rateRefillMs = now;
+
+        if (directMethodBinding->rateTokens < 1.0) {
+            directMethodBinding->rejected++;
+            _stats.rateLimited++;
+            return methodRateLimitedMsg;
+        }
+
+        directMethodBinding->rateTokens -= 1.0;
+    }
+
+    directMethodBinding->accepted++;
+
+    return NULL;
+}
+
+static void recordExecutionTime(DX_DIRECT_METHOD_BINDING *directMethodBinding, int64_t startMs)
+{
+    int64_t elapsedMs = dx_getNowMilliseconds() - startMs;
+
+    dx_latencyHistogramRecord(&directMethodBinding->executionTime, elapsedMs > 0 ? (uint32_t)elapsedMs : 0);
+}
+
+static bool asyncMethodWaiting(DX_DIRECT_METHOD_TOKEN token)
+{
+    return token.slot < DX_DIRECT_METHOD_MAX_IN_FLIGHT && _asyncMethods[token.slot].active &&
+           _asyncMethods[token.slot].generation == token.generation;
+}
+
+bool dx_directMethodComplete(DX_DIRECT_METHOD_TOKEN token, DX_DIRECT_METHOD_RESPONSE_CODE responseCode, const char *responseMsg)
+{
+    if (!asyncMethodWaiting(token)) {
+        return false;
+    }
+
+    resetResponse(&_completion);
+    dx_directMethodResponseString(&_completion,
+                                  responseMsg == NULL || strlen(responseMsg) == 0 ? defaultResponseMessage((int)responseCode) : responseMsg);
+
+    _stats.completed++;
+
+    return finishAsyncMethod(token.slot, (int)responseCode);
+}
+
+bool dx_directMethodCompleteJson(DX_DIRECT_METHOD_TOKEN token, DX_DIRECT_METHOD_RESPONSE_CODE responseCode, const JSON_Value *value)
+{
+    if (!asyncMethodWaiting(token)) {
+        return false;
+    }
+
+    resetResponse(&_completion);
+    dx_directMethodResponseJson(&_completion, value);
+
+    _stats.completed++;
+
+    return finishAsyncMethod(token.slot, (int)responseCode);
+}
+
+static const char *defaultResponseMessage(int result)
+{
+    switch (result) {
+    case DX_METHOD_SUCCEEDED:
+        return methodSucceededMsg;
+    case DX_METHOD_NOT_FOUND:
+        return methodNotFoundMsg;
+    case DX_METHOD_TIMEOUT:
+        return methodTimeoutMsg;
+    case DX_METHOD_TOO_MANY_REQUESTS:
+        return methodRateLimitedMsg;
+    default:
+        return methodErrorMsg;
+    }
+}
+
+static void resetResponse(DX_DIRECT_METHOD_RESPONSE *response)
+{
+    response->length = 0;
+    response->overflow = false;
+}
+
+static bool appendResponse(DX_DIRECT_METHOD_RESPONSE *response, const char *data, size_t length)
+{
+    if (response->overflow || length > response->capacity - response->length) {
+        response->overflow = true;
+        return false;
+    }
+
+    memcpy(response->buffer + response->length, data, length);
+    response->length += length;
+
+    return true;
+}
+
+bool dx_directMethodResponseJson(DX_DIRECT_METHOD_RESPONSE *response, const JSON_Value *value)
+{
+    if (response == NULL) {
+        return false;
+    }
+
+    // Includes the NULL terminator json_serialize_to_buffer writes
+    size_t size = json_serialization_size(value);
+
+    response->length = 0;
+    response->overflow = size == 0 || size > response->capacity ||
+                         json_serialize_to_buffer(value, response->buffer, response->capacity) != JSONSuccess;
+
+    if (!response->overflow) {
+        response->length = size - 1;
+    }
+
+    return !response->overflow;
+}
+
+bool dx_directMethodResponseString(DX_DIRECT_METHOD_RESPONSE *response, const char *string)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    if (response == NULL || string == NULL) {
+        return false;
+    }
+
+    response->length = 0;
+    response->overflow = false;
+
+    if (!appendResponse(response, "\"", 1)) {
+        return false;
+    }
+
+    for (const unsigned char *c = (const unsigned char *)string; *c != 0x00; c++) {
+        char escaped[6] = {'\\'};
+        size_t length = 2;
+
+        switch (*c) {
+        case '"':
+        case '\\':
+            escaped[1] = (char)*c;
+            break;
+        case '\b':
+            escaped[1] = 'b';
+            break;
+        case '\f':
+            escaped[1] = 'f';
+            break;
+        case '\n':
+            escaped[1] = 'n';
+            break;
+        case '\r':
+            escaped[1] = 'r';
+            break;
+        case '\t':
+            escaped[1] = 't';
+            break;
+        default:
+            if (*c < 0x20) {
+                memcpy(escaped, "\\u00", 4);
+                escaped[4] = hex[*c >> 4];
+                escaped[5] = hex[*c & 0x0F];
+                length = 6;
+            } else {
+                escaped[0] = (char)*c;
+                length = 1;
+            }
+            break;
+        }
+
+        if (!appendResponse(response, escaped, length)) {
+            return false;
+        }
+    }
+
+    return appendResponse(response, "\"", 1);
+}
+
+bool dx_directMethodResponsePrintf(DX_DIRECT_METHOD_RESPONSE *response, const char *format, ...)
+{
+    va_list args;
+
+    if (response == NULL || response->overflow) {
+        return false;
+    }
+
+    va_start(args, format);
+    int length = vsnprintf(response->buffer + response->length, response->capacity - response->length, format, args);
+    va_end(args);
+
+    // vsnprintf needs room for a NULL terminator that is not part of the response
+    if (length < 0 || (size_t)length >= response->capacity - response->length) {
+        response->overflow = true;
+        return false;
+    }
+
+    response->length += (size_t)length;
+
+    return true;
+}
+
+/// <summary>
+/// Take a free slot and hand the method to its asyncHandler, which may complete it before returning
+/// </summary>
+static void startAsyncMethod(DX_DIRECT_METHOD_BINDING *directMethodBinding, JSON_Value *json, METHOD_HANDLE methodId)
+{
+    uint32_t timeoutMs = directMethodBinding->timeoutMs > 0 ? directMethodBinding->timeoutMs : DX_DIRECT_METHOD_DEFAULT_TIMEOUT_MS;
+
+    for (uint32_t slot = 0; slot < DX_DIRECT_METHOD_MAX_IN_FLIGHT; slot++) {
+        ASYNC_METHOD *asyncMethod = &_asyncMethods[slot];
+
+        if (!asyncMethod->active) {
+            asyncMethod->methodId = methodId;
+            asyncMethod->client = dx_azureClientHandleGet();
+            asyncMethod->binding = directMethodBinding;
+            asyncMethod->startMs = dx_getNowMilliseconds();
+            asyncMethod->deadlineMs = asyncMethod->startMs + timeoutMs;
+            asyncMethod->active = true;
+            directMethodBinding->inFlight++;
+
+            _stats.started++;
+            if (++_stats.inFlight > _stats.inFlightHighWaterMark) {
+                _stats.inFlightHighWaterMark = _stats.inFlight;
+            }
+
+            armTimeoutTimer();
+
+            // The handler may complete the method before returning
+            directMethodBinding->asyncHandler(json, directMethodBinding, (DX_DIRECT_METHOD_TOKEN){slot, asyncMethod->generation});
+            return;
+        }
+    }
+
+    // admitMethod checked for a free slot, the handler can not have taken it
+    sendMethodResponse(methodId, DX_METHOD_TOO_MANY_REQUESTS, methodBusyMsg);
+}
+
+/// <summary>
+/// Release the slot and send the response built in _completion
+/// </summary>
+static bool finishAsyncMethod(uint32_t slot, int result)
+{
+    ASYNC_METHOD *asyncMethod = &_asyncMethods[slot];
+    bool sent = false;
+
+    asyncMethod->active = false;
+    asyncMethod->generation++;
+    asyncMethod->binding->inFlight--;
+    _stats.inFlight--;
+
+    recordExecutionTime(asyncMethod->binding, asyncMethod->startMs);
+
+    // A reconnect creates a new client, the old method handle is no longer valid
+    if (asyncMethod->client == dx_azureClientHandleGet()) {
+        sent = sendResponse(asyncMethod->methodId, result, &_completion);
+    } else {
+        _stats.abandoned++;
+    }
+
+    return sent;
+}
+
+/// <summary>
+/// Forget waiting methods without responding, IoT Hub times them out on its side
+/// </summary>
+static void abandonAsyncMethods(void)
+{
+    for (size_t slot = 0; slot < DX_DIRECT_METHOD_MAX_IN_FLIGHT; slot++) {
+        if (_asyncMethods[slot].active) {
+            _asyncMethods[slot].active = false;
+            _asyncMethods[slot].generation++;
+            _asyncMethods[slot].binding->inFlight--;
+            _stats.inFlight--;
+            _stats.abandoned++;
+        }
+    }
+}
+
+static void AsyncMethodConnectionChanged(bool connected, void *context)
+{
+    if (!connected) {
+        abandonAsyncMethods();
+    }
+}
+
+/// <summary>
+/// Arm the timeout timer for the earliest deadline. Completing a method does not disarm it, the handler
+/// finds nothing due and re-arms for the next deadline.
+/// </summary>
+static void armTimeoutTimer(void)
+{
+    int64_t earliest = INT64_MAX;
+
+    for (size_t slot = 0; slot < DX_DIRECT_METHOD_MAX_IN_FLIGHT; slot++) {
+        if (_asyncMethods[slot].active && _asyncMethods[slot].deadlineMs < earliest) {
+            earliest = _asyncMethods[slot].deadlineMs;
+        }
+    }
+
+    if (earliest == INT64_MAX) {
+        return;
+    }
+
+    int64_t delayMs = earliest - dx_getNowMilliseconds();
+    delayMs = delayMs < 1 ? 1 : delayMs;
+
+    dx_timerOneShotSet(&tmr_async_method_timeout, &(struct timespec){(time_t)(delayMs / 1000), (long)(delayMs % 1000) * 1000000});
+}
+
+/// <summary>
+/// Answer async methods that passed their deadline with DX_METHOD_TIMEOUT
+/// </summary>
+static DX_TIMER_HANDLER(async_method_timeout_handler)
+{
+    int64_t now = dx_getNowMilliseconds();
+
+    for (uint32_t slot = 0; slot < DX_DIRECT_METHOD_MAX_IN_FLIGHT; slot++) {
+        if (_asyncMethods[slot].active && _asyncMethods[slot].deadlineMs <= now) {
+            _stats.timedOut++;
+            resetResponse(&_completion);
+            dx_directMethodResponseString(&_completion, methodTimeoutMsg);
+            finishAsyncMethod(slot, DX_METHOD_TIMEOUT);
+        }
+    }
+
+    armTimeoutTimer();
+}
+DX_TIMER_HANDLER_END
+
+bool dx_directMethodAdd(DX_DIRECT_METHOD_BINDING *directMethod)
+{
+    if (directMethod == NULL || directMethod->methodName == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < _directMethodCount; i++) {
+        if (_directMethods[i] == directMethod) {
+            return false;
+        }
+    }
+
+    if (!reserveMethods(_directMethodCount + 1)) {
+        return false;
+    }
+
+    _directMethods[_directMethodCount++] = directMethod;
+    buildMethodIndex();
+
+    return true;
+}
+
+bool dx_directMethodRemove(DX_DIRECT_METHOD_BINDING *directMethod)
+{
+    for (size_t i = 0; i < _directMethodCount; i++) {
+        if (_directMethods[i] == directMethod) {
+            // Never modify the application's array, and keep the order so the first binding for a name still wins
+            if (!reserveMethods(_directMethodCount)) {
+                return false;
+            }
+
+            memmove(&_directMethods[i], &_directMethods[i + 1], (_directMethodCount - i - 1) * sizeof(DX_DIRECT_METHOD_BINDING *));
+            _directMethodCount--;
+            buildMethodIndex();
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// <summary>
+/// Make sure the bindings are in an array owned here with room for count
+/// </summary>
+static bool reserveMethods(size_t count)
+{
+    if (_directMethodCapacity >= count) {
+        return true;
+    }
+
+    size_t capacity = _directMethodCapacity > 0 ? _directMethodCapacity * 2 : 8;
+
+    while (capacity < count) {
+        capacity *= 2;
+    }
+
+    DX_DIRECT_METHOD_BINDING **directMethods = (DX_DIRECT_METHOD_BINDING **)malloc(capacity * sizeof(DX_DIRECT_METHOD_BINDING *));
+    if (directMethods == NULL) {
+        Log_Debug("ERROR: Direct method table malloc failed.\n");
+        return false;
+    }
+
+    if (_directMethodCount > 0) {
+        memcpy(directMethods, _directMethods, _directMethodCount * sizeof(DX_DIRECT_METHOD_BINDING *));
+    }
+
+    if (_directMethodCapacity > 0) {
+        free(_directMethods);
+    }
+
+    _directMethods = directMethods;
+    _directMethodCapacity = capacity;
+
+    return true;
+}
+
+static void freeMethods(void)
+{
+    if (_directMethodCapacity > 0) {
+        free(_directMethods);
+    }
+
+    dx_nameIndexFree(&_methodIndex);
 
     _directMethods = NULL;
     _directMethodCount = 0;
+    _directMethodCapacity = 0;
+}
+
+/// <summary>
+/// Rebuilt whenever a method is added or removed, in binding order so the first binding for a name wins
+/// </summary>
+static void buildMethodIndex(void)
+{
+    dx_nameIndexInit(&_methodIndex, _directMethodCount);
+
+    for (size_t i = 0; i < _directMethodCount; i++) {
+        dx_nameIndexInsert(&_methodIndex, dx_hashString(_directMethods[i]->methodName), i);
+    }
+}
+
+static DX_DIRECT_METHOD_BINDING *findMethod(const char *methodName)
+{
+    uint32_t hash = dx_hashString(methodName);
+    size_t cursor = 0;
+    size_t i;
+
+    while (dx_nameIndexNext(&_methodIndex, hash, &cursor, &i)) {
+        if (strcmp(methodName, _directMethods[i]->methodName) == 0) {
+            return _directMethods[i];
+        }
+    }
+
+    return NULL;
+}
+
+/// <summary>
+/// Send a built response. A response that overflowed the buffer is replaced with an error.
+/// </summary>
+static bool sendResponse(METHOD_HANDLE methodId, int result, DX_DIRECT_METHOD_RESPONSE *response)
+{
+    if (response->overflow) {
+        Log_Debug("ERROR: Direct method response larger than DX_DIRECT_METHOD_RESPONSE_MAX_BYTES.\n");
+        dx_directMethodResponseString(response, responseTooLargeMsg);
+        result = DX_METHOD_FAILED;
+    }
+
+    // The SDK copies the payload
+    if (IoTHubDeviceClient_LL_DeviceMethodResponse(dx_azureClientHandleGet(), methodId, (const unsigned char *)response->buffer,
+                                                   response->length, result) != IOTHUB_CLIENT_OK) {
+        Log_Debug("ERROR: Direct method response failed.\n");
+        return false;
+    }
+
+    dx_azureRequestDoWork();
+
+    return true;
+}
+
+/// <summary>
+/// Send a direct method response message as a JSON string, it is part of the JSON payload object
+/// </summary>
+static bool sendMethodResponse(METHOD_HANDLE methodId, int result, const char *responseMessage)
+{
+    resetResponse(&_response);
+    dx_directMethodResponseString(&_response, responseMessage);
+
+    return sendResponse(methodId, result, &_response);
 }
 
 /*
 This implementation of Direct Methods expects a JSON Payload Object
 */
-static int DirectMethodCallbackHandler(const char *method_name, const unsigned char *payload,
-                                          size_t payloadSize, unsigned char **responsePayload,
-                                          size_t *responsePayloadSize, void *userContextCallback)
+static int DirectMethodCallbackHandler(const char *method_name, const unsigned char *payload, size_t payloadSize, METHOD_HANDLE methodId,
+                                       void *userContextCallback)
 {
-    const char *methodSucceededMsg = "Method Succeeded";
-    const char *methodNotFoundMsg = "Method not found";
-    const char *methodErrorMsg = "Method Error";
-    const char *mallocFailedMsg = "Memory Allocation failed";
-    const char *invalidJsonMsg = "Invalid JSON";
-
     DX_DIRECT_METHOD_RESPONSE_CODE responseCode = DX_METHOD_NOT_FOUND;
     char *responseMsg = NULL;
 
@@ -45,46 +628,56 @@ static int DirectMethodCallbackHandler(const char *method_name, const unsigned c
 
     const char *responseMessage = methodNotFoundMsg;
     int result = DX_METHOD_NOT_FOUND;
-    size_t responseMessageLength;
+    bool sent = true;
 
     JSON_Value *root_value = NULL;
+    const char *rejectMessage = NULL;
+    int64_t startMs;
 
-    // Prepare the payload for the response. This is a heap allocated null terminated string.
-    // The Azure IoT Hub SDK is responsible of freeing it.
-    *responsePayload = NULL;  // Response payload content.
-    *responsePayloadSize = 0; // Response payload content size.
+    directMethodBinding = findMethod(method_name);
 
-    char *payLoadString = (char *)malloc(payloadSize + 1);
-    if (payLoadString == NULL) {
-        responseMessage = mallocFailedMsg;
-        result = DX_METHOD_FAILED;
+    // Turn away calls over the method limits before spending any time on the payload
+    if (directMethodBinding != NULL && (rejectMessage = admitMethod(directMethodBinding)) != NULL) {
+        responseMessage = rejectMessage;
+        result = DX_METHOD_TOO_MANY_REQUESTS;
         goto cleanup;
     }
 
-    memset(payLoadString, 0x00, payloadSize + 1);
-
-    memcpy(payLoadString, payload, payloadSize);
-    payLoadString[payloadSize] = 0; // null terminate string
-
-    root_value = json_parse_string(payLoadString);
+    // The payload is not NULL terminated, parse it in place using its length
+    root_value = json_parse_string_with_length((const char *)payload, payloadSize);
     if (root_value == NULL) {
         responseMessage = invalidJsonMsg;
         result = DX_METHOD_FAILED;
         goto cleanup;
     }
 
-    // loop through array of DirectMethodBindings looking for a matching method name
-    for (int i = 0; i < _directMethodCount; i++) {
-        if (strcmp(method_name, _directMethods[i]->methodName) == 0) {
-            directMethodBinding = _directMethods[i];
-            break;
+    startMs = dx_getNowMilliseconds();
+
+    // Async methods respond later with dx_directMethodComplete
+    if (directMethodBinding != NULL && directMethodBinding->asyncHandler != NULL) {
+        startAsyncMethod(directMethodBinding, root_value, methodId);
+        goto release;
+    }
+
+    // Response handlers write straight into the response buffer
+    if (directMethodBinding != NULL && directMethodBinding->responseHandler != NULL) {
+        resetResponse(&_response);
+        result = (int)directMethodBinding->responseHandler(root_value, directMethodBinding, &_response);
+
+        if (_response.length == 0 && !_response.overflow) {
+            dx_directMethodResponseString(&_response, defaultResponseMessage(result));
         }
+
+        sent = sendResponse(methodId, result, &_response);
+        recordExecutionTime(directMethodBinding, startMs);
+        goto release;
     }
 
     if (directMethodBinding != NULL &&
         directMethodBinding->handler != NULL) { // was a DX_DIRECT_METHOD_BINDING found
 
         responseCode = directMethodBinding->handler(root_value, directMethodBinding, &responseMsg);
+        recordExecutionTime(directMethodBinding, startMs);
 
         result = (int)responseCode;
 
@@ -97,44 +690,31 @@ static int DirectMethodCallbackHandler(const char *method_name, const unsigned c
             responseMessage =
                 responseMsg == NULL || strlen(responseMsg) == 0 ? methodErrorMsg : responseMsg;
             break;
+        case DX_METHOD_TIMEOUT: // 504
+            responseMessage =
+                responseMsg == NULL || strlen(responseMsg) == 0 ? methodTimeoutMsg : responseMsg;
+            break;
+        case DX_METHOD_TOO_MANY_REQUESTS: // 429
+            responseMessage =
+                responseMsg == NULL || strlen(responseMsg) == 0 ? methodRateLimitedMsg : responseMsg;
+            break;
         case DX_METHOD_NOT_FOUND:
             break;
         }
     }
 
 cleanup:
+    sent = sendMethodResponse(methodId, result, responseMessage);
 
-    // Prepare the payload for the response.
-    // The Azure IoT Hub SDK is responsible of freeing it.
-    responseMessageLength = strlen(responseMessage);
-    *responsePayloadSize =
-        responseMessageLength + 2; // add two as going to wrap the message with quotes for JSON
-
-    *responsePayload = (unsigned char *)malloc(*responsePayloadSize);
-    if (*responsePayload != NULL) {
-        memset(*responsePayload, 0x00, *responsePayloadSize);
-
-        // response message needs to be wrapped in quotes as it is part of the JSON payload object
-        memcpy(*responsePayload, "\"", 1);
-        memcpy(*responsePayload + 1, responseMessage, responseMessageLength);
-        memcpy(*responsePayload + responseMessageLength + 1, "\"", 1);
-    } else {
-        *responsePayloadSize = 0;
-    }
-
+release:
     if (root_value != NULL) {
         json_value_free(root_value);
     }
 
-    if (payLoadString != NULL) {
-        free(payLoadString);
-        payLoadString = NULL;
-    }
-
     if (responseMsg != NULL) { // there was memory allocated for a response message so free it now
         free(responseMsg);
         responseMsg = NULL;
     }
 
-    return result;
-}
\ No newline at end of file
+    return sent ? 0 : -1;
+}
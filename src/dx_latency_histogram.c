@@ -0,0 +1,100 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_latency_histogram.h"
+
+static size_t bucketIndex(uint32_t latencyMs)
+{
+    if (latencyMs < 4) {
+        return latencyMs;
+    }
+
+    int exponent = 31 - __builtin_clz(latencyMs); // floor(log2(latencyMs)), at least 2
+    size_t subBucket = (latencyMs >> (exponent - 2)) & 0x03;
+    size_t index = (size_t)(4 * (exponent - 1)) + subBucket;
+
+    return index < DX_LATENCY_HISTOGRAM_BUCKETS ? index : DX_LATENCY_HISTOGRAM_BUCKETS - 1;
+}
+
+static uint32_t bucketUpperBound(size_t index)
+{
+    if (index < 3) {
+        return (uint32_t)index;
+    }
+
+    if (index + 1 >= DX_LATENCY_HISTOGRAM_BUCKETS) {
+        return UINT32_MAX;
+    }
+
+    // Lower bound of the next bucket less one
+    size_t next = index + 1;
+    uint32_t exponent = (uint32_t)(next / 4 + 1);
+    uint32_t subBucket = (uint32_t)(next % 4);
+
+    return ((4 + subBucket) << (exponent - 2)) - 1;
+}
+
+static uint32_t percentile(const DX_LATENCY_HISTOGRAM *histogram, uint32_t percent)
+{
+    // Rank of the sample at the percentile, rounded up
+    uint64_t rank = ((uint64_t)histogram->count * percent + 99) / 100;
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < DX_LATENCY_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank && seen > 0) {
+            uint32_t upper = bucketUpperBound(i);
+            return upper < histogram->maxMs ? upper : histogram->maxMs;
+        }
+    }
+
+    return histogram->maxMs;
+}
+
+void dx_latencyHistogramRecord(DX_LATENCY_HISTOGRAM *histogram, uint32_t latencyMs)
+{
+    if (histogram == NULL) {
+        return;
+    }
+
+    histogram->buckets[bucketIndex(latencyMs)]++;
+
+    if (histogram->count == 0 || latencyMs < histogram->minMs) {
+        histogram->minMs = latencyMs;
+    }
+
+    if (latencyMs > histogram->maxMs) {
+        histogram->maxMs = latencyMs;
+    }
+
+    histogram->count++;
+    histogram->totalMs += latencyMs;
+}
+
+void dx_latencyHistogramGetStats(const DX_LATENCY_HISTOGRAM *histogram, DX_LATENCY_STATS *stats)
+{
+    if (histogram == NULL || stats == NULL) {
+        return;
+    }
+
+    memset(stats, 0x00, sizeof(DX_LATENCY_STATS));
+
+    if (histogram->count == 0) {
+        return;
+    }
+
+    stats->count = histogram->count;
+    stats->minMs = histogram->minMs;
+    stats->maxMs = histogram->maxMs;
+    stats->meanMs = (uint32_t)(histogram->totalMs / histogram->count);
+    stats->p50Ms = percentile(histogram, 50);
+    stats->p95Ms = percentile(histogram, 95);
+    stats->p99Ms = percentile(histogram, 99);
+}
+
+void dx_latencyHistogramReset(DX_LATENCY_HISTOGRAM *histogram)
+{
+    if (histogram != NULL) {
+        memset(histogram, 0x00, sizeof(DX_LATENCY_HISTOGRAM));
+    }
+}
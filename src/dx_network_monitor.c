@@ -0,0 +1,207 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_network_monitor.h"
+
+static DX_DECLARE_TIMER_HANDLER(network_monitor_handler);
+static bool applibsIsInterfaceConnected(const char *networkInterface);
+
+typedef struct {
+    DX_NETWORK_CHANGED_CALLBACK callback;
+    void *context;
+} NETWORK_SUBSCRIBER;
+
+static DX_TIMER_BINDING tmr_network_monitor = {.name = "tmr_network_monitor", .handler = network_monitor_handler};
+static DX_NETWORK_MONITOR_CONFIG _config;
+static const DX_NETWORK_MONITOR_PROVIDER applibsProvider = {.isNetworkingReady = dx_isNetworkReady,
+                                                            .isInterfaceConnected = applibsIsInterfaceConnected};
+static DX_NETWORK_MONITOR_PROVIDER _provider = {.isNetworkingReady = dx_isNetworkReady,
+                                                .isInterfaceConnected = applibsIsInterfaceConnected};
+static DX_NETWORK_MONITOR_STATS _stats;
+static bool _connected = false;
+static bool _started = false;
+static NETWORK_SUBSCRIBER *_subscribers = NULL;
+static size_t _subscriberCount = 0;
+static size_t _subscriberCapacity = 0;
+static bool _dispatching = false;
+
+/// <summary>
+/// When the interface status can not be read fall back to networking ready, as dx_isNetworkConnected does
+/// </summary>
+static bool applibsIsInterfaceConnected(const char *networkInterface)
+{
+    Networking_InterfaceConnectionStatus status;
+
+    if (Networking_GetInterfaceConnectionStatus(networkInterface, &status) != 0) {
+        Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: %d (%s)\n", errno, strerror(errno));
+        return dx_isNetworkReady();
+    }
+
+    return (status & Networking_InterfaceConnectionStatus_ConnectedToInternet) != 0;
+}
+
+/// <summary>
+/// Drop the subscribers unregistered while a change was being dispatched
+/// </summary>
+static void compactSubscribers(void)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < _subscriberCount; i++) {
+        if (_subscribers[i].callback != NULL) {
+            _subscribers[count++] = _subscribers[i];
+        }
+    }
+
+    _subscriberCount = count;
+}
+
+static void scheduleRefresh(void)
+{
+    uint32_t delayMs = _connected ? _config.refreshMs : _config.degradedRefreshMs;
+
+    dx_timerOneShotSet(&tmr_network_monitor, &(struct timespec){delayMs / 1000, (delayMs % 1000) * 1000000});
+}
+
+bool dx_networkMonitorRefresh(void)
+{
+    bool connected = false;
+
+    if (_provider.isNetworkingReady != NULL && _provider.isNetworkingReady()) {
+        // No interface to check, networking ready is as good as it gets
+        connected = dx_isStringNullOrEmpty(_config.networkInterface) || _provider.isInterfaceConnected == NULL ||
+                    _provider.isInterfaceConnected(_config.networkInterface);
+    }
+
+    _stats.refreshes++;
+
+    if (connected != _connected) {
+        _connected = connected;
+        _stats.changes++;
+        _stats.lastChangeMs = dx_getNowMilliseconds();
+
+        _dispatching = true;
+
+        // Subscribers added during the dispatch are appended and not called until the next change
+        size_t count = _subscriberCount;
+
+        for (size_t i = 0; i < count; i++) {
+            NETWORK_SUBSCRIBER subscriber = _subscribers[i];
+
+            if (subscriber.callback != NULL) {
+                subscriber.callback(_connected, subscriber.context);
+            }
+        }
+
+        _dispatching = false;
+        compactSubscribers();
+    }
+
+    if (_started) {
+        scheduleRefresh();
+    }
+
+    return _connected;
+}
+
+static DX_TIMER_HANDLER(network_monitor_handler)
+{
+    dx_networkMonitorRefresh();
+}
+DX_TIMER_HANDLER_END
+
+bool dx_networkMonitorStart(const DX_NETWORK_MONITOR_CONFIG *config)
+{
+    if (config != NULL) {
+        _config = *config;
+    }
+
+    if (_config.refreshMs == 0) {
+        _config.refreshMs = DX_NETWORK_MONITOR_REFRESH_MILLISECONDS;
+    }
+
+    if (_config.degradedRefreshMs == 0) {
+        _config.degradedRefreshMs = DX_NETWORK_MONITOR_DEGRADED_REFRESH_MILLISECONDS;
+    }
+
+    if (!dx_timerStart(&tmr_network_monitor)) {
+        return false;
+    }
+
+    _started = true;
+    dx_networkMonitorRefresh();
+
+    return true;
+}
+
+void dx_networkMonitorStop(void)
+{
+    dx_timerStop(&tmr_network_monitor);
+    _started = false;
+}
+
+bool dx_networkMonitorIsRunning(void)
+{
+    return _started;
+}
+
+bool dx_networkMonitorIsConnected(void)
+{
+    return _connected;
+}
+
+void dx_networkMonitorSetProvider(const DX_NETWORK_MONITOR_PROVIDER *provider)
+{
+    if (provider == NULL) {
+        _provider = applibsProvider;
+    } else {
+        _provider = *provider;
+    }
+}
+
+bool dx_networkMonitorRegisterChangedNotification(DX_NETWORK_CHANGED_CALLBACK networkChangedCallback, void *context)
+{
+    if (networkChangedCallback == NULL) {
+        return false;
+    }
+
+    if (_subscriberCount == _subscriberCapacity) {
+        size_t capacity = _subscriberCapacity == 0 ? 4 : _subscriberCapacity * 2;
+        NETWORK_SUBSCRIBER *grown = (NETWORK_SUBSCRIBER *)realloc(_subscribers, capacity * sizeof(NETWORK_SUBSCRIBER));
+
+        if (grown == NULL) {
+            Log_Debug("ERROR: Network monitor subscriber realloc failed.\n");
+            return false;
+        }
+
+        _subscribers = grown;
+        _subscriberCapacity = capacity;
+    }
+
+    _subscribers[_subscriberCount++] = (NETWORK_SUBSCRIBER){.callback = networkChangedCallback, .context = context};
+
+    return true;
+}
+
+/// <summary>
+/// Tombstone matching subscribers so a callback can unregister itself or another during a dispatch
+/// </summary>
+void dx_networkMonitorUnregisterChangedNotification(DX_NETWORK_CHANGED_CALLBACK networkChangedCallback, void *context)
+{
+    for (size_t i = 0; i < _subscriberCount; i++) {
+        if (_subscribers[i].callback == networkChangedCallback && _subscribers[i].context == context) {
+            _subscribers[i].callback = NULL;
+        }
+    }
+
+    if (!_dispatching) {
+        compactSubscribers();
+    }
+}
+
+void dx_networkMonitorGetStats(DX_NETWORK_MONITOR_STATS *stats)
+{
+    if (stats != NULL) {
+        *stats = _stats;
+    }
+}
@@ -0,0 +1,74 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_retry_policy.h"
+
+static uint32_t nextRandom(void);
+
+static uint32_t randomState = 0;
+
+/// <summary>
+/// xorshift32, seeded from the wall clock and monotonic clock so devices booted together still diverge
+/// </summary>
+static uint32_t nextRandom(void)
+{
+    if (randomState == 0) {
+        struct timespec realtime, monotonic;
+        clock_gettime(CLOCK_REALTIME, &realtime);
+        clock_gettime(CLOCK_MONOTONIC, &monotonic);
+
+        randomState = (uint32_t)(realtime.tv_sec ^ realtime.tv_nsec ^ (monotonic.tv_nsec << 7) ^ monotonic.tv_sec);
+        if (randomState == 0) {
+            randomState = 0x9E3779B9;
+        }
+    }
+
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+
+    return randomState;
+}
+
+uint32_t dx_retryPolicyExponential(const DX_RETRY_POLICY *policy)
+{
+    uint64_t delay = policy->baseDelayMs;
+
+    for (uint32_t i = 1; i < policy->attempt && delay < policy->maxDelayMs; i++) {
+        delay *= 2;
+    }
+
+    return delay > policy->maxDelayMs ? policy->maxDelayMs : (uint32_t)delay;
+}
+
+uint32_t dx_retryPolicyFullJitter(const DX_RETRY_POLICY *policy)
+{
+    uint32_t ceiling = dx_retryPolicyExponential(policy);
+
+    return ceiling == 0 ? 0 : (uint32_t)(nextRandom() % ((uint64_t)ceiling + 1));
+}
+
+uint32_t dx_retryPolicyNextDelay(DX_RETRY_POLICY *policy)
+{
+    if (policy == NULL) {
+        return 1;
+    }
+
+    policy->attempt++;
+    policy->nextDelayMs = policy->delayFunction != NULL ? policy->delayFunction(policy) : dx_retryPolicyFullJitter(policy);
+
+    // A zero timespec disarms a one shot timer
+    if (policy->nextDelayMs == 0) {
+        policy->nextDelayMs = 1;
+    }
+
+    return policy->nextDelayMs;
+}
+
+void dx_retryPolicyReset(DX_RETRY_POLICY *policy)
+{
+    if (policy != NULL) {
+        policy->attempt = 0;
+        policy->nextDelayMs = 0;
+    }
+}
@@ -0,0 +1,312 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_storage.h"
+
+static bool loadFile(uint8_t **contents, size_t *length);
+static bool rewriteFile(uint16_t id, const void *data, size_t length, bool remove);
+
+#define DX_STORAGE_RECORD_MAGIC 0x44585354 // "DXST"
+
+// Each region starts with this header followed by length bytes of records
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t length;
+    uint32_t crc;
+} DX_STORAGE_REGION_HEADER;
+
+typedef struct {
+    uint16_t id;
+    uint16_t reserved;
+    uint32_t length;
+} DX_STORAGE_RECORD_HEADER;
+
+// The records of the newest valid region
+typedef struct {
+    const uint8_t *records;
+    size_t length;
+    uint32_t generation;
+    size_t index;
+} DX_STORAGE_REGION;
+
+static uint32_t crc32(const uint8_t *data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+
+    return ~crc;
+}
+
+/// <summary>
+/// Read the whole mutable file. contents is NULL when the file is empty.
+/// </summary>
+static bool loadFile(uint8_t **contents, size_t *length)
+{
+    uint8_t chunk[256];
+    uint8_t *buffer = NULL;
+    size_t size = 0;
+    ssize_t bytesRead;
+    int fd;
+
+    *contents = NULL;
+    *length = 0;
+
+    if ((fd = Storage_OpenMutableFile()) == -1) {
+        Log_Debug("ERROR: Could not open mutable file: %s (%d).\n", strerror(errno), errno);
+        return false;
+    }
+
+    while ((bytesRead = read(fd, chunk, sizeof(chunk))) > 0) {
+        uint8_t *grown = (uint8_t *)realloc(buffer, size + (size_t)bytesRead);
+        if (grown == NULL) {
+            Log_Debug("ERROR: Mutable file read realloc failed.\n");
+            free(buffer);
+            close(fd);
+            return false;
+        }
+        buffer = grown;
+        memcpy(buffer + size, chunk, (size_t)bytesRead);
+        size += (size_t)bytesRead;
+    }
+
+    close(fd);
+
+    if (bytesRead < 0) {
+        Log_Debug("ERROR: Could not read mutable file: %s (%d).\n", strerror(errno), errno);
+        free(buffer);
+        return false;
+    }
+
+    *contents = buffer;
+    *length = size;
+
+    return true;
+}
+
+/// <summary>
+/// The file is ours if either region starts with a header written by this module. A file no longer than the
+/// two regions is taken as ours too, a torn write of region 0 may have lost its header and the records that
+/// survive in region 1 or the next write must not be refused because of it.
+/// </summary>
+static bool isStorageFile(const uint8_t *contents, size_t length)
+{
+    uint32_t magic;
+
+    if (length <= 2 * DX_STORAGE_REGION_BYTES) {
+        return true;
+    }
+
+    // Longer than the two regions, so both headers are there to check
+    for (size_t index = 0; index < 2; index++) {
+        memcpy(&magic, contents + index * DX_STORAGE_REGION_BYTES, sizeof(magic));
+        if (magic == DX_STORAGE_RECORD_MAGIC) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// <summary>
+/// Pick the region with the highest generation whose CRC checks out. With neither valid there are no records
+/// and the next write goes to region 0.
+/// </summary>
+static bool findCurrentRegion(const uint8_t *contents, size_t length, DX_STORAGE_REGION *region)
+{
+    DX_STORAGE_REGION_HEADER header;
+    bool found = false;
+
+    *region = (DX_STORAGE_REGION){.records = NULL, .length = 0, .generation = 0, .index = 1};
+
+    for (size_t index = 0; index < 2; index++) {
+        size_t offset = index * DX_STORAGE_REGION_BYTES;
+
+        if (offset + sizeof(DX_STORAGE_REGION_HEADER) > length) {
+            break;
+        }
+
+        memcpy(&header, contents + offset, sizeof(DX_STORAGE_REGION_HEADER));
+        offset += sizeof(DX_STORAGE_REGION_HEADER);
+
+        if (header.magic != DX_STORAGE_RECORD_MAGIC || header.length > DX_STORAGE_REGION_BYTES - sizeof(DX_STORAGE_REGION_HEADER) ||
+            header.length > length - offset || crc32(contents + offset, header.length) != header.crc) {
+            continue;
+        }
+
+        if (!found || header.generation > region->generation) {
+            *region = (DX_STORAGE_REGION){
+                .records = contents + offset, .length = header.length, .generation = header.generation, .index = index};
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+/// <summary>
+/// Step to the next record in a region, the region CRC has already been checked
+/// </summary>
+static bool nextRecord(const DX_STORAGE_REGION *region, size_t *offset, DX_STORAGE_RECORD_HEADER *header)
+{
+    if (*offset + sizeof(DX_STORAGE_RECORD_HEADER) > region->length) {
+        return false;
+    }
+
+    memcpy(header, region->records + *offset, sizeof(DX_STORAGE_RECORD_HEADER));
+
+    if (header->length > region->length - *offset - sizeof(DX_STORAGE_RECORD_HEADER)) {
+        return false;
+    }
+
+    *offset += sizeof(DX_STORAGE_RECORD_HEADER);
+    return true;
+}
+
+/// <summary>
+/// Copy every record except id, append the new record unless removing, then write the set to the other region
+/// with the next generation. The current region is not touched so it is still there if the write is torn.
+/// </summary>
+static bool rewriteFile(uint16_t id, const void *data, size_t length, bool remove)
+{
+    DX_STORAGE_RECORD_HEADER header;
+    DX_STORAGE_REGION region;
+    DX_STORAGE_REGION_HEADER regionHeader;
+    uint8_t *contents = NULL;
+    uint8_t *output = NULL;
+    size_t contentsLength = 0;
+    size_t outputLength = sizeof(DX_STORAGE_REGION_HEADER);
+    size_t offset = 0;
+    off_t regionOffset;
+    bool result = false;
+    int fd = -1;
+
+    if (!loadFile(&contents, &contentsLength)) {
+        return false;
+    }
+
+    if (!isStorageFile(contents, contentsLength)) {
+        Log_Debug("ERROR: Mutable file holds data not written by dx_storage, it will not be overwritten.\n");
+        goto cleanup;
+    }
+
+    findCurrentRegion(contents, contentsLength, &region);
+
+    if ((output = (uint8_t *)malloc(DX_STORAGE_REGION_BYTES)) == NULL) {
+        Log_Debug("ERROR: Mutable file write malloc failed.\n");
+        goto cleanup;
+    }
+
+    while (nextRecord(&region, &offset, &header)) {
+        if (header.id != id) {
+            memcpy(output + outputLength, &header, sizeof(DX_STORAGE_RECORD_HEADER));
+            memcpy(output + outputLength + sizeof(DX_STORAGE_RECORD_HEADER), region.records + offset, header.length);
+            outputLength += sizeof(DX_STORAGE_RECORD_HEADER) + header.length;
+        }
+        offset += header.length;
+    }
+
+    if (!remove) {
+        if (outputLength + sizeof(DX_STORAGE_RECORD_HEADER) + length > DX_STORAGE_REGION_BYTES) {
+            Log_Debug("ERROR: Storage record %u does not fit, increase DX_STORAGE_REGION_BYTES.\n", id);
+            goto cleanup;
+        }
+
+        header = (DX_STORAGE_RECORD_HEADER){.id = id, .length = (uint32_t)length};
+        memcpy(output + outputLength, &header, sizeof(DX_STORAGE_RECORD_HEADER));
+        memcpy(output + outputLength + sizeof(DX_STORAGE_RECORD_HEADER), data, length);
+        outputLength += sizeof(DX_STORAGE_RECORD_HEADER) + length;
+    }
+
+    regionHeader = (DX_STORAGE_REGION_HEADER){.magic = DX_STORAGE_RECORD_MAGIC,
+                                              .generation = region.generation + 1,
+                                              .length = (uint32_t)(outputLength - sizeof(DX_STORAGE_REGION_HEADER)),
+                                              .crc = crc32(output + sizeof(DX_STORAGE_REGION_HEADER),
+                                                           outputLength - sizeof(DX_STORAGE_REGION_HEADER))};
+    memcpy(output, &regionHeader, sizeof(DX_STORAGE_REGION_HEADER));
+
+    regionOffset = (off_t)((1 - region.index) * DX_STORAGE_REGION_BYTES);
+
+    if ((fd = Storage_OpenMutableFile()) == -1) {
+        Log_Debug("ERROR: Could not open mutable file: %s (%d).\n", strerror(errno), errno);
+        goto cleanup;
+    }
+
+    // Region 1 starts past the end of the file until it is first written, grow the file rather than seek past the end
+    if ((size_t)regionOffset > contentsLength && ftruncate(fd, regionOffset) != 0) {
+        Log_Debug("ERROR: Could not extend mutable file: %s (%d).\n", strerror(errno), errno);
+        goto cleanup;
+    }
+
+    if (lseek(fd, regionOffset, SEEK_SET) != regionOffset || write(fd, output, outputLength) != (ssize_t)outputLength) {
+        Log_Debug("ERROR: Could not write mutable file: %s (%d).\n", strerror(errno), errno);
+        goto cleanup;
+    }
+
+    result = true;
+
+cleanup:
+    if (fd != -1) {
+        close(fd);
+    }
+
+    free(contents);
+    free(output);
+
+    return result;
+}
+
+bool dx_storageWrite(uint16_t id, const void *data, size_t length)
+{
+    if (data == NULL && length > 0) {
+        return false;
+    }
+
+    return rewriteFile(id, data, length, false);
+}
+
+bool dx_storageDelete(uint16_t id)
+{
+    return rewriteFile(id, NULL, 0, true);
+}
+
+bool dx_storageRead(uint16_t id, void *buffer, size_t bufferSize, size_t *length)
+{
+    DX_STORAGE_RECORD_HEADER header;
+    DX_STORAGE_REGION region;
+    uint8_t *contents = NULL;
+    size_t contentsLength = 0;
+    size_t offset = 0;
+    bool result = false;
+
+    if (!loadFile(&contents, &contentsLength)) {
+        return false;
+    }
+
+    // Only a region with the magic and a matching CRC is read, so there is no need to check whose file it is
+    if (findCurrentRegion(contents, contentsLength, &region)) {
+        while (nextRecord(&region, &offset, &header)) {
+            if (header.id == id) {
+                if (header.length <= bufferSize) {
+                    memcpy(buffer, region.records + offset, header.length);
+                    if (length != NULL) {
+                        *length = header.length;
+                    }
+                    result = true;
+                }
+                break;
+            }
+            offset += header.length;
+        }
+    }
+
+    free(contents);
+
+    return result;
+}
@@ -0,0 +1,307 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_telemetry_batch.h"
+
+static DX_DECLARE_TIMER_HANDLER(batch_max_age_handler);
+static bool encodeProperties(uint8_t *buffer, size_t *length, size_t *propertyCount, DX_MESSAGE_PROPERTY **messageProperties,
+                             size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties);
+static void armMaxAgeTimer(uint32_t delayMs);
+static void resetBatch(void);
+
+static DX_TIMER_BINDING tmr_batch_max_age = {.name = "tmr_batch_max_age", .handler = batch_max_age_handler};
+
+static char *_buffer = NULL;
+static size_t _length = 0;
+static size_t _batchCount = 0;
+static int64_t _batchStartMs = 0;
+static DX_TELEMETRY_BATCH_CONFIG _config;
+static DX_TELEMETRY_BATCH_STATS _stats;
+static DX_TELEMETRY_BATCH_SEND _send = NULL;
+
+// Properties shared by every message in the current batch, stored as NULL terminated key and value pairs
+// followed by a flag byte and the NULL terminated content encoding and content type.
+static uint8_t _properties[DX_TELEMETRY_BATCH_PROPERTY_BYTES];
+static size_t _propertiesLength = 0;
+static size_t _propertyCount = 0;
+
+bool dx_telemetryBatchInit(const DX_TELEMETRY_BATCH_CONFIG *config)
+{
+    // Room for the array brackets and at least one byte of payload
+    if (config == NULL || config->maxBatchBytes < 3 || config->maxAgeMs == 0) {
+        Log_Debug("ERROR: Telemetry batching requires maxBatchBytes of at least 3 and a non zero maxAgeMs\n");
+        return false;
+    }
+
+    dx_telemetryBatchDeinit();
+
+    if ((_buffer = (char *)malloc(config->maxBatchBytes)) == NULL) {
+        Log_Debug("ERROR: Telemetry batch malloc failed.\n");
+        return false;
+    }
+
+    _config = *config;
+    resetBatch();
+
+    if (!dx_timerStart(&tmr_batch_max_age)) {
+        free(_buffer);
+        _buffer = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void dx_telemetryBatchDeinit(void)
+{
+    if (_buffer != NULL) {
+        if (_send != NULL) {
+            dx_telemetryBatchFlush(_send);
+        }
+
+        if (_batchCount > 0) {
+            _stats.dropped += (uint32_t)_batchCount;
+        }
+
+        dx_timerStop(&tmr_batch_max_age);
+        free(_buffer);
+        _buffer = NULL;
+    }
+
+    resetBatch();
+}
+
+bool dx_telemetryBatchIsEnabled(void)
+{
+    return _buffer != NULL;
+}
+
+size_t dx_telemetryBatchPendingCount(void)
+{
+    return _batchCount;
+}
+
+void dx_telemetryBatchGetStats(DX_TELEMETRY_BATCH_STATS *stats)
+{
+    if (stats != NULL) {
+        *stats = _stats;
+        stats->messagesPerPublish = _stats.publishes > 0 ? (float)_stats.messages / (float)_stats.publishes : 0.0f;
+    }
+}
+
+void dx_telemetryBatchResetStats(void)
+{
+    memset(&_stats, 0x00, sizeof(_stats));
+}
+
+static void resetBatch(void)
+{
+    _length = 0;
+    _batchCount = 0;
+    _propertiesLength = 0;
+    _propertyCount = 0;
+}
+
+static void armMaxAgeTimer(uint32_t delayMs)
+{
+    dx_timerOneShotSet(&tmr_batch_max_age, &(struct timespec){delayMs / 1000, (delayMs % 1000) * 1000000});
+}
+
+/// <summary>
+/// Publish the batch when it reaches maxAgeMs. The timer can not be cancelled so a batch started after an
+/// explicit flush re-arms for the rest of its age.
+/// </summary>
+static DX_TIMER_HANDLER(batch_max_age_handler)
+{
+    if (_batchCount == 0 || _send == NULL) {
+        return;
+    }
+
+    int64_t age = dx_getNowMilliseconds() - _batchStartMs;
+
+    if (age < _config.maxAgeMs) {
+        armMaxAgeTimer((uint32_t)(_config.maxAgeMs - age));
+        return;
+    }
+
+    dx_telemetryBatchFlush(_send);
+}
+DX_TIMER_HANDLER_END
+
+static bool appendString(uint8_t *buffer, size_t *length, const char *string)
+{
+    size_t stringLength = string == NULL ? 0 : strlen(string);
+
+    if (*length + stringLength + 1 > DX_TELEMETRY_BATCH_PROPERTY_BYTES) {
+        return false;
+    }
+
+    memcpy(buffer + *length, string == NULL ? "" : string, stringLength + 1);
+    *length += stringLength + 1;
+
+    return true;
+}
+
+/// <summary>
+/// Flatten the properties so two messages can be compared with memcmp and the batch can keep its own copy
+/// </summary>
+static bool encodeProperties(uint8_t *buffer, size_t *length, size_t *propertyCount, DX_MESSAGE_PROPERTY **messageProperties,
+                             size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties)
+{
+    *length = 0;
+    *propertyCount = 0;
+
+    if (messageProperties != NULL) {
+        for (size_t i = 0; i < messagePropertyCount; i++) {
+            // Same filter dx_azurePublish applies when setting properties on the IoT Hub message
+            if (dx_isStringNullOrEmpty(messageProperties[i]->key) || dx_isStringNullOrEmpty(messageProperties[i]->value)) {
+                continue;
+            }
+
+            if (*propertyCount == DX_TELEMETRY_BATCH_MAX_PROPERTIES || !appendString(buffer, length, messageProperties[i]->key) ||
+                !appendString(buffer, length, messageProperties[i]->value)) {
+                return false;
+            }
+            (*propertyCount)++;
+        }
+    }
+
+    if (*length + 1 > DX_TELEMETRY_BATCH_PROPERTY_BYTES) {
+        return false;
+    }
+    buffer[(*length)++] = messageContentProperties != NULL ? 1 : 0;
+
+    if (messageContentProperties != NULL) {
+        if (!appendString(buffer, length, messageContentProperties->contentEncoding) ||
+            !appendString(buffer, length, messageContentProperties->contentType)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static const char *nextString(const uint8_t *buffer, size_t *offset)
+{
+    const char *string = (const char *)(buffer + *offset);
+    *offset += strlen(string) + 1;
+    return string;
+}
+
+DX_PUBLISH_RESULT dx_telemetryBatchFlush(DX_TELEMETRY_BATCH_SEND send)
+{
+    DX_MESSAGE_PROPERTY properties[DX_TELEMETRY_BATCH_MAX_PROPERTIES];
+    DX_MESSAGE_PROPERTY *propertyList[DX_TELEMETRY_BATCH_MAX_PROPERTIES];
+    DX_MESSAGE_CONTENT_PROPERTIES contentProperties;
+    DX_MESSAGE_CONTENT_PROPERTIES *contentPropertiesPtr = NULL;
+    size_t offset = 0;
+
+    if (_buffer == NULL || _batchCount == 0) {
+        return DX_PUBLISH_OK;
+    }
+
+    if (send == NULL) {
+        return DX_PUBLISH_FAILED;
+    }
+
+    for (size_t i = 0; i < _propertyCount; i++) {
+        properties[i].key = nextString(_properties, &offset);
+        properties[i].value = nextString(_properties, &offset);
+        propertyList[i] = &properties[i];
+    }
+
+    if (_properties[offset++] != 0) {
+        contentProperties.contentEncoding = nextString(_properties, &offset);
+        contentProperties.contentType = nextString(_properties, &offset);
+        contentPropertiesPtr = &contentProperties;
+    }
+
+    // Room for the closing bracket was reserved when each message was appended
+    _buffer[_length] = ']';
+
+    DX_PUBLISH_RESULT result =
+        send(_buffer, _length + 1, _propertyCount > 0 ? propertyList : NULL, _propertyCount, contentPropertiesPtr);
+
+    switch (result) {
+    case DX_PUBLISH_OK:
+    case DX_PUBLISH_QUEUED:
+        // Each message after the first avoided its own publish and properties but added a separator
+        if (_batchCount > 1) {
+            size_t saved = (_batchCount - 1) * (DX_TELEMETRY_BATCH_MESSAGE_OVERHEAD + _propertiesLength);
+            size_t framing = _batchCount + 1;
+            _stats.bytesSaved += saved > framing ? (uint32_t)(saved - framing) : 0;
+        }
+        _stats.publishes++;
+        resetBatch();
+        break;
+    case DX_PUBLISH_WOULD_BLOCK:
+        // Keep the batch and try again later
+        armMaxAgeTimer(_config.maxAgeMs);
+        break;
+    default:
+        Log_Debug("ERROR: Telemetry batch of %zu messages failed to publish\n", _batchCount);
+        _stats.dropped += (uint32_t)_batchCount;
+        resetBatch();
+        break;
+    }
+
+    return result;
+}
+
+DX_PUBLISH_RESULT dx_telemetryBatchAppend(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                                          size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                                          DX_TELEMETRY_BATCH_SEND send)
+{
+    uint8_t encoded[DX_TELEMETRY_BATCH_PROPERTY_BYTES];
+    size_t encodedLength = 0;
+    size_t encodedCount = 0;
+    DX_PUBLISH_RESULT result;
+
+    if (_buffer == NULL || send == NULL) {
+        return DX_PUBLISH_FAILED;
+    }
+
+    _send = send;
+
+    // Opening bracket or separator, the payload, and room for the closing bracket
+    bool fitsEmptyBatch = messageLength + 2 <= _config.maxBatchBytes;
+
+    if (!fitsEmptyBatch ||
+        !encodeProperties(encoded, &encodedLength, &encodedCount, messageProperties, messagePropertyCount, messageContentProperties)) {
+        // Can not be batched, send on its own but keep ordering with anything already batched
+        if ((result = dx_telemetryBatchFlush(send)) == DX_PUBLISH_WOULD_BLOCK) {
+            return result;
+        }
+        _stats.bypassed++;
+        return send(message, messageLength, messageProperties, messagePropertyCount, messageContentProperties);
+    }
+
+    // A batch carries one set of properties, and must fit the new message
+    if (_batchCount > 0 && (encodedLength != _propertiesLength || memcmp(encoded, _properties, encodedLength) != 0 ||
+                            _length + 1 + messageLength + 1 > _config.maxBatchBytes)) {
+        if ((result = dx_telemetryBatchFlush(send)) == DX_PUBLISH_WOULD_BLOCK) {
+            return result;
+        }
+    }
+
+    if (_batchCount == 0) {
+        memcpy(_properties, encoded, encodedLength);
+        _propertiesLength = encodedLength;
+        _propertyCount = encodedCount;
+        _batchStartMs = dx_getNowMilliseconds();
+        armMaxAgeTimer(_config.maxAgeMs);
+    }
+
+    _buffer[_length++] = _batchCount == 0 ? '[' : ',';
+    memcpy(_buffer + _length, message, messageLength);
+    _length += messageLength;
+    _batchCount++;
+    _stats.messages++;
+
+    // Publish now if nothing more will fit
+    if (_length + 2 >= _config.maxBatchBytes) {
+        dx_telemetryBatchFlush(send);
+    }
+
+    return DX_PUBLISH_QUEUED;
+}
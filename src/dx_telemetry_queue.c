@@ -0,0 +1,288 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_telemetry_queue.h"
+
+static uint8_t *slotAt(size_t index);
+static void completeSlot(const uint8_t *slot, IOTHUB_CLIENT_CONFIRMATION_RESULT result);
+
+// Each slot starts with this header followed by the message bytes, then a NULL terminated key and value
+// for each application property, then the NULL terminated content encoding and content type.
+typedef struct {
+    size_t messageLength;
+    size_t propertyCount;
+    bool hasContentProperties;
+    DX_PUBLISH_COMPLETION_CALLBACK completionCallback;
+    void *context;
+    int64_t publishTimeMs;
+} QUEUE_SLOT_HEADER;
+
+static uint8_t *_slots = NULL;
+static size_t _slotSize = 0;
+static size_t _slotCount = 0;
+static size_t _head = 0;
+static size_t _count = 0;
+static DX_TELEMETRY_QUEUE_CONFIG _config;
+static DX_TELEMETRY_QUEUE_STATS _stats;
+
+bool dx_telemetryQueueInit(const DX_TELEMETRY_QUEUE_CONFIG *config)
+{
+    if (config == NULL || config->slotSize <= sizeof(QUEUE_SLOT_HEADER) || config->byteBudget < config->slotSize) {
+        Log_Debug("ERROR: Telemetry queue requires a slot size larger than %zu bytes and a byte budget of at least one slot\n",
+                  sizeof(QUEUE_SLOT_HEADER));
+        return false;
+    }
+
+    dx_telemetryQueueDeinit();
+
+    _config = *config;
+    _slotSize = config->slotSize;
+    _slotCount = config->byteBudget / config->slotSize;
+
+    if (_config.drainPerTick == 0) {
+        _config.drainPerTick = 1;
+    }
+
+    _slots = (uint8_t *)malloc(_slotCount * _slotSize);
+    if (_slots == NULL) {
+        Log_Debug("ERROR: Telemetry queue malloc failed.\n");
+        _slotCount = 0;
+        return false;
+    }
+
+    memset(&_stats, 0x00, sizeof(_stats));
+    _stats.capacity = (uint32_t)_slotCount;
+
+    return true;
+}
+
+void dx_telemetryQueueDeinit(void)
+{
+    if (_slots != NULL) {
+        for (size_t i = 0; i < _count; i++) {
+            completeSlot(slotAt(i), IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY);
+        }
+
+        free(_slots);
+        _slots = NULL;
+    }
+
+    _slotCount = 0;
+    _head = 0;
+    _count = 0;
+}
+
+bool dx_telemetryQueueIsEnabled(void)
+{
+    return _slots != NULL;
+}
+
+bool dx_telemetryQueueIsEmpty(void)
+{
+    return _count == 0;
+}
+
+void dx_telemetryQueueGetStats(DX_TELEMETRY_QUEUE_STATS *stats)
+{
+    if (stats != NULL) {
+        *stats = _stats;
+        stats->count = (uint32_t)_count;
+    }
+}
+
+static uint8_t *slotAt(size_t index)
+{
+    return _slots + ((_head + index) % _slotCount) * _slotSize;
+}
+
+/// <summary>
+/// Let the publisher of a message that will never be sent know it failed
+/// </summary>
+static void completeSlot(const uint8_t *slot, IOTHUB_CLIENT_CONFIRMATION_RESULT result)
+{
+    QUEUE_SLOT_HEADER header;
+    memcpy(&header, slot, sizeof(QUEUE_SLOT_HEADER));
+
+    if (header.completionCallback != NULL) {
+        header.completionCallback(result, (uint32_t)(dx_getNowMilliseconds() - header.publishTimeMs), header.context);
+    }
+}
+
+static bool appendString(uint8_t *slot, size_t *offset, const char *string)
+{
+    size_t length = string == NULL ? 0 : strlen(string);
+
+    if (*offset + length + 1 > _slotSize) {
+        return false;
+    }
+
+    if (slot != NULL) {
+        memcpy(slot + *offset, string == NULL ? "" : string, length + 1);
+    }
+    *offset += length + 1;
+
+    return true;
+}
+
+/// <summary>
+/// Copy the message into the slot. When slot is NULL only check that the message fits.
+/// </summary>
+static bool encodeSlot(uint8_t *slot, const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                       size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                       DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context)
+{
+    QUEUE_SLOT_HEADER header = {.messageLength = messageLength,
+                                .propertyCount = 0,
+                                .hasContentProperties = messageContentProperties != NULL,
+                                .completionCallback = completionCallback,
+                                .context = context,
+                                .publishTimeMs = dx_getNowMilliseconds()};
+    size_t offset = sizeof(QUEUE_SLOT_HEADER);
+
+    if (offset + messageLength > _slotSize) {
+        return false;
+    }
+
+    if (slot != NULL) {
+        memcpy(slot + offset, message, messageLength);
+    }
+    offset += messageLength;
+
+    if (messageProperties != NULL) {
+        for (size_t i = 0; i < messagePropertyCount; i++) {
+            // Same filter dx_azurePublish applies when setting properties on the IoT Hub message
+            if (dx_isStringNullOrEmpty(messageProperties[i]->key) || dx_isStringNullOrEmpty(messageProperties[i]->value)) {
+                continue;
+            }
+
+            if (header.propertyCount == DX_TELEMETRY_QUEUE_MAX_PROPERTIES ||
+                !appendString(slot, &offset, messageProperties[i]->key) || !appendString(slot, &offset, messageProperties[i]->value)) {
+                return false;
+            }
+            header.propertyCount++;
+        }
+    }
+
+    if (header.hasContentProperties) {
+        if (!appendString(slot, &offset, messageContentProperties->contentEncoding) ||
+            !appendString(slot, &offset, messageContentProperties->contentType)) {
+            return false;
+        }
+    }
+
+    if (slot != NULL) {
+        memcpy(slot, &header, sizeof(QUEUE_SLOT_HEADER));
+    }
+
+    return true;
+}
+
+bool dx_telemetryQueueEnqueue(const void *message, size_t messageLength, DX_MESSAGE_PROPERTY **messageProperties,
+                              size_t messagePropertyCount, DX_MESSAGE_CONTENT_PROPERTIES *messageContentProperties,
+                              DX_PUBLISH_COMPLETION_CALLBACK completionCallback, void *context)
+{
+    if (_slots == NULL) {
+        return false;
+    }
+
+    if (!encodeSlot(NULL, message, messageLength, messageProperties, messagePropertyCount, messageContentProperties, NULL, NULL)) {
+        Log_Debug("ERROR: Message too large for telemetry queue slot of %zu bytes\n", _slotSize);
+        _stats.dropped++;
+        return false;
+    }
+
+    if (_count == _slotCount) {
+        _stats.dropped++;
+
+        if (_config.policy == DX_TELEMETRY_QUEUE_DROP_NEWEST) {
+            return false;
+        }
+
+        // Drop oldest, the slot is reused for the new message
+        completeSlot(slotAt(0), IOTHUB_CLIENT_CONFIRMATION_ERROR);
+        _head = (_head + 1) % _slotCount;
+        _count--;
+    }
+
+    encodeSlot(slotAt(_count), message, messageLength, messageProperties, messagePropertyCount, messageContentProperties,
+               completionCallback, context);
+
+    _count++;
+    _stats.enqueued++;
+
+    if (_count > _stats.highWaterMark) {
+        _stats.highWaterMark = (uint32_t)_count;
+    }
+
+    return true;
+}
+
+static const char *nextString(const uint8_t *slot, size_t *offset)
+{
+    const char *string = (const char *)(slot + *offset);
+    *offset += strlen(string) + 1;
+    return string;
+}
+
+size_t dx_telemetryQueueDrain(size_t maxMessages, DX_TELEMETRY_QUEUE_SEND send)
+{
+    DX_MESSAGE_PROPERTY properties[DX_TELEMETRY_QUEUE_MAX_PROPERTIES];
+    DX_MESSAGE_PROPERTY *propertyList[DX_TELEMETRY_QUEUE_MAX_PROPERTIES];
+    DX_MESSAGE_CONTENT_PROPERTIES contentProperties;
+    QUEUE_SLOT_HEADER header;
+    size_t sent = 0;
+    size_t attempts = 0;
+    DX_PUBLISH_RESULT result;
+
+    if (_slots == NULL || send == NULL) {
+        return 0;
+    }
+
+    if (maxMessages == 0) {
+        maxMessages = _config.drainPerTick;
+    }
+
+    while (_count > 0 && attempts < maxMessages) {
+        const uint8_t *slot = slotAt(0);
+        memcpy(&header, slot, sizeof(QUEUE_SLOT_HEADER));
+
+        size_t offset = sizeof(QUEUE_SLOT_HEADER);
+        const void *message = slot + offset;
+        offset += header.messageLength;
+
+        for (size_t i = 0; i < header.propertyCount; i++) {
+            properties[i].key = nextString(slot, &offset);
+            properties[i].value = nextString(slot, &offset);
+            propertyList[i] = &properties[i];
+        }
+
+        if (header.hasContentProperties) {
+            contentProperties.contentEncoding = nextString(slot, &offset);
+            contentProperties.contentType = nextString(slot, &offset);
+        }
+
+        result = send(message, header.messageLength, header.propertyCount > 0 ? propertyList : NULL, header.propertyCount,
+                      header.hasContentProperties ? &contentProperties : NULL, header.completionCallback, header.context,
+                      header.publishTimeMs);
+
+        // Out of capacity, try again next tick
+        if (result == DX_PUBLISH_WOULD_BLOCK) {
+            break;
+        }
+
+        if (result == DX_PUBLISH_OK) {
+            _stats.drained++;
+            sent++;
+        } else {
+            Log_Debug("ERROR: Queued message could not be sent, removed from the telemetry queue\n");
+            completeSlot(slot, IOTHUB_CLIENT_CONFIRMATION_ERROR);
+            _stats.failed++;
+        }
+
+        _head = (_head + 1) % _slotCount;
+        _count--;
+        attempts++;
+    }
+
+    return sent;
+}
@@ -6,6 +6,15 @@
 volatile sig_atomic_t terminationRequired = false;
 static volatile sig_atomic_t _exitCode = 0;
 
+typedef struct {
+    DX_TERMINATION_DRAIN_HANDLER handler;
+    void *context;
+} DRAIN_HANDLER;
+
+static DRAIN_HANDLER drainHandlers[DX_TERMINATE_MAX_DRAIN_HANDLERS];
+static size_t drainHandlerCount = 0;
+static uint32_t drainDeadlineMs = DX_TERMINATE_DRAIN_DEADLINE_MILLISECONDS;
+
 void dx_registerTerminationHandler(void)
 {
     struct sigaction action;
@@ -37,6 +46,63 @@ int dx_getTerminationExitCode(void)
     return _exitCode;
 }
 
+bool dx_registerTerminationDrainHandler(DX_TERMINATION_DRAIN_HANDLER drainHandler, void *context)
+{
+    if (drainHandler == NULL || drainHandlerCount == DX_TERMINATE_MAX_DRAIN_HANDLERS) {
+        return false;
+    }
+
+    drainHandlers[drainHandlerCount++] = (DRAIN_HANDLER){.handler = drainHandler, .context = context};
+    return true;
+}
+
+void dx_setTerminationDrainDeadline(uint32_t deadlineMs)
+{
+    drainDeadlineMs = deadlineMs;
+}
+
+static int64_t monotonicMilliseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static bool isDrained(void)
+{
+    bool drained = true;
+
+    // Every handler is called each pass so they all make progress
+    for (size_t i = 0; i < drainHandlerCount; i++) {
+        if (!drainHandlers[i].handler(drainHandlers[i].context)) {
+            drained = false;
+        }
+    }
+
+    return drained;
+}
+
+/// <summary>
+/// Keep the event loop, and so the timers that pump the IoT Hub client, running until outstanding work is flushed
+/// </summary>
+static void drainEventLoop(EventLoop *el)
+{
+    int64_t deadline = monotonicMilliseconds() + drainDeadlineMs;
+    int64_t remaining;
+
+    while (!isDrained()) {
+        if ((remaining = deadline - monotonicMilliseconds()) <= 0) {
+            Log_Debug("INFO: Termination drain deadline of %u ms expired.\n", drainDeadlineMs);
+            return;
+        }
+
+        // Wake at least every 100 ms to check the drain handlers
+        if (EventLoop_Run(el, remaining > 100 ? 100 : (int)remaining, true) == -1 && errno != EINTR) {
+            return;
+        }
+    }
+}
+
 void dx_eventLoopRun(void)
 {
     EventLoop *el = dx_timerGetEventLoop();
@@ -48,4 +114,8 @@ void dx_eventLoopRun(void)
             dx_terminate(DX_ExitCode_Main_EventLoopFail);
         }
     }
+
+    if (drainHandlerCount > 0 && drainDeadlineMs > 0 && _exitCode != DX_ExitCode_Main_EventLoopFail) {
+        drainEventLoop(el);
+    }
 }
\ No newline at end of file
@@ -201,6 +201,92 @@ int dx_stringEndsWith(const char *str, const char *suffix)
     return strncmp(str + lenstr - lensuffix, suffix, lensuffix) == 0;
 }
 
+uint32_t dx_hashString(const char *string)
+{
+    return dx_hashStringLength(string, string == NULL ? 0 : strlen(string));
+}
+
+uint32_t dx_hashStringLength(const char *string, size_t length)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)string[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+bool dx_nameIndexInit(DX_NAME_INDEX *index, size_t count)
+{
+    size_t size = 8;
+
+    dx_nameIndexFree(index);
+    index->count = count;
+
+    // Keep the load factor at or below one half so probe sequences stay short
+    while (size < count * 2) {
+        size <<= 1;
+    }
+
+    if ((index->slots = (size_t *)calloc(size, sizeof(size_t))) == NULL) {
+        Log_Debug("ERROR: Name index calloc failed, using linear lookup.\n");
+        return false;
+    }
+
+    index->mask = size - 1;
+
+    return true;
+}
+
+void dx_nameIndexInsert(DX_NAME_INDEX *index, uint32_t hash, size_t item)
+{
+    if (index->slots == NULL) {
+        return;
+    }
+
+    size_t slot = hash & index->mask;
+
+    while (index->slots[slot] != 0) {
+        slot = (slot + 1) & index->mask;
+    }
+
+    index->slots[slot] = item + 1;
+}
+
+bool dx_nameIndexNext(const DX_NAME_INDEX *index, uint32_t hash, size_t *cursor, size_t *item)
+{
+    if (index->slots == NULL) {
+        if (*cursor < index->count) {
+            *item = (*cursor)++;
+            return true;
+        }
+        return false;
+    }
+
+    // The cursor counts probes from the home slot
+    while (*cursor <= index->mask) {
+        size_t slot = (hash + (*cursor)++) & index->mask;
+
+        if (index->slots[slot] == 0) {
+            break;
+        }
+
+        *item = index->slots[slot] - 1;
+        return true;
+    }
+
+    *cursor = index->mask + 1;
+    return false;
+}
+
+void dx_nameIndexFree(DX_NAME_INDEX *index)
+{
+    free(index->slots);
+    *index = (DX_NAME_INDEX){.slots = NULL, .mask = 0, .count = 0};
+}
+
 bool dx_startThreadDetached(void *(*daemon)(void *), void *arg, char *daemon_name)
 {
     pthread_attr_t attr;
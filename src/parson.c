@@ -35,6 +35,7 @@
 
 #include "parson.h"
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,6 +48,8 @@
 #define sscanf THINK_TWICE_ABOUT_USING_SSCANF
 
 #define STARTING_CAPACITY 16
+/* Arena blocks are never reused so objects and arrays start small, most twin objects hold a few members */
+#define ARENA_STARTING_CAPACITY 4
 #define MAX_NESTING 2048
 
 #define FLOAT_FORMAT "%1.17g" /* do not increase precision without incresing NUM_BUF_SIZE */
@@ -55,17 +58,107 @@
 
 #define SIZEOF_TOKEN(a) (sizeof(a) - 1)
 #define SKIP_CHAR(str) ((*str)++)
-#define SKIP_WHITESPACES(str)                 \
-    while (isspace((unsigned char)(**str))) { \
-        SKIP_CHAR(str);                       \
+#define SKIP_WHITESPACES(str, end)                               \
+    while (*(str) < (end) && isspace((unsigned char)(**(str)))) { \
+        SKIP_CHAR(str);                                          \
     }
+/* Current character, or '\0' once the end of the input is reached */
+#define PEEK_CHAR(str, end) (*(str) < (end) ? **(str) : '\0')
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
+#ifndef PARSON_MAX_BORROWED
+#define PARSON_MAX_BORROWED 4
+#endif
+/* Arena blocks are aligned for double, the most strictly aligned member of any parson type */
+#define ARENA_ALIGNMENT sizeof(double)
+
 #undef malloc
 #undef free
 
-static JSON_Malloc_Function parson_malloc = malloc;
-static JSON_Free_Function parson_free = free;
+static JSON_Malloc_Function parson_malloc_fun = malloc;
+static JSON_Free_Function parson_free_fun = free;
+
+/* Arena the parse in progress allocates from, and whether it leaves strings in the source buffer */
+static JSON_Arena *parson_arena = NULL;
+static int parson_in_situ = 0;
+
+/* Arena buffers and in-situ sources, parson_free never hands blocks inside these to free */
+static struct {
+    const char *start;
+    size_t size;
+    JSON_Arena *arena; /* NULL for an in-situ source */
+} parson_borrowed[PARSON_MAX_BORROWED];
+
+static JSON_Status parson_borrow(const char *start, size_t size, JSON_Arena *arena)
+{
+    size_t i, free_slot = PARSON_MAX_BORROWED;
+    for (i = 0; i < PARSON_MAX_BORROWED; i++) {
+        if (parson_borrowed[i].start == NULL) {
+            if (free_slot == PARSON_MAX_BORROWED) {
+                free_slot = i;
+            }
+        } else if (parson_borrowed[i].start == start || (arena != NULL && parson_borrowed[i].arena == arena)) {
+            return JSONFailure;
+        }
+    }
+    if (free_slot == PARSON_MAX_BORROWED) {
+        return JSONFailure;
+    }
+    parson_borrowed[free_slot].start = start;
+    parson_borrowed[free_slot].size = size;
+    parson_borrowed[free_slot].arena = arena;
+    return JSONSuccess;
+}
+
+static void parson_return(const char *start)
+{
+    size_t i;
+    for (i = 0; i < PARSON_MAX_BORROWED; i++) {
+        if (parson_borrowed[i].start == start) {
+            memset(&parson_borrowed[i], 0, sizeof(parson_borrowed[i]));
+        }
+    }
+}
+
+static void *parson_malloc(size_t size)
+{
+    JSON_Arena *arena = parson_arena;
+    if (arena != NULL) {
+        uintptr_t next = (uintptr_t)(arena->buffer + arena->used);
+        size_t offset = arena->used + (size_t)(((next + (ARENA_ALIGNMENT - 1)) & ~(uintptr_t)(ARENA_ALIGNMENT - 1)) - next);
+        if (offset <= arena->capacity && size <= arena->capacity - offset) {
+            arena->last = offset;
+            arena->used = offset + size;
+            if (arena->used > arena->peak) {
+                arena->peak = arena->used;
+            }
+            return arena->buffer + offset;
+        }
+        arena->overflows++;
+    }
+    return parson_malloc_fun(size);
+}
+
+static void parson_free(void *ptr)
+{
+    const char *block = (const char *)ptr;
+    size_t i;
+    if (block == NULL) {
+        return;
+    }
+    for (i = 0; i < PARSON_MAX_BORROWED; i++) {
+        JSON_Arena *arena = parson_borrowed[i].arena;
+        if (parson_borrowed[i].start != NULL && block >= parson_borrowed[i].start &&
+            block < parson_borrowed[i].start + parson_borrowed[i].size) {
+            /* Give back the newest arena block, parse temporaries are often freed straight away */
+            if (arena != NULL && block == arena->buffer + arena->last && arena->last < arena->used) {
+                arena->used = arena->last;
+            }
+            return;
+        }
+    }
+    parson_free_fun(ptr);
+}
 
 #define IS_CONT(b) (((unsigned char)(b)&0xC0) == 0x80) /* is utf-8 continuation byte */
 
@@ -116,9 +209,8 @@ static JSON_Object *json_object_init(JSON_Value *wrapping_value);
 static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_Value *value);
 static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_t name_len,
                                     JSON_Value *value);
+static JSON_Status json_object_add_no_copy(JSON_Object *object, char *name, JSON_Value *value);
 static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity);
-static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
-                                          size_t name_len);
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
                                                int free_value);
 static JSON_Status json_object_dotremove_internal(JSON_Object *object, const char *name,
@@ -135,17 +227,17 @@ static void json_array_free(JSON_Array *array);
 static JSON_Value *json_value_init_string_no_copy(char *string);
 
 /* Parser */
-static JSON_Status skip_quotes(const char **string);
-static int parse_utf16(const char **unprocessed, char **processed);
+static JSON_Status skip_quotes(const char **string, const char *end);
+static int parse_utf16(const char **unprocessed, const char *unprocessed_end, char **processed);
 static char *process_string(const char *input, size_t len);
-static char *get_quoted_string(const char **string);
-static JSON_Value *parse_object_value(const char **string, size_t nesting);
-static JSON_Value *parse_array_value(const char **string, size_t nesting);
-static JSON_Value *parse_string_value(const char **string);
-static JSON_Value *parse_boolean_value(const char **string);
-static JSON_Value *parse_number_value(const char **string);
-static JSON_Value *parse_null_value(const char **string);
-static JSON_Value *parse_value(const char **string, size_t nesting);
+static char *get_quoted_string(const char **string, const char *end);
+static JSON_Value *parse_object_value(const char **string, const char *end, size_t nesting);
+static JSON_Value *parse_array_value(const char **string, const char *end, size_t nesting);
+static JSON_Value *parse_string_value(const char **string, const char *end);
+static JSON_Value *parse_boolean_value(const char **string, const char *end);
+static JSON_Value *parse_number_value(const char **string, const char *end);
+static JSON_Value *parse_null_value(const char **string, const char *end);
+static JSON_Value *parse_value(const char **string, const char *end, size_t nesting);
 
 /* Serialization */
 static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
@@ -348,26 +440,42 @@ static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_V
 static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_t name_len,
                                     JSON_Value *value)
 {
-    size_t index = 0;
+    char *name_copy = NULL;
     if (object == NULL || name == NULL || value == NULL) {
         return JSONFailure;
     }
     if (json_object_getn_value(object, name, name_len) != NULL) {
         return JSONFailure;
     }
+    name_copy = parson_strndup(name, name_len);
+    if (name_copy == NULL) {
+        return JSONFailure;
+    }
+    if (json_object_add_no_copy(object, name_copy, value) == JSONFailure) {
+        parson_free(name_copy);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+/* Takes ownership of name on success */
+static JSON_Status json_object_add_no_copy(JSON_Object *object, char *name, JSON_Value *value)
+{
+    if (object == NULL || name == NULL || value == NULL) {
+        return JSONFailure;
+    }
+    if (json_object_getn_value(object, name, strlen(name)) != NULL) {
+        return JSONFailure;
+    }
     if (object->count >= object->capacity) {
-        size_t new_capacity = MAX(object->capacity * 2, STARTING_CAPACITY);
+        size_t new_capacity = MAX(object->capacity * 2, parson_arena != NULL ? ARENA_STARTING_CAPACITY : STARTING_CAPACITY);
         if (json_object_resize(object, new_capacity) == JSONFailure) {
             return JSONFailure;
         }
     }
-    index = object->count;
-    object->names[index] = parson_strndup(name, name_len);
-    if (object->names[index] == NULL) {
-        return JSONFailure;
-    }
+    object->names[object->count] = name;
     value->parent = json_object_get_wrapping_value(object);
-    object->values[index] = value;
+    object->values[object->count] = value;
     object->count++;
     return JSONSuccess;
 }
@@ -381,6 +489,10 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
         (object->names != NULL && object->values == NULL) || new_capacity == 0) {
         return JSONFailure; /* Shouldn't happen */
     }
+    /* An arena never reuses the old arrays, trimming would only spend more of it */
+    if (parson_arena != NULL && new_capacity <= object->capacity) {
+        return JSONSuccess;
+    }
     temp_names = (char **)parson_malloc(new_capacity * sizeof(char *));
     if (temp_names == NULL) {
         return JSONFailure;
@@ -402,8 +514,7 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
     return JSONSuccess;
 }
 
-static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
-                                          size_t name_len)
+JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name, size_t name_len)
 {
     size_t i, name_length;
     for (i = 0; i < json_object_get_count(object); i++) {
@@ -489,7 +600,7 @@ static JSON_Array *json_array_init(JSON_Value *wrapping_value)
 static JSON_Status json_array_add(JSON_Array *array, JSON_Value *value)
 {
     if (array->count >= array->capacity) {
-        size_t new_capacity = MAX(array->capacity * 2, STARTING_CAPACITY);
+        size_t new_capacity = MAX(array->capacity * 2, parson_arena != NULL ? ARENA_STARTING_CAPACITY : STARTING_CAPACITY);
         if (json_array_resize(array, new_capacity) == JSONFailure) {
             return JSONFailure;
         }
@@ -506,6 +617,9 @@ static JSON_Status json_array_resize(JSON_Array *array, size_t new_capacity)
     if (new_capacity == 0) {
         return JSONFailure;
     }
+    if (parson_arena != NULL && new_capacity <= array->capacity) {
+        return JSONSuccess;
+    }
     new_items = (JSON_Value **)parson_malloc(new_capacity * sizeof(JSON_Value *));
     if (new_items == NULL) {
         return JSONFailure;
@@ -543,18 +657,18 @@ static JSON_Value *json_value_init_string_no_copy(char *string)
 }
 
 /* Parser */
-static JSON_Status skip_quotes(const char **string)
+static JSON_Status skip_quotes(const char **string, const char *end)
 {
-    if (**string != '\"') {
+    if (PEEK_CHAR(string, end) != '\"') {
         return JSONFailure;
     }
     SKIP_CHAR(string);
-    while (**string != '\"') {
-        if (**string == '\0') {
+    while (PEEK_CHAR(string, end) != '\"') {
+        if (PEEK_CHAR(string, end) == '\0') {
             return JSONFailure;
         } else if (**string == '\\') {
             SKIP_CHAR(string);
-            if (**string == '\0') {
+            if (PEEK_CHAR(string, end) == '\0') {
                 return JSONFailure;
             }
         }
@@ -564,13 +678,16 @@ static JSON_Status skip_quotes(const char **string)
     return JSONSuccess;
 }
 
-static int parse_utf16(const char **unprocessed, char **processed)
+static int parse_utf16(const char **unprocessed, const char *unprocessed_end, char **processed)
 {
     unsigned int cp, lead, trail;
     int parse_succeeded = 0;
     char *processed_ptr = *processed;
     const char *unprocessed_ptr = *unprocessed;
     unprocessed_ptr++; /* skips u */
+    if (unprocessed_end - unprocessed_ptr < 4) {
+        return JSONFailure;
+    }
     parse_succeeded = parse_utf16_hex(unprocessed_ptr, &cp);
     if (!parse_succeeded) {
         return JSONFailure;
@@ -590,6 +707,9 @@ static int parse_utf16(const char **unprocessed, char **processed)
         lead = cp;
         unprocessed_ptr +=
             4; /* should always be within the buffer, otherwise previous sscanf would fail */
+        if (unprocessed_end - unprocessed_ptr < 6) {
+            return JSONFailure;
+        }
         if (*unprocessed_ptr++ != '\\' || *unprocessed_ptr++ != 'u') {
             return JSONFailure;
         }
@@ -621,7 +741,9 @@ static char *process_string(const char *input, size_t len)
     size_t initial_size = (len + 1) * sizeof(char);
     size_t final_size = 0;
     char *output = NULL, *output_ptr = NULL, *resized_output = NULL;
-    output = (char *)parson_malloc(initial_size);
+    /* Unescaping only shrinks a string so in place the output never overtakes the input, and the
+       terminating NUL lands on the closing quote at the latest */
+    output = parson_in_situ ? (char *)input : (char *)parson_malloc(initial_size);
     if (output == NULL) {
         goto error;
     }
@@ -655,7 +777,7 @@ static char *process_string(const char *input, size_t len)
                 *output_ptr = '\t';
                 break;
             case 'u':
-                if (parse_utf16(&input_ptr, &output_ptr) == JSONFailure) {
+                if (parse_utf16(&input_ptr, input + len, &output_ptr) == JSONFailure) {
                     goto error;
                 }
                 break;
@@ -674,7 +796,10 @@ static char *process_string(const char *input, size_t len)
     *output_ptr = '\0';
     /* resize to new length */
     final_size = (size_t)(output_ptr - output) + 1;
-    /* todo: don't resize if final_size == initial_size */
+    /* Only strings with escape sequences shrink */
+    if (final_size == initial_size || parson_in_situ) {
+        return output;
+    }
     resized_output = (char *)parson_malloc(final_size);
     if (resized_output == NULL) {
         goto error;
@@ -689,11 +814,11 @@ error:
 
 /* Return processed contents of a string between quotes and
    skips passed argument to a matching quote. */
-static char *get_quoted_string(const char **string)
+static char *get_quoted_string(const char **string, const char *end)
 {
     const char *string_start = *string;
     size_t string_len = 0;
-    JSON_Status status = skip_quotes(string);
+    JSON_Status status = skip_quotes(string, end);
     if (status != JSONSuccess) {
         return NULL;
     }
@@ -701,22 +826,22 @@ static char *get_quoted_string(const char **string)
     return process_string(string_start + 1, string_len);
 }
 
-static JSON_Value *parse_value(const char **string, size_t nesting)
+static JSON_Value *parse_value(const char **string, const char *end, size_t nesting)
 {
     if (nesting > MAX_NESTING) {
         return NULL;
     }
-    SKIP_WHITESPACES(string);
-    switch (**string) {
+    SKIP_WHITESPACES(string, end);
+    switch (PEEK_CHAR(string, end)) {
     case '{':
-        return parse_object_value(string, nesting + 1);
+        return parse_object_value(string, end, nesting + 1);
     case '[':
-        return parse_array_value(string, nesting + 1);
+        return parse_array_value(string, end, nesting + 1);
     case '\"':
-        return parse_string_value(string);
+        return parse_string_value(string, end);
     case 'f':
     case 't':
-        return parse_boolean_value(string);
+        return parse_boolean_value(string, end);
     case '-':
     case '0':
     case '1':
@@ -728,15 +853,15 @@ static JSON_Value *parse_value(const char **string, size_t nesting)
     case '7':
     case '8':
     case '9':
-        return parse_number_value(string);
+        return parse_number_value(string, end);
     case 'n':
-        return parse_null_value(string);
+        return parse_null_value(string, end);
     default:
         return NULL;
     }
 }
 
-static JSON_Value *parse_object_value(const char **string, size_t nesting)
+static JSON_Value *parse_object_value(const char **string, const char *end, size_t nesting)
 {
     JSON_Value *output_value = NULL, *new_value = NULL;
     JSON_Object *output_object = NULL;
@@ -745,52 +870,51 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
     if (output_value == NULL) {
         return NULL;
     }
-    if (**string != '{') {
+    if (PEEK_CHAR(string, end) != '{') {
         json_value_free(output_value);
         return NULL;
     }
     output_object = json_value_get_object(output_value);
     SKIP_CHAR(string);
-    SKIP_WHITESPACES(string);
-    if (**string == '}') { /* empty object */
+    SKIP_WHITESPACES(string, end);
+    if (PEEK_CHAR(string, end) == '}') { /* empty object */
         SKIP_CHAR(string);
         return output_value;
     }
-    while (**string != '\0') {
-        new_key = get_quoted_string(string);
+    while (PEEK_CHAR(string, end) != '\0') {
+        new_key = get_quoted_string(string, end);
         if (new_key == NULL) {
             json_value_free(output_value);
             return NULL;
         }
-        SKIP_WHITESPACES(string);
-        if (**string != ':') {
+        SKIP_WHITESPACES(string, end);
+        if (PEEK_CHAR(string, end) != ':') {
             parson_free(new_key);
             json_value_free(output_value);
             return NULL;
         }
         SKIP_CHAR(string);
-        new_value = parse_value(string, nesting);
+        new_value = parse_value(string, end, nesting);
         if (new_value == NULL) {
             parson_free(new_key);
             json_value_free(output_value);
             return NULL;
         }
-        if (json_object_add(output_object, new_key, new_value) == JSONFailure) {
+        if (json_object_add_no_copy(output_object, new_key, new_value) == JSONFailure) {
             parson_free(new_key);
             json_value_free(new_value);
             json_value_free(output_value);
             return NULL;
         }
-        parson_free(new_key);
-        SKIP_WHITESPACES(string);
-        if (**string != ',') {
+        SKIP_WHITESPACES(string, end);
+        if (PEEK_CHAR(string, end) != ',') {
             break;
         }
         SKIP_CHAR(string);
-        SKIP_WHITESPACES(string);
+        SKIP_WHITESPACES(string, end);
     }
-    SKIP_WHITESPACES(string);
-    if (**string != '}' || /* Trim object after parsing is over */
+    SKIP_WHITESPACES(string, end);
+    if (PEEK_CHAR(string, end) != '}' || /* Trim object after parsing is over */
         json_object_resize(output_object, json_object_get_count(output_object)) == JSONFailure) {
         json_value_free(output_value);
         return NULL;
@@ -799,7 +923,7 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
     return output_value;
 }
 
-static JSON_Value *parse_array_value(const char **string, size_t nesting)
+static JSON_Value *parse_array_value(const char **string, const char *end, size_t nesting)
 {
     JSON_Value *output_value = NULL, *new_array_value = NULL;
     JSON_Array *output_array = NULL;
@@ -807,19 +931,19 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
     if (output_value == NULL) {
         return NULL;
     }
-    if (**string != '[') {
+    if (PEEK_CHAR(string, end) != '[') {
         json_value_free(output_value);
         return NULL;
     }
     output_array = json_value_get_array(output_value);
     SKIP_CHAR(string);
-    SKIP_WHITESPACES(string);
-    if (**string == ']') { /* empty array */
+    SKIP_WHITESPACES(string, end);
+    if (PEEK_CHAR(string, end) == ']') { /* empty array */
         SKIP_CHAR(string);
         return output_value;
     }
-    while (**string != '\0') {
-        new_array_value = parse_value(string, nesting);
+    while (PEEK_CHAR(string, end) != '\0') {
+        new_array_value = parse_value(string, end, nesting);
         if (new_array_value == NULL) {
             json_value_free(output_value);
             return NULL;
@@ -829,15 +953,15 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
             json_value_free(output_value);
             return NULL;
         }
-        SKIP_WHITESPACES(string);
-        if (**string != ',') {
+        SKIP_WHITESPACES(string, end);
+        if (PEEK_CHAR(string, end) != ',') {
             break;
         }
         SKIP_CHAR(string);
-        SKIP_WHITESPACES(string);
+        SKIP_WHITESPACES(string, end);
     }
-    SKIP_WHITESPACES(string);
-    if (**string != ']' || /* Trim array after parsing is over */
+    SKIP_WHITESPACES(string, end);
+    if (PEEK_CHAR(string, end) != ']' || /* Trim array after parsing is over */
         json_array_resize(output_array, json_array_get_count(output_array)) == JSONFailure) {
         json_value_free(output_value);
         return NULL;
@@ -846,10 +970,10 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
     return output_value;
 }
 
-static JSON_Value *parse_string_value(const char **string)
+static JSON_Value *parse_string_value(const char **string, const char *end)
 {
     JSON_Value *value = NULL;
-    char *new_string = get_quoted_string(string);
+    char *new_string = get_quoted_string(string, end);
     if (new_string == NULL) {
         return NULL;
     }
@@ -861,37 +985,57 @@ static JSON_Value *parse_string_value(const char **string)
     return value;
 }
 
-static JSON_Value *parse_boolean_value(const char **string)
+static JSON_Value *parse_boolean_value(const char **string, const char *end)
 {
     size_t true_token_size = SIZEOF_TOKEN("true");
     size_t false_token_size = SIZEOF_TOKEN("false");
-    if (strncmp("true", *string, true_token_size) == 0) {
+    size_t remaining = (size_t)(end - *string);
+    if (remaining >= true_token_size && strncmp("true", *string, true_token_size) == 0) {
         *string += true_token_size;
         return json_value_init_boolean(1);
-    } else if (strncmp("false", *string, false_token_size) == 0) {
+    } else if (remaining >= false_token_size && strncmp("false", *string, false_token_size) == 0) {
         *string += false_token_size;
         return json_value_init_boolean(0);
     }
     return NULL;
 }
 
-static JSON_Value *parse_number_value(const char **string)
+/* Copies the number into a NUL terminated buffer so strtod can not read past the end of the input */
+static JSON_Value *parse_number_value(const char **string, const char *end)
 {
-    char *end;
+    char num_buf[NUM_BUF_SIZE];
+    char *number_string = num_buf, *number_end;
+    size_t number_len = 0;
     double number = 0;
+    int status = JSONFailure;
+    while (*string + number_len < end && strchr("+-.0123456789eE", (*string)[number_len]) != NULL &&
+           (*string)[number_len] != '\0') {
+        number_len++;
+    }
+    if (number_len >= NUM_BUF_SIZE) {
+        number_string = (char *)parson_malloc(number_len + 1);
+        if (number_string == NULL) {
+            return NULL;
+        }
+    }
+    memcpy(number_string, *string, number_len);
+    number_string[number_len] = '\0';
     errno = 0;
-    number = strtod(*string, &end);
-    if (errno || !is_decimal(*string, (size_t)(end - *string))) {
-        return NULL;
+    number = strtod(number_string, &number_end);
+    if (!errno && number_end != number_string && is_decimal(number_string, (size_t)(number_end - number_string))) {
+        *string += number_end - number_string;
+        status = JSONSuccess;
+    }
+    if (number_string != num_buf) {
+        parson_free(number_string);
     }
-    *string = end;
-    return json_value_init_number(number);
+    return status == JSONSuccess ? json_value_init_number(number) : NULL;
 }
 
-static JSON_Value *parse_null_value(const char **string)
+static JSON_Value *parse_null_value(const char **string, const char *end)
 {
     size_t token_size = SIZEOF_TOKEN("null");
-    if (strncmp("null", *string, token_size) == 0) {
+    if ((size_t)(end - *string) >= token_size && strncmp("null", *string, token_size) == 0) {
         *string += token_size;
         return json_value_init_null();
     }
@@ -1219,10 +1363,62 @@ JSON_Value *json_parse_string(const char *string)
     if (string == NULL) {
         return NULL;
     }
-    if (string[0] == '\xEF' && string[1] == '\xBB' && string[2] == '\xBF') {
+    return json_parse_string_with_length(string, strlen(string));
+}
+
+JSON_Value *json_parse_string_with_length(const char *string, size_t length)
+{
+    const char *end = NULL;
+    if (string == NULL) {
+        return NULL;
+    }
+    end = string + length;
+    if (length >= 3 && string[0] == '\xEF' && string[1] == '\xBB' && string[2] == '\xBF') {
         string = string + 3; /* Support for UTF-8 BOM */
     }
-    return parse_value((const char **)&string, 0);
+    return parse_value((const char **)&string, end, 0);
+}
+
+JSON_Value *json_parse_string_in_situ(char *string, size_t length)
+{
+    JSON_Value *result = NULL;
+    if (string == NULL || parson_borrow(string, length, NULL) == JSONFailure) {
+        return NULL;
+    }
+    parson_in_situ = 1;
+    result = json_parse_string_with_length(string, length);
+    parson_in_situ = 0;
+    if (result == NULL) {
+        parson_return(string);
+    }
+    return result;
+}
+
+void json_release_in_situ(char *string)
+{
+    if (string != NULL) {
+        parson_return(string);
+    }
+}
+
+JSON_Value *json_arena_parse_string_with_length(JSON_Arena *arena, const char *string, size_t length)
+{
+    JSON_Arena *previous_arena = parson_arena;
+    JSON_Value *result = NULL;
+    size_t used = arena != NULL ? arena->used : 0;
+    size_t overflows = arena != NULL ? arena->overflows : 0;
+    parson_arena = arena;
+    result = json_parse_string_with_length(string, length);
+    parson_arena = previous_arena;
+    /* A document that does not fit is parsed again on the heap, a tree is never part arena and part heap */
+    if (arena != NULL && arena->buffer != NULL && arena->overflows != overflows) {
+        json_value_free(result);
+        arena->used = used;
+        arena->last = used;
+        arena->overflows = overflows + 1;
+        result = json_parse_string_with_length(string, length);
+    }
+    return result;
 }
 
 JSON_Value *json_parse_string_with_comments(const char *string)
@@ -1236,7 +1432,8 @@ JSON_Value *json_parse_string_with_comments(const char *string)
     remove_comments(string_mutable_copy, "/*", "*/");
     remove_comments(string_mutable_copy, "//", "\n");
     string_mutable_copy_ptr = string_mutable_copy;
-    result = parse_value((const char **)&string_mutable_copy_ptr, 0);
+    result = parse_value((const char **)&string_mutable_copy_ptr,
+                         string_mutable_copy + strlen(string_mutable_copy), 0);
     parson_free(string_mutable_copy);
     return result;
 }
@@ -2197,6 +2394,38 @@ int json_boolean(const JSON_Value *value)
 
 void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun)
 {
-    parson_malloc = malloc_fun;
-    parson_free = free_fun;
+    parson_malloc_fun = malloc_fun;
+    parson_free_fun = free_fun;
+}
+
+JSON_Status json_arena_init(JSON_Arena *arena, void *buffer, size_t capacity)
+{
+    if (arena == NULL || buffer == NULL || capacity == 0 ||
+        parson_borrow((const char *)buffer, capacity, arena) == JSONFailure) {
+        return JSONFailure;
+    }
+    memset(arena, 0, sizeof(JSON_Arena));
+    arena->buffer = (char *)buffer;
+    arena->capacity = capacity;
+    return JSONSuccess;
+}
+
+void json_arena_reset(JSON_Arena *arena)
+{
+    if (arena != NULL) {
+        arena->used = 0;
+        arena->last = 0;
+        arena->overflows = 0;
+    }
+}
+
+void json_arena_deinit(JSON_Arena *arena)
+{
+    /* An arena without a buffer sends every allocation to the heap */
+    if (arena != NULL) {
+        if (arena->buffer != NULL) {
+            parson_return(arena->buffer);
+        }
+        memset(arena, 0, sizeof(JSON_Arena));
+    }
 }
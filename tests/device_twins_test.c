@@ -0,0 +1,387 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host test for device twins. Twin documents are delivered through the callback dx_deviceTwinSubscribe
+// registers and reported properties are captured from a stand-in IoT Hub client.
+
+#include "dx_device_twins.h"
+#include "dx_storage.h"
+#include "dx_test.h"
+
+/****************************************************************************************
+ * Stand-in IoT Hub client, reported properties are kept in order
+ ****************************************************************************************/
+#define MAX_REPORTS 32
+
+static char reports[MAX_REPORTS][256];
+static size_t reportCount = 0;
+static bool connected = true;
+static void (*twinCallback)(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload, size_t payloadSize,
+                            void *userContextCallback) = NULL;
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SendReportedState(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle, const unsigned char *reportedState,
+                                                             size_t size, IOTHUB_CLIENT_REPORTED_STATE_CALLBACK callback, void *context)
+{
+    if (reportCount == MAX_REPORTS || size >= sizeof(reports[0])) {
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    memcpy(reports[reportCount], reportedState, size);
+    reports[reportCount][size] = '\0';
+    reportCount++;
+
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_DEVICE_CLIENT_LL_HANDLE dx_azureClientHandleGet(void)
+{
+    return NULL;
+}
+
+void dx_azureRegisterDeviceTwinCallback(void (*deviceTwinCallbackHandler)(DEVICE_TWIN_UPDATE_STATE updateState,
+                                                                          const unsigned char *payload, size_t payloadSize,
+                                                                          void *userContextCallback))
+{
+    twinCallback = deviceTwinCallbackHandler;
+}
+
+void dx_azureRequestDoWork(void) {}
+
+bool dx_isAzureConnected(void)
+{
+    return connected;
+}
+
+static void deliverTwin(DEVICE_TWIN_UPDATE_STATE updateState, const char *json)
+{
+    twinCallback(updateState, (const unsigned char *)json, strlen(json), NULL);
+}
+
+/****************************************************************************************
+ * Mutable storage held in memory
+ ****************************************************************************************/
+static uint8_t storedRecord[DX_DEVICE_TWIN_CACHE_MAX_BYTES];
+static size_t storedLength = 0;
+static bool recordStored = false;
+static int storageWrites = 0;
+
+bool dx_storageWrite(uint16_t id, const void *data, size_t length)
+{
+    memcpy(storedRecord, data, length);
+    storedLength = length;
+    recordStored = true;
+    storageWrites++;
+    return true;
+}
+
+bool dx_storageRead(uint16_t id, void *buffer, size_t bufferSize, size_t *length)
+{
+    if (!recordStored || storedLength > bufferSize) {
+        return false;
+    }
+
+    memcpy(buffer, storedRecord, storedLength);
+    *length = storedLength;
+    return true;
+}
+
+bool dx_storageDelete(uint16_t id)
+{
+    recordStored = false;
+    return true;
+}
+
+/****************************************************************************************
+ * Tests
+ ****************************************************************************************/
+static void resetReports(void)
+{
+    reportCount = 0;
+}
+
+static const char *lastReport(void)
+{
+    return reportCount > 0 ? reports[reportCount - 1] : "";
+}
+
+static DX_DEVICE_TWIN_BINDING dt_label = {.propertyName = "label",
+                                          .twinType = DX_DEVICE_TWIN_STRING,
+                                          .reportFilter = DX_DEVICE_TWIN_REPORT_ON_CHANGE,
+                                          .minReportIntervalMs = 1000};
+
+static DX_DEVICE_TWIN_BINDING dt_temperature = {
+    .propertyName = "temperature", .twinType = DX_DEVICE_TWIN_INT, .minReportIntervalMs = 1000};
+
+/// <summary>
+/// The last value of a burst inside minReportIntervalMs is sent when the interval expires
+/// </summary>
+static void testRateLimitedReportIsDeferred(void)
+{
+    DX_DEVICE_TWIN_STATS stats;
+    int temperature;
+
+    resetReports();
+    dx_deviceTwinResetStats();
+
+    temperature = 20;
+    CHECK(dx_deviceTwinReportValue(&dt_temperature, &temperature));
+    CHECK(reportCount == 1 && strcmp(lastReport(), "{\"temperature\":20}") == 0);
+
+    dx_testAdvance(100);
+    temperature = 21;
+    CHECK(dx_deviceTwinReportValue(&dt_temperature, &temperature));
+    dx_testAdvance(100);
+    temperature = 22;
+    CHECK(dx_deviceTwinReportValue(&dt_temperature, &temperature));
+    CHECK(reportCount == 1);
+
+    dx_testAdvance(799);
+    CHECK(reportCount == 1);
+    dx_testAdvance(1);
+    CHECK(reportCount == 2 && strcmp(lastReport(), "{\"temperature\":22}") == 0);
+
+    // Nothing more is held back
+    dx_testAdvance(5000);
+    CHECK(reportCount == 2);
+
+    dx_deviceTwinGetStats(&stats);
+    CHECK(stats.suppressedRateLimited == 2);
+    CHECK(stats.deferredReports == 1);
+}
+
+/// <summary>
+/// A string held back is copied, the caller's buffer can change before it is sent
+/// </summary>
+static void testDeferredStringIsCopied(void)
+{
+    char label[16];
+
+    resetReports();
+    dx_testAdvance(5000);
+
+    strcpy(label, "first");
+    CHECK(dx_deviceTwinReportValue(&dt_label, label));
+    CHECK(reportCount == 1 && strcmp(lastReport(), "{\"label\":\"first\"}") == 0);
+
+    strcpy(label, "second");
+    CHECK(dx_deviceTwinReportValue(&dt_label, label));
+    strcpy(label, "scratch");
+
+    dx_testAdvance(1000);
+    CHECK(reportCount == 2 && strcmp(lastReport(), "{\"label\":\"second\"}") == 0);
+}
+
+/// <summary>
+/// Returning to the reported value within the interval cancels what was held back
+/// </summary>
+static void testReturnToReportedValueCancelsDeferred(void)
+{
+    resetReports();
+    dx_testAdvance(5000);
+
+    CHECK(dx_deviceTwinReportValue(&dt_label, "steady"));
+    CHECK(dx_deviceTwinReportValue(&dt_label, "blip"));
+    CHECK(dx_deviceTwinReportValue(&dt_label, "steady"));
+
+    dx_testAdvance(5000);
+    CHECK(reportCount == 1 && strcmp(lastReport(), "{\"label\":\"steady\"}") == 0);
+}
+
+/// <summary>
+/// A held back report that can not be sent while disconnected goes out once connected
+/// </summary>
+static void testDeferredReportRetriedWhenDisconnected(void)
+{
+    resetReports();
+    dx_testAdvance(5000);
+
+    CHECK(dx_deviceTwinReportValue(&dt_label, "before"));
+    CHECK(dx_deviceTwinReportValue(&dt_label, "after"));
+
+    connected = false;
+    dx_testAdvance(3000);
+    CHECK(reportCount == 1);
+
+    connected = true;
+    dx_testAdvance(1000);
+    CHECK(reportCount == 2 && strcmp(lastReport(), "{\"label\":\"after\"}") == 0);
+}
+
+/// <summary>
+/// Strings are compared byte for byte, not by hash
+/// </summary>
+static void testOnChangeComparesStringBytes(void)
+{
+    resetReports();
+    dx_testAdvance(5000);
+
+    CHECK(dx_deviceTwinReportValue(&dt_label, "abc"));
+    dx_testAdvance(5000);
+    CHECK(dx_deviceTwinReportValue(&dt_label, "abc"));
+    CHECK(reportCount == 1);
+
+    dx_testAdvance(5000);
+    CHECK(dx_deviceTwinReportValue(&dt_label, "abcd"));
+    CHECK(reportCount == 2 && strcmp(lastReport(), "{\"label\":\"abcd\"}") == 0);
+}
+
+static DX_DEVICE_TWIN_BINDING dt_interval = {.propertyName = "interval", .twinType = DX_DEVICE_TWIN_INT};
+
+/// <summary>
+/// IoT Hub sends the full twin on every reconnect, flash is only written when the $version or a value changed
+/// </summary>
+static void testTwinCacheWrittenOnlyOnChange(void)
+{
+    DX_DEVICE_TWIN_BINDING *deviceTwins[] = {&dt_interval};
+    const char *twinV3 = "{\"desired\":{\"interval\":5,\"$version\":3},\"reported\":{}}";
+    const char *twinV4 = "{\"desired\":{\"interval\":5,\"$version\":4},\"reported\":{}}";
+    const char *twinV4Changed = "{\"desired\":{\"interval\":6,\"$version\":4},\"reported\":{}}";
+    DX_DEVICE_TWIN_STATS stats;
+
+    dx_deviceTwinEnableCache();
+    dx_deviceTwinSubscribe(deviceTwins, 1);
+    dx_deviceTwinResetStats();
+    storageWrites = 0;
+
+    deliverTwin(DEVICE_TWIN_UPDATE_COMPLETE, twinV3);
+    CHECK(storageWrites == 1);
+    CHECK(*(int *)dt_interval.propertyValue == 5);
+
+    // Reconnect, same document
+    deliverTwin(DEVICE_TWIN_UPDATE_COMPLETE, twinV3);
+    CHECK(storageWrites == 1);
+
+    // New $version, same value
+    deliverTwin(DEVICE_TWIN_UPDATE_COMPLETE, twinV4);
+    CHECK(storageWrites == 2);
+
+    // Same $version, new value
+    deliverTwin(DEVICE_TWIN_UPDATE_COMPLETE, twinV4Changed);
+    CHECK(storageWrites == 3);
+
+    dx_deviceTwinGetStats(&stats);
+    CHECK(stats.cacheWrites == 3);
+    CHECK(stats.cacheWritesSkipped == 1);
+
+    // After a restart the cached twin is restored, neither the first full twin nor a reconnect write flash
+    dx_deviceTwinUnsubscribe();
+    dx_deviceTwinSubscribe(deviceTwins, 1);
+    CHECK(*(int *)dt_interval.propertyValue == 6);
+
+    deliverTwin(DEVICE_TWIN_UPDATE_COMPLETE, twinV4Changed);
+    deliverTwin(DEVICE_TWIN_UPDATE_COMPLETE, twinV4Changed);
+    CHECK(storageWrites == 3);
+
+    dx_deviceTwinUnsubscribe();
+}
+
+static int modeHandlerCalls = 0;
+
+static void mode_handler(DX_DEVICE_TWIN_BINDING *deviceTwinBinding)
+{
+    modeHandlerCalls++;
+    dx_deviceTwinAckDesiredValue(deviceTwinBinding, deviceTwinBinding->propertyValue, DX_DEVICE_TWIN_RESPONSE_COMPLETED);
+}
+
+static DX_DEVICE_TWIN_BINDING dt_mode = {.propertyName = "mode", .twinType = DX_DEVICE_TWIN_STRING, .handler = mode_handler};
+static DX_DEVICE_TWIN_BINDING dt_plain = {.propertyName = "plain", .twinType = DX_DEVICE_TWIN_INT};
+
+/// <summary>
+/// A new $version with the same value skips the handler, the binding the application acknowledges is still acked
+/// with the new version so IoT Plug and Play sees it applied
+/// </summary>
+static void testUnchangedDesiredValueIsAcked(void)
+{
+    DX_DEVICE_TWIN_BINDING *deviceTwins[] = {&dt_mode, &dt_plain};
+    DX_DEVICE_TWIN_STATS stats;
+
+    dx_deviceTwinSubscribe(deviceTwins, 2);
+    dx_deviceTwinResetStats();
+    resetReports();
+
+    deliverTwin(DEVICE_TWIN_UPDATE_PARTIAL, "{\"mode\":\"eco\",\"plain\":1,\"$version\":2}");
+    CHECK(modeHandlerCalls == 1);
+    CHECK(reportCount == 1 && strcmp(lastReport(), "{\"mode\":{\"value\":\"eco\", \"ac\":200, \"av\":2}}") == 0);
+
+    deliverTwin(DEVICE_TWIN_UPDATE_PARTIAL, "{\"mode\":\"eco\",\"plain\":1,\"$version\":3}");
+    CHECK(modeHandlerCalls == 1);
+    CHECK(reportCount == 2 && strcmp(lastReport(), "{\"mode\":{\"value\":\"eco\", \"ac\":200, \"av\":3}}") == 0);
+
+    // The full twin sent on reconnect carries the same $version, nothing new to acknowledge
+    deliverTwin(DEVICE_TWIN_UPDATE_COMPLETE, "{\"desired\":{\"mode\":\"eco\",\"plain\":1,\"$version\":3},\"reported\":{}}");
+    CHECK(modeHandlerCalls == 1);
+    CHECK(reportCount == 2);
+
+    dx_deviceTwinGetStats(&stats);
+    CHECK(stats.suppressedHandlers == 4);
+    CHECK(stats.autoAcks == 1);
+
+    dx_deviceTwinUnsubscribe();
+}
+
+static int levelHandlerCalls = 0;
+
+static void level_handler(DX_DEVICE_TWIN_BINDING *deviceTwinBinding)
+{
+    levelHandlerCalls++;
+}
+
+static DX_DEVICE_TWIN_BINDING dt_level = {.propertyName = "level", .twinType = DX_DEVICE_TWIN_INT, .handler = level_handler};
+static DX_DEVICE_TWIN_BINDING dt_settings = {.propertyName = "settings", .twinType = DX_DEVICE_TWIN_JSON_OBJECT, .handler = level_handler};
+
+/// <summary>
+/// The hash only turns away changed values, a value whose hash matches is still compared with the last value
+/// applied. A hash collision is simulated by changing the kept copy under an unchanged hash.
+/// </summary>
+static void testEqualHashIsConfirmedByValue(void)
+{
+    DX_DEVICE_TWIN_BINDING *deviceTwins[] = {&dt_level, &dt_settings};
+
+    dx_deviceTwinSubscribe(deviceTwins, 2);
+    levelHandlerCalls = 0;
+
+    deliverTwin(DEVICE_TWIN_UPDATE_PARTIAL, "{\"level\":5,\"$version\":2}");
+    deliverTwin(DEVICE_TWIN_UPDATE_PARTIAL, "{\"level\":5,\"$version\":3}");
+    CHECK(levelHandlerCalls == 1);
+    CHECK(dt_level.desiredSize == sizeof(int) && *(int *)dt_level.desiredValue == 5);
+
+    *(int *)dt_level.desiredValue = 7;
+    deliverTwin(DEVICE_TWIN_UPDATE_PARTIAL, "{\"level\":5,\"$version\":4}");
+    CHECK(levelHandlerCalls == 2);
+    CHECK(*(int *)dt_level.desiredValue == 5);
+
+    deliverTwin(DEVICE_TWIN_UPDATE_PARTIAL, "{\"level\":5,\"$version\":5}");
+    CHECK(levelHandlerCalls == 2);
+
+    // Objects compare member by member, the same members in another order are unchanged
+    deliverTwin(DEVICE_TWIN_UPDATE_PARTIAL, "{\"settings\":{\"a\":1,\"b\":\"x\"},\"$version\":6}");
+    deliverTwin(DEVICE_TWIN_UPDATE_PARTIAL, "{\"settings\":{\"b\":\"x\",\"a\":1},\"$version\":7}");
+    CHECK(levelHandlerCalls == 3);
+
+    deliverTwin(DEVICE_TWIN_UPDATE_PARTIAL, "{\"settings\":{\"a\":1,\"b\":\"y\"},\"$version\":8}");
+    CHECK(levelHandlerCalls == 4);
+
+    dx_deviceTwinUnsubscribe();
+    CHECK(dt_level.desiredValue == NULL && dt_settings.desiredValue == NULL);
+}
+
+int main(void)
+{
+    DX_DEVICE_TWIN_BINDING *deviceTwins[] = {&dt_label, &dt_temperature};
+
+    dx_deviceTwinSubscribe(deviceTwins, sizeof(deviceTwins) / sizeof(deviceTwins[0]));
+
+    testRateLimitedReportIsDeferred();
+    testDeferredStringIsCopied();
+    testReturnToReportedValueCancelsDeferred();
+    testDeferredReportRetriedWhenDisconnected();
+    testOnChangeComparesStringBytes();
+
+    dx_deviceTwinUnsubscribe();
+
+    testTwinCacheWrittenOnlyOnChange();
+    testUnchangedDesiredValueIsAcked();
+    testEqualHashIsConfirmedByValue();
+
+    return dx_testFinish("device_twins_test");
+}
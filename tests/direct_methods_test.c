@@ -0,0 +1,458 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host test for direct methods. Methods are delivered through the callback dx_directMethodSubscribe registers
+// and responses are captured from a stand-in IoT Hub client.
+
+#include "dx_direct_methods.h"
+#include "dx_test.h"
+
+/****************************************************************************************
+ * Stand-in IoT Hub client, responses are kept in order
+ ****************************************************************************************/
+#define MAX_RESPONSES 8
+
+typedef struct {
+    METHOD_HANDLE methodId;
+    int result;
+    char payload[256];
+} METHOD_RESPONSE;
+
+static METHOD_RESPONSE responses[MAX_RESPONSES];
+static size_t responseCount = 0;
+static int clients[2];
+static int *client = &clients[0];
+static DX_CONNECTION_CHANGED_CALLBACK connectionChangedCallback = NULL;
+static void *connectionChangedContext = NULL;
+static int (*methodCallback)(const char *method_name, const unsigned char *payload, size_t payloadSize, METHOD_HANDLE methodId,
+                             void *userContextCallback) = NULL;
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_DeviceMethodResponse(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle, METHOD_HANDLE methodId,
+                                                                const unsigned char *response, size_t responseSize, int statusCode)
+{
+    if (responseCount == MAX_RESPONSES || responseSize >= sizeof(responses[0].payload)) {
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    responses[responseCount].methodId = methodId;
+    responses[responseCount].result = statusCode;
+    memcpy(responses[responseCount].payload, response, responseSize);
+    responses[responseCount].payload[responseSize] = '\0';
+    responseCount++;
+
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_DEVICE_CLIENT_LL_HANDLE dx_azureClientHandleGet(void)
+{
+    return (IOTHUB_DEVICE_CLIENT_LL_HANDLE)client;
+}
+
+void dx_azureRegisterDirectMethodInboundCallback(int (*directMethodInboundHandler)(const char *method_name, const unsigned char *payload,
+                                                                                   size_t payloadSize, METHOD_HANDLE methodId,
+                                                                                   void *userContextCallback))
+{
+    methodCallback = directMethodInboundHandler;
+}
+
+bool dx_azureRegisterConnectionChangedNotificationEx(DX_CONNECTION_CHANGED_CALLBACK callback, void *context, int priority)
+{
+    connectionChangedCallback = callback;
+    connectionChangedContext = context;
+    return true;
+}
+
+void dx_azureUnregisterConnectionChangedNotificationEx(DX_CONNECTION_CHANGED_CALLBACK callback, void *context)
+{
+    if (callback == connectionChangedCallback && context == connectionChangedContext) {
+        connectionChangedCallback = NULL;
+    }
+}
+
+void dx_azureRequestDoWork(void) {}
+
+static void invokeMethod(const char *methodName, uintptr_t methodId, const char *json)
+{
+    methodCallback(methodName, (const unsigned char *)json, strlen(json), (METHOD_HANDLE)methodId, NULL);
+}
+
+/****************************************************************************************
+ * Tests
+ ****************************************************************************************/
+static DX_DIRECT_METHOD_TOKEN pendingToken;
+
+static void slow_handler(JSON_Value *json, DX_DIRECT_METHOD_BINDING *directMethodBinding, DX_DIRECT_METHOD_TOKEN token)
+{
+    pendingToken = token;
+}
+
+// Completes the waiting async method between writes of its own response
+static DX_DIRECT_METHOD_RESPONSE_CODE status_handler(JSON_Value *json, DX_DIRECT_METHOD_BINDING *directMethodBinding,
+                                                     DX_DIRECT_METHOD_RESPONSE *response)
+{
+    dx_directMethodResponsePrintf(response, "{\"uptime\":%d", 42);
+    CHECK(dx_directMethodComplete(pendingToken, DX_METHOD_SUCCEEDED, "slow done"));
+    dx_directMethodResponsePrintf(response, ",\"state\":\"%s\"}", "ok");
+
+    return DX_METHOD_SUCCEEDED;
+}
+
+static DX_DIRECT_METHOD_BINDING dm_slow = {.methodName = "Slow", .asyncHandler = slow_handler};
+static DX_DIRECT_METHOD_BINDING dm_status = {.methodName = "Status", .responseHandler = status_handler};
+
+/// <summary>
+/// An async completion sent from inside a responseHandler leaves the handler's response as it was
+/// </summary>
+static void testCompleteInsideResponseHandler(void)
+{
+    DX_DIRECT_METHOD_STATS stats;
+
+    responseCount = 0;
+
+    invokeMethod("Slow", 1, "{}");
+    CHECK(responseCount == 0);
+
+    invokeMethod("Status", 2, "{}");
+    CHECK(responseCount == 2);
+
+    CHECK(responses[0].methodId == (METHOD_HANDLE)1);
+    CHECK(responses[0].result == DX_METHOD_SUCCEEDED);
+    CHECK(strcmp(responses[0].payload, "\"slow done\"") == 0);
+
+    CHECK(responses[1].methodId == (METHOD_HANDLE)2);
+    CHECK(responses[1].result == DX_METHOD_SUCCEEDED);
+    CHECK(strcmp(responses[1].payload, "{\"uptime\":42,\"state\":\"ok\"}") == 0);
+
+    dx_directMethodGetStats(&stats);
+    CHECK(stats.completed == 1 && stats.inFlight == 0);
+}
+
+// Answers with the binding's context, so a test can tell which of several bindings for a name was called
+static DX_DIRECT_METHOD_RESPONSE_CODE named_handler(JSON_Value *json, DX_DIRECT_METHOD_BINDING *directMethodBinding,
+                                                    DX_DIRECT_METHOD_RESPONSE *response)
+{
+    dx_directMethodResponseString(response, (const char *)directMethodBinding->context);
+    return DX_METHOD_SUCCEEDED;
+}
+
+static DX_DIRECT_METHOD_BINDING dm_first = {.methodName = "Shared", .responseHandler = named_handler, .context = "first"};
+static DX_DIRECT_METHOD_BINDING dm_second = {.methodName = "Shared", .responseHandler = named_handler, .context = "second"};
+
+/// <summary>
+/// Invoke methodName and return the response, with its status in result
+/// </summary>
+static const char *invokeForResponse(const char *methodName, int *result)
+{
+    responseCount = 0;
+    invokeMethod(methodName, 10, "{}");
+    CHECK(responseCount == 1);
+    *result = responses[0].result;
+    return responses[0].payload;
+}
+
+/// <summary>
+/// Methods added and removed after subscribing are found, or not, straight away. Of the bindings for one
+/// name the first in binding order answers, including after the one ahead of it is removed.
+/// </summary>
+static void testAddAndRemove(void)
+{
+    int result;
+
+    CHECK(strcmp(invokeForResponse("Shared", &result), "\"Method not found\"") == 0);
+    CHECK(result == DX_METHOD_NOT_FOUND);
+
+    CHECK(dx_directMethodAdd(&dm_first));
+    CHECK(dx_directMethodAdd(&dm_second));
+    CHECK(!dx_directMethodAdd(&dm_first));
+    CHECK(!dx_directMethodAdd(NULL));
+
+    CHECK(strcmp(invokeForResponse("Shared", &result), "\"first\"") == 0);
+    CHECK(result == DX_METHOD_SUCCEEDED);
+
+    CHECK(dx_directMethodRemove(&dm_first));
+    CHECK(!dx_directMethodRemove(&dm_first));
+    CHECK(strcmp(invokeForResponse("Shared", &result), "\"second\"") == 0);
+
+    // Added again it is behind the second binding now
+    CHECK(dx_directMethodAdd(&dm_first));
+    CHECK(strcmp(invokeForResponse("Shared", &result), "\"second\"") == 0);
+
+    CHECK(dx_directMethodRemove(&dm_second));
+    CHECK(strcmp(invokeForResponse("Shared", &result), "\"first\"") == 0);
+
+    // A binding from dx_directMethodSubscribe can be removed too
+    CHECK(dx_directMethodRemove(&dm_status));
+    CHECK(strcmp(invokeForResponse("Status", &result), "\"Method not found\"") == 0);
+
+    // Grow past the table the first add allocated
+    DX_DIRECT_METHOD_BINDING many[20];
+    char names[20][16];
+
+    for (size_t i = 0; i < NELEMS(many); i++) {
+        snprintf(names[i], sizeof(names[i]), "Many%zu", i);
+        many[i] = (DX_DIRECT_METHOD_BINDING){.methodName = names[i], .responseHandler = named_handler, .context = names[i]};
+        CHECK(dx_directMethodAdd(&many[i]));
+    }
+
+    for (size_t i = 0; i < NELEMS(many); i++) {
+        char expected[20];
+        snprintf(expected, sizeof(expected), "\"%s\"", names[i]);
+        CHECK(strcmp(invokeForResponse(names[i], &result), expected) == 0);
+    }
+
+    for (size_t i = 0; i < NELEMS(many); i++) {
+        CHECK(dx_directMethodRemove(&many[i]));
+    }
+    CHECK(strcmp(invokeForResponse("Many0", &result), "\"Method not found\"") == 0);
+    CHECK(strcmp(invokeForResponse("Shared", &result), "\"first\"") == 0);
+}
+
+static DX_DIRECT_METHOD_BINDING dm_timed = {.methodName = "Timed", .asyncHandler = slow_handler, .timeoutMs = 5000};
+
+/// <summary>
+/// An async method not completed by its timeoutMs is answered with DX_METHOD_TIMEOUT, the token is then spent
+/// </summary>
+static void testAsyncMethodTimesOut(void)
+{
+    DX_DIRECT_METHOD_STATS before, after;
+
+    CHECK(dx_directMethodAdd(&dm_timed));
+    dx_directMethodGetStats(&before);
+    responseCount = 0;
+
+    invokeMethod("Timed", 20, "{}");
+    DX_DIRECT_METHOD_TOKEN token = pendingToken;
+    CHECK(dx_testTimerDueInMs("tmr_async_method_timeout") == 5000);
+
+    dx_testAdvance(4999);
+    CHECK(responseCount == 0);
+
+    dx_testAdvance(1);
+    CHECK(responseCount == 1);
+    CHECK(responses[0].methodId == (METHOD_HANDLE)20);
+    CHECK(responses[0].result == DX_METHOD_TIMEOUT);
+    CHECK(strcmp(responses[0].payload, "\"Method timed out\"") == 0);
+
+    CHECK(!dx_directMethodComplete(token, DX_METHOD_SUCCEEDED, NULL));
+    CHECK(responseCount == 1);
+
+    dx_directMethodGetStats(&after);
+    CHECK(after.timedOut - before.timedOut == 1);
+    CHECK(after.inFlight == 0);
+
+    // Nothing waiting, the timer is not re-armed
+    CHECK(dx_testTimerDueInMs("tmr_async_method_timeout") == -1);
+
+    CHECK(dx_directMethodRemove(&dm_timed));
+}
+
+/// <summary>
+/// Losing the connection abandons waiting async methods without a response, and a method received by an
+/// earlier client is not answered on a new one
+/// </summary>
+static void testAsyncMethodsAbandonedOnReconnect(void)
+{
+    DX_DIRECT_METHOD_STATS before, after;
+    DX_DIRECT_METHOD_TOKEN token;
+
+    CHECK(connectionChangedCallback != NULL);
+    dx_directMethodGetStats(&before);
+    responseCount = 0;
+
+    invokeMethod("Slow", 30, "{}");
+    token = pendingToken;
+
+    connectionChangedCallback(false, connectionChangedContext);
+    CHECK(responseCount == 0);
+    CHECK(!dx_directMethodComplete(token, DX_METHOD_SUCCEEDED, NULL));
+
+    // Nor is it answered when its deadline passes
+    dx_testAdvance(DX_DIRECT_METHOD_DEFAULT_TIMEOUT_MS);
+    CHECK(responseCount == 0);
+
+    dx_directMethodGetStats(&after);
+    CHECK(after.abandoned - before.abandoned == 1);
+    CHECK(after.inFlight == 0 && dm_slow.inFlight == 0);
+
+    // The connection came back with a new client before the method was completed
+    invokeMethod("Slow", 31, "{}");
+    token = pendingToken;
+    client = &clients[1];
+
+    CHECK(!dx_directMethodComplete(token, DX_METHOD_SUCCEEDED, NULL));
+    CHECK(responseCount == 0);
+    CHECK(!dx_directMethodComplete(token, DX_METHOD_SUCCEEDED, NULL));
+
+    dx_directMethodGetStats(&after);
+    CHECK(after.abandoned - before.abandoned == 2);
+    CHECK(after.inFlight == 0);
+
+    client = &clients[0];
+}
+
+static DX_DIRECT_METHOD_BINDING dm_limited = {
+    .methodName = "Limited", .responseHandler = named_handler, .context = "limited", .rateLimitPerMinute = 60, .rateLimitBurst = 2};
+
+/// <summary>
+/// The token bucket starts full, allows rateLimitBurst calls back to back and refills at rateLimitPerMinute
+/// </summary>
+static void testRateLimit(void)
+{
+    DX_DIRECT_METHOD_BINDING_STATS bindingStats;
+    DX_DIRECT_METHOD_STATS before, after;
+    int result;
+
+    CHECK(dx_directMethodAdd(&dm_limited));
+    dx_directMethodGetStats(&before);
+
+    CHECK(strcmp(invokeForResponse("Limited", &result), "\"limited\"") == 0 && result == DX_METHOD_SUCCEEDED);
+    CHECK(strcmp(invokeForResponse("Limited", &result), "\"limited\"") == 0 && result == DX_METHOD_SUCCEEDED);
+    CHECK(strcmp(invokeForResponse("Limited", &result), "\"Too many requests\"") == 0);
+    CHECK(result == DX_METHOD_TOO_MANY_REQUESTS);
+
+    // One call a second, not quite a second later there is still no token
+    dx_testAdvance(999);
+    invokeForResponse("Limited", &result);
+    CHECK(result == DX_METHOD_TOO_MANY_REQUESTS);
+
+    dx_testAdvance(1);
+    invokeForResponse("Limited", &result);
+    CHECK(result == DX_METHOD_SUCCEEDED);
+
+    // A long quiet spell refills the bucket to rateLimitBurst, no further
+    dx_testAdvance(60000);
+    invokeForResponse("Limited", &result);
+    CHECK(result == DX_METHOD_SUCCEEDED);
+    invokeForResponse("Limited", &result);
+    CHECK(result == DX_METHOD_SUCCEEDED);
+    invokeForResponse("Limited", &result);
+    CHECK(result == DX_METHOD_TOO_MANY_REQUESTS);
+
+    dx_directMethodGetBindingStats(&dm_limited, &bindingStats);
+    CHECK(bindingStats.accepted == 5);
+    CHECK(bindingStats.rejected == 3);
+
+    dx_directMethodGetStats(&after);
+    CHECK(after.rateLimited - before.rateLimited == 3);
+
+    CHECK(dx_directMethodRemove(&dm_limited));
+}
+
+static DX_DIRECT_METHOD_BINDING dm_capped = {.methodName = "Capped", .asyncHandler = slow_handler, .maxInFlight = 1};
+
+/// <summary>
+/// An async method at its maxInFlight is refused until one of its calls completes
+/// </summary>
+static void testMaxInFlight(void)
+{
+    DX_DIRECT_METHOD_BINDING_STATS bindingStats;
+    DX_DIRECT_METHOD_STATS before, after;
+
+    CHECK(dx_directMethodAdd(&dm_capped));
+    dx_directMethodGetStats(&before);
+    responseCount = 0;
+
+    invokeMethod("Capped", 40, "{}");
+    DX_DIRECT_METHOD_TOKEN token = pendingToken;
+    CHECK(responseCount == 0);
+
+    invokeMethod("Capped", 41, "{}");
+    CHECK(responseCount == 1);
+    CHECK(responses[0].methodId == (METHOD_HANDLE)41);
+    CHECK(responses[0].result == DX_METHOD_TOO_MANY_REQUESTS);
+    CHECK(strcmp(responses[0].payload, "\"Too many methods in progress\"") == 0);
+
+    // Other async methods are not held back by this binding's cap
+    invokeMethod("Slow", 42, "{}");
+    CHECK(responseCount == 1);
+    CHECK(dx_directMethodComplete(pendingToken, DX_METHOD_SUCCEEDED, NULL));
+
+    dx_directMethodGetBindingStats(&dm_capped, &bindingStats);
+    CHECK(bindingStats.inFlight == 1 && bindingStats.accepted == 1 && bindingStats.rejected == 1);
+
+    CHECK(dx_directMethodComplete(token, DX_METHOD_SUCCEEDED, NULL));
+    invokeMethod("Capped", 43, "{}");
+    CHECK(responseCount == 3);
+    CHECK(dx_directMethodComplete(pendingToken, DX_METHOD_SUCCEEDED, NULL));
+    CHECK(responseCount == 4 && responses[3].methodId == (METHOD_HANDLE)43 && responses[3].result == DX_METHOD_SUCCEEDED);
+
+    dx_directMethodGetBindingStats(&dm_capped, &bindingStats);
+    CHECK(bindingStats.inFlight == 0 && bindingStats.accepted == 2 && bindingStats.rejected == 1);
+
+    dx_directMethodGetStats(&after);
+    CHECK(after.rejected - before.rejected == 1);
+
+    CHECK(dx_directMethodRemove(&dm_capped));
+}
+
+// Takes 40 ms of the test clock to answer
+static DX_DIRECT_METHOD_RESPONSE_CODE work_handler(JSON_Value *json, DX_DIRECT_METHOD_BINDING *directMethodBinding,
+                                                   DX_DIRECT_METHOD_RESPONSE *response)
+{
+    dx_testAdvance(40);
+    return DX_METHOD_SUCCEEDED;
+}
+
+static DX_DIRECT_METHOD_BINDING dm_work = {.methodName = "Work", .responseHandler = work_handler};
+static DX_DIRECT_METHOD_BINDING dm_measured = {.methodName = "Measured", .asyncHandler = slow_handler};
+
+/// <summary>
+/// Execution time runs from the handler call to the response, for async methods until dx_directMethodComplete
+/// </summary>
+static void testExecutionTimeHistograms(void)
+{
+    DX_DIRECT_METHOD_BINDING_STATS bindingStats;
+    int result;
+
+    CHECK(dx_directMethodAdd(&dm_work));
+    CHECK(dx_directMethodAdd(&dm_measured));
+
+    invokeForResponse("Work", &result);
+    invokeForResponse("Work", &result);
+    dx_directMethodGetBindingStats(&dm_work, &bindingStats);
+    CHECK(bindingStats.executionTime.count == 2);
+    CHECK(bindingStats.executionTime.minMs == 40 && bindingStats.executionTime.maxMs == 40);
+
+    invokeMethod("Measured", 50, "{}");
+    dx_testAdvance(250);
+    CHECK(dx_directMethodComplete(pendingToken, DX_METHOD_SUCCEEDED, NULL));
+
+    invokeMethod("Measured", 51, "{}");
+    dx_testAdvance(1000);
+    CHECK(dx_directMethodComplete(pendingToken, DX_METHOD_SUCCEEDED, NULL));
+
+    dx_directMethodGetBindingStats(&dm_measured, &bindingStats);
+    CHECK(bindingStats.executionTime.count == 2);
+    CHECK(bindingStats.executionTime.minMs == 250);
+    CHECK(bindingStats.executionTime.maxMs == 1000);
+    CHECK(bindingStats.executionTime.meanMs == 625);
+
+    // A timed out method is recorded at its deadline
+    invokeMethod("Measured", 52, "{}");
+    dx_testAdvance(DX_DIRECT_METHOD_DEFAULT_TIMEOUT_MS);
+    dx_directMethodGetBindingStats(&dm_measured, &bindingStats);
+    CHECK(bindingStats.executionTime.count == 3);
+    CHECK(bindingStats.executionTime.maxMs == DX_DIRECT_METHOD_DEFAULT_TIMEOUT_MS);
+
+    CHECK(dx_directMethodRemove(&dm_work));
+    CHECK(dx_directMethodRemove(&dm_measured));
+}
+
+int main(void)
+{
+    DX_DIRECT_METHOD_BINDING *directMethods[] = {&dm_slow, &dm_status};
+
+    dx_directMethodSubscribe(directMethods, sizeof(directMethods) / sizeof(directMethods[0]));
+
+    testCompleteInsideResponseHandler();
+    testAddAndRemove();
+    testAsyncMethodTimesOut();
+    testAsyncMethodsAbandonedOnReconnect();
+    testRateLimit();
+    testMaxInFlight();
+    testExecutionTimeHistograms();
+
+    dx_directMethodUnsubscribe();
+
+    return dx_testFinish("direct_methods_test");
+}
@@ -0,0 +1,197 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host test for the DPS hub assignment cache. Runs dx_azure_iot.c with DX_CONNECTION_TYPE_DPS against a
+// stand-in provisioning client that assigns a new hub on every registration, and the fixture's IoT Hub client.
+
+#include "dx_test.h"
+#include "dx_test_hub.h"
+
+/****************************************************************************************
+ * Stand-in provisioning client, registration completes on the first DoWork
+ ****************************************************************************************/
+static int provHandleStorage;
+static PROV_DEVICE_CLIENT_REGISTER_DEVICE_CALLBACK registerCallback = NULL;
+static size_t registrations = 0;
+
+const void *Prov_Device_MQTT_Protocol(void)
+{
+    return NULL;
+}
+
+PROV_DEVICE_LL_HANDLE Prov_Device_LL_Create(const char *uri, const char *scope_id, PROV_DEVICE_TRANSPORT_PROVIDER_FUNCTION protocol)
+{
+    return (PROV_DEVICE_LL_HANDLE)&provHandleStorage;
+}
+
+void Prov_Device_LL_Destroy(PROV_DEVICE_LL_HANDLE handle)
+{
+    registerCallback = NULL;
+}
+
+PROV_DEVICE_RESULT Prov_Device_LL_SetOption(PROV_DEVICE_LL_HANDLE handle, const char *name, const void *value)
+{
+    return PROV_DEVICE_RESULT_OK;
+}
+
+PROV_DEVICE_RESULT Prov_Device_LL_Set_Provisioning_Payload(PROV_DEVICE_LL_HANDLE handle, const char *json)
+{
+    return PROV_DEVICE_RESULT_OK;
+}
+
+PROV_DEVICE_RESULT Prov_Device_LL_Register_Device(PROV_DEVICE_LL_HANDLE handle, PROV_DEVICE_CLIENT_REGISTER_DEVICE_CALLBACK callback,
+                                                  void *context, void *statusCallback, void *statusContext)
+{
+    registerCallback = callback;
+    return PROV_DEVICE_RESULT_OK;
+}
+
+void Prov_Device_LL_DoWork(PROV_DEVICE_LL_HANDLE handle)
+{
+    char hubUri[64];
+
+    if (registerCallback != NULL) {
+        snprintf(hubUri, sizeof(hubUri), "hub-%zu.azure-devices.net", ++registrations);
+        registerCallback(PROV_DEVICE_RESULT_OK, hubUri, "device", NULL);
+        registerCallback = NULL;
+    }
+}
+
+int prov_dev_security_init(int type)
+{
+    return 0;
+}
+
+void prov_dev_security_deinit(void) {}
+
+/****************************************************************************************
+ * Tests
+ ****************************************************************************************/
+
+/// <summary>
+/// Run the connection handler until the hub client has been created count times in all. The first DoWork
+/// reports the connect result before the handler returns.
+/// </summary>
+static bool tickUntilCreated(size_t count)
+{
+    for (int i = 0; i < 600 && dx_testHubCreateCount < count; i++) {
+        dx_testAdvance(1000);
+    }
+    return dx_testHubCreateCount == count;
+}
+
+static void reconnectFailing(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason)
+{
+    dx_testHubDisconnect();
+    dx_testNetworkUp = true;
+    dx_testHubConnectReason = reason;
+}
+
+static void testFirstConnectRunsDps(void)
+{
+    DX_CONNECTION_STATS stats;
+
+    CHECK(tickUntilCreated(1));
+    CHECK(dx_isAzureConnected());
+    CHECK(registrations == 1);
+    CHECK(strcmp(dx_testHubHostname, "hub-1.azure-devices.net") == 0);
+
+    dx_azureGetConnectionStats(&stats);
+    CHECK(stats.dpsCacheMisses == 1 && stats.dpsCacheHits == 0);
+}
+
+/// <summary>
+/// A failure that may be the network keeps the cached hub for DX_DPS_CACHE_MAX_FAILED_CONNECTS attempts in a
+/// row, then DPS runs again
+/// </summary>
+static void testTransientFailuresKeepCacheUpToLimit(void)
+{
+    DX_CONNECTION_STATS before, after;
+    size_t created = dx_testHubCreateCount;
+
+    dx_azureGetConnectionStats(&before);
+    reconnectFailing(IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR);
+
+    for (size_t attempt = 1; attempt <= DX_DPS_CACHE_MAX_FAILED_CONNECTS; attempt++) {
+        CHECK(tickUntilCreated(created + attempt));
+        CHECK(strcmp(dx_testHubHostname, "hub-1.azure-devices.net") == 0);
+        CHECK(!dx_isAzureConnected());
+    }
+
+    CHECK(registrations == 1);
+    dx_azureGetConnectionStats(&after);
+    CHECK(after.dpsCacheHits - before.dpsCacheHits == DX_DPS_CACHE_MAX_FAILED_CONNECTS);
+    CHECK(after.dpsCacheInvalidations - before.dpsCacheInvalidations == 1);
+
+    dx_testHubConnectReason = IOTHUB_CLIENT_CONNECTION_OK;
+    CHECK(tickUntilCreated(created + DX_DPS_CACHE_MAX_FAILED_CONNECTS + 1));
+    CHECK(dx_isAzureConnected());
+    CHECK(registrations == 2);
+    CHECK(strcmp(dx_testHubHostname, "hub-2.azure-devices.net") == 0);
+}
+
+/// <summary>
+/// Authenticating resets the count, failures either side of a good connect do not add up
+/// </summary>
+static void testConnectResetsFailureCount(void)
+{
+    DX_CONNECTION_STATS before, after;
+    size_t created = dx_testHubCreateCount;
+
+    dx_azureGetConnectionStats(&before);
+
+    for (int round = 0; round < 2; round++) {
+        reconnectFailing(IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR);
+        created += DX_DPS_CACHE_MAX_FAILED_CONNECTS - 1;
+        CHECK(tickUntilCreated(created));
+
+        dx_testHubConnectReason = IOTHUB_CLIENT_CONNECTION_OK;
+        CHECK(tickUntilCreated(++created));
+        CHECK(dx_isAzureConnected());
+    }
+
+    CHECK(registrations == 2);
+    CHECK(strcmp(dx_testHubHostname, "hub-2.azure-devices.net") == 0);
+    dx_azureGetConnectionStats(&after);
+    CHECK(after.dpsCacheInvalidations == before.dpsCacheInvalidations);
+}
+
+/// <summary>
+/// The hub refusing the device drops the cache on the first attempt
+/// </summary>
+static void testHubRefusalDropsCache(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason)
+{
+    DX_CONNECTION_STATS before, after;
+    size_t created = dx_testHubCreateCount;
+    size_t registered = registrations;
+
+    dx_azureGetConnectionStats(&before);
+    reconnectFailing(reason);
+
+    CHECK(tickUntilCreated(created + 1));
+    CHECK(!dx_isAzureConnected());
+
+    dx_azureGetConnectionStats(&after);
+    CHECK(after.dpsCacheInvalidations - before.dpsCacheInvalidations == 1);
+
+    dx_testHubConnectReason = IOTHUB_CLIENT_CONNECTION_OK;
+    CHECK(tickUntilCreated(created + 2));
+    CHECK(dx_isAzureConnected());
+    CHECK(registrations == registered + 1);
+}
+
+int main(void)
+{
+    DX_USER_CONFIG userConfig = {.idScope = "0ne00000000", .connectionType = DX_CONNECTION_TYPE_DPS};
+
+    dx_azureEnableDpsCache(0, false);
+    dx_azureConnect(&userConfig, "wlan0", NULL);
+
+    testFirstConnectRunsDps();
+    testTransientFailuresKeepCacheUpToLimit();
+    testConnectResetsFailureCount();
+    testHubRefusalDropsCache(IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL);
+    testHubRefusalDropsCache(IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED);
+
+    return dx_testFinish("dps_cache_test");
+}
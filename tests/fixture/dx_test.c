@@ -0,0 +1,41 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dx_test.h"
+#include <stdarg.h>
+
+int dx_testFailures = 0;
+
+int dx_testFinish(const char *testName)
+{
+    if (dx_testFailures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", dx_testFailures);
+        return EXIT_FAILURE;
+    }
+
+    printf("%s passed\n", testName);
+    return EXIT_SUCCESS;
+}
+
+/// <summary>
+/// Silent unless DX_TEST_VERBOSE is set
+/// </summary>
+int Log_Debug(const char *fmt, ...)
+{
+    if (getenv("DX_TEST_VERBOSE") != NULL) {
+        va_list args;
+        va_start(args, fmt);
+        vfprintf(stderr, fmt, args);
+        va_end(args);
+    }
+    return 0;
+}
+
+/// <summary>
+/// The library only terminates on a fault, so count it as a failure
+/// </summary>
+void dx_terminate(int exitCode)
+{
+    fprintf(stderr, "dx_terminate(%d)\n", exitCode);
+    dx_testFailures++;
+}
@@ -0,0 +1,45 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Shared by the host tests. CHECK records a failure and carries on, dx_testFinish reports the result from main.
+// The clock only moves when a test calls dx_testAdvance, timers fire as it passes their deadline.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern int dx_testFailures;
+
+#define CHECK(condition)                                                         \
+    do {                                                                         \
+        if (!(condition)) {                                                      \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            dx_testFailures++;                                                   \
+        }                                                                        \
+    } while (0)
+
+/// <summary>
+/// Print the result and return the exit code for main
+/// </summary>
+/// <param name="testName"></param>
+/// <returns></returns>
+int dx_testFinish(const char *testName);
+
+/// <summary>
+/// Move the clock forward ms, firing each timer in deadline order as it falls due. A timer set for now by
+/// its own handler fires again within the same call.
+/// </summary>
+/// <param name="ms"></param>
+/// <returns>Number of timer handlers run</returns>
+size_t dx_testAdvance(int64_t ms);
+
+/// <summary>
+/// Milliseconds until the timer is due, -1 when it is not armed
+/// </summary>
+/// <param name="timerName"></param>
+/// <returns></returns>
+int64_t dx_testTimerDueInMs(const char *timerName);
@@ -0,0 +1,277 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Stand-in IoT Hub client, network monitor, proxy and termination calls for tests of dx_azure_iot.c,
+// see dx_test_hub.h
+
+#include "dx_network_monitor.h"
+#include "dx_test_hub.h"
+
+/****************************************************************************************
+ * Stand-in IoT Hub client
+ ****************************************************************************************/
+struct IOTHUB_MESSAGE_HANDLE_DATA_TAG {
+    char body[DX_TEST_HUB_BODY_SIZE];
+};
+
+typedef struct {
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK callback;
+    void *context;
+    char body[DX_TEST_HUB_BODY_SIZE];
+} PENDING_SEND;
+
+bool dx_testHubConfirms = true;
+char dx_testHubDelivered[DX_TEST_HUB_MAX_MESSAGES][DX_TEST_HUB_BODY_SIZE];
+size_t dx_testHubDeliveredCount = 0;
+size_t dx_testHubSendCount = 0;
+int dx_testHubLiveMessages = 0;
+IOTHUB_CLIENT_CONNECTION_STATUS_REASON dx_testHubConnectReason = IOTHUB_CLIENT_CONNECTION_OK;
+size_t dx_testHubCreateCount = 0;
+char dx_testHubHostname[128];
+bool dx_testNetworkUp = true;
+
+static int clientHandleStorage;
+static IOTHUB_DEVICE_CLIENT_LL_HANDLE hubClient = NULL;
+static IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK hubStatusCallback = NULL;
+static bool hubAuthenticated = false;
+static bool connectReported = false;
+static PENDING_SEND pendingSends[DX_TEST_HUB_MAX_MESSAGES];
+static size_t pendingSendCount = 0;
+
+void dx_testHubDisconnect(void)
+{
+    dx_testNetworkUp = false;
+    hubAuthenticated = false;
+    hubStatusCallback(IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED, IOTHUB_CLIENT_CONNECTION_NO_NETWORK, NULL);
+}
+
+IOTHUB_DEVICE_CLIENT_LL_HANDLE IoTHubDeviceClient_LL_CreateWithAzureSphereFromDeviceAuth(const char *hostname,
+                                                                                         const void *(*protocol)(void))
+{
+    snprintf(dx_testHubHostname, sizeof(dx_testHubHostname), "%s", hostname);
+    dx_testHubCreateCount++;
+
+    hubClient = (IOTHUB_DEVICE_CLIENT_LL_HANDLE)&clientHandleStorage;
+    hubAuthenticated = false;
+    connectReported = false;
+    return hubClient;
+}
+
+void IoTHubDeviceClient_LL_Destroy(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle)
+{
+    // Messages the client still held are confirmed as destroyed, as the SDK does
+    for (size_t i = 0; i < pendingSendCount; i++) {
+        pendingSends[i].callback(IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY, pendingSends[i].context);
+    }
+    pendingSendCount = 0;
+    hubClient = NULL;
+    hubStatusCallback = NULL;
+    hubAuthenticated = false;
+}
+
+void IoTHubDeviceClient_LL_DoWork(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle)
+{
+    if (!hubAuthenticated && !connectReported && hubStatusCallback != NULL) {
+        connectReported = true;
+        if (dx_testHubConnectReason == IOTHUB_CLIENT_CONNECTION_OK) {
+            hubAuthenticated = true;
+            hubStatusCallback(IOTHUB_CLIENT_CONNECTION_AUTHENTICATED, IOTHUB_CLIENT_CONNECTION_OK, NULL);
+        } else {
+            hubStatusCallback(IOTHUB_CLIENT_CONNECTION_UNAUTHENTICATED, dx_testHubConnectReason, NULL);
+        }
+    }
+
+    if (!dx_testHubConfirms) {
+        return;
+    }
+
+    size_t count = pendingSendCount;
+    PENDING_SEND sends[DX_TEST_HUB_MAX_MESSAGES];
+    memcpy(sends, pendingSends, count * sizeof(PENDING_SEND));
+    pendingSendCount = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        memcpy(dx_testHubDelivered[dx_testHubDeliveredCount++], sends[i].body, sizeof(sends[i].body));
+        sends[i].callback(IOTHUB_CLIENT_CONFIRMATION_OK, sends[i].context);
+    }
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetOption(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle, const char *name, const void *value)
+{
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SendEventAsync(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle, IOTHUB_MESSAGE_HANDLE message,
+                                                          IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK callback, void *context)
+{
+    if (pendingSendCount == DX_TEST_HUB_MAX_MESSAGES) {
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    dx_testHubSendCount++;
+
+    PENDING_SEND *send = &pendingSends[pendingSendCount++];
+    send->callback = callback;
+    send->context = context;
+    memcpy(send->body, message->body, sizeof(send->body));
+
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetDeviceTwinCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle,
+                                                                 IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK callback, void *context)
+{
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetDeviceMethodCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle,
+                                                                   IOTHUB_CLIENT_DEVICE_METHOD_CALLBACK_ASYNC callback, void *context)
+{
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubClientCore_LL_SetDeviceMethodCallback_Ex(IOTHUB_CLIENT_CORE_LL_HANDLE handle,
+                                                                    IOTHUB_CLIENT_INBOUND_DEVICE_METHOD_CALLBACK callback, void *context)
+{
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetConnectionStatusCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle,
+                                                                       IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK callback, void *context)
+{
+    hubStatusCallback = callback;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SetMessageCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle,
+                                                              IOTHUB_CLIENT_MESSAGE_CALLBACK_ASYNC callback, void *context)
+{
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_SendReportedState(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle, const unsigned char *reportedState,
+                                                             size_t size, IOTHUB_CLIENT_REPORTED_STATE_CALLBACK callback, void *context)
+{
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_LL_DeviceMethodResponse(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle, METHOD_HANDLE methodId,
+                                                                const unsigned char *response, size_t responseSize, int statusCode)
+{
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_MESSAGE_HANDLE IoTHubMessage_CreateFromByteArray(const unsigned char *byteArray, size_t size)
+{
+    IOTHUB_MESSAGE_HANDLE message = (IOTHUB_MESSAGE_HANDLE)calloc(1, sizeof(*message));
+
+    if (message != NULL) {
+        memcpy(message->body, byteArray, size < sizeof(message->body) ? size : sizeof(message->body) - 1);
+        dx_testHubLiveMessages++;
+    }
+
+    return message;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_SetContentEncodingSystemProperty(IOTHUB_MESSAGE_HANDLE message, const char *contentEncoding)
+{
+    return IOTHUB_MESSAGE_OK;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_SetContentTypeSystemProperty(IOTHUB_MESSAGE_HANDLE message, const char *contentType)
+{
+    return IOTHUB_MESSAGE_OK;
+}
+
+// A property the client will never accept, so the message can not be sent however often it is retried
+IOTHUB_MESSAGE_RESULT IoTHubMessage_SetProperty(IOTHUB_MESSAGE_HANDLE message, const char *key, const char *value)
+{
+    return strcmp(key, "poison") == 0 ? IOTHUB_MESSAGE_INVALID_ARG : IOTHUB_MESSAGE_OK;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_GetByteArray(IOTHUB_MESSAGE_HANDLE message, const unsigned char **buffer, size_t *size)
+{
+    *buffer = (const unsigned char *)message->body;
+    *size = strlen(message->body);
+    return IOTHUB_MESSAGE_OK;
+}
+
+void IoTHubMessage_Destroy(IOTHUB_MESSAGE_HANDLE message)
+{
+    if (message != NULL) {
+        dx_testHubLiveMessages--;
+        free(message);
+    }
+}
+
+const void *MQTT_Protocol(void)
+{
+    return NULL;
+}
+
+int iothub_security_init(int type)
+{
+    return 0;
+}
+
+void iothub_security_deinit(void) {}
+
+bool dx_proxyIsEnabled(void)
+{
+    return false;
+}
+
+bool dx_proxyCreateDpsClientWithMqttWebSocket(const char *dpsUrl, const char *idScope, PROV_DEVICE_LL_HANDLE *prov_handle)
+{
+    return false;
+}
+
+bool dx_proxyOpenIoTHubHandleWithMqttWebSocket(const char *hostname, IOTHUB_DEVICE_CLIENT_LL_HANDLE *iothubClientHandle)
+{
+    return false;
+}
+
+/****************************************************************************************
+ * Network monitor, termination and device twins
+ ****************************************************************************************/
+bool dx_networkMonitorStart(const DX_NETWORK_MONITOR_CONFIG *config)
+{
+    return true;
+}
+
+bool dx_networkMonitorIsRunning(void)
+{
+    return true;
+}
+
+bool dx_networkMonitorIsConnected(void)
+{
+    return dx_testNetworkUp;
+}
+
+bool dx_networkMonitorRefresh(void)
+{
+    return dx_testNetworkUp;
+}
+
+bool dx_networkMonitorRegisterChangedNotification(DX_NETWORK_CHANGED_CALLBACK networkChangedCallback, void *context)
+{
+    return true;
+}
+
+void dx_networkMonitorUnregisterChangedNotification(DX_NETWORK_CHANGED_CALLBACK networkChangedCallback, void *context) {}
+
+bool dx_isTerminationRequired(void)
+{
+    return false;
+}
+
+bool dx_registerTerminationDrainHandler(DX_TERMINATION_DRAIN_HANDLER drainHandler, void *context)
+{
+    return true;
+}
+
+bool dx_deviceTwinReportValue(DX_DEVICE_TWIN_BINDING *deviceTwinBinding, void *state)
+{
+    return true;
+}
@@ -0,0 +1,39 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Stand-in IoT Hub client for the host tests that run dx_azure_iot.c. Messages handed to the client are
+// delivered and confirmed by the next DoWork, the first DoWork of a new client reports the connect result.
+// Also stands in for the network monitor, proxy and termination modules the connection code calls.
+
+#pragma once
+
+#include "dx_azure_iot.h"
+
+#define DX_TEST_HUB_MAX_MESSAGES 32
+#define DX_TEST_HUB_BODY_SIZE 64
+
+// When false DoWork holds on to sent messages rather than delivering them
+extern bool dx_testHubConfirms;
+
+// Bodies of the delivered messages in order, reset by the test
+extern char dx_testHubDelivered[DX_TEST_HUB_MAX_MESSAGES][DX_TEST_HUB_BODY_SIZE];
+extern size_t dx_testHubDeliveredCount;
+
+// Messages accepted by IoTHubDeviceClient_LL_SendEventAsync and message handles not yet destroyed
+extern size_t dx_testHubSendCount;
+extern int dx_testHubLiveMessages;
+
+// Reason reported by the first DoWork of a new client, IOTHUB_CLIENT_CONNECTION_OK authenticates
+extern IOTHUB_CLIENT_CONNECTION_STATUS_REASON dx_testHubConnectReason;
+
+// Clients created and the host name the last one was created for
+extern size_t dx_testHubCreateCount;
+extern char dx_testHubHostname[128];
+
+// What dx_networkMonitorIsConnected reports
+extern bool dx_testNetworkUp;
+
+/// <summary>
+/// Drop the network and the authenticated connection, the hub reports it as IOTHUB_CLIENT_CONNECTION_NO_NETWORK
+/// </summary>
+void dx_testHubDisconnect(void);
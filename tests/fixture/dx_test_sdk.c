@@ -0,0 +1,48 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Stand-in Azure Sphere SDK and curl calls made by dx_utilities.c. Networking is always ready and
+// connected to the internet, tests that need otherwise fake the layer above.
+
+#include "dx_utilities.h"
+
+int Networking_IsNetworkingReady(bool *outIsNetworkingReady)
+{
+    *outIsNetworkingReady = true;
+    return 0;
+}
+
+int Networking_GetInterfaceConnectionStatus(const char *networkInterfaceName, Networking_InterfaceConnectionStatus *outStatus)
+{
+    *outStatus = Networking_InterfaceConnectionStatus_InterfaceUp | Networking_InterfaceConnectionStatus_ConnectedToNetwork |
+                 Networking_InterfaceConnectionStatus_IpAvailable | Networking_InterfaceConnectionStatus_ConnectedToInternet;
+    return 0;
+}
+
+int Application_IsDeviceAuthReady(bool *outIsReady)
+{
+    *outIsReady = true;
+    return 0;
+}
+
+int curl_global_init(int flags)
+{
+    return 0;
+}
+
+CURL *curl_easy_init(void)
+{
+    return NULL;
+}
+
+int curl_easy_setopt(CURL *handle, int option, ...)
+{
+    return 0;
+}
+
+CURLcode curl_easy_perform(CURL *handle)
+{
+    return 1;
+}
+
+void curl_easy_cleanup(CURL *handle) {}
@@ -0,0 +1,22 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Stand-in for dx_storage.c for tests that do not persist anything, no record is ever kept. Tests of the
+// storage itself link the real one.
+
+#include "dx_storage.h"
+
+bool dx_storageWrite(uint16_t id, const void *data, size_t length)
+{
+    return false;
+}
+
+bool dx_storageRead(uint16_t id, void *buffer, size_t bufferSize, size_t *length)
+{
+    return false;
+}
+
+bool dx_storageDelete(uint16_t id)
+{
+    return true;
+}
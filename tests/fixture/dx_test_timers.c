@@ -0,0 +1,160 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Stand-in for dx_timer.c and the monotonic clock, driven by dx_testAdvance
+
+#include "dx_test.h"
+#include "dx_timer.h"
+
+#define MAX_TIMERS 16
+
+// A handler that keeps re-arming itself for now would otherwise never let dx_testAdvance return
+#define MAX_FIRES_PER_ADVANCE 10000
+
+typedef struct {
+    DX_TIMER_BINDING *timer;
+    int64_t dueMs;
+    int64_t repeatMs;
+} TIMER_DEADLINE;
+
+static TIMER_DEADLINE deadlines[MAX_TIMERS];
+static size_t deadlineCount = 0;
+static int64_t nowMs = 1000000;
+
+static int64_t timespecToMs(const struct timespec *time)
+{
+    return (int64_t)time->tv_sec * 1000 + time->tv_nsec / 1000000;
+}
+
+static void cancelTimer(DX_TIMER_BINDING *timer)
+{
+    for (size_t i = 0; i < deadlineCount; i++) {
+        if (deadlines[i].timer == timer) {
+            deadlines[i] = deadlines[--deadlineCount];
+            return;
+        }
+    }
+}
+
+static bool scheduleTimer(DX_TIMER_BINDING *timer, int64_t delayMs, int64_t repeatMs)
+{
+    cancelTimer(timer);
+
+    if (deadlineCount == MAX_TIMERS) {
+        fprintf(stderr, "FAIL more than %d timers armed\n", MAX_TIMERS);
+        dx_testFailures++;
+        return false;
+    }
+
+    deadlines[deadlineCount++] = (TIMER_DEADLINE){.timer = timer, .dueMs = nowMs + delayMs, .repeatMs = repeatMs};
+    return true;
+}
+
+int64_t dx_getNowMilliseconds(void)
+{
+    return nowMs;
+}
+
+bool dx_timerStart(DX_TIMER_BINDING *timer)
+{
+    if (timer->eventLoopTimer != NULL) {
+        return true;
+    }
+
+    timer->eventLoopTimer = (EventLoopTimer *)timer;
+
+    if (timer->delay != NULL) {
+        return scheduleTimer(timer, timespecToMs(timer->delay), 0);
+    }
+
+    if (timer->repeat != NULL) {
+        return scheduleTimer(timer, timespecToMs(timer->repeat), timespecToMs(timer->repeat));
+    }
+
+    return true;
+}
+
+void dx_timerStop(DX_TIMER_BINDING *timer)
+{
+    cancelTimer(timer);
+    timer->eventLoopTimer = NULL;
+}
+
+bool dx_timerOneShotSet(DX_TIMER_BINDING *timer, const struct timespec *delay)
+{
+    if (timer->eventLoopTimer == NULL) {
+        return false;
+    }
+
+    return scheduleTimer(timer, timespecToMs(delay), 0);
+}
+
+bool dx_timerChange(DX_TIMER_BINDING *timer, const struct timespec *period)
+{
+    if (timer->eventLoopTimer == NULL) {
+        return false;
+    }
+
+    timer->period = *period;
+    return scheduleTimer(timer, timespecToMs(period), timespecToMs(period));
+}
+
+int ConsumeEventLoopTimerEvent(EventLoopTimer *timer)
+{
+    return 0;
+}
+
+size_t dx_testAdvance(int64_t ms)
+{
+    int64_t endMs = nowMs + ms;
+    size_t fired = 0;
+
+    while (fired < MAX_FIRES_PER_ADVANCE) {
+        size_t next = deadlineCount;
+
+        for (size_t i = 0; i < deadlineCount; i++) {
+            if (deadlines[i].dueMs <= endMs && (next == deadlineCount || deadlines[i].dueMs < deadlines[next].dueMs)) {
+                next = i;
+            }
+        }
+
+        if (next == deadlineCount) {
+            break;
+        }
+
+        DX_TIMER_BINDING *timer = deadlines[next].timer;
+
+        if (deadlines[next].dueMs > nowMs) {
+            nowMs = deadlines[next].dueMs;
+        }
+
+        if (deadlines[next].repeatMs > 0) {
+            deadlines[next].dueMs += deadlines[next].repeatMs;
+        } else {
+            deadlines[next] = deadlines[--deadlineCount];
+        }
+
+        fired++;
+        timer->handler(timer->eventLoopTimer);
+    }
+
+    if (fired == MAX_FIRES_PER_ADVANCE) {
+        fprintf(stderr, "FAIL timers still due after %d handler calls\n", MAX_FIRES_PER_ADVANCE);
+        dx_testFailures++;
+    }
+
+    nowMs = endMs;
+
+    return fired;
+}
+
+int64_t dx_testTimerDueInMs(const char *timerName)
+{
+    for (size_t i = 0; i < deadlineCount; i++) {
+        if (deadlines[i].timer->name != NULL && strcmp(deadlines[i].timer->name, timerName) == 0) {
+            return deadlines[i].dueMs - nowMs;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,178 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Lookup benchmark for DX_NAME_INDEX against the linear scan of the bindings it replaced. Names are looked up
+// the way a dispatch does, hash then compare each candidate, for binding tables of a few sizes. Twins are
+// timed per desired document, each binding looked up in the parsed object as before against each member of
+// the object looked up in the index as now.
+
+#include "dx_test.h"
+#include "dx_utilities.h"
+#include "parson.h"
+
+#define MAX_NAMES 64
+#define LOOKUPS 200000
+#define DOCUMENTS 20000
+
+static char names[MAX_NAMES][32];
+
+static int64_t nowNs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static size_t linearFind(size_t count, const char *name)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return count;
+}
+
+static size_t indexFind(const DX_NAME_INDEX *index, size_t count, const char *name)
+{
+    uint32_t hash = dx_hashString(name);
+    size_t cursor = 0;
+    size_t i;
+
+    while (dx_nameIndexNext(index, hash, &cursor, &i)) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return count;
+}
+
+/// <summary>
+/// Time LOOKUPS lookups spread over the first count names, one in eight for a name that is not bound
+/// </summary>
+static void benchmark(const char *kind, size_t count)
+{
+    volatile size_t sink = 0;
+    DX_NAME_INDEX index = {0};
+    int64_t linearNs, indexNs, start;
+
+    CHECK(dx_nameIndexInit(&index, count));
+    for (size_t i = 0; i < count; i++) {
+        dx_nameIndexInsert(&index, dx_hashString(names[i]), i);
+    }
+
+    for (size_t i = 0; i <= count; i++) {
+        const char *name = i < count ? names[i] : "NotBound";
+        CHECK(linearFind(count, name) == indexFind(&index, count, name));
+    }
+
+    start = nowNs();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        sink += linearFind(count, (i & 7) == 7 ? "NotBound" : names[i % count]);
+    }
+    linearNs = nowNs() - start;
+
+    start = nowNs();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        sink += indexFind(&index, count, (i & 7) == 7 ? "NotBound" : names[i % count]);
+    }
+    indexNs = nowNs() - start;
+
+    printf("%-7s %2zu bindings  linear %6.1f ns  index %6.1f ns per lookup\n", kind, count, (double)linearNs / LOOKUPS,
+           (double)indexNs / LOOKUPS);
+
+    dx_nameIndexFree(&index);
+}
+
+/// <summary>
+/// Time DOCUMENTS dispatches of a desired document with a member for each of count bindings and a $version
+/// </summary>
+static void twinBenchmark(size_t count)
+{
+    volatile size_t sink = 0;
+    DX_NAME_INDEX index = {0};
+    int64_t linearNs, indexNs, start;
+    char document[MAX_NAMES * 48];
+    size_t length = 0;
+    size_t linearFound = 0, indexFound = 0;
+
+    length += (size_t)snprintf(document + length, sizeof(document) - length, "{");
+    for (size_t i = 0; i < count; i++) {
+        length += (size_t)snprintf(document + length, sizeof(document) - length, "\"%s\":%zu,", names[i], i);
+    }
+    snprintf(document + length, sizeof(document) - length, "\"$version\":42}");
+
+    JSON_Value *root = json_parse_string(document);
+    JSON_Object *desired = json_value_get_object(root);
+    CHECK(desired != NULL);
+
+    CHECK(dx_nameIndexInit(&index, count));
+    for (size_t i = 0; i < count; i++) {
+        dx_nameIndexInsert(&index, dx_hashStringLength(names[i], strcspn(names[i], ".")), i);
+    }
+
+    start = nowNs();
+    for (size_t d = 0; d < DOCUMENTS; d++) {
+        for (size_t i = 0; i < count; i++) {
+            if (json_object_get_value(desired, names[i]) != NULL) {
+                linearFound++;
+            }
+        }
+    }
+    linearNs = nowNs() - start;
+
+    start = nowNs();
+    for (size_t d = 0; d < DOCUMENTS; d++) {
+        size_t members = json_object_get_count(desired);
+
+        for (size_t m = 0; m < members; m++) {
+            const char *name = json_object_get_name(desired, m);
+            size_t nameLength = strcspn(name, ".");
+            size_t cursor = 0;
+            size_t i;
+
+            while (dx_nameIndexNext(&index, dx_hashStringLength(name, nameLength), &cursor, &i)) {
+                if (strncmp(names[i], name, nameLength) == 0 && names[i][nameLength] == '\0') {
+                    indexFound++;
+                    sink += i;
+                }
+            }
+        }
+    }
+    indexNs = nowNs() - start;
+
+    CHECK(linearFound == count * DOCUMENTS);
+    CHECK(indexFound == linearFound);
+
+    printf("%-7s %2zu bindings  linear %6.1f ns  index %6.1f ns per document\n", "twins", count,
+           (double)linearNs / DOCUMENTS, (double)indexNs / DOCUMENTS);
+
+    dx_nameIndexFree(&index);
+    json_value_free(root);
+}
+
+int main(void)
+{
+    static const size_t counts[] = {4, 16, 64};
+
+    // Method names tend to share a prefix, which is the slow case for the scan
+    for (size_t i = 0; i < MAX_NAMES; i++) {
+        snprintf(names[i], sizeof(names[i]), "SetRelayState%02zu", i);
+    }
+
+    for (size_t i = 0; i < NELEMS(counts); i++) {
+        benchmark("methods", counts[i]);
+    }
+
+    // Twin properties of one device often differ only in a suffix too
+    for (size_t i = 0; i < MAX_NAMES; i++) {
+        snprintf(names[i], sizeof(names[i]), "DesiredTemperature%02zu", i);
+    }
+
+    for (size_t i = 0; i < NELEMS(counts); i++) {
+        twinBenchmark(counts[i]);
+    }
+
+    return dx_testFinish("name_index_benchmark");
+}
@@ -0,0 +1,203 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host test for the network monitor. Runs dx_network_monitor.c against a fake networking provider that
+// counts its calls, on the fixture's clock and timers.
+
+#include "dx_network_monitor.h"
+#include "dx_test.h"
+
+#define INTERFACE "wlan0"
+
+/****************************************************************************************
+ * Fake networking provider
+ ****************************************************************************************/
+static bool networkUp = true;
+static size_t providerCalls = 0;
+
+static bool fakeIsNetworkingReady(void)
+{
+    providerCalls++;
+    return networkUp;
+}
+
+static bool fakeIsInterfaceConnected(const char *networkInterface)
+{
+    providerCalls++;
+    return networkUp && strcmp(networkInterface, INTERFACE) == 0;
+}
+
+static const DX_NETWORK_MONITOR_PROVIDER fakeProvider = {.isNetworkingReady = fakeIsNetworkingReady,
+                                                         .isInterfaceConnected = fakeIsInterfaceConnected};
+
+/****************************************************************************************
+ * Subscribers
+ ****************************************************************************************/
+typedef struct {
+    size_t calls;
+    bool connected;
+    bool unregisterSelf;
+    void *unregisterContext; // Another subscriber to unregister when called
+} SUBSCRIBER;
+
+static void changed(bool connected, void *context)
+{
+    SUBSCRIBER *subscriber = (SUBSCRIBER *)context;
+
+    subscriber->calls++;
+    subscriber->connected = connected;
+
+    if (subscriber->unregisterSelf) {
+        dx_networkMonitorUnregisterChangedNotification(changed, subscriber);
+    }
+    if (subscriber->unregisterContext != NULL) {
+        dx_networkMonitorUnregisterChangedNotification(changed, subscriber->unregisterContext);
+    }
+}
+
+/****************************************************************************************
+ * Tests
+ ****************************************************************************************/
+
+/// <summary>
+/// Starting reads the state at once, then every 30 s while connected
+/// </summary>
+static void testRefreshScheduleWhileConnected(void)
+{
+    DX_NETWORK_MONITOR_STATS stats;
+
+    CHECK(dx_networkMonitorStart(&(DX_NETWORK_MONITOR_CONFIG){.networkInterface = INTERFACE}));
+    CHECK(dx_networkMonitorIsRunning());
+    CHECK(dx_networkMonitorIsConnected());
+    CHECK(dx_testTimerDueInMs("tmr_network_monitor") == DX_NETWORK_MONITOR_REFRESH_MILLISECONDS);
+
+    dx_networkMonitorGetStats(&stats);
+    CHECK(stats.refreshes == 1 && stats.changes == 1);
+
+    CHECK(dx_testAdvance(DX_NETWORK_MONITOR_REFRESH_MILLISECONDS - 1) == 0);
+    CHECK(dx_testAdvance(1) == 1);
+    CHECK(dx_testTimerDueInMs("tmr_network_monitor") == DX_NETWORK_MONITOR_REFRESH_MILLISECONDS);
+
+    dx_networkMonitorGetStats(&stats);
+    CHECK(stats.refreshes == 2 && stats.changes == 1);
+}
+
+/// <summary>
+/// The cached read makes no networking calls however often it is made
+/// </summary>
+static void testCachedReadMakesNoCalls(void)
+{
+    size_t calls = providerCalls;
+
+    for (int i = 0; i < 1000; i++) {
+        CHECK(dx_networkMonitorIsConnected());
+    }
+
+    CHECK(providerCalls == calls);
+}
+
+/// <summary>
+/// A drop is seen on the next refresh, subscribers are called once and the schedule falls to 2 s until
+/// the network is back
+/// </summary>
+static void testChangeEventsAndDegradedSchedule(void)
+{
+    SUBSCRIBER first = {0}, second = {0};
+    DX_NETWORK_MONITOR_STATS before, after;
+
+    CHECK(dx_networkMonitorRegisterChangedNotification(changed, &first));
+    CHECK(dx_networkMonitorRegisterChangedNotification(changed, &second));
+    dx_networkMonitorGetStats(&before);
+
+    networkUp = false;
+    CHECK(dx_networkMonitorIsConnected());
+    dx_testAdvance(DX_NETWORK_MONITOR_REFRESH_MILLISECONDS);
+
+    CHECK(!dx_networkMonitorIsConnected());
+    CHECK(first.calls == 1 && !first.connected);
+    CHECK(second.calls == 1 && !second.connected);
+    CHECK(dx_testTimerDueInMs("tmr_network_monitor") == DX_NETWORK_MONITOR_DEGRADED_REFRESH_MILLISECONDS);
+
+    // Still down, refreshed but no event
+    CHECK(dx_testAdvance(DX_NETWORK_MONITOR_DEGRADED_REFRESH_MILLISECONDS) == 1);
+    CHECK(first.calls == 1);
+
+    networkUp = true;
+    CHECK(dx_testAdvance(DX_NETWORK_MONITOR_DEGRADED_REFRESH_MILLISECONDS) == 1);
+    CHECK(dx_networkMonitorIsConnected());
+    CHECK(first.calls == 2 && first.connected);
+    CHECK(second.calls == 2 && second.connected);
+    CHECK(dx_testTimerDueInMs("tmr_network_monitor") == DX_NETWORK_MONITOR_REFRESH_MILLISECONDS);
+
+    dx_networkMonitorGetStats(&after);
+    CHECK(after.refreshes - before.refreshes == 3);
+    CHECK(after.changes - before.changes == 2);
+
+    dx_networkMonitorUnregisterChangedNotification(changed, &first);
+    dx_networkMonitorUnregisterChangedNotification(changed, &second);
+}
+
+/// <summary>
+/// A subscriber may unregister itself or one later in the list from its callback. The rest are still
+/// called once, the removed ones are not called again.
+/// </summary>
+static void testUnregisterDuringDispatch(void)
+{
+    SUBSCRIBER self = {.unregisterSelf = true}, victim = {0}, remover = {0}, last = {0};
+
+    remover.unregisterContext = &victim;
+
+    CHECK(dx_networkMonitorRegisterChangedNotification(changed, &self));
+    CHECK(dx_networkMonitorRegisterChangedNotification(changed, &remover));
+    CHECK(dx_networkMonitorRegisterChangedNotification(changed, &victim));
+    CHECK(dx_networkMonitorRegisterChangedNotification(changed, &last));
+
+    networkUp = false;
+    CHECK(!dx_networkMonitorRefresh());
+
+    CHECK(self.calls == 1);
+    CHECK(remover.calls == 1);
+    CHECK(victim.calls == 0);
+    CHECK(last.calls == 1);
+
+    networkUp = true;
+    CHECK(dx_networkMonitorRefresh());
+
+    CHECK(self.calls == 1);
+    CHECK(remover.calls == 2);
+    CHECK(victim.calls == 0);
+    CHECK(last.calls == 2);
+
+    dx_networkMonitorUnregisterChangedNotification(changed, &remover);
+    dx_networkMonitorUnregisterChangedNotification(changed, &last);
+}
+
+/// <summary>
+/// Stopped, the last state is still reported and nothing is refreshed
+/// </summary>
+static void testStop(void)
+{
+    size_t calls = providerCalls;
+
+    dx_networkMonitorStop();
+    CHECK(!dx_networkMonitorIsRunning());
+    CHECK(dx_testTimerDueInMs("tmr_network_monitor") == -1);
+
+    networkUp = false;
+    CHECK(dx_testAdvance(DX_NETWORK_MONITOR_REFRESH_MILLISECONDS * 2) == 0);
+    CHECK(dx_networkMonitorIsConnected());
+    CHECK(providerCalls == calls);
+}
+
+int main(void)
+{
+    dx_networkMonitorSetProvider(&fakeProvider);
+
+    testRefreshScheduleWhileConnected();
+    testCachedReadMakesNoCalls();
+    testChangeEventsAndDegradedSchedule();
+    testUnregisterDuringDispatch();
+    testStop();
+
+    return dx_testFinish("network_monitor_test");
+}
@@ -0,0 +1,178 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Parse and free benchmark for the parse arenas. Each document is parsed onto the heap and into an arena of
+// the library's default size, the time per parse and free, the peak heap and the arena the document needs
+// are printed. Figures are for the host, pointers are 8 bytes rather than the 4 of an Azure Sphere app.
+
+#include "dx_avnet_iot_connect.h"
+#include "dx_device_twins.h"
+#include "dx_test.h"
+#include <time.h>
+
+#define ITERATIONS 2000
+
+// A desired properties twin of the size an application with a dozen settings receives
+static const char twinDocument[] =
+    "{\"desired\":{\"sampleRateSeconds\":30,\"reportRateSeconds\":300,\"temperatureAlert\":38.5,\"humidityAlert\":80,"
+    "\"ledEnabled\":true,\"displayMessage\":\"Hello from the cloud\",\"relay1\":false,\"relay2\":true,"
+    "\"thresholds\":{\"low\":12.5,\"high\":30.25},\"timezone\":\"Australia/Sydney\",\"firmwareChannel\":\"stable\","
+    "\"$metadata\":{\"$lastUpdated\":\"2022-04-06T16:25:54.9272761Z\",\"$lastUpdatedVersion\":42,"
+    "\"sampleRateSeconds\":{\"$lastUpdated\":\"2022-04-06T16:25:54.9272761Z\",\"$lastUpdatedVersion\":42},"
+    "\"reportRateSeconds\":{\"$lastUpdated\":\"2022-04-06T16:25:54.9272761Z\",\"$lastUpdatedVersion\":40},"
+    "\"temperatureAlert\":{\"$lastUpdated\":\"2022-04-05T09:12:01.0000000Z\",\"$lastUpdatedVersion\":38},"
+    "\"humidityAlert\":{\"$lastUpdated\":\"2022-04-05T09:12:01.0000000Z\",\"$lastUpdatedVersion\":38},"
+    "\"ledEnabled\":{\"$lastUpdated\":\"2022-04-04T21:40:13.5550000Z\",\"$lastUpdatedVersion\":35},"
+    "\"displayMessage\":{\"$lastUpdated\":\"2022-04-04T21:40:13.5550000Z\",\"$lastUpdatedVersion\":35},"
+    "\"relay1\":{\"$lastUpdated\":\"2022-04-03T08:00:00.0000000Z\",\"$lastUpdatedVersion\":30},"
+    "\"relay2\":{\"$lastUpdated\":\"2022-04-03T08:00:00.0000000Z\",\"$lastUpdatedVersion\":30},"
+    "\"thresholds\":{\"$lastUpdated\":\"2022-04-02T12:30:45.1230000Z\",\"$lastUpdatedVersion\":27,"
+    "\"low\":{\"$lastUpdated\":\"2022-04-02T12:30:45.1230000Z\",\"$lastUpdatedVersion\":27},"
+    "\"high\":{\"$lastUpdated\":\"2022-04-02T12:30:45.1230000Z\",\"$lastUpdatedVersion\":27}},"
+    "\"timezone\":{\"$lastUpdated\":\"2022-04-01T00:00:00.0000000Z\",\"$lastUpdatedVersion\":20}},"
+    "\"$version\":42}}";
+
+// IoTConnect 2.1 hello response, as it arrives formatted
+static const char helloDocument[] = "{\n"
+                                    "\t\"d\": {\n"
+                                    "\t\t\"ec\": 0,\n"
+                                    "\t\t\"ct\": 200,\n"
+                                    "\t\t\"dt\": \"2022-04-06T16:25:54.9272761Z\",\n"
+                                    "\t\t\"sid\": \"NDA5ZTMyMTcyNGMyNGExYWIzMTZhYzE0NTI2MTFjYTU=UTE6MTQ6MDMuMDA=\",\n"
+                                    "\t\t\"meta\": {\n"
+                                    "\t\t\t\"df\": 60,\n"
+                                    "\t\t\t\"cd\": \"138913Y\",\n"
+                                    "\t\t\t\"gtw\": {\n"
+                                    "\t\t\t\t\"tg\": \"spheregwdevice\",\n"
+                                    "\t\t\t\t\"g\": \"8274249f-e31d-429b-b1dd-a43d537a5c04\"\n"
+                                    "\t\t\t},\n"
+                                    "\t\t\t\"dtg\": \"9320fa22-ae64-473d-b6ca-aff78da082ed\",\n"
+                                    "\t\t\t\"edge\": 0,\n"
+                                    "\t\t\t\"pf\": 0,\n"
+                                    "\t\t\t\"hwv\": \"\",\n"
+                                    "\t\t\t\"swv\": \"\",\n"
+                                    "\t\t\t\"v\": 2.1\n"
+                                    "\t\t},\n"
+                                    "\t\t\"has\": {\n"
+                                    "\t\t\t\"d\": 0,\n"
+                                    "\t\t\t\"attr\": 1,\n"
+                                    "\t\t\t\"set\": 0,\n"
+                                    "\t\t\t\"r\": 0,\n"
+                                    "\t\t\t\"ota\": 0\n"
+                                    "\t\t}\n"
+                                    "\t}\n"
+                                    "}";
+
+/****************************************************************************************
+ * Heap accounting, every block carries its size in front of it
+ ****************************************************************************************/
+#define BLOCK_HEADER 16
+
+static size_t heapBytes = 0;
+static size_t heapPeak = 0;
+static size_t heapBlocks = 0;
+
+static void *countingMalloc(size_t size)
+{
+    uint8_t *block = (uint8_t *)malloc(size + BLOCK_HEADER);
+
+    if (block == NULL) {
+        return NULL;
+    }
+
+    memcpy(block, &size, sizeof(size));
+    heapBytes += size;
+    heapBlocks++;
+    if (heapBytes > heapPeak) {
+        heapPeak = heapBytes;
+    }
+
+    return block + BLOCK_HEADER;
+}
+
+static void countingFree(void *pointer)
+{
+    uint8_t *block = (uint8_t *)pointer - BLOCK_HEADER;
+    size_t size;
+
+    if (pointer == NULL) {
+        return;
+    }
+
+    memcpy(&size, block, sizeof(size));
+    heapBytes -= size;
+    free(block);
+}
+
+static int64_t nowNs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/// <summary>
+/// Time ITERATIONS parses and frees of document onto the heap and into an arena of arenaSize bytes
+/// </summary>
+static void benchmark(const char *name, const char *document, size_t arenaSize)
+{
+    static char arenaBuffer[64 * 1024];
+    size_t length = strlen(document);
+    size_t heapPeakBytes, heapPeakBlocks;
+    int64_t heapNs, arenaNs, start;
+    JSON_Arena arena;
+    JSON_Value *value;
+
+    CHECK(arenaSize <= sizeof(arenaBuffer));
+
+    heapPeak = heapBlocks = 0;
+    start = nowNs();
+    for (int i = 0; i < ITERATIONS; i++) {
+        value = json_parse_string_with_length(document, length);
+        CHECK(value != NULL);
+        json_value_free(value);
+    }
+    heapNs = (nowNs() - start) / ITERATIONS;
+    heapPeakBytes = heapPeak;
+    heapPeakBlocks = heapBlocks / ITERATIONS;
+    CHECK(heapBytes == 0);
+
+    // The arena a document needs, measured with one large enough for anything here
+    CHECK(json_arena_init(&arena, arenaBuffer, sizeof(arenaBuffer)) == JSONSuccess);
+    value = json_arena_parse_string_with_length(&arena, document, length);
+    size_t arenaNeeded = arena.peak;
+    json_value_free(value);
+    json_arena_deinit(&arena);
+
+    CHECK(json_arena_init(&arena, arenaBuffer, arenaSize) == JSONSuccess);
+    heapPeak = heapBlocks = 0;
+    start = nowNs();
+    for (int i = 0; i < ITERATIONS; i++) {
+        value = json_arena_parse_string_with_length(&arena, document, length);
+        CHECK(value != NULL);
+
+        // All arena or all heap, never both
+        CHECK((arena.overflows == 0 && heapBlocks == 0) || (arena.overflows == 1 && arena.used == 0));
+
+        json_value_free(value);
+        json_arena_reset(&arena);
+    }
+    arenaNs = (nowNs() - start) / ITERATIONS;
+    CHECK(heapBytes == 0);
+    json_arena_deinit(&arena);
+
+    printf("%-6s %5zu bytes  heap %6lld ns %5zu bytes peak %4zu blocks  arena(%zu) %6lld ns %5zu bytes peak  needs %zu\n",
+           name, length, (long long)heapNs, heapPeakBytes, heapPeakBlocks, arenaSize, (long long)arenaNs, heapPeak,
+           arenaNeeded);
+}
+
+int main(void)
+{
+    json_set_allocation_functions(countingMalloc, countingFree);
+
+    benchmark("twin", twinDocument, DX_DEVICE_TWIN_PARSE_ARENA_BYTES);
+    benchmark("hello", helloDocument, DX_AVNET_IOT_CONNECT_PARSE_ARENA_BYTES);
+
+    return dx_testFinish("parse_arena_benchmark");
+}
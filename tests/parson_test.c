@@ -0,0 +1,238 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host test for parson in-situ parsing. Every document is also parsed by the copying parser, the two must
+// agree on what is decoded and what is rejected.
+
+#include "dx_test.h"
+#include "parson.h"
+
+// Must match the value parson.c is built with, see CMakeLists.txt
+#ifndef PARSON_MAX_BORROWED
+#define PARSON_MAX_BORROWED 4
+#endif
+
+static bool pointsInto(const char *pointer, const char *buffer, size_t length)
+{
+    return pointer >= buffer && pointer < buffer + length;
+}
+
+/// <summary>
+/// Parse json in place and expect member name to decode to expected, with both the member name and the
+/// value pointing into the source buffer
+/// </summary>
+static void checkDecoded(const char *json, const char *name, const char *expected)
+{
+    char buffer[256];
+    size_t length = strlen(json);
+    JSON_Value *value;
+    JSON_Value *copied;
+    const char *decoded;
+
+    memcpy(buffer, json, length + 1);
+
+    if ((value = json_parse_string_in_situ(buffer, length)) == NULL) {
+        fprintf(stderr, "FAIL in-situ parse rejected %s\n", json);
+        dx_testFailures++;
+        return;
+    }
+
+    decoded = json_object_get_string(json_object(value), name);
+    CHECK(decoded != NULL && strcmp(decoded, expected) == 0);
+    CHECK(pointsInto(decoded, buffer, length));
+    CHECK(pointsInto(json_object_get_name(json_object(value), 0), buffer, length));
+
+    copied = json_parse_string(json);
+    CHECK(copied != NULL && json_value_equals(copied, value));
+
+    json_value_free(copied);
+    json_value_free(value);
+    json_release_in_situ(buffer);
+}
+
+static void testEscapes(void)
+{
+    checkDecoded("{\"k\":\"plain\"}", "k", "plain");
+    checkDecoded("{\"k\":\"\"}", "k", "");
+    checkDecoded("{\"k\":\"a\\\"b\\\\c\\/d\\b\\f\\n\\r\\te\"}", "k", "a\"b\\c/d\b\f\n\r\te");
+    checkDecoded("{\"k\":\"\\u0041\\u00e9\\u20ac\"}", "k", "A\xc3\xa9\xe2\x82\xac");
+    checkDecoded("{\"k\\u0031\":\"v\"}", "k1", "v");
+    checkDecoded("\xEF\xBB\xBF{\"k\":\"bom\"}", "k", "bom");
+}
+
+static void testSurrogatePairs(void)
+{
+    // U+1F600, then the highest code point U+10FFFF
+    checkDecoded("{\"k\":\"x\\ud83d\\ude00y\"}", "k", "x\xf0\x9f\x98\x80y");
+    checkDecoded("{\"k\":\"\\udbff\\udfff\"}", "k", "\xf4\x8f\xbf\xbf");
+}
+
+/// <summary>
+/// Documents the copying parser rejects are rejected in place too, and each failed parse gives its buffer
+/// back to the registry
+/// </summary>
+static void testRejected(void)
+{
+    const char *rejected[] = {
+        "{\"k\":\"\\ud83d\"}",        // Lone high surrogate
+        "{\"k\":\"\\ude00\"}",        // Lone low surrogate
+        "{\"k\":\"\\ude00\\ud83d\"}", // Reversed pair
+        "{\"k\":\"\\ud83dx\"}",       // High surrogate then a character
+        "{\"k\":\"\\ud83d\\u0041\"}", // High surrogate then an escape outside the low surrogate range
+        "{\"k\":\"\\u12\"}",          // Truncated escape
+        "{\"k\":\"a\\q\"}",           // Unknown escape
+        "{\"k\":\"a",                 // Unterminated string
+        "{\"k\":[1,\"s\",",           // Truncated document
+        "{\"a\":\"b\",\"a\":\"c\"}",  // Duplicate member
+        "{\"a\\u0062\":1,\"ab\":2}",  // Duplicate member once the escape is decoded
+    };
+    char buffer[64];
+
+    for (size_t i = 0; i < sizeof(rejected) / sizeof(rejected[0]); i++) {
+        size_t length = strlen(rejected[i]);
+        JSON_Value *copied = json_parse_string(rejected[i]);
+        JSON_Value *value;
+
+        memcpy(buffer, rejected[i], length + 1);
+        value = json_parse_string_in_situ(buffer, length);
+
+        if (value != NULL || copied != NULL) {
+            fprintf(stderr, "FAIL accepted %s\n", rejected[i]);
+            dx_testFailures++;
+        }
+
+        json_value_free(value);
+        json_value_free(copied);
+    }
+
+    // More failures than registry slots, the registry must still be empty
+    char sources[PARSON_MAX_BORROWED][8];
+    JSON_Value *values[PARSON_MAX_BORROWED];
+
+    for (size_t i = 0; i < PARSON_MAX_BORROWED; i++) {
+        memcpy(sources[i], "[\"a\"]", 6);
+        values[i] = json_parse_string_in_situ(sources[i], 5);
+        CHECK(values[i] != NULL);
+    }
+
+    for (size_t i = 0; i < PARSON_MAX_BORROWED; i++) {
+        json_value_free(values[i]);
+        json_release_in_situ(sources[i]);
+    }
+}
+
+/// <summary>
+/// Values set or removed after an in-situ parse mix heap and borrowed strings, freeing the tree must only
+/// free the heap ones
+/// </summary>
+static void testModifyAfterParse(void)
+{
+    char buffer[] = "{\"d\":{\"ct\":200,\"meta\":{\"cd\":\"X\\tY\",\"v\":2.5},\"list\":[\"p\",\"q\",{\"id\":\"r\"}]}}";
+    char *serialized;
+    JSON_Value *value;
+    JSON_Object *object;
+
+    value = json_parse_string_in_situ(buffer, strlen(buffer));
+    CHECK(value != NULL);
+    if (value == NULL) {
+        return;
+    }
+
+    // The buffer is already borrowed
+    CHECK(json_parse_string_in_situ(buffer, strlen(buffer)) == NULL);
+
+    object = json_object(value);
+    CHECK(strcmp(json_object_dotget_string(object, "d.meta.cd"), "X\tY") == 0);
+
+    CHECK(json_object_dotset_string(object, "d.meta.cd", "replaced") == JSONSuccess);
+    CHECK(json_object_dotremove(object, "d.list") == JSONSuccess);
+    CHECK(json_object_set_string(object, "added", "h") == JSONSuccess);
+
+    serialized = json_serialize_to_string(value);
+    CHECK(serialized != NULL &&
+          strcmp(serialized, "{\"d\":{\"ct\":200,\"meta\":{\"cd\":\"replaced\",\"v\":2.5}},\"added\":\"h\"}") == 0);
+    json_free_serialized_string(serialized);
+
+    json_value_free(value);
+    json_release_in_situ(buffer);
+}
+
+/// <summary>
+/// Arenas and in-situ sources share PARSON_MAX_BORROWED registry slots
+/// </summary>
+static void testRegistryLimit(void)
+{
+    static char arenaBuffer[256];
+    char sources[PARSON_MAX_BORROWED + 1][8];
+    JSON_Value *values[PARSON_MAX_BORROWED];
+    JSON_Arena arena;
+
+    for (size_t i = 0; i < PARSON_MAX_BORROWED; i++) {
+        memcpy(sources[i], "[\"a\"]", 6);
+        values[i] = json_parse_string_in_situ(sources[i], 5);
+        CHECK(values[i] != NULL);
+    }
+
+    memcpy(sources[PARSON_MAX_BORROWED], "[1]", 4);
+    CHECK(json_parse_string_in_situ(sources[PARSON_MAX_BORROWED], 3) == NULL);
+    CHECK(json_arena_init(&arena, arenaBuffer, sizeof(arenaBuffer)) == JSONFailure);
+
+    for (size_t i = 0; i < PARSON_MAX_BORROWED; i++) {
+        json_value_free(values[i]);
+        json_release_in_situ(sources[i]);
+    }
+
+    CHECK(json_arena_init(&arena, arenaBuffer, sizeof(arenaBuffer)) == JSONSuccess);
+    json_arena_deinit(&arena);
+}
+
+/// <summary>
+/// A document that does not fit in what is left of the arena is parsed on the heap as a whole, the arena is
+/// left as it was and the tree does not depend on it
+/// </summary>
+static void testArenaOverflowParsesOnHeap(void)
+{
+    static char arenaBuffer[256];
+    const char *small = "{\"a\":1}";
+    const char *large = "{\"list\":[\"one\",\"two\",\"three\",\"four\",\"five\",\"six\",\"seven\",\"eight\"],"
+                        "\"nested\":{\"a\":{\"b\":{\"c\":\"deep\"}}},\"number\":12.5}";
+    JSON_Value *smallValue, *largeValue, *copied;
+    JSON_Arena arena;
+    size_t used;
+
+    CHECK(json_arena_init(&arena, arenaBuffer, sizeof(arenaBuffer)) == JSONSuccess);
+
+    smallValue = json_arena_parse_string_with_length(&arena, small, strlen(small));
+    CHECK(smallValue != NULL && arena.overflows == 0 && arena.used > 0);
+    used = arena.used;
+
+    largeValue = json_arena_parse_string_with_length(&arena, large, strlen(large));
+    CHECK(largeValue != NULL);
+    CHECK(arena.overflows == 1);
+    CHECK(arena.used == used);
+    CHECK(json_object_get_number(json_object(smallValue), "a") == 1);
+
+    // Wipe the arena, the heap tree must come through untouched
+    json_value_free(smallValue);
+    json_arena_reset(&arena);
+    memset(arenaBuffer, 0xAA, sizeof(arenaBuffer));
+
+    copied = json_parse_string(large);
+    CHECK(copied != NULL && json_value_equals(copied, largeValue));
+
+    json_value_free(copied);
+    json_value_free(largeValue);
+    json_arena_deinit(&arena);
+}
+
+int main(void)
+{
+    testEscapes();
+    testSurrogatePairs();
+    testRejected();
+    testModifyAfterParse();
+    testRegistryLimit();
+    testArenaOverflowParsesOnHeap();
+
+    return dx_testFinish("parson_test");
+}
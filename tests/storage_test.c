@@ -0,0 +1,221 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host test for the mutable storage record store. The mutable file is a temporary file, a torn write is
+// simulated by cutting the file short or corrupting bytes of the region being written.
+
+#include "dx_storage.h"
+#include "dx_test.h"
+#include <fcntl.h>
+
+static char mutableFilePath[] = "/tmp/dx_storage_test_XXXXXX";
+
+int Storage_OpenMutableFile(void)
+{
+    return open(mutableFilePath, O_RDWR);
+}
+
+static off_t fileSize(void)
+{
+    int fd = open(mutableFilePath, O_RDONLY);
+    off_t size = lseek(fd, 0, SEEK_END);
+    close(fd);
+    return size;
+}
+
+static void truncateFile(off_t size)
+{
+    CHECK(truncate(mutableFilePath, size) == 0);
+}
+
+static void overwriteByte(off_t offset, uint8_t value)
+{
+    int fd = open(mutableFilePath, O_RDWR);
+    CHECK(pwrite(fd, &value, 1, offset) == 1);
+    close(fd);
+}
+
+static bool readString(uint16_t id, char *buffer, size_t bufferSize)
+{
+    size_t length = 0;
+
+    if (!dx_storageRead(id, buffer, bufferSize - 1, &length)) {
+        return false;
+    }
+
+    buffer[length] = '\0';
+    return true;
+}
+
+static void testWriteReadDelete(void)
+{
+    char buffer[64];
+
+    truncateFile(0);
+
+    CHECK(!readString(1, buffer, sizeof(buffer)));
+    CHECK(dx_storageWrite(1, "first", 5));
+    CHECK(dx_storageWrite(2, "second", 6));
+    CHECK(readString(1, buffer, sizeof(buffer)) && strcmp(buffer, "first") == 0);
+    CHECK(readString(2, buffer, sizeof(buffer)) && strcmp(buffer, "second") == 0);
+
+    CHECK(dx_storageWrite(1, "updated", 7));
+    CHECK(readString(1, buffer, sizeof(buffer)) && strcmp(buffer, "updated") == 0);
+    CHECK(readString(2, buffer, sizeof(buffer)) && strcmp(buffer, "second") == 0);
+
+    CHECK(dx_storageDelete(2));
+    CHECK(!readString(2, buffer, sizeof(buffer)));
+    CHECK(readString(1, buffer, sizeof(buffer)) && strcmp(buffer, "updated") == 0);
+
+    // Too small a buffer is not a partial read
+    CHECK(!dx_storageRead(1, buffer, 3, NULL));
+
+    // Never larger than the two regions
+    CHECK(fileSize() <= 2 * DX_STORAGE_REGION_BYTES);
+}
+
+/// <summary>
+/// Whichever region a write lands in, tearing it leaves every record as it was before the write
+/// </summary>
+static void testTornWriteKeepsPreviousGeneration(void)
+{
+    char buffer[64];
+
+    for (size_t tornRegion = 0; tornRegion < 2; tornRegion++) {
+        truncateFile(0);
+
+        // Writes alternate between the regions starting with region 0
+        CHECK(dx_storageWrite(1, "one", 3));
+        CHECK(dx_storageWrite(2, "two", 3));
+        if (tornRegion == 1) {
+            CHECK(dx_storageWrite(3, "three", 5));
+        }
+
+        CHECK(dx_storageWrite(1, "one-updated", 11));
+
+        // Lose the tail of the write, as if power failed before it all reached flash. Region 1 is the end of the file.
+        if (tornRegion == 1) {
+            truncateFile(fileSize() - 1);
+        } else {
+            overwriteByte(20, 0xFF);
+        }
+
+        CHECK(readString(1, buffer, sizeof(buffer)) && strcmp(buffer, "one") == 0);
+        CHECK(readString(2, buffer, sizeof(buffer)) && strcmp(buffer, "two") == 0);
+
+        // The next write rebuilds the torn region from the surviving one
+        CHECK(dx_storageWrite(2, "two-updated", 11));
+        CHECK(readString(1, buffer, sizeof(buffer)) && strcmp(buffer, "one") == 0);
+        CHECK(readString(2, buffer, sizeof(buffer)) && strcmp(buffer, "two-updated") == 0);
+    }
+}
+
+/// <summary>
+/// Region 0 torn with region 1 intact, whether or not the header survived, the records come from region 1 and
+/// the next write rebuilds region 0
+/// </summary>
+static void testTornRegionZero(void)
+{
+    char buffer[64];
+
+    for (off_t tornOffset = 0; tornOffset < 20; tornOffset += 16) {
+        truncateFile(0);
+
+        CHECK(dx_storageWrite(1, "one", 3));
+        CHECK(dx_storageWrite(2, "two", 3));
+
+        // Region 1 holds both records, lose the magic or the records of region 0
+        overwriteByte(tornOffset, 0xFF);
+
+        CHECK(readString(1, buffer, sizeof(buffer)) && strcmp(buffer, "one") == 0);
+        CHECK(readString(2, buffer, sizeof(buffer)) && strcmp(buffer, "two") == 0);
+
+        CHECK(dx_storageWrite(1, "one-updated", 11));
+        CHECK(readString(1, buffer, sizeof(buffer)) && strcmp(buffer, "one-updated") == 0);
+        CHECK(readString(2, buffer, sizeof(buffer)) && strcmp(buffer, "two") == 0);
+    }
+}
+
+/// <summary>
+/// The very first write torn before the header reached flash leaves no records, storage is still usable
+/// </summary>
+static void testTornFirstWrite(void)
+{
+    char buffer[64];
+
+    truncateFile(0);
+    CHECK(dx_storageWrite(1, "one", 3));
+    truncateFile(2);
+
+    CHECK(!readString(1, buffer, sizeof(buffer)));
+    CHECK(dx_storageWrite(1, "again", 5));
+    CHECK(readString(1, buffer, sizeof(buffer)) && strcmp(buffer, "again") == 0);
+
+    truncateFile(0);
+    CHECK(dx_storageWrite(1, "one", 3));
+    overwriteByte(0, 0xFF);
+
+    CHECK(!readString(1, buffer, sizeof(buffer)));
+    CHECK(dx_storageWrite(2, "two", 3));
+    CHECK(readString(2, buffer, sizeof(buffer)) && strcmp(buffer, "two") == 0);
+}
+
+/// <summary>
+/// Data longer than the two regions that neither starts with a region header belongs to someone else
+/// </summary>
+static void testForeignFileIsNotOverwritten(void)
+{
+    static char appData[2 * DX_STORAGE_REGION_BYTES + 1];
+    static char contents[sizeof(appData)];
+    char buffer[64];
+
+    memset(appData, 's', sizeof(appData));
+
+    truncateFile(0);
+    int fd = open(mutableFilePath, O_RDWR);
+    CHECK(write(fd, appData, sizeof(appData)) == (ssize_t)sizeof(appData));
+    close(fd);
+
+    CHECK(!dx_storageWrite(1, "one", 3));
+    CHECK(!dx_storageDelete(1));
+    CHECK(!readString(1, buffer, sizeof(buffer)));
+
+    fd = open(mutableFilePath, O_RDONLY);
+    CHECK(read(fd, contents, sizeof(contents)) == (ssize_t)sizeof(contents));
+    close(fd);
+    CHECK(memcmp(contents, appData, sizeof(appData)) == 0);
+    CHECK(fileSize() == (off_t)sizeof(appData));
+}
+
+static void testRecordLargerThanRegionIsRefused(void)
+{
+    static uint8_t large[DX_STORAGE_REGION_BYTES];
+    char buffer[64];
+
+    truncateFile(0);
+    CHECK(dx_storageWrite(1, "one", 3));
+    CHECK(!dx_storageWrite(2, large, sizeof(large)));
+    CHECK(readString(1, buffer, sizeof(buffer)) && strcmp(buffer, "one") == 0);
+}
+
+int main(void)
+{
+    int fd = mkstemp(mutableFilePath);
+
+    if (fd == -1) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    testWriteReadDelete();
+    testTornWriteKeepsPreviousGeneration();
+    testTornRegionZero();
+    testTornFirstWrite();
+    testForeignFileIsNotOverwritten();
+    testRecordLargerThanRegionIsRefused();
+
+    unlink(mutableFilePath);
+
+    return dx_testFinish("storage_test");
+}
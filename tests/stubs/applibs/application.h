@@ -0,0 +1,4 @@
+/* Host test stand-in for the Azure Sphere SDK header of the same name, declares only what the library uses */
+#pragma once
+#include <stdbool.h>
+int Application_IsDeviceAuthReady(bool *outIsReady);
@@ -0,0 +1,11 @@
+/* Host test stand-in for the Azure Sphere SDK header of the same name, declares only what the library uses */
+#pragma once
+typedef struct EventLoop EventLoop;
+typedef struct EventRegistration EventRegistration;
+typedef enum { EventLoop_Input = 1 } EventLoop_IoEvents;
+typedef void EventLoopIoCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+EventLoop *EventLoop_Create(void);
+void EventLoop_Close(EventLoop *el);
+int EventLoop_Run(EventLoop *el, int duration_in_milliseconds, _Bool process_one_event);
+int EventLoop_Stop(EventLoop *el);
+EventRegistration *EventLoop_RegisterIo(EventLoop *el, int fd, EventLoop_IoEvents eventBitmask, EventLoopIoCallback *callback, void *context);
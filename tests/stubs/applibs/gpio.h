@@ -0,0 +1,3 @@
+/* Host test stand-in for the Azure Sphere SDK header of the same name, declares only what the library uses */
+#pragma once
+typedef int GPIO_Id; typedef enum {GPIO_Value_Low=0, GPIO_Value_High=1} GPIO_Value; typedef unsigned char GPIO_Value_Type; typedef enum {GPIO_OutputMode_PushPull} GPIO_OutputMode;
@@ -0,0 +1,3 @@
+/* Host test stand-in for the Azure Sphere SDK header of the same name, declares only what the library uses */
+#pragma once
+typedef int I2C_InterfaceId;
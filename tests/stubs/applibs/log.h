@@ -0,0 +1,4 @@
+/* Host test stand-in for the Azure Sphere SDK header of the same name, declares only what the library uses */
+#pragma once
+#include <stdarg.h>
+int Log_Debug(const char *fmt, ...);
@@ -0,0 +1,7 @@
+/* Host test stand-in for the Azure Sphere SDK header of the same name, declares only what the library uses */
+#pragma once
+#include <stdbool.h>
+typedef unsigned int Networking_InterfaceConnectionStatus;
+enum { Networking_InterfaceConnectionStatus_InterfaceUp = 1, Networking_InterfaceConnectionStatus_ConnectedToNetwork = 2, Networking_InterfaceConnectionStatus_IpAvailable = 4, Networking_InterfaceConnectionStatus_ConnectedToInternet = 8 };
+int Networking_IsNetworkingReady(bool *outIsNetworkingReady);
+int Networking_GetInterfaceConnectionStatus(const char *networkInterfaceName, Networking_InterfaceConnectionStatus *outStatus);
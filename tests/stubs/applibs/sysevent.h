@@ -0,0 +1,13 @@
+/* Host test stand-in for the Azure Sphere SDK header of the same name, declares only what the library uses */
+#pragma once
+#include <stdint.h>
+#include "eventloop.h"
+typedef enum { SysEvent_Events_UpdateReadyForInstall = 1 } SysEvent_Events;
+typedef enum { SysEvent_Status_Invalid, SysEvent_Status_Pending, SysEvent_Status_Final, SysEvent_Status_Deferred, SysEvent_Status_Complete } SysEvent_Status;
+typedef enum { SysEvent_UpdateType_Invalid, SysEvent_UpdateType_App, SysEvent_UpdateType_System } SysEvent_UpdateType;
+typedef struct SysEvent_Info SysEvent_Info;
+typedef struct { uint32_t max_deferral_time_in_minutes; SysEvent_UpdateType update_type; } SysEvent_Info_UpdateData;
+typedef void SysEvent_EventsCallback(SysEvent_Events, SysEvent_Status, const SysEvent_Info *, void *);
+EventRegistration *SysEvent_RegisterForEventNotifications(EventLoop *el, SysEvent_Events eventBitmask, SysEvent_EventsCallback callback, void *context);
+int SysEvent_Info_GetUpdateData(const SysEvent_Info *info, SysEvent_Info_UpdateData *data);
+int SysEvent_DeferEvent(SysEvent_Events event, uint32_t requested_defer_time_in_minutes);
@@ -0,0 +1,4 @@
+/* Host test stand-in for the Azure Sphere SDK header of the same name, declares only what the library uses */
+#pragma once
+int iothub_security_init(int); void iothub_security_deinit(void);
+#define IOTHUB_SECURITY_TYPE_X509 1
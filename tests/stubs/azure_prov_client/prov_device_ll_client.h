@@ -0,0 +1,17 @@
+/* Host test stand-in for the Azure Sphere SDK header of the same name, declares only what the library uses */
+#pragma once
+typedef struct PROV_INSTANCE_INFO_TAG *PROV_DEVICE_LL_HANDLE;
+typedef enum { PROV_DEVICE_RESULT_OK, PROV_DEVICE_RESULT_INVALID_ARG, PROV_DEVICE_RESULT_INVALID_STATE, PROV_DEVICE_RESULT_ERROR } PROV_DEVICE_RESULT;
+#define PROV_DEVICE_RESULT_VALUE PROV_DEVICE_RESULT_OK
+typedef void (*PROV_DEVICE_CLIENT_REGISTER_DEVICE_CALLBACK)(PROV_DEVICE_RESULT, const char *, const char *, void *);
+typedef const void *(*PROV_DEVICE_TRANSPORT_PROVIDER_FUNCTION)(void);
+const void *Prov_Device_MQTT_Protocol(void);
+PROV_DEVICE_LL_HANDLE Prov_Device_LL_Create(const char *uri, const char *scope_id, PROV_DEVICE_TRANSPORT_PROVIDER_FUNCTION protocol);
+void Prov_Device_LL_Destroy(PROV_DEVICE_LL_HANDLE);
+PROV_DEVICE_RESULT Prov_Device_LL_SetOption(PROV_DEVICE_LL_HANDLE, const char *, const void *);
+PROV_DEVICE_RESULT Prov_Device_LL_Set_Provisioning_Payload(PROV_DEVICE_LL_HANDLE, const char *);
+PROV_DEVICE_RESULT Prov_Device_LL_Register_Device(PROV_DEVICE_LL_HANDLE, PROV_DEVICE_CLIENT_REGISTER_DEVICE_CALLBACK, void *, void *, void *);
+void Prov_Device_LL_DoWork(PROV_DEVICE_LL_HANDLE);
+int prov_dev_security_init(int);
+void prov_dev_security_deinit(void);
+#define SECURE_DEVICE_TYPE_X509 1
@@ -0,0 +1,5 @@
+/* Host test stand-in for the Azure Sphere SDK header of the same name, declares only what the library uses */
+#pragma once
+typedef void CURL; typedef int CURLcode;
+enum { CURL_GLOBAL_ALL, CURLOPT_URL, CURLOPT_HTTPGET, CURLOPT_TIMEOUT, CURLOPT_WRITEFUNCTION, CURLOPT_WRITEDATA, CURLOPT_USERAGENT, CURLOPT_SSL_VERIFYPEER, CURLE_OK = 0 };
+int curl_global_init(int); CURL *curl_easy_init(void); int curl_easy_setopt(CURL *, int, ...); CURLcode curl_easy_perform(CURL *); void curl_easy_cleanup(CURL *);
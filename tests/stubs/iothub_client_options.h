@@ -0,0 +1,4 @@
+/* Host test stand-in for the Azure Sphere SDK header of the same name, declares only what the library uses */
+#pragma once
+#define OPTION_AUTO_URL_ENCODE_DECODE "auto_url_encode_decode"
+#define OPTION_MODEL_ID "model_id"
@@ -0,0 +1,305 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host test for the offline telemetry queue. Runs dx_azure_iot.c against a stand-in IoT Hub client, connects,
+// drops the connection, publishes while offline, reconnects and checks what the hub receives.
+
+#include "dx_telemetry_queue.h"
+#include "dx_test.h"
+#include "dx_test_hub.h"
+
+/****************************************************************************************
+ * DPS is not used with DX_CONNECTION_TYPE_HOSTNAME
+ ****************************************************************************************/
+const void *Prov_Device_MQTT_Protocol(void)
+{
+    return NULL;
+}
+
+PROV_DEVICE_LL_HANDLE Prov_Device_LL_Create(const char *uri, const char *scope_id, PROV_DEVICE_TRANSPORT_PROVIDER_FUNCTION protocol)
+{
+    return NULL;
+}
+
+void Prov_Device_LL_Destroy(PROV_DEVICE_LL_HANDLE handle) {}
+
+PROV_DEVICE_RESULT Prov_Device_LL_SetOption(PROV_DEVICE_LL_HANDLE handle, const char *name, const void *value)
+{
+    return PROV_DEVICE_RESULT_ERROR;
+}
+
+PROV_DEVICE_RESULT Prov_Device_LL_Set_Provisioning_Payload(PROV_DEVICE_LL_HANDLE handle, const char *json)
+{
+    return PROV_DEVICE_RESULT_ERROR;
+}
+
+PROV_DEVICE_RESULT Prov_Device_LL_Register_Device(PROV_DEVICE_LL_HANDLE handle, PROV_DEVICE_CLIENT_REGISTER_DEVICE_CALLBACK callback,
+                                                  void *context, void *statusCallback, void *statusContext)
+{
+    return PROV_DEVICE_RESULT_ERROR;
+}
+
+void Prov_Device_LL_DoWork(PROV_DEVICE_LL_HANDLE handle) {}
+
+int prov_dev_security_init(int type)
+{
+    return 0;
+}
+
+void prov_dev_security_deinit(void) {}
+
+/****************************************************************************************
+ * Tests
+ ****************************************************************************************/
+#define MAX_COMPLETIONS 32
+
+typedef struct {
+    const char *name;
+    IOTHUB_CLIENT_CONFIRMATION_RESULT result;
+} COMPLETION;
+
+static COMPLETION completions[MAX_COMPLETIONS];
+static size_t completionCount = 0;
+
+static void onPublishComplete(IOTHUB_CLIENT_CONFIRMATION_RESULT result, uint32_t latencyMs, void *context)
+{
+    completions[completionCount].name = (const char *)context;
+    completions[completionCount].result = result;
+    completionCount++;
+}
+
+static const COMPLETION *findCompletion(const char *name)
+{
+    for (size_t i = 0; i < completionCount; i++) {
+        if (strcmp(completions[i].name, name) == 0) {
+            return &completions[i];
+        }
+    }
+    return NULL;
+}
+
+static DX_PUBLISH_RESULT publish(const char *body, bool poison)
+{
+    DX_MESSAGE_PROPERTY property = {.key = poison ? "poison" : "type", .value = "telemetry"};
+    DX_MESSAGE_PROPERTY *properties[] = {&property};
+
+    return dx_azurePublishNonBlocking(body, strlen(body), properties, 1, NULL, onPublishComplete, (void *)body);
+}
+
+/// <summary>
+/// Let a second pass, the connection handler runs as often as it asks to
+/// </summary>
+static void tick(void)
+{
+    dx_testAdvance(1000);
+}
+
+static bool tickUntilConnected(void)
+{
+    for (int i = 0; i < 20 && !dx_isAzureConnected(); i++) {
+        tick();
+    }
+    return dx_isAzureConnected();
+}
+
+static void tickUntilQueueEmpty(void)
+{
+    for (int i = 0; i < 20 && !dx_telemetryQueueIsEmpty(); i++) {
+        tick();
+    }
+    // One more pass so the last messages handed over are confirmed
+    tick();
+}
+
+static void resetDelivered(void)
+{
+    dx_testHubDeliveredCount = 0;
+    completionCount = 0;
+}
+
+static void testConnectAndSend(void)
+{
+    CHECK(tickUntilConnected());
+
+    CHECK(publish("online-0", false) == DX_PUBLISH_OK);
+    tick();
+
+    CHECK(dx_testHubDeliveredCount == 1 && strcmp(dx_testHubDelivered[0], "online-0") == 0);
+    CHECK(findCompletion("online-0") != NULL && findCompletion("online-0")->result == IOTHUB_CLIENT_CONFIRMATION_OK);
+    CHECK(dx_testHubLiveMessages == 0);
+}
+
+/// <summary>
+/// A queued message the client rejects outright is removed and failed, the messages behind it still go out in order
+/// </summary>
+static void testPoisonMessageDoesNotBlockQueue(void)
+{
+    DX_TELEMETRY_QUEUE_STATS stats;
+
+    resetDelivered();
+    dx_testHubDisconnect();
+    CHECK(!dx_isAzureConnected());
+
+    CHECK(publish("queued-poison", true) == DX_PUBLISH_QUEUED);
+    CHECK(publish("queued-1", false) == DX_PUBLISH_QUEUED);
+    CHECK(publish("queued-2", false) == DX_PUBLISH_QUEUED);
+    CHECK(publish("queued-3", false) == DX_PUBLISH_QUEUED);
+
+    // Full and DROP_NEWEST, the new message is turned away
+    CHECK(publish("queued-overflow", false) == DX_PUBLISH_FAILED);
+
+    dx_testNetworkUp = true;
+    CHECK(tickUntilConnected());
+    tickUntilQueueEmpty();
+
+    CHECK(dx_telemetryQueueIsEmpty());
+    CHECK(dx_testHubDeliveredCount == 3);
+    CHECK(dx_testHubDeliveredCount == 3 && strcmp(dx_testHubDelivered[0], "queued-1") == 0 && strcmp(dx_testHubDelivered[1], "queued-2") == 0 &&
+          strcmp(dx_testHubDelivered[2], "queued-3") == 0);
+    CHECK(findCompletion("queued-poison") != NULL && findCompletion("queued-poison")->result == IOTHUB_CLIENT_CONFIRMATION_ERROR);
+    CHECK(findCompletion("queued-3") != NULL && findCompletion("queued-3")->result == IOTHUB_CLIENT_CONFIRMATION_OK);
+
+    dx_telemetryQueueGetStats(&stats);
+    CHECK(stats.failed == 1);
+    CHECK(stats.drained == 3);
+    CHECK(dx_testHubLiveMessages == 0);
+
+    // Once the poison message is gone the queue takes new messages again
+    dx_testHubDisconnect();
+    for (int i = 0; i < 4; i++) {
+        CHECK(publish("refill", false) == DX_PUBLISH_QUEUED);
+    }
+
+    resetDelivered();
+    dx_testNetworkUp = true;
+    CHECK(tickUntilConnected());
+    tickUntilQueueEmpty();
+    CHECK(dx_testHubDeliveredCount == 4);
+}
+
+/// <summary>
+/// A queued message turned away because the IoT Hub client is out of capacity stays at the head of the queue
+/// </summary>
+static void testWouldBlockKeepsMessageQueued(void)
+{
+    DX_TELEMETRY_QUEUE_STATS before, after;
+
+    resetDelivered();
+    dx_telemetryQueueGetStats(&before);
+
+    dx_testHubDisconnect();
+    CHECK(publish("blocked-1", false) == DX_PUBLISH_QUEUED);
+    CHECK(publish("blocked-2", false) == DX_PUBLISH_QUEUED);
+
+    dx_azureSetPublishLimits(1, 0);
+    dx_testHubConfirms = false;
+    dx_testNetworkUp = true;
+    CHECK(tickUntilConnected());
+    tick();
+    tick();
+
+    // One message in flight and unconfirmed, the other waits its turn
+    dx_telemetryQueueGetStats(&after);
+    CHECK(after.count == 1);
+    CHECK(after.failed == before.failed);
+    CHECK(findCompletion("blocked-2") == NULL);
+
+    dx_testHubConfirms = true;
+    tickUntilQueueEmpty();
+
+    CHECK(dx_testHubDeliveredCount == 2 && strcmp(dx_testHubDelivered[0], "blocked-1") == 0 && strcmp(dx_testHubDelivered[1], "blocked-2") == 0);
+    CHECK(dx_testHubLiveMessages == 0);
+
+    dx_azureSetPublishLimits(0, 0);
+}
+
+/// <summary>
+/// Connected while the queue still drains, a message the full queue turns away is not sent ahead of it
+/// </summary>
+static void testFullQueueKeepsOrderWhenConnected(void)
+{
+    resetDelivered();
+
+    dx_testHubDisconnect();
+    for (int i = 0; i < 4; i++) {
+        CHECK(publish("ordered", false) == DX_PUBLISH_QUEUED);
+    }
+
+    dx_testNetworkUp = true;
+    CHECK(tickUntilConnected());
+    CHECK(!dx_telemetryQueueIsEmpty());
+
+    CHECK(publish("jumps-queue", false) == DX_PUBLISH_FAILED);
+
+    tickUntilQueueEmpty();
+
+    CHECK(dx_testHubDeliveredCount == 4);
+    for (size_t i = 0; i < dx_testHubDeliveredCount; i++) {
+        CHECK(strcmp(dx_testHubDelivered[i], "ordered") == 0);
+    }
+    CHECK(findCompletion("jumps-queue") == NULL);
+    CHECK(dx_testHubLiveMessages == 0);
+}
+
+/// <summary>
+/// The queue drains drainPerTick messages each time the connection handler runs at the DoWork floor, handing
+/// messages over must not bring the next run forward
+/// </summary>
+static void testDrainIsPacedByPollFloor(void)
+{
+    const int64_t floorMs = IOT_HUB_POLL_TIME_SECONDS * 1000 + IOT_HUB_POLL_TIME_NANOSECONDS / 1000000;
+    size_t steps = 0;
+
+    resetDelivered();
+
+    dx_testHubDisconnect();
+    for (int i = 0; i < 4; i++) {
+        CHECK(publish("paced", false) == DX_PUBLISH_QUEUED);
+    }
+
+    dx_testNetworkUp = true;
+    CHECK(tickUntilConnected());
+
+    // Run up to the first pass of the connection handler since authenticating, it hands over the first batch
+    size_t sentBefore = dx_testHubSendCount;
+    dx_testAdvance(dx_testTimerDueInMs("azureConnectionTimer"));
+    CHECK(dx_testHubSendCount - sentBefore == 2);
+    CHECK(dx_testTimerDueInMs("azureConnectionTimer") == floorMs);
+
+    while (!dx_telemetryQueueIsEmpty() && steps < 10) {
+        sentBefore = dx_testHubSendCount;
+
+        dx_testAdvance(floorMs);
+        steps++;
+
+        CHECK(dx_testHubSendCount - sentBefore <= 2);
+        CHECK(dx_testTimerDueInMs("azureConnectionTimer") == floorMs);
+    }
+
+    CHECK(dx_telemetryQueueIsEmpty());
+    CHECK(steps == 1);
+
+    tick();
+    CHECK(dx_testHubDeliveredCount == 4);
+    CHECK(dx_testHubLiveMessages == 0);
+}
+
+int main(void)
+{
+    DX_USER_CONFIG userConfig = {.hostname = "test-hub.azure-devices.net", .connectionType = DX_CONNECTION_TYPE_HOSTNAME};
+
+    CHECK(dx_telemetryQueueInit(&(DX_TELEMETRY_QUEUE_CONFIG){
+        .byteBudget = 4 * 256, .slotSize = 256, .policy = DX_TELEMETRY_QUEUE_DROP_NEWEST, .drainPerTick = 2}));
+
+    dx_azureConnect(&userConfig, "wlan0", NULL);
+
+    testConnectAndSend();
+    testPoisonMessageDoesNotBlockQueue();
+    testWouldBlockKeepsMessageQueued();
+    testFullQueueKeepsOrderWhenConnected();
+    testDrainIsPacedByPollFloor();
+
+    dx_telemetryQueueDeinit();
+
+    return dx_testFinish("telemetry_queue_test");
+}